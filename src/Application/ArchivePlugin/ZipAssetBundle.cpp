@@ -157,9 +157,12 @@ bool ZipAssetBundle::IsLoaded() const
 
 void ZipAssetBundle::OnAsynchLoadCompleted(bool successful)
 {   
-    // Write new timestamps for extracted files. Cannot be done (?!) in the worker
+    // Add the extracted files to the cache index and write new timestamps for them. Cannot be done (?!) in the worker
     // thread as it would need to access Framework, AssetAPI and AssetCache ptrs 
     // and they might not be safe to access from outside the main thread.
+    foreach(ZipArchiveFile file, files_)
+        if (file.doExtract)
+            assetAPI_->GetAssetCache()->RegisterCachedFile(GetFullAssetReference(file.relativePath));
     QDateTime zipLastModified = assetAPI_->GetAssetCache()->LastModified(Name());
     if (zipLastModified.isValid())
     {
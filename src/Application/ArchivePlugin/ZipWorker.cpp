@@ -58,7 +58,8 @@ void ZipWorker::run()
         ZZIP_FILE *zzipFile = zzip_file_open(archive_, file.relativePath.toStdString().c_str(), ZZIP_ONLYZIP | ZZIP_CASELESS);
         if (zzipFile && !CheckAndLogArchiveError(archive_))
         {            
-            // Create cache file
+            // Create cache file. Remove the old file first, as it may be a hard link that shares its content with other cache files.
+            QFile::remove(file.cachePath);
             QFile cacheFile(file.cachePath);
             if (!cacheFile.open(QIODevice::WriteOnly))
             {
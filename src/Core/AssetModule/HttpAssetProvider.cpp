@@ -19,6 +19,8 @@
 #include <QNetworkReply>
 #include <QLocale>
 
+#include <algorithm>
+
 /// @todo Remove the boost::local_time stuff for good when the TUNDRA_NO_BOOST code path is tested thoroughly.
 #ifndef TUNDRA_NO_BOOST
 // Disable C4245 warning (signed/unsigned mismatch) coming from boost
@@ -67,14 +69,30 @@ static int MonthNameToInt(const char *month)
 
 #include "MemoryLeakCheck.h"
 
+/// Default maximum number of simultaneous downloads from a single host. Matches the connection limit of QNetworkAccessManager.
+static const int cDefaultMaxConnectionsPerHost = 6;
+
 HttpAssetProvider::HttpAssetProvider(Framework *framework_) :
     framework(framework_),
-    networkAccessManager(0)
+    networkAccessManager(0),
+    maxConnectionsPerHost(cDefaultMaxConnectionsPerHost),
+    nextQueueOrder(0)
 {
     CreateAccessManager();
     connect(framework->App(), SIGNAL(ExitRequested()), SLOT(AboutToExit()));
 
     enableRequestsOutsideStorages = framework_->HasCommandLineParameter("--accept_unknown_http_sources");
+
+    QStringList connectionsParam = framework_->CommandLineParameters("--httpconnectionsperhost");
+    if (!connectionsParam.isEmpty())
+    {
+        bool ok = false;
+        int maxConnections = connectionsParam.last().toInt(&ok);
+        if (ok && maxConnections > 0)
+            maxConnectionsPerHost = maxConnections;
+        else
+            LogWarning("HttpAssetProvider: Invalid --httpConnectionsPerHost \"" + connectionsParam.last() + "\", using the default of " + QString::number(cDefaultMaxConnectionsPerHost) + ".");
+    }
 }
 
 HttpAssetProvider::~HttpAssetProvider()
@@ -96,6 +114,7 @@ void HttpAssetProvider::AboutToExit()
     if (!framework->IsExiting())
         return;
 
+    hostQueues.clear();
     if (networkAccessManager)
         SAFE_DELETE(networkAccessManager);
 }
@@ -204,17 +223,120 @@ QByteArray HttpAssetProvider::CreateHttpDate(const QDateTime &dateTime)
 }
 
 #ifdef HTTPASSETPROVIDER_NO_HTTP_IF_MODIFIED_SINCE
-
 std::vector<HttpAssetTransferPtr> delayedTransfers;
+#endif
 
-void HttpAssetProvider::Update(f64 frametime)
+void HttpAssetProvider::Update(f64 /*frametime*/)
 {
+    PROFILE(HttpAssetProvider_Update);
+#ifdef HTTPASSETPROVIDER_NO_HTTP_IF_MODIFIED_SINCE
     for(size_t i = 0; i < delayedTransfers.size(); ++i)
         framework->Asset()->AssetTransferCompleted(delayedTransfers[i].get());
     delayedTransfers.clear();
+#endif
+
+    // The queued transfers are started here rather than in RequestAsset, so that all the requests made during
+    // a frame, and the priorities set for them after the request, are taken into account in the order.
+    QStringList hosts = hostQueues.keys();
+    foreach(const QString &host, hosts)
+        StartQueuedTransfers(host);
 }
 
-#endif
+void HttpAssetProvider::SetMaxConnectionsPerHost(int maxConnections)
+{
+    maxConnectionsPerHost = std::max(maxConnections, 1);
+}
+
+int HttpAssetProvider::NumQueuedTransfers() const
+{
+    int numQueued = 0;
+    for(QHash<QString, HostQueue>::const_iterator iter = hostQueues.begin(); iter != hostQueues.end(); ++iter)
+        numQueued += iter->numQueued;
+    return numQueued;
+}
+
+void HttpAssetProvider::EnqueueTransfer(const HttpAssetTransferPtr &transfer)
+{
+    QueuedTransfer entry;
+    entry.priority = transfer->Priority();
+    entry.order = nextQueueOrder++;
+    entry.transfer = transfer;
+
+    HostQueue &hostQueue = hostQueues[transfer->host];
+    if (!transfer->queued)
+    {
+        transfer->queued = true;
+        ++hostQueue.numQueued;
+    }
+    hostQueue.queue.push(entry);
+    CompactQueue(hostQueue);
+}
+
+void HttpAssetProvider::CompactQueue(HostQueue &hostQueue)
+{
+    // After the compaction the queue has to grow by the number of queued transfers before the next one,
+    // so the cost of compacting stays constant per added entry.
+    if (hostQueue.queue.size() <= 2 * (size_t)hostQueue.numQueued)
+        return;
+
+    std::priority_queue<QueuedTransfer> queue;
+    for(; !hostQueue.queue.empty(); hostQueue.queue.pop())
+        if (!hostQueue.queue.top().IsOutdated())
+            queue.push(hostQueue.queue.top());
+    std::swap(hostQueue.queue, queue);
+}
+
+void HttpAssetProvider::StartQueuedTransfers(const QString &host)
+{
+    QHash<QString, HostQueue>::iterator iter = hostQueues.find(host);
+    if (iter == hostQueues.end())
+        return;
+
+    while(iter->numActive < maxConnectionsPerHost && !iter->queue.empty())
+    {
+        QueuedTransfer entry = iter->queue.top();
+        iter->queue.pop();
+        // Skip the entries of aborted transfers, and the entries left behind by priority changes.
+        if (entry.IsOutdated())
+            continue;
+
+        entry.transfer->queued = false;
+        --iter->numQueued;
+        ++iter->numActive;
+        StartTransfer(entry.transfer);
+        // StartTransfer does not modify hostQueues, so the iterator stays valid.
+    }
+
+    if (iter->numActive == 0 && iter->queue.empty())
+        hostQueues.erase(iter);
+}
+
+void HttpAssetProvider::StartTransfer(const HttpAssetTransferPtr &transfer)
+{
+    if (!networkAccessManager)
+        CreateAccessManager();
+
+    QNetworkRequest request;
+    request.setUrl(QUrl(transfer->url));
+    request.setRawHeader("User-Agent", "realXtend Tundra");
+
+    // Fill 'If-Modified-Since' header if we have a valid cache item.
+    // Server can then reply with 304 Not Modified.
+    AssetCache *cache = framework->Asset()->GetAssetCache();
+    QDateTime cacheLastModified = cache ? cache->LastModified(transfer->url) : QDateTime();
+    if (cacheLastModified.isValid())
+        request.setRawHeader("If-Modified-Since", CreateHttpDate(cacheLastModified));
+
+    QNetworkReply *reply = networkAccessManager->get(request);
+    transfers[QPointer<QNetworkReply>(reply)] = transfer;
+}
+
+void HttpAssetProvider::OnTransferPriorityChanged(IAssetTransfer *transfer)
+{
+    HttpAssetTransfer *httpTransfer = dynamic_cast<HttpAssetTransfer*>(transfer);
+    if (httpTransfer && httpTransfer->queued)
+        EnqueueTransfer(static_pointer_cast<HttpAssetTransfer>(httpTransfer->shared_from_this()));
+}
 
 AssetTransferPtr HttpAssetProvider::RequestAsset(QString assetRef, QString assetType)
 {
@@ -272,18 +394,11 @@ AssetTransferPtr HttpAssetProvider::RequestAsset(QString assetRef, QString asset
     else
 #endif
     {
-        QNetworkRequest request;
-        request.setUrl(QUrl(assetRef));
-        request.setRawHeader("User-Agent", "realXtend Tundra");
-    
-        // Fill 'If-Modified-Since' header if we have a valid cache item.
-        // Server can then reply with 304 Not Modified.
-        QDateTime cacheLastModified = framework->Asset()->GetAssetCache()->LastModified(assetRef);
-        if (cacheLastModified.isValid())
-            request.setRawHeader("If-Modified-Since", CreateHttpDate(cacheLastModified));
-        
-        QNetworkReply *reply = networkAccessManager->get(request);
-        transfers[QPointer<QNetworkReply>(reply)] = transfer;
+        // Queue the download. It is started in Update once there is a free connection to the host.
+        transfer->url = assetRef;
+        transfer->host = QUrl(assetRef).host().toLower();
+        connect(transfer.get(), SIGNAL(PriorityChanged(IAssetTransfer*)), SLOT(OnTransferPriorityChanged(IAssetTransfer*)));
+        EnqueueTransfer(transfer);
     }
     return transfer;
 }
@@ -293,6 +408,22 @@ bool HttpAssetProvider::AbortTransfer(IAssetTransfer *transfer)
     if (!transfer)
         return false;
 
+    // A transfer that is still in the queue has no reply to abort. Its queue entries are skipped when they come up.
+    HttpAssetTransfer *httpTransfer = dynamic_cast<HttpAssetTransfer*>(transfer);
+    if (httpTransfer && httpTransfer->queued)
+    {
+        HttpAssetTransferPtr queuedTransfer = static_pointer_cast<HttpAssetTransfer>(httpTransfer->shared_from_this());
+        queuedTransfer->queued = false;
+        QHash<QString, HostQueue>::iterator iter = hostQueues.find(queuedTransfer->host);
+        if (iter != hostQueues.end())
+        {
+            --iter->numQueued;
+            CompactQueue(*iter);
+        }
+        framework->Asset()->AssetTransferAborted(queuedTransfer.get());
+        return true;
+    }
+
     for (TransferMap::iterator iter = transfers.begin(); iter != transfers.end(); ++iter)
     {
         AssetTransferPtr ongoingTransfer = iter->second;
@@ -434,6 +565,7 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
             return;
         HttpAssetTransferPtr transfer = iter->second;
         transfer->rawAssetData.clear();
+        bool redirected = false;
 
         // We have called abort() or close() on an ongoing transfer, for example in AbortTransfer.
         if (reply->error() == QNetworkReply::OperationCanceledError)
@@ -457,6 +589,7 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
 
                 QNetworkReply *redirectReply = networkAccessManager->get(redirectRequest);
                 transfers[QPointer<QNetworkReply>(redirectReply)] = transfer;
+                redirected = true; // The redirected download keeps the connection slot of the original host.
             }
             else
             {
@@ -540,6 +673,15 @@ void HttpAssetProvider::OnHttpTransferFinished(QNetworkReply *reply)
         }
 
         transfers.erase(iter);
+
+        // Give the freed connection to the next queued download of the same host right away.
+        if (!redirected)
+        {
+            QHash<QString, HostQueue>::iterator hostIter = hostQueues.find(transfer->host);
+            if (hostIter != hostQueues.end() && hostIter->numActive > 0)
+                --hostIter->numActive;
+            StartQueuedTransfers(transfer->host);
+        }
         break;
     }
     case QNetworkAccessManager::PutOperation:
@@ -11,6 +11,9 @@
 #include <QDateTime>
 #include <QByteArray>
 #include <QPointer>
+#include <QHash>
+
+#include <queue>
 
 class QNetworkAccessManager;
 class QNetworkRequest;
@@ -24,6 +27,9 @@ typedef shared_ptr<HttpAssetStorage> HttpAssetStoragePtr;
 // #define HTTPASSETPROVIDER_NO_HTTP_IF_MODIFIED_SINCE
 
 /// Adds support for downloading assets over the web using the 'http://' specifier.
+/** The requested assets are queued and downloaded in the order of their priority (see IAssetTransfer::SetPriority),
+    at most MaxConnectionsPerHost at a time from each host. The limit can be set with the --httpConnectionsPerHost
+    command line parameter. */
 class ASSET_MODULE_API HttpAssetProvider : public QObject, public IAssetProvider, public enable_shared_from_this<HttpAssetProvider>
 {
     Q_OBJECT
@@ -45,6 +51,20 @@ public:
 
     /// Aborts the ongoing http transfer.
     virtual bool AbortTransfer(IAssetTransfer *transfer);
+
+    /// Starts the queued downloads for which there are free connections.
+    virtual void Update(f64 frametime);
+
+    /// Sets the maximum number of simultaneous downloads from a single host.
+    /** @note QNetworkAccessManager opens at most 6 connections to a host, and queues the rest of the requests in the order they
+        were made, so limits above 6 give the priorities less effect without speeding up the downloads. */
+    void SetMaxConnectionsPerHost(int maxConnections);
+
+    /// Returns the maximum number of simultaneous downloads from a single host.
+    int MaxConnectionsPerHost() const { return maxConnectionsPerHost; }
+
+    /// Returns the number of downloads waiting in the queue for a free connection.
+    int NumQueuedTransfers() const;
     
     /// Adds the given http URL to the list of current asset storages.
     /// Returns the newly created storage, or 0 if a storage with the given name already existed, or if some other error occurred.
@@ -83,16 +103,13 @@ public:
     /// Constructs a RFC 822 HTTP date string. f.ex. "Sun, 06 Nov 1994 08:49:37 GMT"
     static QByteArray CreateHttpDate(const QDateTime &dateTime);
 
-#ifdef HTTPASSETPROVIDER_NO_HTTP_IF_MODIFIED_SINCE
-    virtual void Update(f64 frametime);
-#endif
-
     // DEPRECATED
     QNetworkAccessManager* GetNetworkAccessManager() const { return NetworkAccessManager(); } /**< @deprecated Use NetworkAccessManager instead. */
 
 private slots:
     void AboutToExit();
     void OnHttpTransferFinished(QNetworkReply *reply);
+    void OnTransferPriorityChanged(IAssetTransfer *transfer);
     
 private:
     Framework *framework;
@@ -105,6 +122,52 @@ private:
 
     /// Delete assetref from http storages after successful delete
     void DeleteAssetRefFromStorages(const QString& ref);
+
+    /// A queued download. The entries are not removed from the queue when the transfer is aborted or its priority changes,
+    /// instead a new entry is added for the new priority, and the outdated entries are skipped when they come up.
+    /// The queue is compacted when the outdated entries outnumber the queued transfers, so that it does not grow without bound.
+    struct QueuedTransfer
+    {
+        float priority;
+        u32 order; ///< Sequence number that keeps the transfers of equal priority in the order they were requested.
+        HttpAssetTransferPtr transfer;
+
+        /// Returns true if the transfer has been started or aborted, or its priority has changed since this entry was added.
+        bool IsOutdated() const { return !transfer->queued || priority != transfer->Priority(); }
+
+        /// The highest priority, and the earliest of equal priorities, compares the greatest and comes first out of the queue.
+        bool operator <(const QueuedTransfer &rhs) const { return priority < rhs.priority || (priority == rhs.priority && order > rhs.order); }
+    };
+
+    /// The download queue and the number of ongoing downloads of a single host.
+    struct HostQueue
+    {
+        HostQueue() : numActive(0), numQueued(0) {}
+        int numActive;
+        int numQueued; ///< Number of transfers in the queue, not counting the outdated entries.
+        std::priority_queue<QueuedTransfer> queue;
+    };
+
+    /// Adds the transfer to the download queue of its host with its current priority.
+    void EnqueueTransfer(const HttpAssetTransferPtr &transfer);
+
+    /// Removes the outdated entries from the queue, if they outnumber the queued transfers.
+    void CompactQueue(HostQueue &hostQueue);
+
+    /// Starts downloads from the queue of the given host until its connection limit is reached.
+    void StartQueuedTransfers(const QString &host);
+
+    /// Sends the GET request of the transfer.
+    void StartTransfer(const HttpAssetTransferPtr &transfer);
+
+    /// Maps the lowercase host names to their download queues.
+    QHash<QString, HostQueue> hostQueues;
+
+    /// Maximum number of simultaneous downloads from a single host.
+    int maxConnectionsPerHost;
+
+    /// Sequence number of the next queued transfer.
+    u32 nextQueueOrder;
     
     /// Specifies the currently added list of HTTP asset storages.
     /// This array will never store null pointers.
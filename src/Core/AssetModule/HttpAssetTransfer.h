@@ -10,7 +10,16 @@ class HttpAssetTransfer : public IAssetTransfer
 Q_OBJECT
 
 public:
+    HttpAssetTransfer() : queued(false) {}
 
+    /// The URL the transfer downloads, without a possible sub asset name.
+    QString url;
+
+    /// The host the transfer is queued for. The connection limit of HttpAssetProvider is applied per host.
+    QString host;
+
+    /// True while the transfer waits in the download queue of HttpAssetProvider, and the GET request has not been sent.
+    bool queued;
 };
 
 typedef shared_ptr<HttpAssetTransfer> HttpAssetTransferPtr;
@@ -26,10 +26,17 @@
 #include <QFileSystemWatcher>
 #include <QMap>
 
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
+/// Maximum number of file reads handed to the I/O worker threads at a time. Bounds the memory held by read but not yet completed assets.
+static const size_t cMaxOngoingReads = 64;
+
 LocalAssetProvider::LocalAssetProvider(Framework* framework_) :
-    framework(framework_)
+    framework(framework_),
+    // Disk reads do not scale with the core count, a few parallel reads are enough to keep the disk busy.
+    fileReads(&LocalAssetProvider::ReadFile, 4)
 {
     enableRequestsOutsideStorages = framework_->HasCommandLineParameter("--accept_unknown_local_sources");
 }
@@ -105,6 +112,17 @@ bool LocalAssetProvider::AbortTransfer(IAssetTransfer *transfer)
             return true;
         }
     }
+    // If the file is already being read, drop the read. The worker thread finishes it, but its result is discarded.
+    for (std::vector<FileReadPtr>::iterator iter = ongoingReads.begin(); iter != ongoingReads.end(); ++iter)
+    {
+        if ((*iter)->transfer.get() == transfer)
+        {
+            AssetTransferPtr ongoingTransfer = (*iter)->transfer;
+            ongoingReads.erase(iter);
+            framework->Asset()->AssetTransferAborted(transfer);
+            return true;
+        }
+    }
     return false;
 }
 
@@ -308,10 +326,15 @@ void LocalAssetProvider::CompletePendingFileDownloads()
     if (pendingUploads.size() > 0)
         return;
 
+    // Throttle asset loading to at most 16 msecs/frame. The files are read by the I/O worker threads, so the time
+    // goes to resolving the file paths and to the Asset API processing the loaded assets.
     const int maxLoadMSecs = 16;
-    tick_t startTime = GetCurrentClockTime();
+    const tick_t deadline = GetCurrentClockTime() + GetCurrentClockFreq() * maxLoadMSecs / 1000;
+
+    if (!CompleteFinishedFileReads(deadline))
+        return;
 
-    while(pendingDownloads.size() > 0)
+    while(pendingDownloads.size() > 0 && ongoingReads.size() < cMaxOngoingReads)
     {
         PROFILE(LocalAssetProvider_ProcessPendingDownload);
 
@@ -344,7 +367,7 @@ void LocalAssetProvider::CompletePendingFileDownloads()
                     QString reason = "Failed to find local asset with filename \"" + ref + "\"!";
                     framework->Asset()->AssetTransferFailed(transfer.get(), reason);
                     // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
-                    //if (GetCurrentClockTime() - startTime >= GetCurrentClockFreq() * maxLoadMSecs / 1000)
+                    //if (GetCurrentClockTime() >= deadline)
                     //    break;
                     continue;
                 }
@@ -352,31 +375,78 @@ void LocalAssetProvider::CompletePendingFileDownloads()
                 file = QFileInfo(GuaranteeTrailingSlash(path) + path_filename);
             }
         }
-        QString absoluteFilename = file.absoluteFilePath();
 
-        bool success = LoadFileToVector(absoluteFilename, transfer->rawAssetData);
-        if (!success)
+        FileReadPtr read(new FileRead);
+        read->transfer = transfer;
+        read->storage = storage;
+        read->filename = file.absoluteFilePath();
+        ongoingReads.push_back(read);
+        fileReads.Start(read);
+
+        if (GetCurrentClockTime() >= deadline)
+            break;
+    }
+}
+
+void LocalAssetProvider::ReadFile(FileRead &read)
+{
+    QFile file(read.filename);
+    if (!file.open(QIODevice::ReadOnly))
+        read.error = "Failed to open file \"" + read.filename + "\" for reading";
+    else
+    {
+        qint64 fileSize = file.size();
+        if (fileSize <= 0)
+            read.error = "File \"" + read.filename + "\" is empty";
+        else
         {
-            QString reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + absoluteFilename + "\"";
+            read.data.resize((size_t)fileSize);
+            qint64 numRead = file.read((char*)&read.data[0], fileSize);
+            if (numRead < fileSize)
+            {
+                read.error = "Failed to read " + QString::number(fileSize) + " bytes from file \"" + read.filename + "\"";
+                read.data.clear();
+            }
+        }
+    }
+}
+
+bool LocalAssetProvider::CompleteFinishedFileReads(tick_t deadline)
+{
+    FileReadPtr read;
+    while(GetCurrentClockTime() < deadline)
+    {
+        if (!fileReads.TakeFinishedJob(read))
+            return true;
+
+        PROFILE(LocalAssetProvider_CompleteFileRead);
+
+        std::vector<FileReadPtr>::iterator iter = std::find(ongoingReads.begin(), ongoingReads.end(), read);
+        if (iter == ongoingReads.end())
+            continue; // The transfer was aborted while the file was being read.
+        ongoingReads.erase(iter);
+
+        AssetTransferPtr transfer = read->transfer;
+        if (!read->error.isEmpty())
+        {
+            QString reason = "Failed to read asset data for asset \"" + transfer->source.ref + "\": " + read->error;
             framework->Asset()->AssetTransferFailed(transfer.get(), reason);
-            // Also throttle asset loading here. This is needed in the case we have a lot of failed refs.
-            if (GetCurrentClockTime() - startTime >= GetCurrentClockFreq() * maxLoadMSecs / 1000)
-                break;
-            continue;
         }
-        
-        // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
-        // as a disk source, rather than generating a cache file for it.
-        transfer->SetCachingBehavior(false, absoluteFilename);
-        transfer->storage = storage;
+        else
+        {
+            transfer->rawAssetData.swap(read->data);
 
-        // Signal the Asset API that this asset is now successfully downloaded.
-        framework->Asset()->AssetTransferCompleted(transfer.get());
+            // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
+            // as a disk source, rather than generating a cache file for it.
+            transfer->SetCachingBehavior(false, read->filename);
+            transfer->storage = read->storage;
 
-        // Throttle asset loading to at most 16 msecs/frame.
-        if (GetCurrentClockTime() - startTime >= GetCurrentClockFreq() * maxLoadMSecs / 1000)
-            break;
+            // Signal the Asset API that this asset is now successfully downloaded.
+            framework->Asset()->AssetTransferCompleted(transfer.get());
+        }
     }
+    // Out of time for this frame, the rest are completed on the next frame.
+    return false;
 }
 
 AssetStoragePtr LocalAssetProvider::TryDeserializeStorageFromString(const QString &storage, bool /*fromNetwork*/)
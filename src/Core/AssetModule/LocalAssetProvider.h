@@ -5,6 +5,8 @@
 #include "AssetModuleApi.h"
 #include "IAssetProvider.h"
 #include "AssetFwd.h"
+#include "HighPerfClock.h"
+#include "WorkerJobQueue.h"
 
 #include <QSet>
 
@@ -77,9 +79,27 @@ private:
     /// @param storage [out] Receives the local storage that contains the asset.
     QString GetPathForAsset(const QString &localFilename, LocalAssetStoragePtr *storage) const;
 
-    /// Takes all the pending file download transfers and finishes them.
+    /// A file read of a download transfer, performed on an I/O worker thread.
+    struct FileRead
+    {
+        AssetTransferPtr transfer;
+        LocalAssetStoragePtr storage;
+        QString filename; ///< Absolute path of the file to read.
+        std::vector<u8> data; ///< Filled by the worker thread.
+        QString error; ///< Set by the worker thread if reading fails.
+    };
+    typedef shared_ptr<FileRead> FileReadPtr;
+
+    /// Reads the file of a download transfer on an I/O worker thread.
+    static void ReadFile(FileRead &read);
+
+    /// Resolves the files of the pending download transfers and hands them to the I/O worker threads,
+    /// then finishes the transfers whose files have been read.
     void CompletePendingFileDownloads();
 
+    /// Finishes the transfers whose files the I/O worker threads have read. Returns false if the deadline was reached.
+    bool CompleteFinishedFileReads(tick_t deadline);
+
     /// Takes all the pending file upload transfers and finishes them.
     void CompletePendingFileUploads();
 
@@ -90,6 +110,8 @@ private:
     std::vector<LocalAssetStoragePtr> storages; ///< Asset directories to search, may be recursive or not
     std::vector<AssetUploadTransferPtr> pendingUploads; ///< The following asset uploads are pending to be completed by this provider.
     std::vector<AssetTransferPtr> pendingDownloads; ///< The following asset downloads are pending to be completed by this provider.
+    std::vector<FileReadPtr> ongoingReads; ///< Reads handed to the I/O worker threads and not yet finished or aborted.
+    WorkerJobQueue<FileRead> fileReads; ///< Reads being processed by the I/O worker threads. Waits for them when destroyed.
     QSet<QString> changedFiles; ///< Pending file changes.
     QSet<QString> changedDirectories; ///< Pending directory changes.
 
@@ -23,6 +23,8 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "FrameAPI.h"
+#include "TerrainChunkBuilder.h"
 
 #include <Ogre.h>
 #include <utility>
@@ -41,9 +43,15 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     heightMap(this, "Heightmap"),
     uScale(this, "Tex. U scale", 0.13f),
     vScale(this, "Tex. V scale", 0.13f),
+    chunkSize(this, "Chunk size", 0),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    rootNode(0),
+    heightRevision(0),
+    chunksWidth(0),
+    chunksHeight(0),
+    chunkQuads(0),
+    chunkBuilder(MAKE_SHARED(TerrainChunkBuilder))
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
@@ -78,7 +86,13 @@ void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
     Patch &patch = GetPatch(x, y);
     patch.heightData.clear();
     patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
+    MarkPatchHeightsChanged(patch);
+}
+
+void EC_Terrain::MarkPatchHeightsChanged(Patch &patch)
+{
     patch.patch_geometry_dirty = true;
+    patch.heightRevision = ++heightRevision;
 }
 
 void EC_Terrain::MakeTerrainFlat(float heightValue)
@@ -161,8 +175,23 @@ void EC_Terrain::AttributesChanged()
     if (heightMap.ValueChanged())
         sizeChanged = needFullRecreate = needIncrementalRecreate = false;
 
+    // Switching between the chunks and the separate patches, or to another chunk size, recreates all the geometry.
+    if (chunkSize.ValueChanged())
+    {
+        for(int y = 0; y < patchHeight; ++y)
+            for(int x = 0; x < patchWidth; ++x)
+                DestroyPatch(x, y);
+        DestroyChunks();
+        for(size_t i = 0; i < patches.size(); ++i)
+            patches[i].patch_geometry_dirty = true;
+        if (!heightMap.ValueChanged())
+            needIncrementalRecreate = true;
+    }
+
+    // The texture scale changes only the geometry, keep the height data revisions.
     if (needFullRecreate)
-        DirtyAllTerrainPatches();
+        for(size_t i = 0; i < patches.size(); ++i)
+            patches[i].patch_geometry_dirty = true;
     if (sizeChanged)
         ResizeTerrain(xPatches.Get(), yPatches.Get());
     if (needIncrementalRecreate)
@@ -199,6 +228,9 @@ void EC_Terrain::MaterialAssetLoaded(AssetPtr asset_)
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
             UpdateTerrainPatchMaterial(x, y);
+    for(size_t i = 0; i < chunks.size(); ++i)
+        if (chunks[i].entity)
+            chunks[i].entity->setMaterialName(currentMaterial.toStdString());
 }
 
 void EC_Terrain::TerrainAssetLoaded(AssetPtr asset_)
@@ -280,6 +312,8 @@ void EC_Terrain::DestroyPatch(int x, int y)
 
 void EC_Terrain::Destroy()
 {
+    DestroyChunks();
+
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
             DestroyPatch(x, y);
@@ -317,7 +351,9 @@ void EC_Terrain::SetPointHeight(int x, int y, float height)
     if (x < 0 || y < 0 || x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    Patch &patch = GetPatch(x / cPatchSize, y / cPatchSize);
+    patch.heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    MarkPatchHeightsChanged(patch);
 }
 
 namespace
@@ -657,7 +693,7 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
     for(size_t i = 0; i < newPatches.size(); ++i)
     {
         newPatches[i].heightData.resize(cPatchSize*cPatchSize);
-        newPatches[i].patch_geometry_dirty = true;
+        MarkPatchHeightsChanged(newPatches[i]);
         if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
             throw Exception("Not enough bytes to deserialize!");
 
@@ -1454,7 +1490,7 @@ void EC_Terrain::GetTerrainHeightRange(float &minHeight, float &maxHeight) const
 void EC_Terrain::DirtyAllTerrainPatches()
 {
     for(size_t i = 0; i < patches.size(); ++i)
-        patches[i].patch_geometry_dirty = true;
+        MarkPatchHeightsChanged(patches[i]);
 }
 
 void EC_Terrain::RegenerateDirtyTerrainPatches()
@@ -1465,7 +1501,10 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
     if (!parentEntity)
         return;
     EC_Placeable *position = parentEntity->GetComponent<EC_Placeable>().get();
-    if (!GetFramework()->IsHeadless() && (!position || position->visible.Get())) // Only need to create GPU resources if the placeable itself is visible.
+    const bool createGeometry = !GetFramework()->IsHeadless() && (!position || position->visible.Get()); // Only need to create GPU resources if the placeable itself is visible.
+    if (createGeometry && ChunkPatches() > 0)
+        RegenerateDirtyChunks();
+    else if (createGeometry)
     {
         for(int y = 0; y < patchHeight; ++y)
             for(int x = 0; x < patchWidth; ++x)
@@ -1507,3 +1546,298 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
 
     emit TerrainRegenerated();
 }
+
+bool EC_Terrain::PatchGeometryCreated(int patchX, int patchY) const
+{
+    if (GetPatch(patchX, patchY).node)
+        return true;
+    const int n = ChunkPatches();
+    if (n <= 0 || chunks.empty())
+        return false;
+    const size_t chunkIndex = (patchY / n) * chunksWidth + patchX / n;
+    return chunkIndex < chunks.size() && chunks[chunkIndex].entity != 0;
+}
+
+int EC_Terrain::ChunkPatches() const
+{
+    // 8x8 patches is the largest chunk whose vertices can be indexed with 16-bit indices.
+    const int size = min(chunkSize.Get(), 8);
+    if (size <= 0)
+        return 0;
+    int n = 1;
+    while(n * 2 <= size)
+        n *= 2;
+    return n;
+}
+
+void EC_Terrain::RegenerateDirtyChunks()
+{
+    PROFILE(EC_Terrain_RegenerateDirtyChunks);
+
+    if (!ViewEnabled() || world_.expired())
+        return;
+
+    const int n = ChunkPatches();
+    const int newChunksWidth = (patchWidth + n - 1) / n;
+    const int newChunksHeight = (patchHeight + n - 1) / n;
+    if (newChunksWidth != chunksWidth || newChunksHeight != chunksHeight || n * cPatchSize != chunkQuads)
+    {
+        DestroyChunks();
+        chunks.resize(newChunksWidth * newChunksHeight);
+        chunksWidth = newChunksWidth;
+        chunksHeight = newChunksHeight;
+        chunkQuads = n * cPatchSize;
+        CreateChunkIndexData();
+    }
+
+    // A chunk reads one vertex past its edges for the seams and the normals, so a changed patch dirties the chunks of its neighbors too.
+    for(int y = 0; y < patchHeight; ++y)
+        for(int x = 0; x < patchWidth; ++x)
+        {
+            Patch &patch = GetPatch(x, y);
+            if (!patch.patch_geometry_dirty || patch.heightData.empty())
+                continue;
+            for(int ny = max(y - 1, 0); ny <= min(y + 1, patchHeight - 1); ++ny)
+                for(int nx = max(x - 1, 0); nx <= min(x + 1, patchWidth - 1); ++nx)
+                    chunks[(ny / n) * chunksWidth + nx / n].geometryDirty = true;
+            patch.patch_geometry_dirty = false;
+        }
+
+    for(int y = 0; y < chunksHeight; ++y)
+        for(int x = 0; x < chunksWidth; ++x)
+            if (chunks[y * chunksWidth + x].geometryDirty)
+                StartChunkJob(x, y);
+
+    connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(UpdateTerrainChunks()), Qt::UniqueConnection);
+}
+
+void EC_Terrain::StartChunkJob(int chunkX, int chunkY)
+{
+    // The chunk can be built only after its patches and the patches next to it have been loaded.
+    const int n = ChunkPatches();
+    for(int y = max(chunkY * n - 1, 0); y <= min((chunkY + 1) * n, patchHeight - 1); ++y)
+        for(int x = max(chunkX * n - 1, 0); x <= min((chunkX + 1) * n, patchWidth - 1); ++x)
+            if (GetPatch(x, y).heightData.empty())
+                return;
+
+    shared_ptr<TerrainChunkJob> job = MAKE_SHARED(TerrainChunkJob);
+    job->chunkX = chunkX;
+    job->chunkY = chunkY;
+    job->quads = chunkQuads;
+    job->firstX = chunkX * chunkQuads;
+    job->firstY = chunkY * chunkQuads;
+    job->verticesWidth = VerticesWidth();
+    job->verticesHeight = VerticesHeight();
+    job->uScale = uScale.Get();
+    job->vScale = vScale.Get();
+    const int stride = chunkQuads + 3;
+    job->heights.resize(stride * stride);
+    for(int y = 0; y < stride; ++y)
+        for(int x = 0; x < stride; ++x)
+            job->heights[y * stride + x] = GetPoint(job->firstX + x - 1, job->firstY + y - 1);
+
+    // A job started earlier for the chunk is dropped, as its results would be outdated.
+    Chunk &chunk = chunks[chunkY * chunksWidth + chunkX];
+    chunk.job = job;
+    chunk.geometryDirty = false;
+    chunkBuilder->Start(job);
+}
+
+void EC_Terrain::UpdateTerrainChunks()
+{
+    // Take the finished jobs even when there is nothing to upload them to, so that the dropped jobs are released.
+    std::vector<shared_ptr<TerrainChunkJob> > finishedJobs;
+    chunkBuilder->TakeFinishedJobs(finishedJobs);
+    if (chunks.empty() || world_.expired())
+        return;
+
+    PROFILE(EC_Terrain_UpdateTerrainChunks);
+
+    bool uploaded = false;
+    for(size_t i = 0; i < finishedJobs.size(); ++i)
+    {
+        TerrainChunkJob &job = *finishedJobs[i];
+        if (job.chunkX >= chunksWidth || job.chunkY >= chunksHeight)
+            continue;
+        // The chunk has been rebuilt or recreated since the job was started, if it no longer refers to the job.
+        Chunk &chunk = chunks[job.chunkY * chunksWidth + job.chunkX];
+        if (chunk.job != finishedJobs[i])
+            continue;
+        chunk.job.reset();
+        UploadChunkGeometry(job.chunkX, job.chunkY, job);
+        uploaded = true;
+    }
+    // All the new geometry will be visible for Ogre by default. Re-apply the visibility of the EC_Placeable.
+    if (uploaded)
+        AttachTerrainRootNode();
+
+    OgreWorldPtr world = world_.lock();
+    Ogre::Camera *camera = world->IsActive() ? world->Renderer()->MainOgreCamera() : 0;
+    if (!camera)
+        return;
+
+    // Full detail within one chunk width from the camera, and half the detail each time the distance doubles.
+    const Ogre::Vector3 cameraPos = camera->getDerivedPosition();
+    const int numLods = (int)chunkLodIndices.size();
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        Chunk &chunk = chunks[i];
+        if (!chunk.entity)
+            continue;
+        const Ogre::AxisAlignedBox &box = chunk.entity->getWorldBoundingBox(true);
+        const Ogre::Vector3 halfSize = box.getHalfSize();
+        const float distance = max(0.f, (cameraPos - box.getCenter()).length() - halfSize.length());
+        float limit = 2.f * max(halfSize.x, halfSize.z);
+        int lod = 0;
+        while(lod + 1 < numLods && distance > limit)
+        {
+            ++lod;
+            limit *= 2.f;
+        }
+        SetChunkLod(chunk, lod);
+    }
+}
+
+void EC_Terrain::UploadChunkGeometry(int chunkX, int chunkY, TerrainChunkJob &job)
+{
+    PROFILE(EC_Terrain_UploadChunkGeometry);
+
+    if (job.vertices.empty() || world_.expired())
+        return;
+    OgreWorldPtr world = world_.lock();
+    Ogre::SceneManager *sceneMgr = world->OgreSceneManager();
+    Chunk &chunk = chunks[chunkY * chunksWidth + chunkX];
+
+    const Ogre::AxisAlignedBox bounds(job.minPos, job.maxPos);
+    const float boundingRadius = job.minPos.Abs().Max(job.maxPos.Abs()).Length();
+
+    // A rebuilt chunk keeps its mesh, only the vertex buffer is rewritten.
+    if (chunk.entity)
+    {
+        Ogre::Mesh *mesh = chunk.entity->getMesh().get();
+        Ogre::HardwareVertexBufferSharedPtr vbuf = mesh->getSubMesh(0)->vertexData->vertexBufferBinding->getBuffer(0);
+        vbuf->writeData(0, vbuf->getSizeInBytes(), &job.vertices[0], true);
+        mesh->_setBounds(bounds);
+        mesh->_setBoundingSphereRadius(boundingRadius);
+        chunk.node->needUpdate();
+        return;
+    }
+
+    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+
+    chunk.meshGeometryName = world->GetUniqueObjectName("EC_Terrain_chunkmesh");
+    Ogre::MeshPtr mesh = Ogre::MeshManager::getSingleton().createManual(chunk.meshGeometryName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+    Ogre::SubMesh *sub = mesh->createSubMesh();
+    sub->useSharedVertices = false;
+    sub->vertexData = new Ogre::VertexData();
+
+    // The layout of TerrainChunkBuilder: position, normal, diffuse UV and blend mask UV.
+    Ogre::VertexDeclaration *decl = sub->vertexData->vertexDeclaration;
+    size_t offset = 0;
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+    decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1);
+
+    // Use a shadow buffer, so that the raycasts can read the geometry back.
+    const size_t numVertices = job.vertices.size() / TerrainChunkBuilder::cVertexFloats;
+    Ogre::HardwareVertexBufferSharedPtr vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        decl->getVertexSize(0), numVertices, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+    vbuf->writeData(0, vbuf->getSizeInBytes(), &job.vertices[0], true);
+    sub->vertexData->vertexBufferBinding->setBinding(0, vbuf);
+    sub->vertexData->vertexCount = numVertices;
+    sub->setMaterialName(terrainMaterial->getName());
+    mesh->_setBounds(bounds);
+    mesh->_setBoundingSphereRadius(boundingRadius);
+    mesh->load();
+
+    chunk.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_chunkentity"), chunk.meshGeometryName);
+    chunk.entity->setUserAny(Ogre::Any(static_cast<IComponent *>(this)));
+    chunk.entity->setCastShadows(false);
+    for(uint i = 0; i < chunk.entity->getNumSubEntities(); ++i)
+        chunk.entity->getSubEntity(i)->setUserAny(chunk.entity->getUserAny());
+    chunk.lod = -1;
+    SetChunkLod(chunk, 0);
+
+    if (!rootNode)
+        CreateRootNode();
+    QString name = QString("EC_Terrain_Chunk_") + QString::number(chunkX) + "_" + QString::number(chunkY);
+    chunk.node = sceneMgr->createSceneNode(world->GetUniqueObjectName(name.toStdString()));
+    if (rootNode)
+        rootNode->addChild(chunk.node);
+    else
+        sceneMgr->getRootSceneNode()->addChild(chunk.node);
+    chunk.node->setPosition((float)job.firstX, 0.f, (float)job.firstY);
+    chunk.node->attachObject(chunk.entity);
+}
+
+void EC_Terrain::SetChunkLod(Chunk &chunk, int lod)
+{
+    if (chunk.lod == lod || !chunk.entity || lod < 0 || lod >= (int)chunkLodIndices.size())
+        return;
+
+    // Each submesh owns its index data, which refers to the shared index buffer of the level of detail.
+    const Ogre::IndexData *src = chunkLodIndices[lod];
+    Ogre::IndexData *dst = chunk.entity->getMesh()->getSubMesh(0)->indexData;
+    dst->indexBuffer = src->indexBuffer;
+    dst->indexStart = 0;
+    dst->indexCount = src->indexCount;
+    chunk.lod = lod;
+}
+
+void EC_Terrain::CreateChunkIndexData()
+{
+    std::vector<u16> indices;
+    const int numLods = TerrainChunkBuilder::NumLodLevels(chunkQuads);
+    for(int lod = 0; lod < numLods; ++lod)
+    {
+        TerrainChunkBuilder::BuildIndices(chunkQuads, lod, indices);
+        Ogre::IndexData *data = new Ogre::IndexData();
+        data->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+            indices.size(), Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, true);
+        data->indexBuffer->writeData(0, data->indexBuffer->getSizeInBytes(), &indices[0], true);
+        data->indexCount = indices.size();
+        chunkLodIndices.push_back(data);
+    }
+}
+
+void EC_Terrain::DestroyChunks()
+{
+    disconnect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(UpdateTerrainChunks()));
+
+    if (world_.expired()) // Oops! Already destroyed
+        return;
+    Ogre::SceneManager *sceneMgr = world_.lock()->OgreSceneManager();
+
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        Chunk &chunk = chunks[i];
+        if (chunk.node)
+        {
+            if (chunk.node->getParentSceneNode())
+                chunk.node->getParentSceneNode()->removeChild(chunk.node);
+            chunk.node->detachAllObjects();
+            sceneMgr->destroySceneNode(chunk.node);
+        }
+        if (chunk.entity)
+            sceneMgr->destroyEntity(chunk.entity);
+        if (chunk.meshGeometryName.length() > 0)
+        {
+            try
+            {
+                Ogre::MeshManager::getSingleton().remove(chunk.meshGeometryName);
+            }
+            catch(...) {}
+        }
+    }
+    chunks.clear();
+    chunksWidth = 0;
+    chunksHeight = 0;
+    chunkQuads = 0;
+
+    for(size_t i = 0; i < chunkLodIndices.size(); ++i)
+        delete chunkLodIndices[i];
+    chunkLodIndices.clear();
+}
@@ -11,7 +11,10 @@
 #include "AssetRefListener.h"
 #include "OgreModuleFwd.h"
 
-namespace Ogre { class Matrix4; }
+namespace Ogre { class Matrix4; class IndexData; }
+
+struct TerrainChunkJob;
+class TerrainChunkBuilder;
 
 /// Adds a heightmap-based terrain to the scene.
 /** <table class="header">
@@ -40,6 +43,8 @@ namespace Ogre { class Matrix4; }
     <div> @copydoc material </div>
     <li>AssetReference: heightMap
     <div> @copydoc heightMap </div>
+    <li>int: chunkSize
+    <div> @copydoc chunkSize </div>
     </ul>
 
     Note that the way the textures are used depends completely on the material. For example, the default height-based terrain material "Rex/TerrainPCF"
@@ -88,6 +93,13 @@ public:
     Q_PROPERTY(AssetReference heightMap READ getheightMap WRITE setheightMap);
     DEFINE_QPROPERTY_ATTRIBUTE(AssetReference, heightMap);
 
+    /// The number of patches on each side of a rendered chunk, or 0 to render each patch separately at full detail (the default).
+    /** With a non-zero value, the patches are merged into chunks of chunkSize x chunkSize patches, each drawn with one draw call.
+        The chunks are drawn with less detail the farther away they are from the camera. The chunk geometry is built on worker threads.
+        The value is rounded down to a power of two, and clamped to 8. */
+    Q_PROPERTY(int chunkSize READ getchunkSize WRITE setchunkSize);
+    DEFINE_QPROPERTY_ATTRIBUTE(int, chunkSize);
+
     /// Returns the minimum and maximum extents of terrain heights.
     void GetTerrainHeightRange(float &minHeight, float &maxHeight) const;
 
@@ -102,7 +114,7 @@ public:
         - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
     struct Patch
     {
-        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
+        Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true), heightRevision(0) {}
 
         /// X-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchWidth()].
         int x;
@@ -128,6 +140,11 @@ public:
         /// in yet.
         bool patch_geometry_dirty;
 
+        /// The value of EC_Terrain::HeightRevision() when the height data of this patch last changed.
+        /** Unlike patch_geometry_dirty, this is not reset when the geometry is generated, so that the other users
+            of the height data, like the physics heightfield, can tell which patches have changed since they last read them. */
+        u32 heightRevision;
+
         /// Call only when you've checked that this patch has been loaded in.
         float GetHeightValue(int x, int y) const { return heightData[y*cPatchSize+x]; }
     };
@@ -174,7 +191,7 @@ public slots:
     {
         for(int y = 0; y < patchHeight; ++y)
             for(int x = 0; x < patchWidth; ++x)
-                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || GetPatch(x,y).node == 0)
+                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || !PatchGeometryCreated(x,y))
                     return false;
 
         return true;
@@ -185,6 +202,10 @@ public slots:
     /// @param y In the range [0, EC_Terrain::PatchHeight * EC_Terrain::cPatchSize [.
     float GetPoint(int x, int y) const;
 
+    /// Returns a counter which is incremented whenever the height data of a patch changes.
+    /** Compare the heightRevision of each patch to the value of this counter at the previous read to find the changed patches. */
+    u32 HeightRevision() const { return heightRevision; }
+
     /// Sets a new height value to the given terrain map vertex. Marks the patch that vertex is part of dirty,
     /// but does not immediately recreate the GPU surfaces. Use the RegenerateDirtyTerrainPatches() function
     /// to regenerate the visible Ogre mesh geometry.
@@ -343,7 +364,7 @@ public slots:
         @param entityName Name of the entity. */
     void GenerateFromSceneEntity(QString entityName);
 
-    /// Marks all terrain patches dirty.
+    /// Marks all terrain patches dirty, including their height data.
     void DirtyAllTerrainPatches();
 
     void RegenerateDirtyTerrainPatches();
@@ -372,13 +393,57 @@ private slots:
     void MaterialAssetLoaded(AssetPtr asset);
     void TerrainAssetLoaded(AssetPtr asset);
 
+    /// Uploads the chunk geometry built by the worker threads, and selects the level of detail of each chunk by the camera distance.
+    void UpdateTerrainChunks();
+
     /// (Re)checks whether this entity has EC_Placeable (or if it was just added or removed), and reparents the rootNode of this component to it or the scene root.
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
 private:
+    /// A square block of patches rendered as one mesh, used when the chunkSize attribute is set.
+    struct Chunk
+    {
+        Chunk() : node(0), entity(0), lod(-1), geometryDirty(true) {}
+
+        Ogre::SceneNode *node;
+        Ogre::Entity *entity;
+        /// The name of the Ogre Mesh resource of this chunk.
+        std::string meshGeometryName;
+        /// The geometry being built for this chunk on a worker thread, if any.
+        shared_ptr<TerrainChunkJob> job;
+        /// The level of detail the chunk is currently drawn with, 0 being the full detail.
+        int lod;
+        /// If true, the height data of the chunk or its neighbors has changed, but a new geometry build has not been started yet.
+        bool geometryDirty;
+    };
+
     void AttributesChanged();
 
+    /// Returns whether the GPU geometry of the given patch exists, either as a patch or as a part of a chunk.
+    bool PatchGeometryCreated(int patchX, int patchY) const;
+
+    /// Returns the number of patches on each side of a chunk, from the chunkSize attribute. 0 if the patches are rendered separately.
+    int ChunkPatches() const;
+
+    /// Starts building the geometry of the dirty chunks whose patches and neighbors are loaded.
+    void RegenerateDirtyChunks();
+
+    /// Starts building the geometry of the given chunk on a worker thread.
+    void StartChunkJob(int chunkX, int chunkY);
+
+    /// Creates the Ogre resources of a chunk, or updates its vertex buffer, from a finished job.
+    void UploadChunkGeometry(int chunkX, int chunkY, TerrainChunkJob &job);
+
+    /// Draws a chunk with the given level of detail.
+    void SetChunkLod(Chunk &chunk, int lod);
+
+    /// Creates the index data of each level of detail, shared by all chunks.
+    void CreateChunkIndexData();
+
+    /// Destroys the chunks and their shared index data.
+    void DestroyChunks();
+
     /// Creates the patch parent/root node if it does not exist.
     /** After this function returns, the 'root' member node will exist, unless Ogre rendering subsystem fails. */
     void CreateRootNode();
@@ -388,6 +453,9 @@ private:
     /// Sets the given patch to use the currently set material and textures.
     void UpdateTerrainPatchMaterial(int patchX, int patchY);
 
+    /// Marks the height data of a patch changed, and its geometry dirty.
+    void MarkPatchHeightsChanged(Patch &patch);
+
     /// Updates the root node transform from the current attribute values, if the root node exists.
     void UpdateRootNodeTransform();
 
@@ -413,6 +481,9 @@ private:
     int patchWidth;
     int patchHeight;
 
+    /// Incremented whenever the height data of a patch changes. @see HeightRevision
+    u32 heightRevision;
+
     /// Specifies the asset source from which the height map is currently loaded from. Used to shadow the heightMap attribute so that if
     /// the same value is received from the network, reloading the terrain can be avoided.
     QString currentHeightmapAssetSource;
@@ -422,6 +493,20 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    /// The rendered chunks, chunksWidth x chunksHeight of them, when the chunkSize attribute is set.
+    std::vector<Chunk> chunks;
+    int chunksWidth;
+    int chunksHeight;
+
+    /// The number of quads on each side of the current chunks.
+    int chunkQuads;
+
+    /// The index data of each level of detail of the chunks. The chunks point their submeshes to these index buffers.
+    std::vector<Ogre::IndexData*> chunkLodIndices;
+
+    /// Builds the geometry of the chunks on worker threads. Waits for the running jobs when destroyed.
+    shared_ptr<TerrainChunkBuilder> chunkBuilder;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
@@ -0,0 +1,166 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TerrainChunkBuilder.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <limits>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Appends the two triangles between two border vertices p0, p1 of a chunk and their skirt vertices s0, s1.
+/** The triangles face outwards from the chunk when the border runs along the +x axis on the -z side of the chunk, or along
+    the +z axis on the +x side. flip reverses the winding for the two other sides. */
+void PushSkirtQuad(std::vector<u16> &dst, int p0, int p1, int s0, int s1, bool flip)
+{
+    if (!flip)
+    {
+        dst.push_back((u16)p0); dst.push_back((u16)p1); dst.push_back((u16)s0);
+        dst.push_back((u16)p1); dst.push_back((u16)s1); dst.push_back((u16)s0);
+    }
+    else
+    {
+        dst.push_back((u16)p1); dst.push_back((u16)p0); dst.push_back((u16)s0);
+        dst.push_back((u16)p1); dst.push_back((u16)s0); dst.push_back((u16)s1);
+    }
+}
+
+}
+
+TerrainChunkBuilder::TerrainChunkBuilder() :
+    jobs(&TerrainChunkBuilder::Process, QThread::idealThreadCount() / 2)
+{
+}
+
+void TerrainChunkBuilder::Start(const shared_ptr<TerrainChunkJob> &job)
+{
+    jobs.Start(job);
+}
+
+void TerrainChunkBuilder::TakeFinishedJobs(std::vector<shared_ptr<TerrainChunkJob> > &finishedJobs)
+{
+    jobs.TakeFinishedJobs(finishedJobs);
+}
+
+int TerrainChunkBuilder::NumVertices(int quads)
+{
+    return (quads + 1) * (quads + 1) + 4 * (quads + 1);
+}
+
+int TerrainChunkBuilder::NumLodLevels(int quads)
+{
+    int levels = 0;
+    while((1 << levels) <= quads)
+        ++levels;
+    return levels;
+}
+
+void TerrainChunkBuilder::Process(TerrainChunkJob &job)
+{
+    const int quads = job.quads;
+    const int side = quads + 1;
+    const int stride = quads + 3;
+    const int lastX = job.verticesWidth - 1;
+    const int lastY = job.verticesHeight - 1;
+    const float *heights = &job.heights[0];
+
+    job.vertices.resize(NumVertices(quads) * cVertexFloats);
+    float *v = &job.vertices[0];
+    float minY = std::numeric_limits<float>::max();
+    float maxY = -std::numeric_limits<float>::max();
+
+    for(int y = 0; y < side; ++y)
+        for(int x = 0; x < side; ++x)
+        {
+            // Past the terrain edge, the vertices repeat the edge vertex.
+            const int globalX = std::min(job.firstX + x, lastX);
+            const int globalY = std::min(job.firstY + y, lastY);
+            // The heights array starts one vertex before the chunk, and is clamped to the terrain, so the neighbors of a vertex are next to it.
+            const float *h = heights + (globalY - job.firstY + 1) * stride + (globalX - job.firstX + 1);
+
+            // The normal is computed like EC_Terrain::CalculateNormal does, with a one-sided difference at the terrain edges.
+            float xSlope = h[-1] - h[1];
+            if (globalX == 0 || globalX == lastX)
+                xSlope *= 2.f;
+            float ySlope = h[-stride] - h[stride];
+            if (globalY == 0 || globalY == lastY)
+                ySlope *= 2.f;
+            const float3 normal = float3(xSlope, 2.f, ySlope).Normalized();
+
+            minY = std::min(minY, *h);
+            maxY = std::max(maxY, *h);
+
+            v[0] = (float)(globalX - job.firstX);
+            v[1] = *h;
+            v[2] = (float)(globalY - job.firstY);
+            v[3] = normal.x;
+            v[4] = normal.y;
+            v[5] = normal.z;
+            // The UV set 0 contains the diffuse texture UV map, a planar mapping with the specified UV scale.
+            v[6] = globalX * job.uScale;
+            v[7] = globalY * job.vScale;
+            // The UV set 1 contains the terrain blend mask UV map, which stretches once across the whole terrain.
+            v[8] = (float)globalX / lastX;
+            v[9] = (float)globalY / lastY;
+            v += cVertexFloats;
+        }
+
+    // The skirt of each side, in the order -z, +z, -x, +x. The skirt reaches below the lowest point of the chunk, so that it
+    // covers the crack to a neighboring chunk at any level of detail.
+    const float skirtY = minY - 1.f;
+    const float *grid = &job.vertices[0];
+    for(int edge = 0; edge < 4; ++edge)
+        for(int i = 0; i < side; ++i)
+        {
+            int x = i, y = i;
+            switch(edge)
+            {
+            case 0: y = 0; break;
+            case 1: y = quads; break;
+            case 2: x = 0; break;
+            default: x = quads; break;
+            }
+            std::copy(grid + (y * side + x) * cVertexFloats, grid + (y * side + x + 1) * cVertexFloats, v);
+            v[1] = skirtY;
+            v += cVertexFloats;
+        }
+
+    job.minPos = float3(0.f, skirtY, 0.f);
+    job.maxPos = float3((float)std::min(quads, lastX - job.firstX), maxY, (float)std::min(quads, lastY - job.firstY));
+}
+
+void TerrainChunkBuilder::BuildIndices(int quads, int lod, std::vector<u16> &dst)
+{
+    const int side = quads + 1;
+    const int step = 1 << lod;
+    const int skirt = side * side;
+    dst.clear();
+    dst.reserve((quads / step) * (quads / step) * 6 + 4 * (quads / step) * 6);
+
+    for(int y = 0; y < quads; y += step)
+        for(int x = 0; x < quads; x += step)
+        {
+            // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+            const int topLeft = y * side + x;
+            const int topRight = topLeft + step;
+            const int bottomLeft = topLeft + step * side;
+            const int bottomRight = bottomLeft + step;
+            dst.push_back((u16)bottomLeft); dst.push_back((u16)topRight); dst.push_back((u16)topLeft);
+            dst.push_back((u16)bottomLeft); dst.push_back((u16)bottomRight); dst.push_back((u16)topRight);
+        }
+
+    for(int i = 0; i < quads; i += step)
+    {
+        PushSkirtQuad(dst, i, i + step, skirt + i, skirt + i + step, false);
+        PushSkirtQuad(dst, quads * side + i, quads * side + i + step, skirt + side + i, skirt + side + i + step, true);
+        PushSkirtQuad(dst, i * side, (i + step) * side, skirt + 2 * side + i, skirt + 2 * side + i + step, true);
+        PushSkirtQuad(dst, i * side + quads, (i + step) * side + quads, skirt + 3 * side + i, skirt + 3 * side + i + step, false);
+    }
+}
@@ -0,0 +1,73 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "EnvironmentModuleApi.h"
+#include "CoreTypes.h"
+#include "Math/float3.h"
+#include "WorkerJobQueue.h"
+
+#include <vector>
+
+/// Describes the building of the vertex data of one EC_Terrain chunk, which TerrainChunkBuilder runs on a worker thread.
+/** The main thread fills in the source heights, and uploads the vertices to the GPU after the job has finished.
+    While the job is being processed, the worker thread owns the source and result fields, and they must not be touched. */
+struct ENVIRONMENT_MODULE_API TerrainChunkJob
+{
+    TerrainChunkJob() : chunkX(0), chunkY(0), quads(0), firstX(0), firstY(0), verticesWidth(0), verticesHeight(0), uScale(0.f), vScale(0.f) {}
+
+    int chunkX; ///< The chunk of the terrain the job was started for.
+    int chunkY;
+    int quads; ///< The number of quads on each side of the chunk.
+    int firstX; ///< The terrain vertex coordinates of the first vertex of the chunk.
+    int firstY;
+    int verticesWidth; ///< The number of vertices in the whole terrain. See EC_Terrain::VerticesWidth().
+    int verticesHeight;
+    float uScale; ///< Texture coordinate scale of the diffuse UV set. See EC_Terrain::uScale.
+    float vScale;
+    /// Heights of the terrain vertices from (firstX-1, firstY-1) to (firstX+quads+1, firstY+quads+1), clamped to the terrain edges.
+    /** The extra vertex around the chunk is needed for the normals. */
+    std::vector<float> heights;
+
+    std::vector<float> vertices; ///< The built vertices, TerrainChunkBuilder::cVertexFloats floats each.
+    float3 minPos; ///< Bounds of the built vertices, in the space of the chunk.
+    float3 maxPos;
+};
+
+/// Builds the geometry of the EC_Terrain chunks.
+/** A chunk is a square grid of (quads+1)^2 vertices, surrounded by a skirt: a copy of its border vertices moved down below the
+    lowest point of the chunk. The vertices of the chunks at the far terrain edges are clamped to the edge, so all chunks of a
+    terrain have the same vertex layout, and use the same index buffers. Each level of detail skips every other vertex of the
+    previous level, and the skirts hide the cracks between neighboring chunks drawn at different levels of detail.
+
+    The vertices are built on worker threads, and EC_Terrain takes the finished jobs each frame. Does not touch the terrain
+    from the worker threads. */
+class ENVIRONMENT_MODULE_API TerrainChunkBuilder
+{
+public:
+    TerrainChunkBuilder();
+
+    /// Floats per vertex: position, normal, diffuse UV and blend mask UV.
+    static const int cVertexFloats = 10;
+
+    /// Starts building the vertices of the job on a worker thread.
+    void Start(const shared_ptr<TerrainChunkJob> &job);
+
+    /// Moves the jobs processed by the worker threads to finishedJobs.
+    void TakeFinishedJobs(std::vector<shared_ptr<TerrainChunkJob> > &finishedJobs);
+
+    /// Builds the vertices of the job on the calling thread.
+    static void Process(TerrainChunkJob &job);
+
+    /// Returns the number of vertices in a chunk, including the skirt.
+    static int NumVertices(int quads);
+
+    /// Returns the number of levels of detail of a chunk. quads must be a power of two.
+    static int NumLodLevels(int quads);
+
+    /// Fills dst with the triangle list indices of a level of detail, 0 being the full detail.
+    static void BuildIndices(int quads, int lod, std::vector<u16> &dst);
+
+private:
+    WorkerJobQueue<TerrainChunkJob> jobs; ///< Jobs being processed by the worker threads. Waits for them when destroyed.
+};
@@ -3,6 +3,7 @@
 #include "Types.h"
 
 #include "Math/MathFunc.h"
+#include "Math/SSEMath.h"
 #include "Geometry/AABB.h"
 #include "Geometry/OBB.h"
 #include "Geometry/Ray.h"
@@ -11,6 +12,9 @@
 #include "Container/MaxHeap.h"
 #endif
 
+#include <vector>
+#include <string.h>
+
 enum CardinalAxis
 {
 	AxisX = 0,
@@ -64,6 +68,17 @@ public:
 	/// After Build() has been called, do *not* call AddObjects() again.
 	void Build();
 
+	/// Exchanges the contents of this kD-tree with the given kD-tree.
+	void Swap(KdTree<T> &other);
+
+	/// Appends the built kD-tree to the given byte array.
+	/// Type T must be a plain data type. The data can be read back only on a platform with the same type layout.
+	void SerializeTo(std::vector<u8> &dst) const;
+
+	/// Replaces the contents of this kD-tree with a kD-tree serialized with SerializeTo().
+	/// @return The number of bytes read, or 0 if the data was not a valid kD-tree, in which case this kD-tree is left empty.
+	size_t DeserializeFrom(const u8 *data, size_t numBytes);
+
 	/// Returns an object bucket by the given bucket index.
 	/// An object bucket is a contiguous C array of object indices, terminated with a sentinel value BUCKET_SENTINEL.
 	/// To fetch the actual object based on an object index, call the Object() method.
@@ -114,6 +129,22 @@ public:
 	template<typename Func>
 	inline void RayQuery(const Ray &r, Func &leafCallback);
 
+	/// Traverses a packet of four rays through this kD-tree, and calls the given leafCallback function for each non-empty leaf
+	/// of the tree that any of the rays enters.
+	/// The rays of the packet share the node visits, so this is faster than four separate RayQuery() calls when the rays are
+	/// coherent, i.e. start near each other and point in roughly the same direction. With SSE, the rays are traversed four-wide.
+	/// The leaves are visited in front-to-back order for most of the rays, but not necessarily for all of them.
+	/// @param rays An array of four rays. To trace fewer rays, duplicate one of the rays to the remaining slots.
+	/// @param leafCallback A function or a function object of prototype
+	///    bool LeafCallbackFunction(KdTree<T> &tree, const KdTreeNode &leaf, const Ray *rays, const float *tNear, const float *tFar, float *tHit, int activeMask);
+	///    The arrays tNear and tFar give the parameter range of each ray inside the leaf. Only the rays whose bit is set in
+	///    activeMask enter the leaf. tHit is the distance to the nearest hit of each ray so far, initially +inf. The callback
+	///    lowers it when it finds a nearer hit, and the traversal then skips the nodes of that ray beyond the hit.
+	///    If the callback function returns true, the execution of the query is stopped and this function immediately
+	///    returns afterwards. If the callback function returns false, the execution of the query continues.
+	template<typename Func>
+	inline void RayQueryPacket(const Ray *rays, Func &leafCallback);
+
 	/// Performs an AABB intersection query in this kD-tree, and calls the given leafCallback function for each leaf
 	/// of the tree which intersects the given AABB.
 	/// @param leafCallback A function or a function object of prototype
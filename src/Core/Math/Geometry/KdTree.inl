@@ -261,6 +261,115 @@ void KdTree<T>::Build()
 	SplitLeaf(1, rootAABB, objects.size(), 1);
 }
 
+template<typename T>
+void KdTree<T>::Swap(KdTree<T> &other)
+{
+	nodes.swap(other.nodes);
+	objects.swap(other.objects);
+	buckets.swap(other.buckets);
+	std::swap(rootAABB, other.rootAABB);
+}
+
+inline void KdTreeAppendBytes(std::vector<u8> &dst, const void *data, size_t numBytes)
+{
+	if (numBytes > 0)
+		dst.insert(dst.end(), (const u8*)data, (const u8*)data + numBytes);
+}
+
+template<typename T>
+void KdTree<T>::SerializeTo(std::vector<u8> &dst) const
+{
+	// The layout is a header of four u32s (the number of objects, nodes and buckets, and the total length of the buckets),
+	// followed by the root AABB, the objects, the nodes, and the buckets. Each bucket is stored with its BUCKET_SENTINEL.
+	// The dummy bucket at index 0 is not stored.
+	std::vector<u32> bucketData;
+	for(size_t i = 1; i < buckets.size(); ++i)
+	{
+		for(const u32 *bucket = buckets[i]; bucket && *bucket != BUCKET_SENTINEL; ++bucket)
+			bucketData.push_back(*bucket);
+		bucketData.push_back(BUCKET_SENTINEL);
+	}
+
+	const u32 header[4] = { (u32)objects.size(), (u32)nodes.size(), (u32)buckets.size(), (u32)bucketData.size() };
+	KdTreeAppendBytes(dst, header, sizeof(header));
+	KdTreeAppendBytes(dst, &rootAABB, sizeof(rootAABB));
+	if (!objects.empty())
+		KdTreeAppendBytes(dst, &objects[0], objects.size() * sizeof(T));
+	if (!nodes.empty())
+		KdTreeAppendBytes(dst, &nodes[0], nodes.size() * sizeof(KdTreeNode));
+	if (!bucketData.empty())
+		KdTreeAppendBytes(dst, &bucketData[0], bucketData.size() * sizeof(u32));
+}
+
+template<typename T>
+size_t KdTree<T>::DeserializeFrom(const u8 *data, size_t numBytes)
+{
+	Clear();
+	nodes.clear();
+	objects.clear();
+
+	u32 header[4];
+	if (!data || numBytes < sizeof(header) + sizeof(AABB))
+		return 0;
+	memcpy(header, data, sizeof(header));
+	const u32 numObjects = header[0];
+	const u32 numNodes = header[1];
+	const u32 numBuckets = header[2];
+	const u32 bucketDataSize = header[3];
+	// A built tree has at least the dummy node and bucket, and the root node.
+	if (numNodes < 2 || numBuckets < 1)
+		return 0;
+	const size_t totalSize = sizeof(header) + sizeof(AABB) + (size_t)numObjects * sizeof(T) + (size_t)numNodes * sizeof(KdTreeNode) + (size_t)bucketDataSize * sizeof(u32);
+	if (numBytes < totalSize)
+		return 0;
+
+	const u8 *pos = data + sizeof(header);
+	memcpy(&rootAABB, pos, sizeof(AABB));
+	pos += sizeof(AABB);
+	objects.resize(numObjects);
+	if (numObjects > 0)
+		memcpy(&objects[0], pos, numObjects * sizeof(T));
+	pos += numObjects * sizeof(T);
+	nodes.resize(numNodes);
+	memcpy(&nodes[0], pos, numNodes * sizeof(KdTreeNode));
+	pos += numNodes * sizeof(KdTreeNode);
+	std::vector<u32> bucketData(bucketDataSize);
+	if (bucketDataSize > 0)
+		memcpy(&bucketData[0], pos, bucketDataSize * sizeof(u32));
+
+	bool valid = true;
+	buckets.push_back(0);
+	size_t i = 0;
+	for(u32 b = 1; valid && b < numBuckets; ++b)
+	{
+		const size_t start = i;
+		while(i < bucketData.size() && bucketData[i] != BUCKET_SENTINEL && bucketData[i] < numObjects)
+			++i;
+		if (i >= bucketData.size() || bucketData[i] != BUCKET_SENTINEL)
+		{
+			valid = false;
+			break;
+		}
+		++i;
+		u32 *bucket = new u32[i - start];
+		memcpy(bucket, &bucketData[start], (i - start) * sizeof(u32));
+		buckets.push_back(bucket);
+	}
+	// The children of a node are always stored after it, so requiring that rules out cycles in the tree.
+	for(size_t n = 1; valid && n < nodes.size(); ++n)
+		if (nodes[n].IsLeaf() ? nodes[n].bucketIndex >= numBuckets : (nodes[n].childIndex <= n || nodes[n].childIndex + 1 >= numNodes))
+			valid = false;
+
+	if (!valid)
+	{
+		Clear();
+		nodes.clear();
+		objects.clear();
+		return 0;
+	}
+	return totalSize;
+}
+
 template<typename T>
 KdTreeNode *KdTree<T>::Root() { return nodes.size() > 1 ? &nodes[1] : 0; }
 
@@ -410,6 +519,184 @@ inline void KdTree<T>::RayQuery(const Ray &r, Func &nodeProcessFunc)
 	}
 }
 
+#ifndef MATH_SSE
+/// Adapts a RayQueryPacket() leaf callback to RayQuery(), for tracing the rays of a packet one at a time without SSE.
+template<typename T, typename Func>
+struct KdTreeRayPacketAdapter
+{
+	Func *leafCallback;
+	const Ray *rays;
+	float *tHit;
+	int index; ///< The ray of the packet that is being traced.
+	bool finished; ///< Set when the leaf callback asks to stop the whole query.
+
+	bool operator()(KdTree<T> &tree, const KdTreeNode &leaf, const Ray & /*ray*/, float tNear, float tFar)
+	{
+		if (leaf.IsEmptyLeaf())
+			return false;
+		float tNears[4], tFars[4];
+		tNears[index] = tNear;
+		tFars[index] = tFar;
+		finished = (*leafCallback)(tree, leaf, rays, tNears, tFars, tHit, 1 << index);
+		// RayQuery() visits the leaves in front-to-back order, so a hit inside this leaf is the nearest one.
+		return finished || tHit[index] <= tFar;
+	}
+};
+#endif
+
+// The packet traversal of Wald et al. "Interactive Rendering with Coherent Ray Tracing", 2001.
+template<typename T>
+template<typename Func>
+inline void KdTree<T>::RayQueryPacket(const Ray *rays, Func &leafCallback)
+{
+	float tNear[4], tFar[4], tHit[4];
+	int activeMask = 0;
+	for(int i = 0; i < 4; ++i)
+	{
+		tHit[i] = FLOAT_INF;
+		if (rootAABB.Intersects(rays[i], &tNear[i], &tFar[i]) && tFar[i] >= 0.f)
+		{
+			// We are performing a ray query - ignore any hits behind the ray starting position.
+			tNear[i] = Max(tNear[i], 0.f);
+			activeMask |= 1 << i;
+		}
+		else
+		{
+			// An empty range marks the ray inactive.
+			tNear[i] = FLOAT_INF;
+			tFar[i] = -FLOAT_INF;
+		}
+	}
+	if (activeMask == 0)
+		return; // None of the rays intersect the root, therefore no collision.
+
+#ifdef MATH_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 inf = _mm_set1_ps(FLOAT_INF);
+
+	// The rays of the packet in structure-of-arrays layout.
+	__m128 origin[3], invDir[3], dirNonPositive[3];
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		origin[axis] = _mm_setr_ps(rays[0].pos[axis], rays[1].pos[axis], rays[2].pos[axis], rays[3].pos[axis]);
+		const __m128 dir = _mm_setr_ps(rays[0].dir[axis], rays[1].dir[axis], rays[2].dir[axis], rays[3].dir[axis]);
+		invDir[axis] = _mm_div_ps(_mm_set1_ps(1.f), dir);
+		dirNonPositive[axis] = _mm_cmple_ps(dir, zero);
+	}
+
+	struct StackElem
+	{
+		KdTreeNode *node;
+		__m128 tMin;
+		__m128 tMax;
+	};
+
+	// Each inner node on the path from the root to the current node pushes at most one element.
+	const int cMaxStackItems = maxTreeDepth*2;
+	StackElem stack[cMaxStackItems];
+	int stackSize = 0;
+
+	KdTreeNode *currentNode = Root();
+	__m128 tMin = _mm_loadu_ps(tNear);
+	__m128 tMax = _mm_loadu_ps(tFar);
+
+	for(;;)
+	{
+		// The rays need not be traced beyond their nearest hits so far.
+		tMax = _mm_min_ps(tMax, _mm_loadu_ps(tHit));
+		activeMask = _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+
+		while(activeMask != 0 && !currentNode->IsLeaf())
+		{
+			const int axis = currentNode->splitAxis;
+			const __m128 splitPos = _mm_set1_ps(currentNode->splitPos);
+
+			// The distance to the split plane. If a ray does not cross the plane in front of its origin, it stays on
+			// the near side, which is marked with an infinite distance. This covers the rays parallel to the plane as
+			// well, since NaN compares false.
+			__m128 tSplit = _mm_mul_ps(_mm_sub_ps(splitPos, origin[axis]), invDir[axis]);
+			const __m128 crosses = _mm_cmpgt_ps(tSplit, zero);
+			tSplit = _mm_or_ps(_mm_and_ps(crosses, tSplit), _mm_andnot_ps(crosses, inf));
+
+			// The near child is on the side of the ray origin, or the side the ray travels to if it starts on the plane.
+			const __m128 nearIsLeft = _mm_or_ps(_mm_cmplt_ps(origin[axis], splitPos),
+				_mm_and_ps(_mm_cmpeq_ps(origin[axis], splitPos), dirNonPositive[axis]));
+
+			// A ray spans [tMin, nearMax] in its near child and [farMin, tMax] in its far child. An empty range leaves the ray
+			// out of the child. The ranges of the inactive rays stay empty.
+			const __m128 nearMax = _mm_min_ps(tMax, tSplit);
+			const __m128 farMin = _mm_max_ps(tMin, tSplit);
+			const __m128 leftMin = _mm_or_ps(_mm_and_ps(nearIsLeft, tMin), _mm_andnot_ps(nearIsLeft, farMin));
+			const __m128 leftMax = _mm_or_ps(_mm_and_ps(nearIsLeft, nearMax), _mm_andnot_ps(nearIsLeft, tMax));
+			const __m128 rightMin = _mm_or_ps(_mm_and_ps(nearIsLeft, farMin), _mm_andnot_ps(nearIsLeft, tMin));
+			const __m128 rightMax = _mm_or_ps(_mm_and_ps(nearIsLeft, tMax), _mm_andnot_ps(nearIsLeft, nearMax));
+			const int leftMask = _mm_movemask_ps(_mm_cmple_ps(leftMin, leftMax));
+			const int rightMask = _mm_movemask_ps(_mm_cmple_ps(rightMin, rightMax));
+
+			KdTreeNode *leftChild = &nodes[currentNode->LeftChildIndex()];
+			KdTreeNode *rightChild = &nodes[currentNode->RightChildIndex()];
+			if (leftMask != 0 && rightMask != 0)
+			{
+				// Both children are needed. Descend to the near child of the first active ray and visit the other one later.
+				const int firstActiveRay = activeMask & -activeMask;
+				const bool leftFirst = (_mm_movemask_ps(nearIsLeft) & firstActiveRay) != 0;
+				assert(stackSize < cMaxStackItems);
+				StackElem &farElem = stack[stackSize++];
+				farElem.node = leftFirst ? rightChild : leftChild;
+				farElem.tMin = leftFirst ? rightMin : leftMin;
+				farElem.tMax = leftFirst ? rightMax : leftMax;
+				currentNode = leftFirst ? leftChild : rightChild;
+				tMin = leftFirst ? leftMin : rightMin;
+				tMax = leftFirst ? leftMax : rightMax;
+				activeMask = leftFirst ? leftMask : rightMask;
+			}
+			else if (leftMask != 0)
+			{
+				currentNode = leftChild;
+				tMin = leftMin;
+				tMax = leftMax;
+				activeMask = leftMask;
+			}
+			else
+			{
+				currentNode = rightChild;
+				tMin = rightMin;
+				tMax = rightMax;
+				activeMask = rightMask;
+			}
+		}
+
+		if (activeMask != 0 && !currentNode->IsEmptyLeaf())
+		{
+			_mm_storeu_ps(tNear, tMin);
+			_mm_storeu_ps(tFar, tMax);
+			if (leafCallback(*this, *currentNode, rays, tNear, tFar, tHit, activeMask))
+				return;
+		}
+
+		// Pop from the stack
+		if (stackSize == 0)
+			return;
+		--stackSize;
+		currentNode = stack[stackSize].node;
+		tMin = stack[stackSize].tMin;
+		tMax = stack[stackSize].tMax;
+	}
+#else
+	KdTreeRayPacketAdapter<T, Func> adapter;
+	adapter.leafCallback = &leafCallback;
+	adapter.rays = rays;
+	adapter.tHit = tHit;
+	adapter.finished = false;
+	for(int i = 0; i < 4 && !adapter.finished; ++i)
+		if ((activeMask & (1 << i)) != 0)
+		{
+			adapter.index = i;
+			RayQuery(rays[i], adapter);
+		}
+#endif
+}
+
 template<typename T>
 template<typename Func>
 inline void KdTree<T>::AABBQuery(const AABB &aabb, Func &leafCallback)
@@ -16,6 +16,7 @@
 	@author Jukka Jylnki
 	@brief Implementation for the Triangle geometry object. */
 #include "Math/MathFunc.h"
+#include "Math/SSEMath.h"
 #include "Math/float2.h"
 #include "Math/float3.h"
 #include "Math/float3x3.h"
@@ -329,6 +330,81 @@ bool Triangle::IntersectLineTri(const float3 &linePos, const float3 &lineDir,
 //	return (det < 0.f) ? IntersectBackface : IntersectFrontface;
 }
 
+/** Calculates the intersections between four lines and a triangle at once. This is the batched version of IntersectLineTri()
+	for ray packets, and computes four-wide with SSE.
+	@param linePos The starting points of the four lines in structure-of-arrays layout: the x coordinates of the lines in
+		linePos[0-3], the y coordinates in linePos[4-7] and the z coordinates in linePos[8-11].
+	@param lineDir The directions of the four lines in the same layout as linePos.
+	@param v0 Vertex 0 of the triangle.
+	@param v1 Vertex 1 of the triangle.
+	@param v2 Vertex 2 of the triangle.
+	@param u [out] An array of four floats that receives the barycentric u coordinates of the intersections.
+	@param v [out] An array of four floats that receives the barycentric v coordinates of the intersections.
+	@param t [out] An array of four floats that receives the signed distances from the line origins to the intersections.
+	@return A bit mask of the lines that intersect the triangle, bit i set for line i. The u, v and t of the lines that do not
+		intersect contain undefined values. */
+int Triangle::IntersectLineTri4(const float *linePos, const float *lineDir,
+		const float3 &v0, const float3 &v1, const float3 &v2,
+		float *u, float *v, float *t)
+{
+#ifdef MATH_SSE
+	const float3 vE1 = v1 - v0;
+	const float3 vE2 = v2 - v0;
+	const __m128 e1x = _mm_set1_ps(vE1.x), e1y = _mm_set1_ps(vE1.y), e1z = _mm_set1_ps(vE1.z);
+	const __m128 e2x = _mm_set1_ps(vE2.x), e2y = _mm_set1_ps(vE2.y), e2z = _mm_set1_ps(vE2.z);
+
+	const __m128 dx = _mm_loadu_ps(lineDir), dy = _mm_loadu_ps(lineDir + 4), dz = _mm_loadu_ps(lineDir + 8);
+
+	// vP = Cross(lineDir, vE2)
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+	// det = Dot(vE1, vP). The lines that lie in the plane of the triangle are rejected.
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+	__m128 hit = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-6f));
+	const __m128 recipDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+	// vT = linePos - v0
+	const __m128 tx = _mm_sub_ps(_mm_loadu_ps(linePos), _mm_set1_ps(v0.x));
+	const __m128 ty = _mm_sub_ps(_mm_loadu_ps(linePos + 4), _mm_set1_ps(v0.y));
+	const __m128 tz = _mm_sub_ps(_mm_loadu_ps(linePos + 8), _mm_set1_ps(v0.z));
+
+	// u = Dot(vT, vP) / det
+	const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), recipDet);
+
+	// vQ = Cross(vT, vE1)
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+	// v = Dot(lineDir, vQ) / det
+	const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), recipDet);
+
+	// The barycentric coordinates must be inside the triangle.
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+
+	// t = Dot(vE2, vQ) / det
+	const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), recipDet);
+
+	_mm_storeu_ps(u, uu);
+	_mm_storeu_ps(v, vv);
+	_mm_storeu_ps(t, tt);
+	return _mm_movemask_ps(hit);
+#else
+	int hits = 0;
+	for(int i = 0; i < 4; ++i)
+		if (IntersectLineTri(float3(linePos[i], linePos[i+4], linePos[i+8]), float3(lineDir[i], lineDir[i+4], lineDir[i+8]),
+			v0, v1, v2, u[i], v[i], t[i]))
+			hits |= 1 << i;
+	return hits;
+#endif
+}
+
 /// [groupSyntax]
 bool Triangle::Intersects(const LineSegment &l, float *d, float3 *intersectionPoint) const
 {
@@ -268,6 +268,12 @@ public:
 		const float3 &v0, const float3 &v1, const float3 &v2,
 		float &u, float &v, float &t);
 
+	/// A helper function that intersects four lines with a triangle at once, used in ray packet tests.
+	/// The lines are given in structure-of-arrays layout, and the function returns a bit mask of the lines that intersect.
+	static int IntersectLineTri4(const float *linePos, const float *lineDir,
+		const float3 &v0, const float3 &v1, const float3 &v2,
+		float *u, float *v, float *t);
+
 	/// Projects this Triangle onto the given axis.
 	/** This function is used in SAT tests (separate axis theorem) to check the interval this triangle
 		lies in on an 1D line.
@@ -0,0 +1,31 @@
+/* Copyright 2011 Jukka Jylnki
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file SSEMath.h
+	@brief Detects the availability of the SSE instruction set.
+
+	Defines MATH_SSE if the compiler targets a CPU that supports SSE, and includes the SSE intrinsics.
+	The SSE code paths of the library are guarded by MATH_SSE and have a scalar fallback, so the library
+	compiles for platforms without SSE (e.g. ARM) as well. Define MATH_NO_SSE to force the scalar code paths. */
+#pragma once
+
+#if !defined(MATH_SSE) && !defined(MATH_NO_SSE)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATH_SSE
+#endif
+#endif
+
+#ifdef MATH_SSE
+#include <xmmintrin.h>
+#endif
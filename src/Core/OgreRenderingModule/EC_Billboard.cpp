@@ -51,6 +51,10 @@ EC_Billboard::EC_Billboard(Scene* scene) :
     connect(materialAsset_.get(), SIGNAL(TransferFailed(IAssetTransfer*, QString)), this, SLOT(OnMaterialAssetFailed(IAssetTransfer*, QString)), Qt::UniqueConnection);
     
     connect(this, SIGNAL(ParentEntitySet()), SLOT(OnParentEntitySet()));
+
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        connect(world.get(), SIGNAL(AssetPrioritiesChanged()), this, SLOT(UpdateAssetPriority()));
 }
 
 EC_Billboard::~EC_Billboard()
@@ -205,6 +209,7 @@ void EC_Billboard::AttributesChanged()
         // In the case of empty ref setting it to the ref listener will
         // make sure we don't get called to OnMaterialAssetLoaded. This would happen 
         // if something touches the previously set material in the asset system (eg. reload).
+        UpdateAssetPriority();
         materialAsset_->HandleAssetRefChange(&materialRef);
 
         try
@@ -250,3 +255,10 @@ void EC_Billboard::OnMaterialAssetFailed(IAssetTransfer* transfer, QString reaso
     if (billboardSet_)
         billboardSet_->setMaterialName("AssetLoadError");
 }
+
+void EC_Billboard::UpdateAssetPriority()
+{
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        materialAsset_->SetPriority(world->AssetPriority(ParentEntity()));
+}
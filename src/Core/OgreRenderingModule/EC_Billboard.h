@@ -121,6 +121,9 @@ private slots:
     
     /// Called when material asset failed to load
     void OnMaterialAssetFailed(IAssetTransfer* transfer, QString reason);
+
+    /// Sets the download priority of the material request by the distance to the camera.
+    void UpdateAssetPriority();
     
 private:
     /// Create billboardset & billboard
@@ -7,6 +7,7 @@
 #include "EC_Mesh.h"
 #include "OgreMaterialAsset.h"
 #include "OgreRenderingModule.h"
+#include "OgreWorld.h"
 
 #include "FrameAPI.h"
 #include "Scene/Scene.h"
@@ -28,6 +29,11 @@ EC_Material::EC_Material(Scene* scene) :
     
     connect(this, SIGNAL(ParentEntitySet()), SLOT(OnParentEntitySet()));
 
+    if (scene)
+        world_ = scene->GetWorld<OgreWorld>();
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        connect(world.get(), SIGNAL(AssetPrioritiesChanged()), this, SLOT(UpdateAssetPriority()));
 }
 
 EC_Material::~EC_Material()
@@ -121,9 +127,17 @@ void EC_Material::CheckForInputMaterial()
     QString inputMatName = GetInputMaterialName();
     if (inputMatName.isEmpty())
         return; // Empty material ref, and could not be interrogated from the EC_Mesh, so can't do anything
+    UpdateAssetPriority();
     materialAsset->HandleAssetRefChange(framework->Asset(), inputMatName, "OgreMaterial");
 }
 
+void EC_Material::UpdateAssetPriority()
+{
+    OgreWorldPtr world = world_.lock();
+    if (world)
+        materialAsset->SetPriority(world->AssetPriority(ParentEntity()));
+}
+
 void EC_Material::OnMaterialAssetLoaded(AssetPtr material)
 {
     OgreMaterialAsset* srcMatAsset = dynamic_cast<OgreMaterialAsset*>(material.get());
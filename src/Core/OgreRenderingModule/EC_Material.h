@@ -81,6 +81,9 @@ private slots:
     /// Input asset has been successfully loaded.
     void OnMaterialAssetLoaded(AssetPtr material);
 
+    /// Sets the download priority of the input material request by the distance to the camera.
+    void UpdateAssetPriority();
+
 signals:
     void AppliedOutputMaterial(Entity *entity, const QString &meshCompName, const int index, const QString &material);
     
@@ -101,5 +104,8 @@ private:
     
     /// Ref listener for the input material asset
     AssetRefListenerPtr materialAsset;
+
+    /// Ogre world ptr
+    OgreWorldWeakPtr world_;
 };
 
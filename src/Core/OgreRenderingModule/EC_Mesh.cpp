@@ -62,6 +62,7 @@ EC_Mesh::EC_Mesh(Scene* scene) :
         connect(this, SIGNAL(ParentEntitySet()), SLOT(UpdateSignals()));
         connect(meshAsset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnMeshAssetLoaded(AssetPtr)), Qt::UniqueConnection);
         connect(skeletonAsset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(OnSkeletonAssetLoaded(AssetPtr)), Qt::UniqueConnection);
+        connect(world.get(), SIGNAL(AssetPrioritiesChanged()), this, SLOT(UpdateAssetPriority()));
     }
 }
 
@@ -883,6 +884,7 @@ void EC_Mesh::AttributesChanged()
 
         if (meshRef.Get().ref.trimmed().isEmpty())
             LogDebug("Warning: Mesh \"" + this->parentEntity->Name() + "\" mesh ref was set to an empty reference!");
+        UpdateAssetPriority();
         meshAsset->HandleAssetRefChange(&meshRef);
     }
     if (meshMaterial.ValueChanged())
@@ -907,6 +909,7 @@ void EC_Mesh::AttributesChanged()
             materialAssets.pop_back();
         while(materialAssets.size() < (size_t)materials.Size())
             materialAssets.push_back(shared_ptr<AssetRefListener>(new AssetRefListener));
+        UpdateAssetPriority();
 
         for(int i = 0; i < materials.Size(); ++i)
         {
@@ -925,10 +928,26 @@ void EC_Mesh::AttributesChanged()
             return;
 
         if (!skeletonRef.Get().ref.isEmpty())
+        {
+            UpdateAssetPriority();
             skeletonAsset->HandleAssetRefChange(&skeletonRef);
+        }
     }
 }
 
+void EC_Mesh::UpdateAssetPriority()
+{
+    OgreWorldPtr world = world_.lock();
+    if (!world)
+        return;
+
+    const float priority = world->AssetPriority(ParentEntity());
+    meshAsset->SetPriority(priority);
+    skeletonAsset->SetPriority(priority);
+    for(size_t i = 0; i < materialAssets.size(); ++i)
+        materialAssets[i]->SetPriority(priority);
+}
+
 void EC_Mesh::OnComponentRemoved(IComponent* component, AttributeChange::Type change)
 {
     if (component == placeable_.get())
@@ -389,6 +389,9 @@ private slots:
     /// Called when component has been removed from the parent entity. Checks if the component removed was the placeable, and autodissociates it.
     void OnComponentRemoved(IComponent* component, AttributeChange::Type change);
 
+    /// Sets the download priority of the mesh, skeleton and material requests by the distance to the camera.
+    void UpdateAssetPriority();
+
     /// Called when mesh asset has been downloaded.
     void OnMeshAssetLoaded(AssetPtr mesh);
 
@@ -8,6 +8,7 @@
 #include "EC_Placeable.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "PlaceableGrid.h"
 #include "Renderer.h"
 
 #include "AttributeMetadata.h"
@@ -206,6 +207,8 @@ EC_Placeable::EC_Placeable(Scene* scene) :
         connect(this, SIGNAL(ParentEntitySet()), SLOT(RegisterActions()));
     
         AttachNode();
+
+        world->Placeables()->Add(this);
     }
 }
 
@@ -221,6 +224,7 @@ EC_Placeable::~EC_Placeable()
     emit AboutToBeDestroyed();
     
     OgreWorldPtr world = world_.lock();
+    world->Placeables()->Remove(this);
     Ogre::SceneManager* sceneMgr = world->OgreSceneManager();
     
     if (sceneNode_)
@@ -670,6 +674,10 @@ void EC_Placeable::AttributesChanged()
     // If parent ref or parent bone changed, reattach node to scene hierarchy
     if (parentRef.ValueChanged() || parentBone.ValueChanged())
         AttachNode();
+
+    OgreWorldPtr world = world_.lock();
+    if (world && (transform.ValueChanged() || parentRef.ValueChanged() || parentBone.ValueChanged()))
+        world->Placeables()->MarkDirty(this);
     
     if (transform.ValueChanged())
     {
@@ -0,0 +1,175 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "MeshKdTreeBuilder.h"
+#include "OgreMeshAsset.h"
+
+#include "Profiler.h"
+
+#include <QFile>
+#include <QThread>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Identifies a kD-tree cache file. Bump the version whenever the layout of the file or of the kD-tree changes.
+const u32 cKdTreeCacheMagic = 0x54444B54; // "TKDT"
+const u32 cKdTreeCacheVersion = 1;
+
+void AppendBytes(std::vector<u8> &dst, const void *data, size_t numBytes)
+{
+    if (numBytes > 0)
+        dst.insert(dst.end(), (const u8*)data, (const u8*)data + numBytes);
+}
+
+void AppendU32(std::vector<u8> &dst, u32 value)
+{
+    AppendBytes(dst, &value, sizeof(value));
+}
+
+bool ReadBytes(const u8 *&pos, const u8 *end, void *dst, size_t numBytes)
+{
+    if ((size_t)(end - pos) < numBytes)
+        return false;
+    memcpy(dst, pos, numBytes);
+    pos += numBytes;
+    return true;
+}
+
+template<typename T>
+bool ReadArray(const u8 *&pos, const u8 *end, std::vector<T> &dst)
+{
+    u32 size = 0;
+    if (!ReadBytes(pos, end, &size, sizeof(size)) || (size_t)(end - pos) / sizeof(T) < size)
+        return false;
+    dst.resize(size);
+    return size == 0 || ReadBytes(pos, end, &dst[0], size * sizeof(T));
+}
+
+/// Serializes the results of the job to the cache file format.
+/** The file has a header with the magic number, the version and the content hash of the mesh, followed by the normals, the uvs and the kD-tree. */
+void SerializeCacheData(MeshKdTreeJob &job)
+{
+    std::vector<u8> &dst = job.cacheData;
+    dst.clear();
+    AppendU32(dst, cKdTreeCacheMagic);
+    AppendU32(dst, cKdTreeCacheVersion);
+    AppendU32(dst, (u32)job.meshHash.size());
+    AppendBytes(dst, job.meshHash.constData(), job.meshHash.size());
+    AppendU32(dst, (u32)job.normals.size());
+    if (!job.normals.empty())
+        AppendBytes(dst, &job.normals[0], job.normals.size() * sizeof(float3));
+    AppendU32(dst, (u32)job.uvs.size());
+    if (!job.uvs.empty())
+        AppendBytes(dst, &job.uvs[0], job.uvs.size() * sizeof(float2));
+    job.tree.SerializeTo(dst);
+}
+
+/// Reads the results of the job from the cache file data. Returns an error message on failure.
+QString ParseCacheData(MeshKdTreeJob &job, const u8 *pos, const u8 *end)
+{
+    u32 magic = 0, version = 0, hashSize = 0;
+    if (!ReadBytes(pos, end, &magic, sizeof(magic)) || !ReadBytes(pos, end, &version, sizeof(version)) || magic != cKdTreeCacheMagic || version != cKdTreeCacheVersion)
+        return "Unsupported kD-tree cache file \"" + job.cacheFile + "\"";
+
+    if (!ReadBytes(pos, end, &hashSize, sizeof(hashSize)) || hashSize != (u32)job.meshHash.size() || (size_t)(end - pos) < hashSize
+        || memcmp(pos, job.meshHash.constData(), hashSize) != 0)
+        return "kD-tree cache file \"" + job.cacheFile + "\" was built from different mesh content";
+    pos += hashSize;
+
+    if (!ReadArray(pos, end, job.normals) || !ReadArray(pos, end, job.uvs) || job.tree.DeserializeFrom(pos, end - pos) == 0
+        || job.normals.size() != (size_t)job.tree.NumObjects() || (!job.uvs.empty() && job.uvs.size() != 3 * (size_t)job.tree.NumObjects()))
+        return "kD-tree cache file \"" + job.cacheFile + "\" is corrupted";
+    return QString();
+}
+
+/// Reads the results of the job from its cache file.
+void ReadCacheFile(MeshKdTreeJob &job)
+{
+    QFile file(job.cacheFile);
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+    {
+        job.error = "Failed to open kD-tree cache file \"" + job.cacheFile + "\"";
+        return;
+    }
+    uchar *data = file.map(0, file.size());
+    if (!data)
+    {
+        job.error = "Failed to map kD-tree cache file \"" + job.cacheFile + "\"";
+        return;
+    }
+
+    job.error = ParseCacheData(job, data, data + file.size());
+    file.unmap(data);
+}
+
+/// Processes a job on a worker thread.
+void ProcessQueuedJob(MeshKdTreeJob &job)
+{
+    // Skip the job if its asset was deleted while the job was queued.
+    if (!job.asset.expired())
+        MeshKdTreeBuilder::Process(job);
+}
+
+}
+
+MeshKdTreeBuilder::MeshKdTreeBuilder() :
+    // Use at most half of the worker threads, the rest are left for texture decoding.
+    jobs(&ProcessQueuedJob, QThread::idealThreadCount() / 2)
+{
+}
+
+void MeshKdTreeBuilder::Start(const MeshKdTreeJobPtr &job)
+{
+    jobs.Start(job);
+}
+
+void MeshKdTreeBuilder::Process(MeshKdTreeJob &job)
+{
+    if (!job.cacheFile.isEmpty())
+    {
+        ReadCacheFile(job);
+        return;
+    }
+
+    if (!job.triangles.empty())
+        job.tree.AddObjects(&job.triangles[0], (int)job.triangles.size());
+    std::vector<Triangle>().swap(job.triangles);
+
+    job.normals.resize(job.tree.NumObjects());
+    for(int i = 0; i < job.tree.NumObjects(); ++i)
+    {
+        const Triangle &t = job.tree.Object(i);
+        float3 normal = (t.b - t.a).Cross(t.c - t.a);
+        normal.Normalize();
+        job.normals[i] = normal;
+    }
+
+    job.tree.Build();
+
+    if (job.serialize)
+        SerializeCacheData(job);
+}
+
+bool MeshKdTreeBuilder::CompleteFinishedJobs(tick_t deadline)
+{
+    MeshKdTreeJobPtr job;
+    while(GetCurrentClockTime() < deadline)
+    {
+        if (!jobs.TakeFinishedJob(job))
+            return true;
+
+        PROFILE(MeshKdTreeBuilder_CompleteJob);
+
+        // If the asset has been deleted, or the job has been replaced by another build, the asset drops the job.
+        OgreMeshAssetPtr mesh = dynamic_pointer_cast<OgreMeshAsset>(job->asset.lock());
+        if (mesh)
+            mesh->KdTreeBuildFinished(job);
+    }
+    // Out of time for this frame, the rest are completed on the next frame.
+    return false;
+}
@@ -0,0 +1,61 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "AssetFwd.h"
+#include "HighPerfClock.h"
+#include "Math/float2.h"
+#include "Math/float3.h"
+#include "Geometry/KdTree.h"
+#include "Geometry/Triangle.h"
+#include "WorkerJobQueue.h"
+
+#include <QString>
+#include <QByteArray>
+
+#include <vector>
+
+/// Describes the building of the raycast kD-tree of a mesh, which MeshKdTreeBuilder runs on a worker thread.
+/** The main thread fills in the source, and reads the results after the job has finished.
+    While the job is being processed, it is owned by the worker thread and must not be touched. */
+struct OGRE_MODULE_API MeshKdTreeJob
+{
+    MeshKdTreeJob() : serialize(false) {}
+
+    AssetWeakPtr asset; ///< The mesh asset the job is processed for. If the asset is deleted, the job is skipped.
+    QByteArray meshHash; ///< Content hash of the mesh file. Identifies the mesh the cache file was built from.
+    QString cacheFile; ///< If non-empty, the tree is read from this cache file instead of built. Fails if the file was built from other content than meshHash.
+    std::vector<Triangle> triangles; ///< The triangles to build the tree from, if not read from a cache file. Freed when the tree has been built.
+    bool serialize; ///< If true, the built tree is serialized to cacheData.
+
+    KdTree<Triangle> tree; ///< The built tree.
+    std::vector<float3> normals; ///< Triangle normals. One per triangle.
+    std::vector<float2> uvs; ///< Texture coordinates, three per triangle. Filled in by the main thread if the tree is built.
+    std::vector<u8> cacheData; ///< The built tree in the cache file format, to be stored to the asset cache.
+    QString error; ///< Set if the processing fails.
+};
+
+/// Builds the raycast kD-trees of meshes on worker threads.
+/** A tree built from a mesh in the asset cache is serialized and stored to the cache next to the mesh, so that later runs
+    read it instead of building it again. OgreRenderingModule hands the finished jobs to their mesh assets each frame.
+    Does not log from the worker threads, the errors are stored to the jobs and reported on the main thread. */
+class OGRE_MODULE_API MeshKdTreeBuilder
+{
+public:
+    MeshKdTreeBuilder();
+
+    /// Starts processing the job on a worker thread.
+    void Start(const MeshKdTreeJobPtr &job);
+
+    /// Processes the job on the calling thread.
+    /** Used by the worker threads, and by the synchronous kD-tree builds on the main thread. */
+    static void Process(MeshKdTreeJob &job);
+
+    /// Hands the finished jobs to their mesh assets. Returns false if the deadline was reached.
+    bool CompleteFinishedJobs(tick_t deadline);
+
+private:
+    WorkerJobQueue<MeshKdTreeJob> jobs; ///< Jobs being processed by the worker threads. Waits for them when destroyed.
+};
@@ -5,6 +5,8 @@
 #include "DebugOperatorNew.h"
 #include "OgreMeshAsset.h"
 #include "OgreRenderingModule.h"
+#include "MeshKdTreeBuilder.h"
+#include "Framework.h"
 #include "AssetAPI.h"
 #include "AssetCache.h"
 #include "Profiler.h"
@@ -174,41 +176,157 @@ struct KdTreeRayQueryFirstHitVisitor
     }
 };
 
+/// The packet version of KdTreeRayQueryFirstHitVisitor. Tests each triangle against all the active rays at once.
+struct KdTreeRayPacketFirstHitVisitor
+{
+    RayQueryResult results[4];
+    float linePos[12]; ///< The ray origins in the structure-of-arrays layout of Triangle::IntersectLineTri4.
+    float lineDir[12]; ///< The ray directions in the same layout.
+
+    explicit KdTreeRayPacketFirstHitVisitor(const Ray *rays)
+    {
+        for(int i = 0; i < 4; ++i)
+        {
+            results[i].entity = 0;
+            results[i].component = 0;
+            results[i].t = std::numeric_limits<float>::infinity();
+            results[i].triangleIndex = KdTree<Triangle>::BUCKET_SENTINEL;
+            results[i].submeshIndex = (u32)-1;
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                linePos[axis*4+i] = rays[i].pos[axis];
+                lineDir[axis*4+i] = rays[i].dir[axis];
+            }
+        }
+    }
+    bool operator()(KdTree<Triangle> &tree, const KdTreeNode &leaf, const Ray * /*rays*/, const float *tNear, const float *tFar, float *tHit, int activeMask)
+    {
+        u32 *bucket = tree.Bucket(leaf.bucketIndex);
+        assert(bucket);
+        while(*bucket != KdTree<Triangle>::BUCKET_SENTINEL)
+        {
+            const Triangle &tri = tree.Object(*bucket);
+            float u[4], v[4], t[4];
+            const int hits = Triangle::IntersectLineTri4(linePos, lineDir, tri.a, tri.b, tri.c, u, v, t) & activeMask;
+            if (hits != 0)
+                for(int i = 0; i < 4; ++i)
+                    if ((hits & (1 << i)) != 0 && t[i] >= tNear[i] && t[i] <= tFar[i] && t[i] < tHit[i])
+                    {
+                        // The hit positions are computed for the final hits only.
+                        tHit[i] = t[i];
+                        results[i].t = t[i];
+                        results[i].triangleIndex = *bucket;
+                        results[i].barycentricUV = float2(u[i], v[i]);
+                    }
+            ++bucket;
+        }
+        return false; // The traversal itself skips the nodes beyond the hits.
+    }
+};
+
 RayQueryResult OgreMeshAsset::Raycast(const Ray &ray)
 {
     if (!ogreMesh.get())
         return RayQueryResult();
     if (meshData.NumObjects() == 0)
+    {
+        if (kdTreeJob)
+            return RaycastBoundingBox(ray);
         CreateKdTree();
+    }
     KdTreeRayQueryFirstHitVisitor visitor;
     meshData.RayQuery(ray, visitor);
     if (visitor.result.triangleIndex != KdTree<Triangle>::BUCKET_SENTINEL)
+        FillTriangleHitInfo(visitor.result);
+    return visitor.result;
+}
+
+void OgreMeshAsset::RaycastPacket(const Ray *rays, RayQueryResult *results)
+{
+    if (!ogreMesh.get())
     {
-        visitor.result.normal = normals[visitor.result.triangleIndex];
-        float2 uv = (uvs.size() > visitor.result.triangleIndex*3+2) ?
-                       (1.f - visitor.result.barycentricUV.x - visitor.result.barycentricUV.y) * uvs[visitor.result.triangleIndex*3]
-                       + visitor.result.barycentricUV.x * uvs[visitor.result.triangleIndex*3+1]
-                       + visitor.result.barycentricUV.y * uvs[visitor.result.triangleIndex*3+2]
-                    : float2(-1, -1);
-        visitor.result.uv = uv;
-        int triangleIndex = visitor.result.triangleIndex;
-        for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+        for(int i = 0; i < 4; ++i)
+            results[i] = RayQueryResult();
+        return;
+    }
+    if (meshData.NumObjects() == 0)
+    {
+        if (kdTreeJob)
         {
-            if (triangleIndex < subMeshTriangleCounts[i])
-            {
-                visitor.result.submeshIndex = i;
-                break;
-            }
-            else
-                triangleIndex -= subMeshTriangleCounts[i];
+            for(int i = 0; i < 4; ++i)
+                results[i] = RaycastBoundingBox(rays[i]);
+            return;
+        }
+        CreateKdTree();
+    }
+    KdTreeRayPacketFirstHitVisitor visitor(rays);
+    meshData.RayQueryPacket(rays, visitor);
+    for(int i = 0; i < 4; ++i)
+    {
+        results[i] = visitor.results[i];
+        if (results[i].triangleIndex != KdTree<Triangle>::BUCKET_SENTINEL)
+        {
+            results[i].pos = rays[i].GetPoint(results[i].t);
+            FillTriangleHitInfo(results[i]);
         }
     }
-    return visitor.result;
+}
+
+void OgreMeshAsset::FillTriangleHitInfo(RayQueryResult &result) const
+{
+    result.normal = normals[result.triangleIndex];
+    float2 uv = (uvs.size() > result.triangleIndex*3+2) ?
+                   (1.f - result.barycentricUV.x - result.barycentricUV.y) * uvs[result.triangleIndex*3]
+                   + result.barycentricUV.x * uvs[result.triangleIndex*3+1]
+                   + result.barycentricUV.y * uvs[result.triangleIndex*3+2]
+                : float2(-1, -1);
+    result.uv = uv;
+    int triangleIndex = result.triangleIndex;
+    for(size_t i = 0; i < subMeshTriangleCounts.size(); ++i)
+    {
+        if (triangleIndex < subMeshTriangleCounts[i])
+        {
+            result.submeshIndex = i;
+            break;
+        }
+        else
+            triangleIndex -= subMeshTriangleCounts[i];
+    }
+}
+
+RayQueryResult OgreMeshAsset::RaycastBoundingBox(const Ray &ray) const
+{
+    RayQueryResult result;
+    result.entity = 0;
+    result.component = 0;
+    result.t = std::numeric_limits<float>::infinity();
+
+    AABB aabb(ogreMesh->getBounds());
+    float tNear, tFar;
+    if (!aabb.Intersects(ray, &tNear, &tFar) || tFar < 0.f)
+        return result;
+
+    result.t = std::max(tNear, 0.f);
+    result.pos = ray.GetPoint(result.t);
+    // The normal of the face that was hit is along the axis where the hit position is closest to the box.
+    float minDistance = std::numeric_limits<float>::infinity();
+    for(int i = 0; i < 3; ++i)
+    {
+        const float toMin = fabs(result.pos[i] - aabb.minPoint[i]);
+        const float toMax = fabs(result.pos[i] - aabb.maxPoint[i]);
+        if (std::min(toMin, toMax) < minDistance)
+        {
+            minDistance = std::min(toMin, toMax);
+            result.normal = float3::zero;
+            result.normal[i] = (toMin < toMax) ? -1.f : 1.f;
+        }
+    }
+    return result;
 }
 
 Triangle OgreMeshAsset::Tri(int submeshIndex, int triangleIndex)
 {
-    if (subMeshTriangleCounts.size() == 0)
+    if (meshData.NumObjects() == 0)
         CreateKdTree();
 
     if (triangleIndex < 0 || NumTris(submeshIndex) < triangleIndex)
@@ -244,10 +362,99 @@ int OgreMeshAsset::NumTris(int submeshIndex)
 
 void OgreMeshAsset::CreateKdTree()
 {
-    meshData.Clear();
+    // Build synchronously, superseding any build started on a worker thread.
+    kdTreeJob.reset();
+    MeshKdTreeJob job;
+    ExtractTriangles(job.triangles, job.uvs);
+    {
+        PROFILE(OgreMeshAsset_KdTree_Build);
+        MeshKdTreeBuilder::Process(job);
+    }
+    meshData.Swap(job.tree);
+    normals.swap(job.normals);
+    uvs.swap(job.uvs);
+}
+
+void OgreMeshAsset::StartKdTreeBuild(bool readFromCache)
+{
+    kdTreeJob.reset();
+    KdTree<Triangle> emptyTree;
+    meshData.Swap(emptyTree);
     normals.clear();
     uvs.clear();
     subMeshTriangleCounts.clear();
+
+    OgreRenderer::OgreRenderingModule *module = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>();
+    MeshKdTreeBuilder *builder = module ? module->GetMeshKdTreeBuilder() : 0;
+    if (!builder || assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load"))
+        return;
+
+    MeshKdTreeJobPtr job(new MeshKdTreeJob);
+    job->asset = shared_from_this();
+    // The tree can be cached only if the mesh is in the asset cache, as the tree is tied to the content hash of the mesh file.
+    AssetCache *cache = assetAPI->GetAssetCache();
+    if (cache)
+        job->meshHash = cache->ContentHash(Name());
+    if (readFromCache && !job->meshHash.isEmpty())
+        job->cacheFile = cache->FindInCache(KdTreeCacheRef());
+
+    if (job->cacheFile.isEmpty())
+    {
+        ExtractTriangles(job->triangles, job->uvs);
+        job->serialize = !job->meshHash.isEmpty();
+    }
+    else
+    {
+        // The triangle counts are needed right away, and are cheap to compute without reading the buffers.
+        for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
+        {
+            Ogre::SubMesh *submesh = ogreMesh->getSubMesh(i);
+            Ogre::VertexData *vertexData = submesh->useSharedVertices ? ogreMesh->sharedVertexData : submesh->vertexData;
+            const bool hasPositions = vertexData && vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
+            subMeshTriangleCounts.push_back(hasPositions ? (int)(submesh->indexData->indexCount / 3) : 0);
+        }
+    }
+
+    kdTreeJob = job;
+    builder->Start(job);
+}
+
+void OgreMeshAsset::KdTreeBuildFinished(const MeshKdTreeJobPtr &job)
+{
+    if (job != kdTreeJob)
+        return; // Unloaded, reloaded or built synchronously while the job was being processed.
+    kdTreeJob.reset();
+
+    if (!job->error.isEmpty())
+    {
+        // The cached tree is missing, outdated or corrupted. Build it again.
+        LogDebug("OgreMeshAsset::KdTreeBuildFinished: " + job->error + ", rebuilding the kD-tree for " + Name());
+        StartKdTreeBuild(false);
+        return;
+    }
+
+    meshData.Swap(job->tree);
+    normals.swap(job->normals);
+    uvs.swap(job->uvs);
+
+    if (!job->cacheData.empty() && assetAPI->GetAssetCache())
+    {
+        PROFILE(OgreMeshAsset_KdTree_CacheStore);
+        assetAPI->GetAssetCache()->StoreAsset(&job->cacheData[0], job->cacheData.size(), KdTreeCacheRef());
+    }
+}
+
+QString OgreMeshAsset::KdTreeCacheRef() const
+{
+    return Name() + ".kdtree";
+}
+
+void OgreMeshAsset::ExtractTriangles(std::vector<Triangle> &triangles, std::vector<float2> &texCoords)
+{
+    PROFILE(OgreMeshAsset_ExtractTriangles);
+    triangles.clear();
+    texCoords.clear();
+    subMeshTriangleCounts.clear();
     for(unsigned short i = 0; i < ogreMesh->getNumSubMeshes(); ++i)
     {
         Ogre::SubMesh *submesh = ogreMesh->getSubMesh(i);
@@ -314,21 +521,14 @@ void OgreMeshAsset::CreateKdTree()
             float3 v0 = *(float3*)(pos + posOffset + i0 * posSize);
             float3 v1 = *(float3*)(pos + posOffset + i1 * posSize);
             float3 v2 = *(float3*)(pos + posOffset + i2 * posSize);
-            Triangle t(v0, v1, v2);
-            meshData.AddObjects(&t, 1);
+            triangles.push_back(Triangle(v0, v1, v2));
 
             if (texElem)
             {
-                uvs.push_back(*((float2*)(texCoord + texOffset + i0 * texSize)));
-                uvs.push_back(*((float2*)(texCoord + texOffset + i1 * texSize)));
-                uvs.push_back(*((float2*)(texCoord + texOffset + i2 * texSize)));
+                texCoords.push_back(*((float2*)(texCoord + texOffset + i0 * texSize)));
+                texCoords.push_back(*((float2*)(texCoord + texOffset + i1 * texSize)));
+                texCoords.push_back(*((float2*)(texCoord + texOffset + i2 * texSize)));
             }
-
-            float3 edge1 = v1 - v0;
-            float3 edge2 = v2 - v0;
-            float3 normal = edge1.Cross(edge2);
-            normal.Normalize();
-            normals.push_back(normal);
         }
         subMeshTriangleCounts.push_back(indexData->indexCount / 3);
         
@@ -337,11 +537,6 @@ void OgreMeshAsset::CreateKdTree()
             vbufTex->unlock();
         ibuf->unlock();
     }
-
-    {
-        PROFILE(OgreMeshAsset_KdTree_Build);
-        meshData.Build();
-    }
 }
 
 bool OgreMeshAsset::GenerateMeshData()
@@ -401,6 +596,9 @@ bool OgreMeshAsset::GenerateMeshData()
     //internal_name_ = AssetAPI::SanitateAssetRef(id_);
     //LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
 
+    // Build the raycast kD-tree ahead of time, so that the first raycast to this mesh does not stall.
+    StartKdTreeBuild(true);
+
     return true;
 }
 
@@ -448,6 +646,9 @@ void OgreMeshAsset::DoUnload()
         Ogre::ResourceBackgroundQueue::getSingleton().abortRequest(loadTicket_);
         loadTicket_ = 0;
     }
+
+    // Drop any ongoing kD-tree build. The worker thread may still finish the job, but it is not taken into use.
+    kdTreeJob.reset();
     
     if (ogreMesh.isNull())
         return;
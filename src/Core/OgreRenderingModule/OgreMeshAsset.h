@@ -5,6 +5,7 @@
 #include "Math/MathNamespace.h"
 #include "IAsset.h"
 #include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
 
 #include <OgreMesh.h>
 #include <OgreResourceBackgroundQueue.h>
@@ -16,6 +17,7 @@
 class OpenAssetImport;
 
 /// Represents an Ogre .mesh loaded to the GPU.
+/** The kD-tree for raycasting is built on a worker thread of MeshKdTreeBuilder after the mesh has loaded, unless --no_async_asset_load is given. */
 class OGRE_MODULE_API OgreMeshAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
@@ -55,15 +57,29 @@ public:
     /// Ticket for ogres threaded loading operation.
     Ogre::BackgroundProcessTicket loadTicket_;
 
+    /// Takes the kD-tree of a finished build job into use. Called by MeshKdTreeBuilder on the main thread.
+    /** The job is dropped if it is not the latest one started for this asset. */
+    void KdTreeBuildFinished(const MeshKdTreeJobPtr &job);
+
+    /// Returns the nearest triangle hits of a packet of four rays in the mesh local space.
+    /** The rays are traced together through the kD-tree, which is faster than four Raycast() calls when the rays are coherent,
+        e.g. picking rays through neighbouring pixels. Otherwise behaves like Raycast().
+        @param rays An array of four rays.
+        @param results [out] An array of four results, which receives the hit of each ray. */
+    void RaycastPacket(const Ray *rays, RayQueryResult *results);
+
     /// Specifies the unique mesh name Ogre uses in its asset pool for this mesh.
     //QString ogreAssetName;
 
     //std::vector<QString> originalMaterials;
 
 public slots:
+    /// Returns the nearest triangle hit by the given ray in the mesh local space.
+    /** While the kD-tree is being built on a worker thread, returns the hit to the bounding box of the mesh, without the triangle information. */
     RayQueryResult Raycast(const Ray &ray);
 
     /// Returns the given triangle of the mesh data.
+    /** If the kD-tree is being built on a worker thread, it is built synchronously instead. */
     Triangle Tri(int submeshIndex, int triangleIndex);
 
     int NumSubmeshes();
@@ -79,6 +95,23 @@ private:
     /// Precomputes a kD-tree for the triangle data of this mesh.
     void CreateKdTree();
 
+    /// Starts building the kD-tree on a worker thread, or reading it from the asset cache if readFromCache is true.
+    /** If the kD-tree builder is not available, the tree is built on the first query instead. */
+    void StartKdTreeBuild(bool readFromCache);
+
+    /// Reads the triangles and their texture coordinates from the Ogre mesh, and counts the triangles of each submesh.
+    /** Locks the hardware buffers, so this must be called on the main thread. */
+    void ExtractTriangles(std::vector<Triangle> &triangles, std::vector<float2> &texCoords);
+
+    /// Fills in the normal, the texture coordinate and the submesh index of a result that hit the triangle result.triangleIndex.
+    void FillTriangleHitInfo(RayQueryResult &result) const;
+
+    /// Returns the hit of the ray to the bounding box of the mesh.
+    RayQueryResult RaycastBoundingBox(const Ray &ray) const;
+
+    /// Returns the asset cache ref under which the kD-tree of this mesh is stored.
+    QString KdTreeCacheRef() const;
+
     /// Process mesh data after loading to create tangents and such.
     bool GenerateMeshData();
 
@@ -93,6 +126,9 @@ private:
     std::vector<float2> uvs; 
     std::vector<int> subMeshTriangleCounts;
 
+    /// The latest kD-tree build started for this asset. Reset when the build finishes or the asset is unloaded.
+    MeshKdTreeJobPtr kdTreeJob;
+
 #ifdef ASSIMP_ENABLED
     OpenAssetImport *importer;
 #endif
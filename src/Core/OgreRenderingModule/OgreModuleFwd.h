@@ -46,6 +46,7 @@ namespace OgreRenderer
 class OgreCompositionHandler;
 class GaussianListener;
 class OgreWorld;
+class PlaceableGrid;
 class UiPlane;
 class RenderWindow;
 
@@ -61,6 +62,13 @@ typedef shared_ptr<OgreMaterialAsset> OgreMaterialAssetPtr;
 typedef shared_ptr<OgreSkeletonAsset> OgreSkeletonAssetPtr;
 typedef shared_ptr<OgreParticleAsset> OgreParticleAssetPtr;
 
+class TextureDecoder;
+struct TextureDecodeJob;
+typedef shared_ptr<TextureDecodeJob> TextureDecodeJobPtr;
+class MeshKdTreeBuilder;
+struct MeshKdTreeJob;
+typedef shared_ptr<MeshKdTreeJob> MeshKdTreeJobPtr;
+
 class EC_AnimationController;
 class EC_Camera;
 class EC_Light;
@@ -25,6 +25,8 @@
 #include "OgreSkeletonAsset.h"
 #include "OgreMaterialAsset.h"
 #include "TextureAsset.h"
+#include "TextureDecoder.h"
+#include "MeshKdTreeBuilder.h"
 
 #include "Application.h"
 #include "Entity.h"
@@ -202,6 +204,12 @@ void OgreRenderingModule::Initialize()
     // Register renderer.
     framework_->RegisterRenderer(renderer.get());
     framework_->RegisterDynamicObject("renderer", renderer.get());
+
+    if (!framework_->IsHeadless())
+    {
+        textureDecoder = MAKE_SHARED(TextureDecoder);
+        meshKdTreeBuilder = MAKE_SHARED(MeshKdTreeBuilder);
+    }
     
     // Connect to scene change signals.
     connect(framework_->Scene(), SIGNAL(SceneAdded(const QString&)), this, SLOT(OnSceneAdded(const QString&)));
@@ -231,10 +239,28 @@ void OgreRenderingModule::Uninitialize()
     // no refs to Ogre assets remain - below 'renderer.reset()' is going to delete Ogre::Root.
     framework_->Asset()->ForgetAllAssets();
 
+    // Wait for the worker threads, as the texture decoder uses Ogre's image codecs.
+    textureDecoder.reset();
+    meshKdTreeBuilder.reset();
+
     // Clear up the renderer object, so that it will not be left dangling.
     framework_->RegisterRenderer(0);
 }
 
+void OgreRenderingModule::Update(f64 /*frametime*/)
+{
+    if (!textureDecoder)
+        return;
+
+    PROFILE(OgreRenderingModule_Update);
+    // Throttle the texture uploads and the kD-tree completions to at most 8 msecs/frame. The decoding and building is done
+    // by the worker threads, so the time goes to creating the Ogre textures, uploading them to the GPU and storing the kD-trees to the cache.
+    const int maxUploadMSecs = 8;
+    const tick_t deadline = GetCurrentClockTime() + GetCurrentClockFreq() * maxUploadMSecs / 1000;
+    if (textureDecoder->CompleteFinishedJobs(deadline))
+        meshKdTreeBuilder->CompleteFinishedJobs(deadline);
+}
+
 void OgreRenderingModule::ConsoleStats()
 {
     if (framework_->IsHeadless())
@@ -27,10 +27,17 @@ namespace OgreRenderer
         virtual void Load();
         virtual void Initialize();
         virtual void Uninitialize();
+        virtual void Update(f64 frametime);
 
         /// Returns the renderer.
         const RendererPtr &GetRenderer() const { return renderer; }
 
+        /// Returns the decoder that processes textures on worker threads, or null if not available (headless mode).
+        TextureDecoder *GetTextureDecoder() const { return textureDecoder.get(); }
+
+        /// Returns the builder that builds the raycast kD-trees of meshes on worker threads, or null if not available (headless mode).
+        MeshKdTreeBuilder *GetMeshKdTreeBuilder() const { return meshKdTreeBuilder.get(); }
+
         /// Ogre resource group for cached asset files.
         static std::string CACHE_RESOURCE_GROUP;
 
@@ -54,5 +61,7 @@ namespace OgreRenderer
 
     private:
         RendererPtr renderer;  ///< Renderer
+        shared_ptr<TextureDecoder> textureDecoder; ///< Texture decoder
+        shared_ptr<MeshKdTreeBuilder> meshKdTreeBuilder; ///< Mesh kD-tree builder
     };
 }
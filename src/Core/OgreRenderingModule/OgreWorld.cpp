@@ -6,6 +6,7 @@
 #define MATH_OGRE_INTEROP
 
 #include "OgreWorld.h"
+#include "PlaceableGrid.h"
 #include "Renderer.h"
 #include "EC_Camera.h"
 #include "EC_Placeable.h"
@@ -20,6 +21,7 @@
 #include "Profiler.h"
 #include "ConfigAPI.h"
 #include "FrameAPI.h"
+#include "AssetAPI.h"
 #include "Transform.h"
 #include "Math/float2.h"
 #include "Math/float3x4.h"
@@ -47,7 +49,10 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     sceneManager_(0),
     rayQuery_(0),
     debugLines_(0),
-    debugLinesNoDepth_(0)
+    debugLinesNoDepth_(0),
+    placeableGrid_(new PlaceableGrid()),
+    assetPriorityCameraPos_(float3::zero),
+    hasAssetPriorityCamera_(false)
 {
     assert(renderer_->IsInitialized());
     sceneManager_ = Ogre::Root::getSingleton().createSceneManager(Ogre::ST_GENERIC, scene->Name().toStdString());
@@ -98,6 +103,7 @@ OgreWorld::~OgreWorld()
         sceneManager_->getRootSceneNode()->detachObject(debugLinesNoDepth_);
         SAFE_DELETE(debugLinesNoDepth_);
     }
+    SAFE_DELETE(placeableGrid_);
     
     // Remove all compositors.
     /// \todo This does not work with a proper multiscene approach
@@ -484,6 +490,9 @@ void OgreWorld::StopViewTracking(Entity* entity)
 void OgreWorld::OnUpdated(float timeStep)
 {
     PROFILE(OgreWorld_OnUpdated);
+    placeableGrid_->MarkParentedDirty();
+    UpdateAssetPriorities();
+
     // Do nothing if visibility not being tracked for any entities
     if (visibilityTrackedEntities_.empty())
     {
@@ -529,6 +538,34 @@ void OgreWorld::OnUpdated(float timeStep)
     }
 }
 
+float OgreWorld::AssetPriority(Entity* entity) const
+{
+    EC_Placeable *placeable = (entity && hasAssetPriorityCamera_) ? entity->GetComponent<EC_Placeable>().get() : 0;
+    if (!placeable)
+        return 0.f;
+    return -placeable->WorldPosition().Distance(assetPriorityCameraPos_);
+}
+
+void OgreWorld::UpdateAssetPriorities()
+{
+    // Recomputing the priorities on every small camera move would only reorder the queues needlessly.
+    const float cUpdateDistance = 5.f;
+
+    EC_Camera* activeCamera = VerifyCurrentSceneCameraComponent();
+    EC_Placeable *placeable = activeCamera ? activeCamera->ParentEntity()->GetComponent<EC_Placeable>().get() : 0;
+    if (!placeable)
+        return;
+
+    const float3 cameraPos = placeable->WorldPosition();
+    if (hasAssetPriorityCamera_ && cameraPos.DistanceSq(assetPriorityCameraPos_) < cUpdateDistance * cUpdateDistance)
+        return;
+    assetPriorityCameraPos_ = cameraPos;
+    hasAssetPriorityCamera_ = true;
+
+    if (framework_->Asset()->NumCurrentTransfers() > 0)
+        emit AssetPrioritiesChanged();
+}
+
 void OgreWorld::SetupShadows()
 {
     OgreRenderer::Renderer::ShadowQualitySetting shadowQuality = renderer_->ShadowQuality();
@@ -7,6 +7,7 @@
 #include "OgreModuleFwd.h"
 #include "SceneFwd.h"
 #include "Math/MathFwd.h"
+#include "Math/float3.h"
 #include "IRenderer.h"
 #include "Color.h"
 
@@ -89,6 +90,11 @@ public slots:
     
     /// Stop tracking an entity's visibility
     void StopViewTracking(Entity* entity);
+
+    /// Returns the download priority for the assets of an entity, based on its distance to the active camera.
+    /** The closer the entity, the higher the priority. Entities without a placeable, and all entities while there is no active camera,
+        get the default priority 0, which is higher than the priority of any placed entity. @see AssetRefListener::SetPriority */
+    float AssetPriority(Entity* entity) const;
     
     /// Returns the Renderer instance
     OgreRenderer::Renderer* Renderer() const { return renderer_; }
@@ -99,6 +105,9 @@ public slots:
     /// Returns the parent scene
     ScenePtr Scene() const { return scene_.lock(); }
 
+    /// Returns the grid of the placeable positions of the scene, used for proximity queries.
+    PlaceableGrid *Placeables() const { return placeableGrid_; }
+
     /// Renders an axis-aligned bounding box.
     void DebugDrawAABB(const AABB &aabb, float r, float g, float b, bool depthTest = true);
     void DebugDrawAABB(const AABB &aabb, const Color &clr, bool depthTest = true) { DebugDrawAABB(aabb, clr.r, clr.g, clr.b, depthTest); } /**< @overload @param clr Color, alpha is ignored. */
@@ -151,6 +160,10 @@ signals:
     /// An entity has left the view
     void EntityLeaveView(Entity* entity);
 
+    /// The active camera has moved enough to change the asset priorities, and there are asset transfers in progress.
+    /** Components that request assets should update the priorities of their pending requests using AssetPriority. */
+    void AssetPrioritiesChanged();
+
 private slots:
     /// Handle frame update. Used for entity visibility tracking
     void OnUpdated(float timeStep);
@@ -161,6 +174,9 @@ private:
 
     /// Setup shadows
     void SetupShadows();
+
+    /// Updates the camera position used for the asset priorities, and emits AssetPrioritiesChanged if it moved enough.
+    void UpdateAssetPriorities();
     
     /// Returns the currently active camera component, if it belongs to this scene. Else return null
     EC_Camera* VerifyCurrentSceneCameraComponent() const;
@@ -202,4 +218,13 @@ private:
     DebugLines* debugLines_;
     /// Debug geometry object, no depth testing
     DebugLines* debugLinesNoDepth_;
+
+    /// Grid of the placeable positions
+    PlaceableGrid* placeableGrid_;
+
+    /// Active camera position the asset priorities were last computed for
+    float3 assetPriorityCameraPos_;
+
+    /// Whether assetPriorityCameraPos_ has been set
+    bool hasAssetPriorityCamera_;
 };
@@ -0,0 +1,205 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "PlaceableGrid.h"
+#include "EC_Placeable.h"
+#include "Profiler.h"
+
+#include "Math/MathFunc.h"
+#include "Geometry/AABB.h"
+
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+struct SphereContains
+{
+    SphereContains(const float3 &center, float radius) : center_(center), radiusSq_(radius * radius) {}
+    bool operator()(const float3 &pos) const { return pos.DistanceSq(center_) <= radiusSq_; }
+
+    float3 center_;
+    float radiusSq_;
+};
+
+struct AABBContains
+{
+    explicit AABBContains(const AABB &aabb) : aabb_(aabb) {}
+    bool operator()(const float3 &pos) const { return aabb_.Contains(pos); }
+
+    AABB aabb_;
+};
+
+}
+
+PlaceableGrid::PlaceableGrid(float cellSize) :
+    cellSize_(cellSize > 0.f ? cellSize : 1.f),
+    invCellSize_(1.f / cellSize_)
+{
+}
+
+void PlaceableGrid::Add(EC_Placeable *placeable)
+{
+    if (!placeable || items_.contains(placeable))
+        return;
+    items_.insert(placeable, Item());
+    dirty_.insert(placeable);
+}
+
+void PlaceableGrid::Remove(EC_Placeable *placeable)
+{
+    ItemMap::iterator iter = items_.find(placeable);
+    if (iter == items_.end())
+        return;
+    RemoveFromCell(placeable, *iter);
+    items_.erase(iter);
+    dirty_.remove(placeable);
+    parented_.remove(placeable);
+}
+
+void PlaceableGrid::MarkDirty(EC_Placeable *placeable)
+{
+    if (items_.contains(placeable))
+        dirty_.insert(placeable);
+}
+
+void PlaceableGrid::MarkParentedDirty()
+{
+    dirty_.unite(parented_);
+}
+
+void PlaceableGrid::QuerySphere(const float3 &center, float radius, std::vector<EC_Placeable*> &result)
+{
+    if (!center.IsFinite() || radius < 0.f)
+        return;
+    Refresh();
+    const float3 extent(radius, radius, radius);
+    Query(center - extent, center + extent, SphereContains(center, radius), result);
+}
+
+void PlaceableGrid::QueryAABB(const AABB &aabb, std::vector<EC_Placeable*> &result)
+{
+    if (!aabb.IsFinite())
+        return;
+    Refresh();
+    Query(aabb.minPoint, aabb.maxPoint, AABBContains(aabb), result);
+}
+
+template<typename Func>
+void PlaceableGrid::Query(const float3 &minPoint, const float3 &maxPoint, const Func &contains, std::vector<EC_Placeable*> &result)
+{
+    const int minX = CellCoord(minPoint.x), maxX = CellCoord(maxPoint.x);
+    const int minY = CellCoord(minPoint.y), maxY = CellCoord(maxPoint.y);
+    const int minZ = CellCoord(minPoint.z), maxZ = CellCoord(maxPoint.z);
+
+    // With a huge range compared to the cell size, walking the occupied cells is cheaper than walking the range.
+    if ((quint64)(maxX - minX + 1) * (maxY - minY + 1) * (maxZ - minZ + 1) > (quint64)cells_.size())
+    {
+        for(CellMap::const_iterator iter = cells_.begin(); iter != cells_.end(); ++iter)
+            for(Cell::const_iterator item = iter->begin(); item != iter->end(); ++item)
+                if (contains(item->pos))
+                    result.push_back(item->placeable);
+        return;
+    }
+
+    for(int x = minX; x <= maxX; ++x)
+        for(int y = minY; y <= maxY; ++y)
+            for(int z = minZ; z <= maxZ; ++z)
+            {
+                CellMap::const_iterator iter = cells_.find(CellKey(x, y, z));
+                if (iter == cells_.end())
+                    continue;
+                for(Cell::const_iterator item = iter->begin(); item != iter->end(); ++item)
+                    if (contains(item->pos))
+                        result.push_back(item->placeable);
+            }
+}
+
+void PlaceableGrid::Refresh()
+{
+    if (dirty_.isEmpty())
+        return;
+
+    PROFILE(PlaceableGrid_Refresh);
+    for(QSet<EC_Placeable*>::const_iterator iter = dirty_.begin(); iter != dirty_.end(); ++iter)
+    {
+        ItemMap::iterator item = items_.find(*iter);
+        if (item != items_.end())
+            UpdateItem(*iter, *item);
+    }
+    dirty_.clear();
+}
+
+void PlaceableGrid::UpdateItem(EC_Placeable *placeable, Item &item)
+{
+    if (placeable->parentRef.Get().IsEmpty())
+        parented_.remove(placeable);
+    else
+        parented_.insert(placeable);
+
+    const float3 pos = placeable->WorldPosition();
+    if (!pos.IsFinite())
+    {
+        RemoveFromCell(placeable, item);
+        return;
+    }
+
+    const quint64 cell = CellKey(CellCoord(pos.x), CellCoord(pos.y), CellCoord(pos.z));
+    if (item.inCell && item.cell == cell)
+    {
+        // Stays in the same cell, only update the position.
+        Cell &items = *cells_.find(cell);
+        for(Cell::iterator iter = items.begin(); iter != items.end(); ++iter)
+            if (iter->placeable == placeable)
+            {
+                iter->pos = pos;
+                return;
+            }
+    }
+
+    RemoveFromCell(placeable, item);
+    CellItem cellItem;
+    cellItem.placeable = placeable;
+    cellItem.pos = pos;
+    cells_[cell].push_back(cellItem);
+    item.inCell = true;
+    item.cell = cell;
+}
+
+void PlaceableGrid::RemoveFromCell(EC_Placeable *placeable, Item &item)
+{
+    if (!item.inCell)
+        return;
+    item.inCell = false;
+
+    CellMap::iterator cellIter = cells_.find(item.cell);
+    if (cellIter == cells_.end())
+        return;
+    Cell &items = *cellIter;
+    for(size_t i = 0; i < items.size(); ++i)
+        if (items[i].placeable == placeable)
+        {
+            items[i] = items.back();
+            items.pop_back();
+            break;
+        }
+    if (items.empty())
+        cells_.erase(cellIter);
+}
+
+int PlaceableGrid::CellCoord(float x) const
+{
+    // Keep the coordinates inside the 21 bits CellKey packs per axis.
+    const float maxCoord = (float)((1 << 20) - 1);
+    return (int)Clamp(floorf(x * invCellSize_), -maxCoord, maxCoord);
+}
+
+quint64 PlaceableGrid::CellKey(int x, int y, int z)
+{
+    const quint64 mask = (1 << 21) - 1;
+    return (((quint64)(x + (1 << 20)) & mask) << 42) | (((quint64)(y + (1 << 20)) & mask) << 21) | ((quint64)(z + (1 << 20)) & mask);
+}
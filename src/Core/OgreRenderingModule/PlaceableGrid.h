@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "Math/float3.h"
+#include "Math/MathFwd.h"
+
+#include <QHash>
+#include <QSet>
+
+#include <vector>
+
+class EC_Placeable;
+
+/// Uniform grid broad-phase over the world positions of the EC_Placeable components of a scene.
+/** Finding the placeables near a point visits only the grid cells the query range overlaps, instead of walking all the entities
+    of the scene. OgreWorld owns the grid of its scene, and the placeables register themselves to it and mark themselves dirty
+    when their transform changes. The dirty placeables are moved to their new cells on the next query, so the cost of the
+    updates is paid only by the scenes that are queried. The world position of a placeable is used, so the parented placeables
+    are read again once per frame. Used by the proximity and volume triggers. */
+class OGRE_MODULE_API PlaceableGrid
+{
+public:
+    explicit PlaceableGrid(float cellSize = 10.f);
+
+    /// Adds a placeable to the grid. Its position is read on the next query.
+    void Add(EC_Placeable *placeable);
+
+    /// Removes a placeable from the grid.
+    void Remove(EC_Placeable *placeable);
+
+    /// Marks the position of a placeable changed, so that it is read again on the next query.
+    void MarkDirty(EC_Placeable *placeable);
+
+    /// Marks the positions of the parented placeables changed.
+    /** Called by OgreWorld each frame, as the parented placeables move along with their parents without a change of their own. */
+    void MarkParentedDirty();
+
+    /// Appends the placeables whose world position is inside a sphere to result.
+    void QuerySphere(const float3 &center, float radius, std::vector<EC_Placeable*> &result);
+
+    /// Appends the placeables whose world position is inside an axis-aligned box to result.
+    void QueryAABB(const AABB &aabb, std::vector<EC_Placeable*> &result);
+
+    /// Returns the number of placeables in the grid.
+    int Size() const { return items_.size(); }
+
+    /// Returns the edge length of a grid cell.
+    float CellSize() const { return cellSize_; }
+
+private:
+    struct CellItem
+    {
+        EC_Placeable *placeable;
+        float3 pos;
+    };
+    typedef std::vector<CellItem> Cell;
+    typedef QHash<quint64, Cell> CellMap;
+
+    /// The cell of each placeable in the grid. Placeables with a non-finite position are not in any cell.
+    struct Item
+    {
+        Item() : inCell(false), cell(0) {}
+        bool inCell;
+        quint64 cell;
+    };
+    typedef QHash<EC_Placeable*, Item> ItemMap;
+
+    /// Moves the dirty placeables to their current cells.
+    void Refresh();
+
+    /// Reads the world position of a placeable and moves it to the cell of that position.
+    void UpdateItem(EC_Placeable *placeable, Item &item);
+
+    /// Removes a placeable from its current cell.
+    void RemoveFromCell(EC_Placeable *placeable, Item &item);
+
+    /// Appends the placeables of the cells in the given cell range that pass the given test to result.
+    template<typename Func>
+    void Query(const float3 &minPoint, const float3 &maxPoint, const Func &contains, std::vector<EC_Placeable*> &result);
+
+    /// Returns the cell coordinate of a world coordinate.
+    int CellCoord(float x) const;
+    /// Returns the hash key of a cell.
+    static quint64 CellKey(int x, int y, int z);
+
+    CellMap cells_;
+    ItemMap items_;
+    QSet<EC_Placeable*> dirty_; ///< Placeables whose transform has changed since the last query.
+    QSet<EC_Placeable*> parented_; ///< Placeables that have a parent, and may move without a change of their own transform.
+    float cellSize_;
+    float invCellSize_;
+};
@@ -4,8 +4,10 @@
 #include "DebugOperatorNew.h"
 
 #include "TextureAsset.h"
+#include "TextureDecoder.h"
 #include "OgreRenderingModule.h"
 
+#include "Framework.h"
 #include "Profiler.h"
 #include "AssetCache.h"
 #include "LoggingFunctions.h"
@@ -40,7 +42,7 @@
 #include "MemoryLeakCheck.h"
 
 TextureAsset::TextureAsset(AssetAPI *owner, const QString &type_, const QString &name_) :
-    IAsset(owner, type_, name_), loadTicket_(0)
+    IAsset(owner, type_, name_)
 {
     ogreAssetName = AssetAPI::SanitateAssetRef(NameInternal());
 }
@@ -52,21 +54,64 @@ TextureAsset::~TextureAsset()
 
 bool TextureAsset::LoadFromFile(QString filename)
 {
-    bool allowAsynchronous = true;
-    if (assetAPI->GetFramework()->IsHeadless() || assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load") || !assetAPI->GetAssetCache() || (OGRE_THREAD_SUPPORT == 0))
-        allowAsynchronous = false;
-    QString cacheDiskSource;
-    if (allowAsynchronous)
+    TextureDecoder *decoder = AsynchronousDecoder();
+    if (!decoder || assetAPI->GetFramework()->HasCommandLineParameter("--notextures"))
+        return IAsset::LoadFromFile(filename);
+
+    // Read and decode the file on a worker thread.
+    TextureDecodeJobPtr job = CreateDecodeJob();
+    job->filename = CachedDdsFile();
+    if (job->filename.isEmpty())
     {
-        cacheDiskSource = assetAPI->GetAssetCache()->FindInCache(Name());
-        if (cacheDiskSource.isEmpty())
-            allowAsynchronous = false;
+        job->filename = filename.trimmed();
+        job->crn = (NameSuffix() == "crn");
     }
-    
-    if (allowAsynchronous)
-        return DeserializeFromData(0, 0, true);
-    else
-        return IAsset::LoadFromFile(filename);
+    decodeJob = job;
+    decoder->Start(job);
+    return true;
+}
+
+TextureDecoder *TextureAsset::AsynchronousDecoder() const
+{
+    Framework *framework = assetAPI->GetFramework();
+    if (framework->IsHeadless() || framework->HasCommandLineParameter("--no_async_asset_load"))
+        return 0;
+    OgreRenderer::OgreRenderingModule *module = framework->GetModule<OgreRenderer::OgreRenderingModule>();
+    return module ? module->GetTextureDecoder() : 0;
+}
+
+TextureDecodeJobPtr TextureAsset::CreateDecodeJob()
+{
+    TextureDecodeJobPtr job(new TextureDecodeJob);
+    job->asset = shared_from_this();
+
+    QStringList sizeParam = assetAPI->GetFramework()->CommandLineParameters("--maxtexturesize");
+    if (sizeParam.size() > 0)
+    {
+        int size = sizeParam.first().toInt();
+        if (size > 0)
+            job->maxTextureSize = size;
+    }
+
+    Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+    const Ogre::RenderSystemCapabilities *caps = renderSystem ? renderSystem->getCapabilities() : 0;
+    if (assetAPI->GetFramework()->HasCommandLineParameter("--autodxtcompress"))
+        job->compress = caps && caps->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_DXT);
+
+    // Generate the mipmaps on the CPU if the GPU cannot do it, which is always the case for compressed textures.
+    // If we are submitting a .dds file which did not contain mip maps, don't generate them. See UploadImage().
+    if (!NameInternal().endsWith(".dds", Qt::CaseInsensitive))
+        job->generateMipmaps = job->compress || !caps || !caps->hasCapability(Ogre::RSC_AUTOMIPMAP);
+    return job;
+}
+
+QString TextureAsset::CachedDdsFile() const
+{
+    // The DDS data transcoded from a CRN file is stored to the asset cache. Use it instead of transcoding again,
+    // unless the CRN data is new, in which case the stored DDS may be outdated.
+    if (NameSuffix() != "crn" || diskSourceType == IAsset::Original || !assetAPI->GetAssetCache())
+        return QString();
+    return assetAPI->GetAssetCache()->FindInCache(NameInternal());
 }
 
 QString TextureAsset::NameInternal() const
@@ -93,20 +138,31 @@ QString TextureAsset::NameSuffix() const
 bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData)
 {
     PROFILE(TextureAsset_DeserializeFromData_CRN_Uncompress);
+    QString error;
+    if (!DecompressCRNtoDDS(crnData, crnNumBytes, ddsData, error))
+    {
+        LogError(error);
+        return false;
+    }
+    return true;
+}
+
+bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, QString &error)
+{
     ddsData.clear();
     
     // Texture data
     crnd::crn_texture_info textureInfo;
     if (!crnd::crnd_get_texture_info((void*)crnData, crnNumBytes, &textureInfo))
     {
-        LogError("CRN texture info parsing failed, invalid input data.");
+        error = "CRN texture info parsing failed, invalid input data.";
         return false;
     }
     // Begin unpack
     crnd::crnd_unpack_context crnContext = crnd::crnd_unpack_begin((void*)crnData, crnNumBytes);
     if (!crnContext)
     {
-        LogError("CRN texture data unpacking failed, invalid input data.");
+        error = "CRN texture data unpacking failed, invalid input data.";
         return false;
     }
     
@@ -184,7 +240,7 @@ bool TextureAsset::DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std
     
     if (ddsData.size() == 0)
     {
-        LogError("CRN uncompression failed!");
+        error = "CRN uncompression failed!";
         return false;
     }
     return true;
@@ -204,93 +260,27 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
     // We should never be here in headless mode.
     assert(!assetAPI->IsHeadless());
 
-    if (assetAPI->GetFramework()->IsHeadless() || assetAPI->GetFramework()->HasCommandLineParameter("--no_async_asset_load") || !assetAPI->GetAssetCache() || (OGRE_THREAD_SUPPORT == 0))
-        allowAsynchronous = false;
-    QString cacheDiskSource;
-    if (allowAsynchronous)
-    {
-        cacheDiskSource = assetAPI->GetAssetCache()->FindInCache(Name());
-        if (cacheDiskSource.isEmpty())
-            allowAsynchronous = false;
-    }
-
-    // Check if this is a crunch library CRN file and we need to decompress to DDS.
-    std::vector<u8> crnUncompressData;
-    if (NameSuffix() == "crn")
+    // Asynchronous loading
+    // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
+    // 2. The texture decoder exists, ie. we are not headless and --no_async_asset_load was not given.
+    TextureDecoder *decoder = allowAsynchronous ? AsynchronousDecoder() : 0;
+    if (decoder)
     {
-        /** If asynchronous loading is allowed we want to store the decompressed DDS data to the asset cache.
-            This way below threaded loading can be done on the DDS disk source. If saving to disk fails, it is not
-            fatal, we can still continue with async loading withe data ptr and len. Checking for allowAsynchronous
-            also filters out any local:// etc. refs that are not meant to be loaded from asynch from asset cache.
-
-            - Do not rewrite dds to disk if the source type for this asset is cache and the dds already exists. 
-              Otherwise we would save the potentially big dds disk file every time this .crn loads!
-            - If async loading is allowed and we have a valid disk source, don't do in memory decompression.
-              Its a waste of resources as our disk source is up to date and we are allowed to use it to load
-              into Ogre. 
-        */
-        QString nameInternal = NameInternal();
-        cacheDiskSource = assetAPI->GetAssetCache()->FindInCache(nameInternal);
-        if (allowAsynchronous)
+        TextureDecodeJobPtr job = CreateDecodeJob();
+        job->filename = CachedDdsFile();
+        if (job->filename.isEmpty())
         {
-            // Only decompress and store dds if the data is new or not in cache.
-            if (diskSourceType == IAsset::Original || cacheDiskSource.isEmpty())
+            if (!data || numBytes == 0)
             {
-                // Input data ptr can be empty if it has been detected that we can load 
-                // asynchronously, meaning there was no need to load the file data.
-                std::vector<u8> fileData;
-                if (!data || numBytes == 0)
-                {
-                    bool success = LoadFileToVector(assetAPI->GetAssetCache()->FindInCache(Name()), fileData);
-                    if (!success)
-                        return false;
-                    data = &fileData[0];
-                    numBytes = fileData.size();
-                }
-                if (!DecompressCRNtoDDS(data, numBytes, crnUncompressData))
-                    return false;
-                if (crnUncompressData.size() == 0)
-                    return false;
-                PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
-                cacheDiskSource = assetAPI->GetAssetCache()->StoreAsset(&crnUncompressData[0], crnUncompressData.size(), nameInternal);
-                fileData.clear();
-                ELIFORP(TextureAsset_DeserializeFromData_CRN_CacheStore);
-            }
-            allowAsynchronous = !cacheDiskSource.isEmpty();
-            if (!allowAsynchronous)
-                LogWarning("TextureAsset::DeserializeFromData: Could not store decompressed CRN to asset cache, threaded loading disabled.");
-        }
-        if (!allowAsynchronous)
-        {
-            // We are doing a synchronous loading, ddsData memory is released once its loaded to ogre.
-            if (crnUncompressData.size() == 0)
-                if (!DecompressCRNtoDDS(data, numBytes, crnUncompressData))
-                    return false;
-            if (crnUncompressData.size() == 0)
+                LogError("TextureAsset::DeserializeFromData failed: No data to deserialize from!");
                 return false;
-            data = (const u8*)&crnUncompressData[0];
-            numBytes = crnUncompressData.size();
-        }
-        else
-        {
-            // We are bound to do threaded loading from disk.
-            crnUncompressData.clear();
+            }
+            // The input data is owned by the caller, so the worker thread needs its own copy.
+            job->data.assign(data, data + numBytes);
+            job->crn = (NameSuffix() == "crn");
         }
-    }
-    
-    // Asynchronous loading
-    // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
-    // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
-    // 3. The Ogre we are building against has thread support.
-    if (allowAsynchronous)
-    {
-        // We can only do threaded loading from disk, and not any disk location but only from asset cache.
-        // local:// refs will return empty string here and those will fall back to the non-threaded loading.
-        // Do not change this to do DiskCache() as that directory for local:// refs will not be a known resource location for ogre.
-        QFileInfo fileInfo(cacheDiskSource);
-        std::string sanitatedAssetRef = fileInfo.fileName().toStdString();
-        loadTicket_ = Ogre::ResourceBackgroundQueue::getSingleton().load(Ogre::TextureManager::getSingleton().getResourceType(),
-                          sanitatedAssetRef, OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP, false, 0, 0, this);
+        decodeJob = job;
+        decoder->Start(job);
         return true;
     }
 
@@ -305,20 +295,79 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
         return false;
     }
 
-    // Synchronous loading
-    try
+    // Synchronous loading. Do the same processing as the worker threads, but on this thread.
+    // Any ongoing asynchronous load is superseded by this one.
+    decodeJob.reset();
+    TextureDecodeJobPtr job = CreateDecodeJob();
+    job->data.assign(data, data + numBytes);
+    job->crn = (NameSuffix() == "crn");
+    TextureDecoder::Process(*job);
+    if (!job->error.isEmpty())
+    {
+        LogError("TextureAsset::DeserializeFromData: Failed to create texture " + Name() + ": " + job->error);
+        return false;
+    }
+    if (!UploadImage(*job))
+        return false;
+
+    // We did a synchronous load and must call AssetLoadCompleted here.
+    // This is done with Name() that is tracked by AssetAPI and is the ref
+    // we are showing outside this object, even if the input data was pre-processed 
+    // before passed to Ogre with NameInternal().
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
+void TextureAsset::DecodeFinished(const TextureDecodeJobPtr &job)
+{
+    if (job != decodeJob)
+        return; // Unloaded or reloaded while the job was being processed.
+    decodeJob.reset();
+
+    PROFILE(TextureAsset_DecodeFinished);
+
+    if (!job->error.isEmpty())
+        LogError("TextureAsset asynch load: Failed to load texture " + Name() + ": " + job->error);
+    else
     {
-        // Convert the data into Ogre's own DataStream format.
-        std::vector<u8> tempData(data, data + numBytes);
-#include "DisableMemoryLeakCheck.h"
-        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&tempData[0], tempData.size(), false));
-#include "EnableMemoryLeakCheck.h"
-        // Load up the image as an Ogre CPU image object.
-        Ogre::Image image;
-        image.load(stream);
+        /** Store the DDS data transcoded from CRN to the asset cache, so that the next loads can skip the transcoding.
+            - Only if the CRN file itself is in the cache. This filters out any local:// etc. refs.
+            - Do not rewrite the DDS if the source type for this asset is cache and the DDS already exists.
+              Otherwise we would save the potentially big DDS file every time this .crn loads! */
+        if (!job->ddsData.empty() && assetAPI->GetAssetCache() && !assetAPI->GetAssetCache()->FindInCache(Name()).isEmpty())
+        {
+            const QString nameInternal = NameInternal();
+            if (diskSourceType == IAsset::Original || assetAPI->GetAssetCache()->FindInCache(nameInternal).isEmpty())
+            {
+                PROFILE(TextureAsset_DeserializeFromData_CRN_CacheStore);
+                if (assetAPI->GetAssetCache()->StoreAsset(&job->ddsData[0], job->ddsData.size(), nameInternal).isEmpty())
+                    LogWarning("TextureAsset asynch load: Could not store decompressed CRN to asset cache.");
+            }
+        }
+
+        if (UploadImage(*job))
+        {
+            assetAPI->AssetLoadCompleted(Name());
+            return;
+        }
+    }
+
+    DoUnload();
+    assetAPI->AssetLoadFailed(Name());
+}
+
+bool TextureAsset::UploadImage(TextureDecodeJob &job)
+{
+    PROFILE(TextureAsset_UploadImage);
 
+    if (!job.warning.isEmpty())
+        LogWarning("TextureAsset::UploadImage: " + job.warning + " " + Name());
+
+    Ogre::Image &image = job.image;
+    try
+    {
         // Internal name that will be passed to Ogre for creating and loading the texture.
-        // This differs from Name() only if the data was pre-processed above, eg. CRN files.
+        // This differs from Name() only if the data was pre-processed, eg. CRN files.
         const QString nameInternal = NameInternal();
 
         // If we are submitting a .dds file which did not contain mip maps, don't have Ogre generating them either.
@@ -336,7 +385,6 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
             ogreAssetName = AssetAPI::SanitateAssetRef(nameInternal);
             
             // Optionally load textures to default pool for memory use debugging. Do not use in production use due to possible crashes on device loss & missing mipmaps!
-            // Note: this does not affect async loading path, so specify additionally --no_async_asset_load to be sure textures are loaded through this path
             // Furthermore, it may still allocate virtual memory address space due to using AGP memory mapping (we would not actually need a dynamic texture, but there's no way to tell Ogre that)
             if (assetAPI->GetFramework()->HasCommandLineParameter("--d3ddefaultpool"))
             {
@@ -365,7 +413,7 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
 
             if (ogreTexture->getBuffer().isNull())
             {
-                LogError("DeserializeFromData: Failed to create texture " + this->Name() + ": OgreTexture::getBuffer() was null!");
+                LogError("UploadImage: Failed to create texture " + this->Name() + ": OgreTexture::getBuffer() was null!");
                 return false;
             }
 
@@ -374,55 +422,15 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, bool all
 
             ogreTexture->createInternalResources();
         }
-
-        if (NameSuffix() == "crn" && crnUncompressData.size() > 0)
-            crnUncompressData.clear();
-
-        PostProcessTexture();
-        
-        // We did a synchronous load and must call AssetLoadCompleted here.
-        // This is done with Name() that is tracked by AssetAPI and is the ref
-        // we are showing outside this object, even if the input data was pre-processed 
-        // before passed to Ogre with NameInternal().
-        assetAPI->AssetLoadCompleted(Name());
         return true;
     }
     catch(Ogre::Exception &e)
     {
-        LogError("TextureAsset::DeserializeFromData: Failed to create texture " + Name().toStdString() + ": " + std::string(e.what()));
+        LogError("TextureAsset::UploadImage: Failed to create texture " + Name().toStdString() + ": " + std::string(e.what()));
         return false;
     }
 }
 
-void TextureAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
-{
-    if (ticket != loadTicket_)
-        return;
-        
-    // Reset to 0 to mark the asynch request is not active anymore. Aborted in Unload() if it is.
-    loadTicket_ = 0;
-
-    ogreAssetName = AssetAPI::SanitateAssetRef(NameInternal());
-    if (!result.error)
-    {
-        ogreTexture = Ogre::TextureManager::getSingleton().getByName(ogreAssetName.toStdString(), OgreRenderer::OgreRenderingModule::CACHE_RESOURCE_GROUP);
-        if (!ogreTexture.isNull())
-        {
-            PostProcessTexture();
-            
-            assetAPI->AssetLoadCompleted(Name());
-            return;
-        }
-        else
-            LogError("TextureAsset asynch load: Ogre::Texture was null after threaded loading: " + Name());
-    }
-    else
-        LogError("TextureAsset asynch load: Ogre failed to do threaded loading: " + result.message);
-
-    DoUnload();
-    assetAPI->AssetLoadFailed(Name());
-}
-
 /*
 void TextureAsset::RegenerateAllMipLevels()
 {
@@ -481,13 +489,8 @@ bool TextureAsset::SerializeTo(std::vector<u8> &data, const QString &serializati
 
 void TextureAsset::DoUnload()
 {
-    // If a ongoing asynchronous asset load requested has been made to ogre, we need to abort it.
-    // Otherwise Ogre will crash to our raw pointer that was passed if we get deleted. A ongoing ticket id cannot be 0.
-    if (loadTicket_ != 0)
-    {
-        Ogre::ResourceBackgroundQueue::getSingleton().abortRequest(loadTicket_);
-        loadTicket_ = 0;
-    }
+    // Drop any ongoing asynchronous load. The worker thread may still finish the job, but it is not uploaded.
+    decodeJob.reset();
     
     if (!ogreTexture.isNull())
         ogreAssetName = ogreTexture->getName().c_str();
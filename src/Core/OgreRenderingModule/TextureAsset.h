@@ -3,16 +3,18 @@
 #pragma once
 
 #include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
 #include "IAsset.h"
 #include "AssetAPI.h"
 
 #include <QImage>
 
 #include <OgreTexture.h>
-#include <OgreResourceBackgroundQueue.h>
 
 /// Represents a texture on the GPU.
-class OGRE_MODULE_API TextureAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
+/** Unless --no_async_asset_load is given, the texture data is decoded and processed on the worker threads of TextureDecoder,
+    and only the GPU upload is done on the main thread. */
+class OGRE_MODULE_API TextureAsset : public IAsset
 {
     Q_OBJECT
 
@@ -28,8 +30,9 @@ public:
     /// Load texture into memory
     virtual bool SerializeTo(std::vector<u8> &data, const QString &serializationParameters) const;
 
-    /// Ogre threaded load listener. Ogre::ResourceBackgroundQueue::Listener override.
-    virtual void operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result);
+    /// Uploads the image of a finished decode job to the GPU. Called by TextureDecoder on the main thread.
+    /** The job is dropped if it is not the latest one started for this asset. */
+    void DecodeFinished(const TextureDecodeJobPtr &job);
 
     /// Unload texture from ogre
     virtual void DoUnload();
@@ -64,7 +67,8 @@ public:
 
     //void RegenerateAllMipLevels();
 
-    /// Perform post-processing after loading (DXT compression and size reduction) according to command line options
+    /// Perform post-processing on the GPU texture (DXT compression and size reduction) according to command line options
+    /** Loading does the same processing on the CPU before the upload, see TextureDecoder. */
     void PostProcessTexture();
     
     /// Compress texture to suitable DXT format. Also, if applicable, reduce texture size at the same time.
@@ -79,9 +83,6 @@ public:
     /// Specifies the unique texture name Ogre uses in its asset pool for this texture.
     QString ogreAssetName;
 
-    /// Ticket for ogres threaded loading operation.
-    Ogre::BackgroundProcessTicket loadTicket_;
-    
     /// Convert texture to QImage, static version.
     static QImage ToQImage(Ogre::Texture* tex, size_t faceIndex = 0, size_t mipmapLevel = 0);
 
@@ -101,6 +102,10 @@ public:
      ** data with crn_free_block when done with it. */
     bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData);
 
+    /// Same as DecompressCRNtoDDS but static and does not log, so that it can be called from worker threads.
+    /** @param error The reason of the failure is assigned to this parameter. */
+    static bool DecompressCRNtoDDS(const u8 *crnData, size_t crnNumBytes, std::vector<u8> &ddsData, QString &error);
+
 public slots:
     /// Convert texture to QImage
     QImage ToQImage(size_t faceIndex = 0, size_t mipmapLevel = 0) const;
@@ -113,4 +118,20 @@ public slots:
 
     /// Texture extension.
     QString NameSuffix() const;
+
+private:
+    /// Returns the decoder for asynchronous loading, or null if the texture must be loaded synchronously.
+    TextureDecoder *AsynchronousDecoder() const;
+
+    /// Creates a decode job with the processing options given on the command line.
+    TextureDecodeJobPtr CreateDecodeJob();
+
+    /// Returns the DDS file transcoded from this CRN texture in the asset cache, or an empty string if it cannot be used.
+    QString CachedDdsFile() const;
+
+    /// Creates the Ogre texture from the processed image of the job, or reuses the existing one. Returns true on success.
+    bool UploadImage(TextureDecodeJob &job);
+
+    /// The latest asynchronous decode job started for this asset. Reset when the job finishes or the asset is unloaded.
+    TextureDecodeJobPtr decodeJob;
 };
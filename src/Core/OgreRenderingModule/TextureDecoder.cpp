@@ -0,0 +1,223 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureDecoder.h"
+#include "TextureAsset.h"
+
+#include "Profiler.h"
+
+#include <QFile>
+#include <QThread>
+
+#include <Ogre.h>
+
+#include <squish.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Reduces the image to fit in maxSize x maxSize.
+/** If the image has mipmaps, the levels larger than maxSize are dropped, but the smallest level is always kept.
+    Otherwise the image is halved until it fits. Already compressed images without mipmaps are not resized. */
+void ReduceImageSize(Ogre::Image &image, size_t maxSize, QString &warning)
+{
+    const size_t width = image.getWidth();
+    const size_t height = image.getHeight();
+    if (width <= maxSize && height <= maxSize)
+        return;
+
+    if (image.getNumFaces() > 1 || image.getDepth() > 1)
+    {
+        warning = "not reducing the size of a cubemap or a volume texture";
+        return;
+    }
+
+    const size_t numMipmaps = image.getNumMipmaps(); // Note: This does not count the first level.
+    if (numMipmaps > 0)
+    {
+        size_t firstLevel = 0;
+        while(firstLevel < numMipmaps && (std::max<size_t>(1, width >> firstLevel) > maxSize || std::max<size_t>(1, height >> firstLevel) > maxSize))
+            ++firstLevel;
+
+        // The levels are stored consecutively, so the kept levels can be copied in one go.
+        Ogre::PixelBox firstBox = image.getPixelBox(0, firstLevel);
+        const size_t offset = (size_t)((Ogre::uchar*)firstBox.data - image.getData());
+        const size_t size = image.getSize() - offset;
+        Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, size, Ogre::MEMCATEGORY_GENERAL);
+        memcpy(data, image.getData() + offset, size);
+        image.loadDynamicImage(data, firstBox.getWidth(), firstBox.getHeight(), 1, image.getFormat(), true, 1, numMipmaps - firstLevel);
+    }
+    else if (Ogre::PixelUtil::isCompressed(image.getFormat()))
+    {
+        warning = "not resizing an already compressed texture";
+    }
+    else
+    {
+        size_t targetWidth = width;
+        size_t targetHeight = height;
+        while(targetWidth > maxSize || targetHeight > maxSize)
+        {
+            targetWidth >>= 1;
+            targetHeight >>= 1;
+        }
+        image.resize((Ogre::ushort)std::max<size_t>(1, targetWidth), (Ogre::ushort)std::max<size_t>(1, targetHeight), Ogre::Image::FILTER_BILINEAR);
+    }
+}
+
+/// Generates a full mipmap chain for an uncompressed 2D image that has only the first level.
+void GenerateMipmaps(Ogre::Image &image)
+{
+    const Ogre::PixelFormat format = image.getFormat();
+    if (image.getNumMipmaps() > 0 || image.getNumFaces() > 1 || image.getDepth() > 1 || Ogre::PixelUtil::isCompressed(format))
+        return;
+
+    const size_t width = image.getWidth();
+    const size_t height = image.getHeight();
+    size_t numMipmaps = 0;
+    for(size_t w = width, h = height; w > 1 || h > 1; w = std::max<size_t>(1, w / 2), h = std::max<size_t>(1, h / 2))
+        ++numMipmaps;
+    if (numMipmaps == 0)
+        return;
+
+    const size_t size = Ogre::Image::calculateSize(numMipmaps, 1, width, height, 1, format);
+    Ogre::uchar *data = OGRE_ALLOC_T(Ogre::uchar, size, Ogre::MEMCATEGORY_GENERAL);
+    memcpy(data, image.getData(), image.getSize());
+    image.loadDynamicImage(data, width, height, 1, format, true, 1, numMipmaps);
+
+    // Each level is filtered from the previous one.
+    for(size_t level = 1; level <= numMipmaps; ++level)
+        Ogre::Image::scale(image.getPixelBox(0, level - 1), image.getPixelBox(0, level), Ogre::Image::FILTER_BILINEAR);
+}
+
+/// Compresses all the levels of an uncompressed 2D image to DXT1, or to DXT5 if the image has alpha.
+void CompressImage(Ogre::Image &image)
+{
+    const Ogre::PixelFormat sourceFormat = image.getFormat();
+    if (Ogre::PixelUtil::isCompressed(sourceFormat) || image.getNumFaces() > 1 || image.getDepth() > 1)
+        return;
+    if ((sourceFormat >= Ogre::PF_L8 && sourceFormat <= Ogre::PF_BYTE_LA) || sourceFormat == Ogre::PF_R8)
+        return; // 1 or 2 byte format, leave alone
+
+    const bool hasAlpha = Ogre::PixelUtil::hasAlpha(sourceFormat);
+    const int flags = squish::kColourRangeFit | (hasAlpha ? squish::kDxt5 : squish::kDxt1); // Lowest quality, but fastest
+    const Ogre::PixelFormat newFormat = hasAlpha ? Ogre::PF_DXT5 : Ogre::PF_DXT1;
+
+    const size_t width = image.getWidth();
+    const size_t height = image.getHeight();
+    const size_t numMipmaps = image.getNumMipmaps();
+    Ogre::uchar *compressedData = OGRE_ALLOC_T(Ogre::uchar, Ogre::Image::calculateSize(numMipmaps, 1, width, height, 1, newFormat), Ogre::MEMCATEGORY_GENERAL);
+
+    std::vector<u8> levelData;
+    size_t writePos = 0;
+    for(size_t level = 0; level <= numMipmaps; ++level)
+    {
+        Ogre::PixelBox levelBox = image.getPixelBox(0, level);
+        const size_t levelWidth = levelBox.getWidth();
+        const size_t levelHeight = levelBox.getHeight();
+
+        // squish takes the pixels as RGBA bytes.
+        levelData.resize(levelWidth * levelHeight * 4);
+        Ogre::PixelBox rgbaBox(levelWidth, levelHeight, 1, Ogre::PF_BYTE_RGBA, &levelData[0]);
+        Ogre::PixelUtil::bulkPixelConversion(levelBox, rgbaBox);
+
+        squish::CompressImage((squish::u8*)&levelData[0], (int)levelWidth, (int)levelHeight, compressedData + writePos, flags);
+        writePos += squish::GetStorageRequirements((int)levelWidth, (int)levelHeight, flags);
+    }
+
+    image.loadDynamicImage(compressedData, width, height, 1, newFormat, true, 1, numMipmaps);
+}
+
+/// Processes a job on a worker thread.
+void ProcessQueuedJob(TextureDecodeJob &job)
+{
+    // Skip the job if its asset was deleted while the job was queued.
+    if (!job.asset.expired())
+        TextureDecoder::Process(job);
+}
+
+}
+
+TextureDecoder::TextureDecoder() :
+    // Leave a core for the main thread, which keeps rendering while the textures are being processed.
+    jobs(&ProcessQueuedJob, QThread::idealThreadCount() - 1)
+{
+}
+
+void TextureDecoder::Start(const TextureDecodeJobPtr &job)
+{
+    jobs.Start(job);
+}
+
+void TextureDecoder::Process(TextureDecodeJob &job)
+{
+    if (!job.filename.isEmpty())
+    {
+        QFile file(job.filename);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            job.error = "Failed to open file \"" + job.filename + "\" for reading";
+            return;
+        }
+        job.data.resize((size_t)std::max<qint64>(0, file.size()));
+        if (job.data.empty() || file.read((char*)&job.data[0], job.data.size()) < (qint64)job.data.size())
+        {
+            job.error = "Failed to read file \"" + job.filename + "\"";
+            job.data.clear();
+            return;
+        }
+    }
+    if (job.data.empty())
+    {
+        job.error = "No texture data to decode";
+        return;
+    }
+
+    if (job.crn && !TextureAsset::DecompressCRNtoDDS(&job.data[0], job.data.size(), job.ddsData, job.error))
+        return;
+
+    try
+    {
+        std::vector<u8> &source = job.crn ? job.ddsData : job.data;
+#include "DisableMemoryLeakCheck.h"
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&source[0], source.size(), false));
+#include "EnableMemoryLeakCheck.h"
+        job.image.load(stream);
+
+        // The source data is not needed anymore. The transcoded DDS data is kept for storing it to the asset cache.
+        std::vector<u8>().swap(job.data);
+
+        if (job.maxTextureSize > 0)
+            ReduceImageSize(job.image, job.maxTextureSize, job.warning);
+        if (job.generateMipmaps)
+            GenerateMipmaps(job.image);
+        if (job.compress)
+            CompressImage(job.image);
+    }
+    catch(Ogre::Exception &e)
+    {
+        job.error = "Failed to decode image: " + QString(e.what());
+    }
+}
+
+bool TextureDecoder::CompleteFinishedJobs(tick_t deadline)
+{
+    TextureDecodeJobPtr job;
+    while(GetCurrentClockTime() < deadline)
+    {
+        if (!jobs.TakeFinishedJob(job))
+            return true;
+
+        PROFILE(TextureDecoder_CompleteJob);
+
+        // If the asset has been deleted, or the job has been replaced by another load, the asset drops the job.
+        TextureAssetPtr texture = dynamic_pointer_cast<TextureAsset>(job->asset.lock());
+        if (texture)
+            texture->DecodeFinished(job);
+    }
+    // Out of time for this frame, the rest are uploaded on the next frame.
+    return false;
+}
@@ -0,0 +1,59 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "OgreModuleFwd.h"
+#include "AssetFwd.h"
+#include "HighPerfClock.h"
+#include "WorkerJobQueue.h"
+
+#include <QString>
+
+#include <OgreImage.h>
+
+#include <vector>
+
+/// Describes the CPU-side processing of a texture that TextureDecoder runs on a worker thread.
+/** The main thread fills in the source and the processing options, and reads the results after the job has finished.
+    While the job is being processed, it is owned by the worker thread and must not be touched. */
+struct OGRE_MODULE_API TextureDecodeJob
+{
+    TextureDecodeJob() : crn(false), maxTextureSize(0), generateMipmaps(false), compress(false) {}
+
+    AssetWeakPtr asset; ///< The texture asset the job is processed for. If the asset is deleted, the job is skipped.
+    QString filename; ///< If non-empty, the source data is read from this file.
+    std::vector<u8> data; ///< The source data, if not read from a file. Freed when the image has been decoded.
+    bool crn; ///< If true, the source data is a CRN file that is transcoded to DDS before decoding.
+    size_t maxTextureSize; ///< If non-zero, the image is reduced to fit in this size.
+    bool generateMipmaps; ///< If true, a full mipmap chain is generated for images that do not have one.
+    bool compress; ///< If true, the image is compressed to DXT1, or to DXT5 if it has alpha.
+
+    Ogre::Image image; ///< The decoded and processed image, ready to be uploaded to the GPU.
+    std::vector<u8> ddsData; ///< The DDS data transcoded from a CRN source.
+    QString error; ///< Set if the processing fails.
+    QString warning; ///< Set if the processing succeeded, but some of it could not be done.
+};
+
+/// Decodes and processes textures on worker threads, so that only the GPU upload is left for the main thread.
+/** The workers transcode CRN to DDS, decode the image, reduce its size, generate the mipmaps and compress the image to DXT,
+    as specified by the TextureDecodeJob. OgreRenderingModule hands the finished jobs to their texture assets each frame.
+    Does not log from the worker threads, the errors are stored to the jobs and reported on the main thread. */
+class OGRE_MODULE_API TextureDecoder
+{
+public:
+    TextureDecoder();
+
+    /// Starts processing the job on a worker thread.
+    void Start(const TextureDecodeJobPtr &job);
+
+    /// Processes the job on the calling thread.
+    /** Used by the worker threads, and by the synchronous texture loads on the main thread. */
+    static void Process(TextureDecodeJob &job);
+
+    /// Hands the finished jobs to their texture assets for uploading. Returns false if the deadline was reached.
+    bool CompleteFinishedJobs(tick_t deadline);
+
+private:
+    WorkerJobQueue<TextureDecodeJob> jobs; ///< Jobs being processed by the worker threads. Waits for them when destroyed.
+};
@@ -0,0 +1,316 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "CollisionShapeBuilder.h"
+#include "CollisionShapeUtils.h"
+#include "ConvexHull.h"
+
+// Disable unreferenced formal parameter coming from Bullet
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4100)
+#endif
+#include <btBulletDynamicsCommon.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <QFile>
+#include <QThread>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Identifies a collision shape cache file. Bump the version whenever the layout of the file changes, or Bullet is upgraded.
+/** The BVH is stored in the in-place format of Bullet, which depends on the Bullet version and the platform. */
+const u32 cCollisionShapeCacheMagic = 0x48534354; // "TCSH"
+const u32 cCollisionShapeCacheVersion = 1;
+
+void AppendBytes(std::vector<u8> &dst, const void *data, size_t numBytes)
+{
+    if (numBytes > 0)
+        dst.insert(dst.end(), (const u8*)data, (const u8*)data + numBytes);
+}
+
+void AppendU32(std::vector<u8> &dst, u32 value)
+{
+    AppendBytes(dst, &value, sizeof(value));
+}
+
+void AppendFloat3(std::vector<u8> &dst, const btVector3 &v)
+{
+    const float3 value(v.x(), v.y(), v.z());
+    AppendBytes(dst, &value, sizeof(value));
+}
+
+bool ReadBytes(const u8 *&pos, const u8 *end, void *dst, size_t numBytes)
+{
+    if ((size_t)(end - pos) < numBytes)
+        return false;
+    memcpy(dst, pos, numBytes);
+    pos += numBytes;
+    return true;
+}
+
+template<typename T>
+bool ReadArray(const u8 *&pos, const u8 *end, std::vector<T> &dst)
+{
+    u32 size = 0;
+    if (!ReadBytes(pos, end, &size, sizeof(size)) || (size_t)(end - pos) / sizeof(T) < size)
+        return false;
+    dst.resize(size);
+    return size == 0 || ReadBytes(pos, end, &dst[0], size * sizeof(T));
+}
+
+/// Deleter of the BVHs, which are allocated with btAlignedAlloc like btBvhTriangleMeshShape allocates its own.
+void DeleteAlignedBvh(btOptimizedBvh *bvh)
+{
+    if (bvh)
+    {
+        bvh->~btOptimizedBvh();
+        btAlignedFree(bvh);
+    }
+}
+
+/// Creates the triangle mesh of the job from its triangles.
+void CreateTriangleMesh(Physics::CollisionShapeJob &job)
+{
+#include "DisableMemoryLeakCheck.h"
+    job.triangleMesh = MAKE_SHARED(btTriangleMesh);
+#include "EnableMemoryLeakCheck.h"
+    Physics::GenerateTriangleMesh(job.triangles, job.triangleMesh.get());
+}
+
+/// Builds the BVH of the triangle mesh of the job, with the same bounds btBvhTriangleMeshShape would use.
+void BuildBvh(Physics::CollisionShapeJob &job)
+{
+    btVector3 aabbMin, aabbMax;
+    job.triangleMesh->calculateAabbBruteForce(aabbMin, aabbMax);
+#include "DisableMemoryLeakCheck.h"
+    btOptimizedBvh *bvh = new (btAlignedAlloc(sizeof(btOptimizedBvh), 16)) btOptimizedBvh();
+#include "EnableMemoryLeakCheck.h"
+    job.bvh = shared_ptr<btOptimizedBvh>(bvh, &DeleteAlignedBvh);
+    bvh->build(job.triangleMesh.get(), true, aabbMin, aabbMax);
+}
+
+/// Serializes the results of the job to the cache file format.
+/** The file has a header with the magic number, the version, the shape type and the content hash of the mesh. A triangle
+    mesh is followed by its triangles and its BVH, a convex hull set by the position and the points of each hull. */
+void SerializeCacheData(Physics::CollisionShapeJob &job)
+{
+    std::vector<u8> &dst = job.cacheData;
+    dst.clear();
+    AppendU32(dst, cCollisionShapeCacheMagic);
+    AppendU32(dst, cCollisionShapeCacheVersion);
+    AppendU32(dst, job.convexHull ? 1 : 0);
+    AppendU32(dst, (u32)job.meshHash.size());
+    AppendBytes(dst, job.meshHash.constData(), job.meshHash.size());
+
+    if (!job.convexHull)
+    {
+        AppendU32(dst, (u32)job.triangles.size());
+        if (!job.triangles.empty())
+            AppendBytes(dst, &job.triangles[0], job.triangles.size() * sizeof(float3));
+
+        // The BVH serializes only to a 16-byte aligned buffer.
+        const unsigned bvhSize = job.bvh->calculateSerializeBufferSize();
+        void *buffer = btAlignedAlloc(bvhSize, 16);
+        job.bvh->serializeInPlace(buffer, bvhSize, false);
+        AppendU32(dst, (u32)bvhSize);
+        AppendBytes(dst, buffer, bvhSize);
+        btAlignedFree(buffer);
+    }
+    else
+    {
+        const std::vector<Physics::ConvexHull> &hulls = job.convexHullSet->hulls_;
+        AppendU32(dst, (u32)hulls.size());
+        for(size_t i = 0; i < hulls.size(); ++i)
+        {
+            const btConvexHullShape *hull = hulls[i].hull_.get();
+            AppendBytes(dst, &hulls[i].position_, sizeof(float3));
+            AppendU32(dst, (u32)hull->getNumPoints());
+            for(int j = 0; j < hull->getNumPoints(); ++j)
+                AppendFloat3(dst, hull->getUnscaledPoints()[j]);
+        }
+    }
+}
+
+/// Returns true if the node and subtree indices of a BVH read from a cache file are within the BVH and the triangle mesh.
+/** The traversal of the BVH follows the indices without checks, so a corrupted cache file could make it read out of bounds. */
+bool IsValidBvh(btOptimizedBvh &bvh, int numTriangles)
+{
+    // The built BVHs are always quantized, see BuildBvh.
+    if (!bvh.isQuantized())
+        return false;
+
+    const QuantizedNodeArray &nodes = bvh.getQuantizedNodeArray();
+    const int numNodes = nodes.size();
+    for(int i = 0; i < numNodes; ++i)
+    {
+        const btQuantizedBvhNode &node = nodes[i];
+        if (node.isLeafNode())
+        {
+            // The triangle mesh has a single part.
+            if (node.getPartId() != 0 || node.getTriangleIndex() < 0 || node.getTriangleIndex() >= numTriangles)
+                return false;
+        }
+        else if (node.getEscapeIndex() < 1 || node.getEscapeIndex() > numNodes - i)
+            return false;
+    }
+
+    const BvhSubtreeInfoArray &subtrees = bvh.getSubtreeInfoArray();
+    for(int i = 0; i < subtrees.size(); ++i)
+        if (subtrees[i].m_rootNodeIndex < 0 || subtrees[i].m_subtreeSize < 1 || subtrees[i].m_subtreeSize > numNodes - subtrees[i].m_rootNodeIndex)
+            return false;
+    return true;
+}
+
+/// Reads the triangle mesh of the job and its BVH from the cache file data. Returns false if the data is corrupted.
+bool ParseTriangleMesh(Physics::CollisionShapeJob &job, const u8 *pos, const u8 *end)
+{
+    u32 bvhSize = 0;
+    if (!ReadArray(pos, end, job.triangles) || job.triangles.empty() || job.triangles.size() % 3 != 0 || !ReadBytes(pos, end, &bvhSize, sizeof(bvhSize))
+        || bvhSize == 0 || (size_t)(end - pos) < bvhSize)
+        return false;
+
+    // The BVH is used in place from its buffer, which is freed with the BVH.
+    void *buffer = btAlignedAlloc(bvhSize, 16);
+    memcpy(buffer, pos, bvhSize);
+    btOptimizedBvh *bvh = btOptimizedBvh::deSerializeInPlace(buffer, bvhSize, false);
+    if (!bvh)
+    {
+        btAlignedFree(buffer);
+        return false;
+    }
+    job.bvh = shared_ptr<btOptimizedBvh>(bvh, &DeleteAlignedBvh);
+    if (!IsValidBvh(*bvh, (int)(job.triangles.size() / 3)))
+        return false;
+
+    CreateTriangleMesh(job);
+    std::vector<float3>().swap(job.triangles);
+    return true;
+}
+
+/// Reads the convex hull set of the job from the cache file data. Returns false if the data is corrupted.
+bool ParseConvexHullSet(Physics::CollisionShapeJob &job, const u8 *pos, const u8 *end)
+{
+    u32 numHulls = 0;
+    if (!ReadBytes(pos, end, &numHulls, sizeof(numHulls)))
+        return false;
+
+    job.convexHullSet = MAKE_SHARED(Physics::ConvexHullSet);
+    std::vector<float3> points;
+    for(u32 i = 0; i < numHulls; ++i)
+    {
+        Physics::ConvexHull hull;
+        if (!ReadBytes(pos, end, &hull.position_, sizeof(float3)) || !ReadArray(pos, end, points) || points.empty())
+            return false;
+#include "DisableMemoryLeakCheck.h"
+        hull.hull_ = shared_ptr<btConvexHullShape>(new btConvexHullShape((const btScalar*)&points[0], (int)points.size(), sizeof(float3)));
+#include "EnableMemoryLeakCheck.h"
+        job.convexHullSet->hulls_.push_back(hull);
+    }
+    return true;
+}
+
+/// Reads the results of the job from the cache file data. Returns an error message on failure.
+QString ParseCacheData(Physics::CollisionShapeJob &job, const u8 *pos, const u8 *end)
+{
+    u32 magic = 0, version = 0, type = 0, hashSize = 0;
+    if (!ReadBytes(pos, end, &magic, sizeof(magic)) || !ReadBytes(pos, end, &version, sizeof(version)) || !ReadBytes(pos, end, &type, sizeof(type))
+        || magic != cCollisionShapeCacheMagic || version != cCollisionShapeCacheVersion || type != (job.convexHull ? 1u : 0u))
+        return "Unsupported collision shape cache file \"" + job.cacheFile + "\"";
+
+    if (!ReadBytes(pos, end, &hashSize, sizeof(hashSize)) || hashSize != (u32)job.meshHash.size() || (size_t)(end - pos) < hashSize
+        || memcmp(pos, job.meshHash.constData(), hashSize) != 0)
+        return "Collision shape cache file \"" + job.cacheFile + "\" was built from different mesh content";
+    pos += hashSize;
+
+    const bool ok = job.convexHull ? ParseConvexHullSet(job, pos, end) : ParseTriangleMesh(job, pos, end);
+    if (!ok)
+    {
+        job.triangleMesh.reset();
+        job.bvh.reset();
+        job.convexHullSet.reset();
+        return "Collision shape cache file \"" + job.cacheFile + "\" is corrupted";
+    }
+    return QString();
+}
+
+/// Reads the results of the job from its cache file.
+void ReadCacheFile(Physics::CollisionShapeJob &job)
+{
+    QFile file(job.cacheFile);
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+    {
+        job.error = "Failed to open collision shape cache file \"" + job.cacheFile + "\"";
+        return;
+    }
+    uchar *data = file.map(0, file.size());
+    if (!data)
+    {
+        job.error = "Failed to map collision shape cache file \"" + job.cacheFile + "\"";
+        return;
+    }
+
+    job.error = ParseCacheData(job, data, data + file.size());
+    file.unmap(data);
+}
+
+}
+
+namespace Physics
+{
+
+CollisionShapeBuilder::CollisionShapeBuilder() :
+    // Use at most half of the worker threads, the rest are left for the asset loading.
+    jobs(&CollisionShapeBuilder::Process, QThread::idealThreadCount() / 2)
+{
+}
+
+void CollisionShapeBuilder::Start(const CollisionShapeJobPtr &job)
+{
+    jobs.Start(job);
+}
+
+void CollisionShapeBuilder::TakeFinishedJobs(std::vector<CollisionShapeJobPtr> &finishedJobs)
+{
+    jobs.TakeFinishedJobs(finishedJobs);
+}
+
+QString CollisionShapeBuilder::CacheRef(const QByteArray &meshHash, bool convexHull)
+{
+    return QString(meshHash.toHex()) + (convexHull ? ".convexhull" : ".trimesh");
+}
+
+void CollisionShapeBuilder::Process(CollisionShapeJob &job)
+{
+    if (!job.cacheFile.isEmpty())
+    {
+        ReadCacheFile(job);
+        return;
+    }
+
+    if (job.convexHull)
+    {
+        job.convexHullSet = MAKE_SHARED(ConvexHullSet);
+        job.error = GenerateConvexHullSet(job.triangles, job.convexHullSet.get());
+    }
+    else if (job.triangles.empty())
+        job.error = "Mesh had no triangles; aborting triangle mesh generation";
+    else
+    {
+        CreateTriangleMesh(job);
+        BuildBvh(job);
+    }
+
+    if (job.error.isEmpty() && job.serialize)
+        SerializeCacheData(job);
+    std::vector<float3>().swap(job.triangles);
+}
+
+}
@@ -0,0 +1,66 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "PhysicsModuleApi.h"
+#include "PhysicsModuleFwd.h"
+#include "Math/float3.h"
+#include "WorkerJobQueue.h"
+
+#include <QString>
+#include <QByteArray>
+
+#include <vector>
+
+namespace Physics
+{
+
+/// Describes the building of the collision shape of a mesh, which CollisionShapeBuilder runs on a worker thread.
+/** The main thread fills in the source, and reads the results after the job has finished.
+    While the job is being processed, it is owned by the worker thread and must not be touched. */
+struct PHYSICS_MODULE_API CollisionShapeJob
+{
+    CollisionShapeJob() : convexHull(false), serialize(false) {}
+
+    QString shapeKey; ///< Identifies the shape in PhysicsModule. Meshes with the same content share the shape.
+    QString meshName; ///< Name of the mesh asset the job was started for. Used in the error messages.
+    bool convexHull; ///< If true, a convex hull set is built, otherwise a triangle mesh and its BVH.
+    QByteArray meshHash; ///< Content hash of the mesh file. Identifies the mesh the cache file was built from.
+    QString cacheFile; ///< If non-empty, the shape is read from this cache file instead of built. Fails if the file was built from other content than meshHash.
+    std::vector<float3> triangles; ///< Vertices of the triangles to build the shape from, three per triangle, if not read from a cache file.
+    bool serialize; ///< If true, the built shape is serialized to cacheData.
+
+    shared_ptr<btTriangleMesh> triangleMesh; ///< The built triangle mesh, if not a convex hull job.
+    shared_ptr<btOptimizedBvh> bvh; ///< The BVH of the triangle mesh, shared by all the rigid bodies using the mesh.
+    shared_ptr<ConvexHullSet> convexHullSet; ///< The built convex hull set, if a convex hull job.
+    std::vector<u8> cacheData; ///< The built shape in the cache file format, to be stored to the asset cache.
+    QString error; ///< Set if the processing fails.
+};
+
+/// Builds the collision shapes of meshes on worker threads.
+/** The built shapes are serialized and stored to the asset cache by the content hash of the mesh, so that later runs read
+    them instead of building them again. Reading a cached shape does not need the Ogre mesh buffers, so it works the same
+    in headless mode. PhysicsModule takes the finished jobs each frame.
+    Does not log from the worker threads, the errors are stored to the jobs and reported on the main thread. */
+class PHYSICS_MODULE_API CollisionShapeBuilder
+{
+public:
+    CollisionShapeBuilder();
+
+    /// Starts processing the job on a worker thread.
+    void Start(const CollisionShapeJobPtr &job);
+
+    /// Processes the job on the calling thread.
+    static void Process(CollisionShapeJob &job);
+
+    /// Moves the jobs processed by the worker threads to finishedJobs.
+    void TakeFinishedJobs(std::vector<CollisionShapeJobPtr> &finishedJobs);
+
+    /// Returns the asset cache ref of the cache file for a shape of the mesh content with the given hash.
+    static QString CacheRef(const QByteArray &meshHash, bool convexHull);
+
+private:
+    WorkerJobQueue<CollisionShapeJob> jobs; ///< Jobs being processed by the worker threads. Waits for them when destroyed.
+};
+
+}
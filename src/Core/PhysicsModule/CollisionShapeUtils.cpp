@@ -11,6 +11,9 @@
 
 #include <Ogre.h>
 
+#include <QMutex>
+#include <QMutexLocker>
+
 // Disable unreferenced formal parameter coming from Bullet
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -23,6 +26,12 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// StanHull keeps its temporaries in static variables, so only one hull can be generated at a time.
+    QMutex hullMutex;
+}
+
 namespace Physics
 {
 
@@ -30,8 +39,12 @@ void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr)
 {
     std::vector<float3> triangles;
     GetTrianglesFromMesh(mesh, triangles);
-    
-    for(uint i = 0; i < triangles.size(); i += 3)
+    GenerateTriangleMesh(triangles, ptr);
+}
+
+void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr)
+{
+    for(uint i = 0; i + 2 < triangles.size(); i += 3)
         ptr->addTriangle(triangles[i], triangles[i+1], triangles[i+2]);
 }
 
@@ -39,12 +52,18 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
 {
     std::vector<float3> vertices;
     GetTrianglesFromMesh(mesh, vertices);
+    QString error = GenerateConvexHullSet(vertices, ptr);
+    if (!error.isEmpty())
+        LogError(error);
+}
+
+QString GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr)
+{
     if (!vertices.size())
-    {
-        LogError("Mesh had no triangles; aborting convex hull generation");
-        return;
-    }
+        return "Mesh had no triangles; aborting convex hull generation";
     
+    QMutexLocker lock(&hullMutex);
+
     StanHull::HullDesc desc;
     desc.SetHullFlag(StanHull::QF_TRIANGLES);
     desc.mVcount = vertices.size();
@@ -57,10 +76,7 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     lib.CreateConvexHull(desc, result);
 
     if (!result.mNumOutputVertices)
-    {
-        LogError("No vertices were generated; aborting convex hull generation");
-        return;
-    }
+        return "No vertices were generated; aborting convex hull generation";
     
     ConvexHull hull;
     hull.position_ = float3(0,0,0);
@@ -71,6 +87,7 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     ptr->hulls_.push_back(hull);
     
     lib.ReleaseResult(result);
+    return QString();
 }
 
 void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest)
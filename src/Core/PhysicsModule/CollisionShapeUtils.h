@@ -7,6 +7,10 @@
 #include "PhysicsModuleFwd.h"
 #include "Math/float3.h"
 
+#include <QString>
+
+#include <vector>
+
 namespace Ogre
 {
     class Mesh;
@@ -15,8 +19,13 @@ namespace Ogre
 namespace Physics
 {
     void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr);
+    /// Adds triangles to a Bullet triangle mesh, three vertices per triangle. Can be called from worker threads.
+    void GenerateTriangleMesh(const std::vector<float3>& triangles, btTriangleMesh* ptr);
     void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest);
     void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr);
+    /// Generates a convex hull set from triangles, three vertices per triangle. Can be called from worker threads, does not log.
+    /** @return An error message on failure, or an empty string. */
+    QString GenerateConvexHullSet(const std::vector<float3>& triangles, ConvexHullSet* ptr);
 }
 
 
@@ -28,6 +28,7 @@
 #include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 #include <BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h>
 #include <set>
+#include <algorithm>
 
 #include <OgreSceneNode.h>
 
@@ -63,6 +64,11 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     shape_(0),
     childShape_(0),
     heightField_(0),
+    heightFieldWidth_(0),
+    heightFieldHeight_(0),
+    heightRevision_(0),
+    minHeight_(0.f),
+    maxHeight_(0.f),
     disconnected_(false),
     cachedShapeType_(-1),
     cachedSize_(float3::zero),
@@ -86,6 +92,8 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     shapeType.SetMetadata(&shapemetadata);
 
     connect(this, SIGNAL(ParentEntitySet()), SLOT(UpdateSignals()));
+    if (owner_)
+        connect(owner_, SIGNAL(CollisionShapeReady(const QString&)), SLOT(OnCollisionShapeReady(const QString&)));
 }
 
 EC_RigidBody::~EC_RigidBody()
@@ -283,6 +291,7 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         if (terrain)
         {
             terrain_ = terrain;
+            heightFieldWidth_ = 0; // A different terrain, copy all of its patches.
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
@@ -321,7 +330,10 @@ void EC_RigidBody::CreateCollisionShape()
         if (triangleMesh_)
         {
             // Need to first create a bvhTriangleMeshShape, then a scaled version of it to allow for individual scaling.
-            childShape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, true);
+            // Use the BVH shared by all the bodies of the mesh, instead of building one for each body.
+            childShape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, !triangleMeshBvh_);
+            if (triangleMeshBvh_)
+                static_cast<btBvhTriangleMeshShape*>(childShape_)->setOptimizedBvh(triangleMeshBvh_.get());
             shape_ = new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape*>(childShape_), btVector3(1.0f, 1.0f, 1.0f));
         }
         break;
@@ -507,35 +519,82 @@ void EC_RigidBody::SetClientExtrapolating(bool isClientExtrapolating)
 
 void EC_RigidBody::OnTerrainRegenerated()
 {
-    if (shapeType.Get() == Shape_HeightField)
-        CreateCollisionShape();
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (terrain && heightField_ && body_ && world_)
+    {
+        PROFILE(EC_RigidBody_UpdateHeightField);
+        const int oldWidth = heightFieldWidth_;
+        const int oldHeight = heightFieldHeight_;
+        const float oldMin = minHeight_;
+        const float oldMax = maxHeight_;
+        UpdateHeightValues(*terrain);
+        // The heightfield shape reads heightValues_ directly, so when the size and the height bounds stay the same,
+        // the patched values are already in use. Only the cached contacts of the body need to be recomputed.
+        if (heightFieldWidth_ == oldWidth && heightFieldHeight_ == oldHeight && minHeight_ == oldMin && maxHeight_ == oldMax)
+        {
+            btDiscreteDynamicsWorld *bulletWorld = world_->BulletWorld();
+            if (body_->getBroadphaseHandle())
+                bulletWorld->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(body_->getBroadphaseHandle(), bulletWorld->getDispatcher());
+            return;
+        }
+    }
+
+    CreateCollisionShape();
 }
 
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
-    if (!meshAsset || !meshAsset->ogreMesh.get())
+    if (!meshAsset)
+    {
         LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
-            asset->Name() + "\", but Ogre::Mesh pointer was null!");
-
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
+            asset->Name() + "\", but it is not an Ogre mesh asset!");
+        return;
+    }
 
-    if (mesh)
+    // The shapes are read from the asset cache, or built, on worker threads. Until then the previous shape remains.
+    pendingCollisionMesh_.reset();
+    bool ready = true;
+    if (shapeType.Get() == Shape_TriMesh)
     {
-        if (shapeType.Get() == Shape_TriMesh)
+        shared_ptr<btTriangleMesh> triangleMesh;
+        shared_ptr<btOptimizedBvh> bvh;
+        ready = owner_->GetTriangleMesh(meshAsset, triangleMesh, bvh);
+        if (ready)
         {
-            triangleMesh_ = owner_->GetTriangleMeshFromOgreMesh(mesh);
+            triangleMesh_ = triangleMesh;
+            triangleMeshBvh_ = bvh;
             CreateCollisionShape();
         }
-        if (shapeType.Get() == Shape_ConvexHull)
+    }
+    if (shapeType.Get() == Shape_ConvexHull)
+    {
+        shared_ptr<ConvexHullSet> convexHullSet;
+        ready = owner_->GetConvexHullSet(meshAsset, convexHullSet);
+        if (ready)
         {
-            convexHullSet_ = owner_->GetConvexHullSetFromOgreMesh(mesh);
+            convexHullSet_ = convexHullSet;
             CreateCollisionShape();
         }
+    }
 
+    if (ready)
+    {
         cachedShapeType_ = shapeType.Get();
         cachedSize_ = size.Get();
     }
+    else
+        pendingCollisionMesh_ = asset;
+}
+
+void EC_RigidBody::OnCollisionShapeReady(const QString &meshName)
+{
+    AssetPtr asset = pendingCollisionMesh_.lock();
+    if (asset && asset->Name() == meshName)
+        OnCollisionMeshAssetLoaded(asset);
 }
 
 void EC_RigidBody::AttributesChanged()
@@ -773,7 +832,7 @@ void EC_RigidBody::TerrainUpdated(IAttribute* attribute)
     EC_Terrain* terrain = terrain_.lock().get();
     if (!terrain)
         return;
-    /// \todo It is suboptimal to regenerate the whole heightfield when just the terrain's transform changes
+    // Recreates only the shape objects, the height values are copied again only for the changed patches.
     if ((attribute == &terrain->nodeTransformation) && (shapeType.Get() == Shape_HeightField))
         CreateCollisionShape();
 }
@@ -855,28 +914,16 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     if (!terrain)
         return;
     
-    int width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    int height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
-    
+    UpdateHeightValues(*terrain);
+    const int width = heightFieldWidth_;
+    const int height = heightFieldHeight_;
     if ((!width) || (!height))
         return;
     
-    heightValues_.resize(width * height);
-    
     float xzSpacing = 1.0f;
     float ySpacing = 1.0f;
-    float minY = 1000000000;
-    float maxY = -1000000000;
-    for(uint z = 0; z < (uint)height; ++z)
-        for(uint x = 0; x < (uint)width; ++x)
-        {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            heightValues_[z * width + x] = value;
-        }
+    float minY = minHeight_;
+    float maxY = maxHeight_;
 
     float3 scale = terrain->nodeTransformation.Get().scale;
     float3 bbMin(0, minY, 0);
@@ -900,6 +947,67 @@ void EC_RigidBody::CreateHeightFieldFromTerrain()
     compound->addChildShape(btTransform(btQuaternion(0,0,0,1), positionAdjust), heightField_);
 }
 
+void EC_RigidBody::UpdateHeightValues(const EC_Terrain &terrain)
+{
+    const int patchWidth = terrain.PatchWidth();
+    const int patchHeight = terrain.PatchHeight();
+    const int width = patchWidth * EC_Terrain::cPatchSize;
+    const int height = patchHeight * EC_Terrain::cPatchSize;
+
+    const bool resized = (width != heightFieldWidth_ || height != heightFieldHeight_);
+    if (!resized && terrain.HeightRevision() == heightRevision_)
+        return;
+
+    if (resized)
+    {
+        heightValues_.assign(width * height, 0.f);
+        patchMinHeights_.assign(patchWidth * patchHeight, 0.f);
+        patchMaxHeights_.assign(patchWidth * patchHeight, 0.f);
+        heightFieldWidth_ = width;
+        heightFieldHeight_ = height;
+    }
+    if (!width || !height)
+    {
+        heightRevision_ = terrain.HeightRevision();
+        minHeight_ = maxHeight_ = 0.f;
+        return;
+    }
+
+    for(int py = 0; py < patchHeight; ++py)
+        for(int px = 0; px < patchWidth; ++px)
+        {
+            const EC_Terrain::Patch &patch = terrain.GetPatch(px, py);
+            if (!resized && patch.heightRevision <= heightRevision_)
+                continue;
+
+            const bool hasData = (patch.heightData.size() == EC_Terrain::cPatchSize * EC_Terrain::cPatchSize);
+            float minY = hasData ? patch.heightData[0] : 0.f;
+            float maxY = minY;
+            for(int y = 0; y < EC_Terrain::cPatchSize; ++y)
+            {
+                float *dst = &heightValues_[(py * EC_Terrain::cPatchSize + y) * width + px * EC_Terrain::cPatchSize];
+                if (!hasData)
+                {
+                    std::fill(dst, dst + EC_Terrain::cPatchSize, 0.f);
+                    continue;
+                }
+                const float *src = &patch.heightData[y * EC_Terrain::cPatchSize];
+                for(int x = 0; x < EC_Terrain::cPatchSize; ++x)
+                {
+                    dst[x] = src[x];
+                    minY = std::min(minY, src[x]);
+                    maxY = std::max(maxY, src[x]);
+                }
+            }
+            patchMinHeights_[py * patchWidth + px] = minY;
+            patchMaxHeights_[py * patchWidth + px] = maxY;
+        }
+
+    minHeight_ = *std::min_element(patchMinHeights_.begin(), patchMinHeights_.end());
+    maxHeight_ = *std::max_element(patchMaxHeights_.begin(), patchMaxHeights_.end());
+    heightRevision_ = terrain.HeightRevision();
+}
+
 void EC_RigidBody::CreateConvexHullSetShape()
 {
     if (!convexHullSet_)
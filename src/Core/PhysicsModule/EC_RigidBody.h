@@ -325,6 +325,9 @@ private slots:
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
+    /// Called when PhysicsModule has read or built the collision shape of a mesh.
+    void OnCollisionShapeReady(const QString &meshName);
+
 private:
     /// Called when some of the attributes has been changed.
     void AttributesChanged();
@@ -337,6 +340,10 @@ private:
     
     /// Create a heightfield collisionshape from EC_Terrain
     void CreateHeightFieldFromTerrain();
+
+    /// Copies the changed terrain patches to the heightfield values, and updates the height bounds.
+    /** Copies all patches if the terrain size has changed, otherwise only the patches whose height data has changed since the last copy. */
+    void UpdateHeightValues(const EC_Terrain &terrain);
     
     /// Create a convex hull set collisionshape
     void CreateConvexHullSetShape();
@@ -405,6 +412,12 @@ private:
 
     /// Bullet triangle mesh
     shared_ptr<btTriangleMesh> triangleMesh_;
+
+    /// BVH of the triangle mesh, shared with the other rigid bodies using the same mesh. If null, the shape builds its own.
+    shared_ptr<btOptimizedBvh> triangleMeshBvh_;
+
+    /// Collision mesh whose shape is being read or built by PhysicsModule
+    AssetWeakPtr pendingCollisionMesh_;
     
     /// Convex hull set
     shared_ptr<Physics::ConvexHullSet> convexHullSet_;
@@ -414,4 +427,19 @@ private:
     
     /// Heightfield values, for the case the shape is a heightfield.
     std::vector<float> heightValues_;
+
+    /// Size of the terrain in vertices when heightValues_ was filled. Zero to copy all patches on the next update.
+    int heightFieldWidth_;
+    int heightFieldHeight_;
+
+    /// EC_Terrain::HeightRevision() when heightValues_ was last updated.
+    u32 heightRevision_;
+
+    /// Height bounds of each terrain patch in heightValues_.
+    std::vector<float> patchMinHeights_;
+    std::vector<float> patchMaxHeights_;
+
+    /// Height bounds of the whole heightfield.
+    float minHeight_;
+    float maxHeight_;
 };
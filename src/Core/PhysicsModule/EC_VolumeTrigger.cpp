@@ -6,6 +6,8 @@
 #include "EC_VolumeTrigger.h"
 #include "EC_RigidBody.h"
 #include "EC_Placeable.h"
+#include "OgreWorld.h"
+#include "PlaceableGrid.h"
 #include "Entity.h"
 #include "Scene/Scene.h"
 #include "PhysicsModule.h"
@@ -13,6 +15,7 @@
 #include "PhysicsUtils.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
+#include "Geometry/AABB.h"
 
 #include <OgreAxisAlignedBox.h>
 #include <QMap>
@@ -152,6 +155,38 @@ bool EC_VolumeTrigger::IsInsideVolume(const float3& point) const
            RayTestSingle(float3(point.x, point.y + 1e7f, point.z), point, rigidbody->GetRigidBody());
 }
 
+QList<Entity*> EC_VolumeTrigger::GetEntitiesWithPivotInside() const
+{
+    QList<Entity*> ret;
+    Entity* parent = ParentEntity();
+    Scene* scene = parent ? parent->ParentScene() : 0;
+    OgreWorldPtr world = scene ? scene->GetWorld<OgreWorld>() : OgreWorldPtr();
+    shared_ptr<EC_RigidBody> rigidbody = rigidbody_.lock();
+    if (!rigidbody || !world)
+    {
+        LogWarning("EC_VolumeTrigger::GetEntitiesWithPivotInside(): volume has no EC_RigidBody or the scene has no OgreWorld.");
+        return ret;
+    }
+
+    PROFILE(EC_VolumeTrigger_GetEntitiesWithPivotInside);
+
+    float3 aabbMin, aabbMax;
+    rigidbody->GetAabbox(aabbMin, aabbMax);
+    std::vector<EC_Placeable*> candidates;
+    world->Placeables()->QueryAABB(AABB(aabbMin, aabbMax), candidates);
+
+    const bool allInteresting = entities.Get().isEmpty();
+    for(size_t i = 0; i < candidates.size(); ++i)
+    {
+        Entity* entity = candidates[i]->ParentEntity();
+        if (!entity || entity == parent || (!allInteresting && !IsInterestingEntity(entity->Name())))
+            continue;
+        if (IsInsideVolume(candidates[i]->WorldPosition()))
+            ret.push_back(entity);
+    }
+    return ret;
+}
+
 void EC_VolumeTrigger::AttributesChanged()
 {
     /// \todo Attribute updates not handled yet, there are a bit too many problems of what signals to send after the update -cm
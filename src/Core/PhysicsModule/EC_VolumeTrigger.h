@@ -36,6 +36,7 @@
     <li> "IsInterestingEntity": @copydoc IsInterestingEntity
     <li> "IsPivotInside": @copydoc IsPivotInside
     <li> "IsInsideVolume":@copydoc IsInsideVolume
+    <li> "GetEntitiesWithPivotInside":@copydoc GetEntitiesWithPivotInside
     </ul>
 
     <b>Reacts on the following actions:</b>
@@ -144,6 +145,12 @@ public slots:
     /// Returns true if given world coordinate point is inside volume. 
     bool IsInsideVolume(const float3& point) const;
 
+    /// Returns the entities whose pivot point is inside this volume, also the ones that have no rigid body.
+    /** Does not depend on the physics collisions. The candidates within the bounding box of the volume are found from the
+        placeable grid of the scene, and tested with IsInsideVolume(). Only the interesting entities are returned.
+        @return list of entities */
+    QList<Entity*> GetEntitiesWithPivotInside() const;
+
 private slots:
 
     void UpdateSignals();
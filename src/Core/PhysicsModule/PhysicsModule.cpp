@@ -6,16 +6,20 @@
 #include "PhysicsModule.h"
 #include "PhysicsWorld.h"
 #include "CollisionShapeUtils.h"
+#include "CollisionShapeBuilder.h"
 #include "ConvexHull.h"
 #include "EC_RigidBody.h"
 #include "EC_VolumeTrigger.h"
 #include "EC_PhysicsMotor.h"
 #include "OgreRenderingModule.h"
+#include "OgreMeshAsset.h"
 #include "EC_Mesh.h"
 #include "EC_Placeable.h"
 #include "EC_Terrain.h"
 #include "Entity.h"
 #include "SceneAPI.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
 #include "Framework.h"
 #include "Scene/Scene.h"
 #include "Profiler.h"
@@ -37,6 +41,9 @@
 
 #include <QtScript>
 #include <QTreeWidgetItem>
+#include <QFile>
+#include <QFileInfo>
+#include <QCryptographicHash>
 
 #include <Ogre.h>
 
@@ -72,6 +79,8 @@ void PhysicsModule::Load()
 void PhysicsModule::Initialize()
 {
     framework_->RegisterDynamicObject("physics", this);
+
+    collisionShapeBuilder_ = MAKE_SHARED(CollisionShapeBuilder);
     
     connect(framework_->Scene(), SIGNAL(SceneAdded(const QString&)), this, SLOT(OnSceneAdded(const QString&)));
     connect(framework_->Scene(), SIGNAL(SceneRemoved(const QString&)), this, SLOT(OnSceneRemoved(const QString&)));
@@ -108,6 +117,8 @@ void PhysicsModule::Initialize()
 
 void PhysicsModule::Uninitialize()
 {
+    // Waits for the ongoing collision shape jobs to finish.
+    collisionShapeBuilder_.reset();
 }
 
 void PhysicsModule::ToggleDebugGeometry()
@@ -173,6 +184,15 @@ void PhysicsModule::AutoCollisionMesh()
 void PhysicsModule::Update(f64 frametime)
 {
     PROFILE(PhysicsModule_Update);
+
+    if (collisionShapeBuilder_)
+    {
+        std::vector<CollisionShapeJobPtr> jobs;
+        collisionShapeBuilder_->TakeFinishedJobs(jobs);
+        for(size_t j = 0; j < jobs.size(); ++j)
+            CollisionShapeJobFinished(jobs[j]);
+    }
+
     // Loop all the physics worlds and update them.
     PhysicsWorldMap::iterator i = physicsWorlds_.begin();
     while(i != physicsWorlds_.end())
@@ -272,6 +292,161 @@ shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromOgreMesh(Ogre::Mesh
     return ptr;
 }
 
+bool PhysicsModule::GetTriangleMesh(OgreMeshAsset *mesh, shared_ptr<btTriangleMesh> &triangleMesh, shared_ptr<btOptimizedBvh> &bvh)
+{
+    triangleMesh.reset();
+    bvh.reset();
+    if (!mesh || !collisionShapeBuilder_)
+        return true;
+
+    QByteArray meshHash;
+    const QString shapeKey = CollisionShapeKey(mesh, meshHash);
+    TriangleMeshMap::const_iterator iter = triangleMeshes_.find(shapeKey.toStdString());
+    if (iter != triangleMeshes_.end())
+    {
+        triangleMesh = iter->second;
+        BvhMap::const_iterator bvhIter = triangleMeshBvhs_.find(shapeKey.toStdString());
+        if (bvhIter != triangleMeshBvhs_.end())
+            bvh = bvhIter->second;
+        return true;
+    }
+
+    RequestCollisionShape(mesh, shapeKey, meshHash, false);
+    return false;
+}
+
+bool PhysicsModule::GetConvexHullSet(OgreMeshAsset *mesh, shared_ptr<ConvexHullSet> &convexHullSet)
+{
+    convexHullSet.reset();
+    if (!mesh || !collisionShapeBuilder_)
+        return true;
+
+    QByteArray meshHash;
+    const QString shapeKey = CollisionShapeKey(mesh, meshHash);
+    ConvexHullSetMap::const_iterator iter = convexHullSets_.find(shapeKey.toStdString());
+    if (iter != convexHullSets_.end())
+    {
+        convexHullSet = iter->second;
+        return true;
+    }
+
+    RequestCollisionShape(mesh, shapeKey, meshHash, true);
+    return false;
+}
+
+QString PhysicsModule::CollisionShapeKey(OgreMeshAsset *mesh, QByteArray &meshHash)
+{
+    // The hash of a cached mesh is known by the asset cache. Other meshes, such as local assets, are hashed from their disk source.
+    AssetCache *cache = framework_->Asset()->Cache();
+    meshHash = cache ? cache->ContentHash(mesh->Name()) : QByteArray();
+    if (meshHash.isEmpty() && !mesh->DiskSource().isEmpty())
+        meshHash = DiskSourceHash(mesh->DiskSource());
+    return meshHash.isEmpty() ? mesh->Name() : QString(meshHash.toHex());
+}
+
+QByteArray PhysicsModule::DiskSourceHash(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    if (!info.isFile())
+        return QByteArray();
+
+    FileHash &known = diskSourceHashes_[info.absoluteFilePath()];
+    if (known.hash.isEmpty() || known.lastModified != info.lastModified() || known.size != info.size())
+    {
+        PROFILE(PhysicsModule_DiskSourceHash);
+        QFile file(info.absoluteFilePath());
+        if (!file.open(QIODevice::ReadOnly))
+            return QByteArray();
+        known.hash = QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1);
+        known.lastModified = info.lastModified();
+        known.size = info.size();
+    }
+    return known.hash;
+}
+
+void PhysicsModule::RequestCollisionShape(OgreMeshAsset *mesh, const QString &shapeKey, const QByteArray &meshHash, bool convexHull)
+{
+    PendingShapeMap &pending = convexHull ? pendingConvexHullSets_ : pendingTriangleMeshes_;
+    PendingShapeMap::iterator iter = pending.find(shapeKey);
+    if (iter != pending.end())
+    {
+        iter->insert(mesh->Name());
+        return;
+    }
+
+    pending[shapeKey].insert(mesh->Name());
+    StartCollisionShapeJob(mesh, shapeKey, meshHash, convexHull, true);
+}
+
+void PhysicsModule::StartCollisionShapeJob(OgreMeshAsset *mesh, const QString &shapeKey, const QByteArray &meshHash, bool convexHull, bool readFromCache)
+{
+    CollisionShapeJobPtr job(new CollisionShapeJob);
+    job->shapeKey = shapeKey;
+    job->meshName = mesh->Name();
+    job->convexHull = convexHull;
+    job->meshHash = meshHash;
+    // The shape can be cached only if the content hash of the mesh is known.
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (cache && readFromCache && !meshHash.isEmpty())
+        job->cacheFile = cache->FindInCache(CollisionShapeBuilder::CacheRef(meshHash, convexHull));
+
+    // Only a shape that is not cached needs the triangles from the Ogre mesh buffers.
+    if (job->cacheFile.isEmpty())
+    {
+        if (mesh->ogreMesh.get())
+        {
+            PROFILE(PhysicsModule_GetTrianglesFromMesh);
+            GetTrianglesFromMesh(mesh->ogreMesh.get(), job->triangles);
+        }
+        job->serialize = cache && !meshHash.isEmpty();
+    }
+
+    collisionShapeBuilder_->Start(job);
+}
+
+void PhysicsModule::CollisionShapeJobFinished(const CollisionShapeJobPtr &job)
+{
+    PROFILE(PhysicsModule_CollisionShapeJobFinished);
+
+    if (!job->error.isEmpty())
+    {
+        if (!job->cacheFile.isEmpty())
+        {
+            // The cached shape is outdated or corrupted. Build it again, if the mesh still exists.
+            LogDebug("PhysicsModule::CollisionShapeJobFinished: " + job->error + ", rebuilding the collision shape for " + job->meshName);
+            OgreMeshAssetPtr mesh = dynamic_pointer_cast<OgreMeshAsset>(framework_->Asset()->GetAsset(job->meshName));
+            if (mesh)
+            {
+                StartCollisionShapeJob(mesh.get(), job->shapeKey, job->meshHash, job->convexHull, false);
+                return;
+            }
+        }
+        else
+            LogError("PhysicsModule::CollisionShapeJobFinished: Failed to build the collision shape for " + job->meshName + ": " + job->error);
+    }
+
+    const std::string shapeKey = job->shapeKey.toStdString();
+    const bool succeeded = job->error.isEmpty();
+    if (job->convexHull)
+        convexHullSets_[shapeKey] = succeeded ? job->convexHullSet : shared_ptr<ConvexHullSet>();
+    else
+    {
+        triangleMeshes_[shapeKey] = succeeded ? job->triangleMesh : shared_ptr<btTriangleMesh>();
+        triangleMeshBvhs_[shapeKey] = succeeded ? job->bvh : shared_ptr<btOptimizedBvh>();
+    }
+
+    AssetCache *cache = framework_->Asset()->Cache();
+    if (succeeded && !job->cacheData.empty() && cache)
+    {
+        PROFILE(PhysicsModule_CollisionShapeCacheStore);
+        cache->StoreAsset(&job->cacheData[0], job->cacheData.size(), CollisionShapeBuilder::CacheRef(job->meshHash, job->convexHull));
+    }
+
+    const QSet<QString> meshNames = (job->convexHull ? pendingConvexHullSets_ : pendingTriangleMeshes_).take(job->shapeKey);
+    foreach(const QString &meshName, meshNames)
+        emit CollisionShapeReady(meshName);
+}
+
 #ifdef PROFILING
 static QTreeWidgetItem *FindItemByName(QTreeWidgetItem *parent, const char *name)
 {
@@ -9,6 +9,10 @@
 
 #include <set>
 #include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QDateTime>
+#include <QByteArray>
 
 namespace Ogre
 {
@@ -16,6 +20,7 @@ namespace Ogre
 }
 
 class QScriptEngine;
+class OgreMeshAsset;
 
 #ifdef PROFILING
 class QTreeWidgetItem;
@@ -47,6 +52,16 @@ public:
     /** If already has been generated, returns the previously created one */
     shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
 
+    /// Get a Bullet triangle mesh and its BVH corresponding to a mesh asset, without blocking.
+    /** Meshes with the same content share the triangle mesh and the BVH. If they are not in memory yet, they are read from
+        the asset cache, or built, on a worker thread, false is returned, and CollisionShapeReady is emitted for the mesh
+        when they are available. The pointers are null if the mesh had no triangles. */
+    bool GetTriangleMesh(OgreMeshAsset *mesh, shared_ptr<btTriangleMesh> &triangleMesh, shared_ptr<btOptimizedBvh> &bvh);
+
+    /// Get a Bullet convex hull set corresponding to a mesh asset, without blocking.
+    /** Works like GetTriangleMesh. The pointer is null if the hull generation failed. */
+    bool GetConvexHullSet(OgreMeshAsset *mesh, shared_ptr<ConvexHullSet> &convexHullSet);
+
     /// Set default physics update rate for new physics worlds
     void SetDefaultPhysicsUpdatePeriod(float updatePeriod);
 
@@ -78,6 +93,10 @@ public slots:
     /// Initialize physics datatypes for a script engine
     void OnScriptEngineCreated(QScriptEngine* engine);
 
+signals:
+    /// The collision shape requested for a mesh asset with GetTriangleMesh or GetConvexHullSet is available.
+    void CollisionShapeReady(const QString &meshName);
+
 private slots:
     /// New scene has been created
     void OnSceneAdded(const QString &name);
@@ -96,6 +115,46 @@ private:
     typedef std::map<std::string, shared_ptr<ConvexHullSet> > ConvexHullSetMap;
     /// Bullet convex hull sets generated from Ogre meshes
     ConvexHullSetMap convexHullSets_;
+
+    typedef std::map<std::string, shared_ptr<btOptimizedBvh> > BvhMap;
+    /// BVHs of the triangle meshes built by collisionShapeBuilder_, by the same key
+    BvhMap triangleMeshBvhs_;
+
+    typedef QHash<QString, QSet<QString> > PendingShapeMap;
+    /// Names of the mesh assets waiting for each triangle mesh being read or built
+    PendingShapeMap pendingTriangleMeshes_;
+    /// Names of the mesh assets waiting for each convex hull set being read or built
+    PendingShapeMap pendingConvexHullSets_;
+
+    /// Content hash of a mesh file outside the asset cache, and the file version it was computed from
+    struct FileHash
+    {
+        FileHash() : size(0) {}
+        QDateTime lastModified;
+        qint64 size;
+        QByteArray hash;
+    };
+    /// Content hashes of the mesh files outside the asset cache by absolute path
+    QHash<QString, FileHash> diskSourceHashes_;
+
+    /// Reads and builds the collision shapes on worker threads
+    shared_ptr<CollisionShapeBuilder> collisionShapeBuilder_;
+
+    /// Returns the key of the collision shapes of a mesh asset in the shape maps, and the content hash of the mesh if known.
+    /** Meshes with the same content have the same key. Without a content hash, the shapes are identified by the mesh name. */
+    QString CollisionShapeKey(OgreMeshAsset *mesh, QByteArray &meshHash);
+
+    /// Returns the SHA-1 of the contents of a file, or an empty array if it can not be read. Hashes each version of a file once.
+    QByteArray DiskSourceHash(const QString &fileName);
+
+    /// Adds the mesh to the meshes waiting for a collision shape, and starts a job for the shape unless one is already running.
+    void RequestCollisionShape(OgreMeshAsset *mesh, const QString &shapeKey, const QByteArray &meshHash, bool convexHull);
+
+    /// Starts a job that reads the collision shape of a mesh from the asset cache, or builds it if readFromCache is false or it is not cached.
+    void StartCollisionShapeJob(OgreMeshAsset *mesh, const QString &shapeKey, const QByteArray &meshHash, bool convexHull, bool readFromCache);
+
+    /// Stores the shape of a finished job, and emits CollisionShapeReady for the meshes waiting for it.
+    void CollisionShapeJobFinished(const CollisionShapeJobPtr &job);
     
     float defaultPhysicsUpdatePeriod_;
     int defaultMaxSubSteps_;
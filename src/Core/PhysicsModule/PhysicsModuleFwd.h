@@ -15,6 +15,9 @@ namespace Physics
     class PhysicsWorld;
     struct ConvexHull;
     struct ConvexHullSet;
+    struct CollisionShapeJob;
+    class CollisionShapeBuilder;
+    typedef shared_ptr<CollisionShapeJob> CollisionShapeJobPtr;
 }
 
 class PhysicsRaycastResult;
@@ -26,6 +29,7 @@ typedef weak_ptr<Physics::PhysicsWorld> PhysicsWorldWeakPtr;
 
 // From Bullet:
 class btTriangleMesh;
+class btOptimizedBvh;
 class btCollisionConfiguration;
 class btBroadphaseInterface;
 class btConstraintSolver;
@@ -26,9 +26,13 @@
 #include "FileUtils.h"
 
 #include <QDir>
+#include <QFile>
 #include <QFileSystemWatcher>
 #include <QList>
 #include <QMap>
+#include <QSet>
+
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
@@ -480,6 +484,9 @@ void AssetAPI::ForgetAsset(AssetPtr asset, bool removeDiskSource)
     if (diskSourceChangeWatcher && !asset->DiskSource().isEmpty())
         diskSourceChangeWatcher->removePath(asset->DiskSource());
     assets.erase(iter);
+
+    // The assets that depend on the forgotten asset are now waiting for it again.
+    RemoveAssetDependencies(asset->Name());
 }
 
 void AssetAPI::DeleteAssetFromStorage(QString assetRef)
@@ -686,7 +693,7 @@ void AssetAPI::Reset()
     defaultStorage.reset();
     readyTransfers.clear();
     readySubTransfers.clear();
-    assetDependencies.clear();
+    dependencyGraph.clear();
     currentUploadTransfers.clear();
     currentTransfers.clear();
     providers.clear();
@@ -714,7 +721,7 @@ AssetTransferPtr AssetAPI::GetPendingTransfer(QString assetRef) const
     return AssetTransferPtr();
 }
 
-AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, bool forceTransfer)
+AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, bool forceTransfer, float priority)
 {
     // This is a function that handles all asset requests made to the Tundra asset system.
     // Note that touching this function has many implications all around the complex asset load routines
@@ -795,7 +802,11 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
             LogWarning("AssetAPI::RequestAsset: Asset \"" + assetRef + "\" first requested by type " + 
                 transfer->assetType + ", but now requested by type " + assetType + ".");
         }
-        
+
+        // The requests that do not identify themselves share one priority on the transfer. The most urgent of them decides it.
+        if (priority != 0.f && priority > transfer->Priority())
+            transfer->SetPriority(priority);
+
         return transfer;
     }
 
@@ -906,6 +917,30 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
         return AssetTransferPtr();
     }
 
+    // If the content of the asset is known by its hash, and the same content is already in the cache under another
+    // asset ref, load the asset from the cache instead of downloading it again. The readyTransfers list does the
+    // AssetTransferCompleted call on the next frame, like for the virtual transfers above.
+    if (!isSubAsset && !forceTransfer && assetCache && !contentHashes.isEmpty() && ParseAssetRef(assetRef) == AssetRefExternalUrl)
+    {
+        QHash<QString, QByteArray>::const_iterator hashIter = contentHashes.find(assetRef);
+        QString diskSource = hashIter != contentHashes.end() ? assetCache->LinkToContent(assetRef, hashIter.value()) : QString();
+        if (!diskSource.isEmpty())
+        {
+            AssetTransferPtr transfer = AssetTransferPtr(new IAssetTransfer());
+            transfer->source.ref = assetRef;
+            transfer->assetType = assetType;
+            transfer->asset = existingAsset;
+            transfer->provider = provider;
+            transfer->storage = provider->GetStorageForAssetRef(assetRef);
+            transfer->diskSourceType = IAsset::Cached;
+            transfer->SetCachingBehavior(false, diskSource);
+
+            currentTransfers[assetRef] = transfer;
+            readyTransfers.push_back(transfer);
+            return transfer;
+        }
+    }
+
     // Perform the actual request from the provider.
     AssetTransferPtr transfer = provider->RequestAsset(assetRef, assetType);
     if (!transfer)
@@ -919,6 +954,10 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
     // upcoming download and load process will reload the asset data instead of creating a new asset.
     transfer->asset = existingAsset;
     transfer->provider = provider;
+    // Providers that queue their requests start them on a later Update, so the priority can still be set here.
+    if (priority != 0.f)
+        transfer->SetPriority(priority);
+    connect(transfer.get(), SIGNAL(PriorityChanged(IAssetTransfer*)), this, SLOT(OnTransferPriorityChanged(IAssetTransfer*)));
 
     // Store the newly allocated AssetTransfer internally, so that any duplicated requests to this asset 
     // will return the same request pointer, so we'll avoid multiple downloads to the exact same asset.
@@ -969,9 +1008,58 @@ AssetTransferPtr AssetAPI::RequestAsset(QString assetRef, QString assetType, boo
     }
 }
 
-AssetTransferPtr AssetAPI::RequestAsset(const AssetReference &ref, bool forceTransfer)
+void AssetAPI::SetContentHash(QString assetRef, const QString &sha1)
+{
+    assetRef = ResolveAssetRef("", assetRef);
+    QByteArray hash = QByteArray::fromHex(sha1.trimmed().toAscii());
+    if (hash.size() == 20)
+        contentHashes[assetRef] = hash;
+    else
+    {
+        if (!sha1.trimmed().isEmpty())
+            LogWarning("AssetAPI::SetContentHash: \"" + sha1 + "\" is not a SHA-1 hash, forgetting the content hash of \"" + assetRef + "\".");
+        contentHashes.remove(assetRef);
+    }
+}
+
+QString AssetAPI::ContentHash(QString assetRef) const
 {
-    return RequestAsset(ref.ref, ref.type, forceTransfer);
+    QHash<QString, QByteArray>::const_iterator iter = contentHashes.find(ResolveAssetRef("", assetRef));
+    return iter != contentHashes.end() ? QString::fromAscii(iter.value().toHex()) : QString();
+}
+
+int AssetAPI::LoadContentHashManifest(const QString &filename, const QString &baseRef)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        LogError("AssetAPI::LoadContentHashManifest: Failed to open " + filename + " for reading.");
+        return -1;
+    }
+
+    int numHashes = 0;
+    while(!file.atEnd())
+    {
+        // sha1sum writes "<hash> <name>" or "<hash> *<name>" for binary mode.
+        QString line = QString::fromUtf8(file.readLine()).trimmed();
+        int separator = line.indexOf(' ');
+        if (line.isEmpty() || line.startsWith('#') || separator <= 0)
+            continue;
+        QString name = line.mid(separator + 1).trimmed();
+        if (name.startsWith('*'))
+            name = name.mid(1);
+        QByteArray hash = QByteArray::fromHex(line.left(separator).toAscii());
+        if (hash.size() != 20 || name.isEmpty())
+            continue;
+        contentHashes[ResolveAssetRef(baseRef, name)] = hash;
+        ++numHashes;
+    }
+    return numHashes;
+}
+
+AssetTransferPtr AssetAPI::RequestAsset(const AssetReference &ref, bool forceTransfer, float priority)
+{
+    return RequestAsset(ref.ref, ref.type, forceTransfer, priority);
 }
 
 AssetProviderPtr AssetAPI::ProviderForAssetRef(QString assetRef, QString assetType) const
@@ -1218,6 +1306,9 @@ AssetPtr AssetAPI::CreateNewAsset(QString type, QString name, AssetStoragePtr st
     // Remember this asset in the global AssetAPI storage.
     assets[name] = asset;
 
+    // Track the unloads of the asset, so that the assets depending on it know to wait for it again.
+    connect(asset.get(), SIGNAL(Unloaded(IAsset*)), this, SLOT(OnAssetUnloaded(IAsset*)), Qt::UniqueConnection);
+
     ///\bug DiskSource and DiskSourceType are not set yet.
     {
         PROFILE(AssetAPI_CreateNewAsset_emit_AssetCreated);
@@ -1611,6 +1702,17 @@ void AssetAPI::AssetTransferCompleted(IAssetTransfer *transfer_)
         // If disksource is still empty, forcibly look up if the asset exists in the cache now.
         if (assetDiskSource.isEmpty() && assetCache)
             assetDiskSource = assetCache->FindInCache(transfer->source.ref);
+
+        // Forget a known content hash that does not match what was downloaded, so that the stale hash is not used to share content.
+        if (assetCache && transfer->rawAssetData.size() > 0 && contentHashes.contains(transfer->source.ref))
+        {
+            QByteArray hash = assetCache->ContentHash(transfer->source.ref);
+            if (!hash.isEmpty() && hash != contentHashes[transfer->source.ref])
+            {
+                LogWarning("AssetAPI: The content of asset \"" + transfer->source.ref + "\" does not match its known content hash.");
+                contentHashes.remove(transfer->source.ref);
+            }
+        }
         
         // Save for the asset the storage and provider it came from.
         transfer->asset->SetDiskSource(assetDiskSource.trimmed());
@@ -1712,6 +1814,8 @@ void AssetAPI::AssetLoadCompleted(const QString assetRef)
 
     if (asset.get())
     {
+        // Update the dependency graph with the references of the new data before the asset queries its pending dependencies.
+        NotifyAssetDependenciesChanged(asset);
         asset->LoadCompleted();
 
         // Add to watch this path for changed, note this does nothing if the path is already added
@@ -1766,6 +1870,8 @@ void AssetAPI::AssetLoadFailed(const QString assetRef)
     AssetTransferMap::iterator iter = FindTransferIterator(assetRef);
     AssetMap::const_iterator iter2 = assets.find(assetRef);
 
+    UpdateDependencySatisfied(DependencyKey(assetRef));
+
     if (iter != currentTransfers.end())
     {
         AssetTransferPtr transfer = iter->second;
@@ -1875,21 +1981,7 @@ void AssetAPI::AssetDependenciesCompleted(AssetTransferPtr transfer)
 void AssetAPI::NotifyAssetDependenciesChanged(AssetPtr asset)
 {
     PROFILE(AssetAPI_NotifyAssetDependenciesChanged);
-
-    /// Delete all old stored asset dependencies for this asset.
-    RemoveAssetDependencies(asset->Name());
-
-    std::vector<AssetReference> refs = asset->FindReferences();
-    for(size_t i = 0; i < refs.size(); ++i)
-    {
-        // Turn named storage (and default storage) specifiers to absolute specifiers.
-        QString ref = refs[i].ref;
-        if (ref.isEmpty())
-            continue;
-
-        // Remember this assetref for future lookup.
-        assetDependencies.push_back(std::make_pair(asset->Name(), ref));
-    }
+    UpdateDependencyEdges(asset);
 }
 
 void AssetAPI::RequestAssetDependencies(AssetPtr asset)
@@ -1898,6 +1990,10 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
     // Make sure we have most up-to-date internal view of the asset dependencies.
     NotifyAssetDependenciesChanged(asset);
 
+    // The dependencies are needed as urgently as the asset itself. The transfer of the asset requests them as their parent,
+    // so that OnTransferPriorityChanged can later change its priority on them.
+    AssetTransferPtr assetTransfer = GetPendingTransfer(asset->Name());
+
     std::vector<AssetReference> refs = asset->FindReferences();
     for(size_t i = 0; i < refs.size(); ++i)
     {
@@ -1909,20 +2005,159 @@ void AssetAPI::RequestAssetDependencies(AssetPtr asset)
         if (!existing || !existing->IsLoaded())
         {
 //            LogDebug("Asset " + asset->ToString() + " depends on asset " + ref.ref + " (type=\"" + ref.type + "\") which has not been loaded yet. Requesting..");
-            RequestAsset(ref);
+            AssetTransferPtr dependency = RequestAsset(ref);
+            if (dependency && assetTransfer && dependency != assetTransfer)
+                dependency->SetPriority(assetTransfer->Priority(), assetTransfer.get());
         }
     }
 }
 
+void AssetAPI::OnTransferPriorityChanged(IAssetTransfer *transfer)
+{
+    // Only an asset that has been downloaded knows its dependencies. Each dependency tracks the priority of each of its parent
+    // transfers and takes the highest, so lowering the priority of one parent lowers a shared dependency only as far as its
+    // other parents allow. The change continues down the dependency chain.
+    if (!transfer->asset)
+        return;
+    std::vector<AssetReference> refs = transfer->asset->FindReferences();
+    for(size_t i = 0; i < refs.size(); ++i)
+    {
+        AssetTransferPtr dependency = refs[i].ref.isEmpty() ? AssetTransferPtr() : GetPendingTransfer(refs[i].ref);
+        if (dependency && dependency.get() != transfer)
+            dependency->SetPriority(transfer->Priority(), transfer);
+    }
+}
+
 void AssetAPI::RemoveAssetDependencies(QString asset)
 {
     PROFILE(AssetAPI_RemoveAssetDependencies);
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
-        if (QString::compare(assetDependencies[i].first, asset, Qt::CaseInsensitive) == 0)
+    const QString key = DependencyKey(asset);
+    ClearDependencyEdges(key);
+    UpdateDependencySatisfied(key);
+    PruneDependencyNode(key);
+}
+
+QString AssetAPI::DependencyKey(const QString &assetRef)
+{
+    return assetRef.trimmed().toLower();
+}
+
+void AssetAPI::UpdateDependencyEdges(const AssetPtr &asset) const
+{
+    const QString key = DependencyKey(asset->Name());
+    ClearDependencyEdges(key);
+    // Note: the node references are not held over the calls below, as inserting to the graph invalidates them.
+    dependencyGraph[key].ref = asset->Name();
+
+    std::vector<AssetReference> refs = asset->FindReferences();
+    for(size_t i = 0; i < refs.size(); ++i)
+    {
+        if (refs[i].ref.isEmpty())
+            continue;
+        const QString dependencyKey = DependencyKey(refs[i].ref);
+        if (dependencyKey == key)
+            continue;
+        const std::vector<QString> &dependencies = dependencyGraph[key].dependencies;
+        if (std::find(dependencies.begin(), dependencies.end(), dependencyKey) != dependencies.end())
+            continue;
+
+        EnsureDependencyNode(refs[i]);
+
+        AssetDependencyGraph::iterator node = dependencyGraph.find(key);
+        AssetDependencyGraph::iterator dependency = dependencyGraph.find(dependencyKey);
+        node->dependencies.push_back(dependencyKey);
+        dependency->dependents.insert(key);
+        if (!dependency->ignored && !dependency->satisfied)
+            ++node->numPending;
+    }
+
+    UpdateDependencySatisfied(key);
+}
+
+void AssetAPI::EnsureDependencyNode(const AssetReference &ref) const
+{
+    const QString key = DependencyKey(ref.ref);
+    if (dependencyGraph.contains(key))
+        return;
+
+    AssetDependencyNode &node = dependencyGraph[key];
+    node.ref = ref.ref;
+    // We silently ignore the dependencies to assets of types that are disabled.
+    node.ignored = dynamic_cast<NullAssetFactory*>(GetAssetTypeFactory(GetResourceTypeFromAssetRef(ref)).get()) != 0;
+
+    // If the asset is already loaded, its own dependencies decide whether it is satisfied.
+    // The node exists at this point, so a dependency cycle does not recurse back here.
+    AssetPtr existing = GetAsset(ref.ref);
+    if (existing && existing->IsLoaded() && DependencyKey(existing->Name()) == key)
+        UpdateDependencyEdges(existing);
+    else
+        UpdateDependencySatisfied(key);
+}
+
+void AssetAPI::ClearDependencyEdges(const QString &key) const
+{
+    AssetDependencyGraph::iterator node = dependencyGraph.find(key);
+    if (node == dependencyGraph.end())
+        return;
+
+    std::vector<QString> dependencies;
+    dependencies.swap(node->dependencies);
+    node->numPending = 0;
+    for(size_t i = 0; i < dependencies.size(); ++i)
+    {
+        AssetDependencyGraph::iterator dependency = dependencyGraph.find(dependencies[i]);
+        if (dependency != dependencyGraph.end())
+        {
+            dependency->dependents.remove(key);
+            PruneDependencyNode(dependencies[i]);
+        }
+    }
+}
+
+void AssetAPI::PruneDependencyNode(const QString &key) const
+{
+    AssetDependencyGraph::iterator node = dependencyGraph.find(key);
+    if (node != dependencyGraph.end() && node->dependencies.empty() && node->dependents.isEmpty())
+        dependencyGraph.erase(node);
+}
+
+void AssetAPI::UpdateDependencySatisfied(const QString &key) const
+{
+    std::vector<QString> unvisited(1, key);
+    while(!unvisited.empty())
+    {
+        AssetDependencyGraph::iterator node = dependencyGraph.find(unvisited.back());
+        unvisited.pop_back();
+        if (node == dependencyGraph.end())
+            continue;
+
+        AssetPtr asset = GetAsset(node->ref);
+        const bool satisfied = asset && !asset->IsEmpty() && asset->IsLoaded() && node->numPending == 0;
+        if (satisfied == node->satisfied)
+            continue;
+        node->satisfied = satisfied;
+        if (node->ignored)
+            continue;
+
+        // Only the assets depending on this one can change state as a result.
+        foreach(const QString &dependentKey, node->dependents)
         {
-            assetDependencies.erase(assetDependencies.begin() + i);
-            --i;
+            AssetDependencyGraph::iterator dependent = dependencyGraph.find(dependentKey);
+            if (dependent == dependencyGraph.end())
+                continue;
+            dependent->numPending += (satisfied ? -1 : 1);
+            unvisited.push_back(dependentKey);
         }
+    }
+}
+
+AssetAPI::AssetDependenciesMap AssetAPI::DebugGetAssetDependencies() const
+{
+    AssetDependenciesMap dependencies;
+    for(AssetDependencyGraph::const_iterator iter = dependencyGraph.begin(); iter != dependencyGraph.end(); ++iter)
+        for(size_t i = 0; i < iter->dependencies.size(); ++i)
+            dependencies.push_back(std::make_pair(iter.key(), iter->dependencies[i]));
+    return dependencies;
 }
 
 std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
@@ -1930,14 +2165,18 @@ std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
     PROFILE(AssetAPI_FindDependents);
 
     std::vector<AssetPtr> dependents;
-    for(size_t i = 0; i < assetDependencies.size(); ++i)
+    AssetDependencyGraph::const_iterator node = dependencyGraph.find(DependencyKey(dependee));
+    if (node == dependencyGraph.end())
+        return dependents;
+
+    foreach(const QString &dependentKey, node->dependents)
     {
-        if (QString::compare(assetDependencies[i].second, dependee, Qt::CaseInsensitive) == 0)
-        {
-            AssetMap::iterator iter = assets.find(assetDependencies[i].first);
-            if (iter != assets.end())
-                dependents.push_back(iter->second);
-        }
+        AssetDependencyGraph::const_iterator dependent = dependencyGraph.find(dependentKey);
+        if (dependent == dependencyGraph.end())
+            continue;
+        AssetMap::iterator iter = assets.find(dependent->ref);
+        if (iter != assets.end())
+            dependents.push_back(iter->second);
     }
     return dependents;
 }
@@ -1945,42 +2184,38 @@ std::vector<AssetPtr> AssetAPI::FindDependents(QString dependee)
 int AssetAPI::NumPendingDependencies(AssetPtr asset) const
 {
     PROFILE(AssetAPI_NumPendingDependencies);
-    int numDependencies = 0;
+    const QString key = DependencyKey(asset->Name());
+    if (!dependencyGraph.contains(key))
+        UpdateDependencyEdges(asset);
 
-    std::vector<AssetReference> refs = asset->FindReferences();
-    for(size_t i = 0; i < refs.size(); ++i)
+    QSet<QString> visited;
+    visited.insert(key);
+    return CountPendingDependencies(key, visited);
+}
+
+int AssetAPI::CountPendingDependencies(const QString &key, QSet<QString> &visited) const
+{
+    AssetDependencyGraph::const_iterator node = dependencyGraph.find(key);
+    if (node == dependencyGraph.end() || node->numPending == 0)
+        return 0;
+
+    const std::vector<QString> &dependencies = node->dependencies;
+    int numDependencies = 0;
+    for(size_t i = 0; i < dependencies.size(); ++i)
     {
-        QString ref = refs[i].ref;
-        if (ref.isEmpty())
+        if (visited.contains(dependencies[i]))
             continue;
+        visited.insert(dependencies[i]);
 
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(GetAssetTypeFactory(GetResourceTypeFromAssetRef(refs[i])).get()))
+        AssetDependencyGraph::const_iterator dependency = dependencyGraph.find(dependencies[i]);
+        if (dependency == dependencyGraph.end() || dependency->ignored || dependency->satisfied)
             continue;
-
-        AssetPtr existing = GetAsset(refs[i].ref);
-        if (!existing)
-        {
-            // Not loaded, just mark the single one
+        // Count the unloaded dependency itself, and everything pending down the chain below it.
+        AssetPtr existing = GetAsset(dependency->ref);
+        if (!existing || existing->IsEmpty() || !existing->IsLoaded())
             ++numDependencies;
-        }
-        else
-        {
-            // If asset is empty, count it as an unloaded dependency
-            if (existing->IsEmpty())
-                ++numDependencies;
-            else
-            {
-                if (!existing->IsLoaded())
-                    ++numDependencies;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                numDependencies += NumPendingDependencies(existing);
-            }
-        }
+        numDependencies += CountPendingDependencies(dependencies[i], visited);
     }
-
     return numDependencies;
 }
 
@@ -1988,38 +2223,24 @@ bool AssetAPI::HasPendingDependencies(AssetPtr asset) const
 {
     PROFILE(AssetAPI_HasPendingDependencies);
 
-    std::vector<AssetReference> refs = asset->FindReferences();
-    for(size_t i = 0; i < refs.size(); ++i)
+    const QString key = DependencyKey(asset->Name());
+    AssetDependencyGraph::iterator node = dependencyGraph.find(key);
+    if (node == dependencyGraph.end())
     {
-        if (refs[i].ref.isEmpty())
-            continue;
-
-        // We silently ignore this dependency if the asset type in question is disabled.
-        if (dynamic_cast<NullAssetFactory*>(GetAssetTypeFactory(GetResourceTypeFromAssetRef(refs[i])).get()))
-            continue;
-
-        AssetPtr existing = GetAsset(refs[i].ref);
-        if (!existing) // Not loaded, just mark the single one
-            return true;
-        else
-        {            
-            if (existing->IsEmpty())
-                return true; // If asset is empty, count it as an unloaded dependency
-            else
-            {
-                if (!existing->IsLoaded())
-                    return true;
-                // Ask the dependencies of the dependency, we want all of the asset
-                // down the chain to be loaded before we load the base asset
-                // Note: if the dependency is unloaded, it may or may not be able to tell the dependencies correctly
-                bool dependencyHasDependencies = HasPendingDependencies(existing);
-                if (dependencyHasDependencies)
-                    return true;
-            }
-        }
+        UpdateDependencyEdges(asset);
+        node = dependencyGraph.find(key);
     }
+    if (node->numPending == 0)
+        return false;
 
-    return false;
+    // Assets that are loaded without going through AssetLoadCompleted do not notify the graph. Re-evaluate the
+    // pending direct dependencies to pick up such loads. This is O(degree), and any change propagates upwards.
+    const std::vector<QString> dependencies = node->dependencies;
+    for(size_t i = 0; i < dependencies.size(); ++i)
+        UpdateDependencySatisfied(dependencies[i]);
+
+    node = dependencyGraph.find(key);
+    return node != dependencyGraph.end() && node->numPending > 0;
 }
 
 void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType)
@@ -2101,6 +2322,8 @@ void AssetAPI::OnAssetLoaded(AssetPtr asset)
 {
     PROFILE(AssetAPI_OnAssetLoaded);
 
+    UpdateDependencySatisfied(DependencyKey(asset->Name()));
+
     std::vector<AssetPtr> dependents = FindDependents(asset->Name());
     for(size_t i = 0; i < dependents.size(); ++i)
     {
@@ -2120,6 +2343,11 @@ void AssetAPI::OnAssetLoaded(AssetPtr asset)
     }
 }
 
+void AssetAPI::OnAssetUnloaded(IAsset *asset)
+{
+    UpdateDependencySatisfied(DependencyKey(asset->Name()));
+}
+
 void AssetAPI::OnAssetDiskSourceChanged(const QString &path_)
 {
     QDir path(path_);
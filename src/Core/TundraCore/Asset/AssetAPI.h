@@ -9,6 +9,9 @@
 #include "IAssetStorage.h"
 
 #include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
 #include <vector>
 #include <utility>
 #include <map>
@@ -203,9 +206,12 @@ public slots:
               that is used to load it.
         @param assetType The type of the asset to request. This can be null if the assetRef itself identifies the asset type.
         @param forceTransfer Force transfer even if the asset is in the loaded state
+        @param priority Download priority, higher first. If the asset is already being transferred, the priority of the transfer
+              is raised to this if it was lower. The default 0 sets no priority, so that requesters who track their own priority
+              on the transfer, like AssetRefListener, are not overridden by it. @see IAssetTransfer::SetPriority
         @return A pointer to the created asset transfer, or null if the transfer could not be initiated. */
-    AssetTransferPtr RequestAsset(QString assetRef, QString assetType = "", bool forceTransfer = false);
-    AssetTransferPtr RequestAsset(const AssetReference &ref, bool forceTransfer = false); /**< @overload */
+    AssetTransferPtr RequestAsset(QString assetRef, QString assetType = "", bool forceTransfer = false, float priority = 0.f);
+    AssetTransferPtr RequestAsset(const AssetReference &ref, bool forceTransfer = false, float priority = 0.f); /**< @overload */
 
     /// Returns the asset provider that is used to fetch assets from the given full URL.
     /** Example: GetProviderForAssetRef("local://my.mesh") will return an instance of LocalAssetProvider.
@@ -253,6 +259,20 @@ public slots:
     /// Returns the asset cache object that generates a disk source for all assets.
     AssetCache *Cache() const { return assetCache; }
 
+    /// Sets the SHA-1 hash of the content of the given asset, for example from a manifest published along with the assets.
+    /** When an asset whose content hash is known is requested from an external URL, and the same content is already in the
+        asset cache under another asset ref, the asset is loaded from the cache without downloading it.
+        @param sha1 The hash as a hex string. An empty string forgets the hash. */
+    void SetContentHash(QString assetRef, const QString &sha1);
+
+    /// Returns the known SHA-1 hash of the content of the given asset as a hex string, or an empty string if not known.
+    QString ContentHash(QString assetRef) const;
+
+    /// Reads content hashes from a manifest file in the output format of the sha1sum tool, "<sha1> <name>" per line.
+    /** @param baseRef The context in which the names are resolved, for example "http://myserver.com/assets/".
+        @return The number of hashes read, or -1 if the file could not be read. */
+    int LoadContentHashManifest(const QString &filename, const QString &baseRef);
+
     /// Returns the asset storage of the given name.
     /// @param name The name of the storage to get. Remember that Asset Storage names are case-insensitive.
     AssetStoragePtr AssetStorageByName(const QString &name) const;
@@ -385,8 +405,8 @@ public slots:
     int NumPendingDependencies(AssetPtr asset) const;
 
     /// A utility function that returns true if the given asset still has some unloaded dependencies left to process.
-    /// @note For performance reasons, calling this function is highly advisable instead of calling NumPendingDependencies, if it is only
-    ///       desirable to known whether the asset has any pending dependencies or not.
+    /// @note This reads the pending dependency count kept up to date in the dependency graph, whereas NumPendingDependencies walks
+    ///       all the dependencies down the chain. Call this function if it is only desirable to know whether there are any pending dependencies.
     bool HasPendingDependencies(AssetPtr asset) const;
 
     /// Handle discovery of a new asset through the AssetDiscovery network message
@@ -407,8 +427,8 @@ public slots:
     /// A utility function that counts the number of current asset transfers.
     int NumCurrentTransfers() const { return currentTransfers.size(); }
     
-    /// Return the current asset dependency map (debugging)
-    const AssetDependenciesMap& DebugGetAssetDependencies() const { return assetDependencies; }
+    /// Return the current asset dependencies as (dependent, dependency) pairs of lowercase asset refs (debugging)
+    AssetDependenciesMap DebugGetAssetDependencies() const;
     
     /// Return ready asset transfers (debugging)
     const std::vector<AssetTransferPtr>& DebugGetReadyTransfers() const { return readyTransfers; }
@@ -459,6 +479,12 @@ private slots:
     /// The Asset API listens on each asset when they get loaded, to track the completion of the dependencies of other loaded assets.
     void OnAssetLoaded(AssetPtr asset);
 
+    /// The Asset API listens on each asset when they get unloaded, to track which dependencies of other assets are pending.
+    void OnAssetUnloaded(IAsset *asset);
+
+    /// Sets the priority of the transfer as its parent priority on the pending dependency transfers of its asset.
+    void OnTransferPriorityChanged(IAssetTransfer *transfer);
+
     /// The Asset API reloads all assets from file when their disk source contents change.
     void OnAssetDiskSourceChanged(const QString &path);
 
@@ -482,9 +508,45 @@ private:
     AssetTransferMap::iterator FindTransferIterator(IAssetTransfer *transfer);
     AssetTransferMap::const_iterator FindTransferIterator(IAssetTransfer *transfer) const;
 
-    /// Removes from AssetDependenciesMap all dependencies the given asset has.
+    /// Removes from the dependency graph all dependencies the given asset has.
     void RemoveAssetDependencies(QString asset);
 
+    /// Node of the asset dependency graph. The nodes are keyed by the lowercase asset ref, as asset refs are case-insensitive.
+    struct AssetDependencyNode
+    {
+        AssetDependencyNode() : numPending(0), satisfied(false), ignored(false) {}
+
+        QString ref; ///< The asset ref the node was created for, used to look up the asset.
+        std::vector<QString> dependencies; ///< Keys of the assets this asset depends on, without duplicates.
+        QSet<QString> dependents; ///< Keys of the assets that depend on this asset.
+        int numPending; ///< Number of dependencies that are not satisfied. Dependencies to ignored assets are not counted.
+        bool satisfied; ///< True if the asset is loaded and none of its dependencies are pending.
+        bool ignored; ///< True if the asset is of a type disabled with a NullAssetFactory, and is never waited for.
+    };
+    typedef QHash<QString, AssetDependencyNode> AssetDependencyGraph;
+
+    /// Returns the key of an asset ref in the dependency graph.
+    static QString DependencyKey(const QString &assetRef);
+
+    /// Replaces the edges from the asset to its dependencies with the references the asset currently has.
+    void UpdateDependencyEdges(const AssetPtr &asset) const;
+
+    /// Adds a node for the given asset ref to the dependency graph if it does not have one yet.
+    /** When a node is created for an already loaded asset, the dependencies of that asset are added to the graph as well. */
+    void EnsureDependencyNode(const AssetReference &ref) const;
+
+    /// Removes the edges from the given node to its dependencies.
+    void ClearDependencyEdges(const QString &key) const;
+
+    /// Removes the node if no edges remain in it.
+    void PruneDependencyNode(const QString &key) const;
+
+    /// Re-evaluates whether the asset with the given key is satisfied, and propagates a change to its dependents and onwards.
+    void UpdateDependencySatisfied(const QString &key) const;
+
+    /// Counts the unsatisfied assets below the given node once each. Used by NumPendingDependencies.
+    int CountPendingDependencies(const QString &key, QSet<QString> &visited) const;
+
     /// Handle discovery of a new asset, when the storage is already known. This is used internally for optimization, so that providers don't need to be queried
     void HandleAssetDiscovery(const QString &assetRef, const QString &assetType, AssetStoragePtr storage);
     
@@ -509,9 +571,9 @@ private:
     /// Stores all the currently ongoing asset uploads, maps full assetRefs to the asset upload transfer structures.
     AssetUploadTransferMap currentUploadTransfers;
 
-    /// Keeps track of all the dependencies each asset has to each other asset.
-    /// \todo Find a more effective data structure for this. Needs something like boost::bimap but for multi-indices.
-    AssetDependenciesMap assetDependencies;
+    /// Keeps track of all the dependencies each asset has to each other asset, in both directions, along with
+    /// the number of pending dependencies of each asset. Mutable, as the pending state is re-evaluated lazily in the const queries.
+    mutable AssetDependencyGraph dependencyGraph;
 
     /// Stores a list of asset requests to assets that have already been downloaded into the system. These requests don't go to the asset providers
     /// to process, but are internally filled by the Asset API. This member vector is needed to be able to delay the requests and virtual completions
@@ -547,6 +609,9 @@ private:
     /// Stores all the already loaded assets in the system.
     AssetMap assets;
 
+    /// Known SHA-1 hashes of asset contents by asset ref. @see SetContentHash
+    QHash<QString, QByteArray> contentHashes;
+
     /// Stores all the already loaded asset bundles in the system.
     AssetBundleMap assetBundles;
 
@@ -17,19 +17,74 @@
 #include <QDataStream>
 #include <QFileInfo>
 #include <QScopedPointer>
+#include <QDirIterator>
+#include <QCryptographicHash>
+#include <QStringList>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
 
 #ifdef Q_WS_WIN
 #include "Win.h"
 #else
 #include <sys/stat.h>
 #include <utime.h>
+#include <unistd.h>
 #endif
 
 #include "MemoryLeakCheck.h"
 
+/// Identifies the asset cache index file and its version.
+static const quint32 cIndexMagic = 0x54434958; // "TCIX"
+static const quint32 cIndexVersion = 1;
+
+/// Default maximum size of the asset cache in megabytes.
+static const qint64 cDefaultMaxSizeMB = 2048;
+
+typedef std::pair<qint64, QFileInfo> TimedFile;
+
+static bool OlderFile(const TimedFile &a, const TimedFile &b)
+{
+    return a.first < b.first;
+}
+
+/// Returns the SHA-1 hash of the contents of a file, or an empty array if it can not be read.
+static QByteArray FileContentHash(const QString &absolutePath)
+{
+    QFile file(absolutePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    std::vector<char> buffer(64 * 1024);
+    for(;;)
+    {
+        const qint64 numRead = file.read(&buffer[0], (qint64)buffer.size());
+        if (numRead < 0)
+            return QByteArray();
+        if (numRead == 0)
+            break;
+        hash.addData(&buffer[0], (int)numRead);
+    }
+    return hash.result();
+}
+
+/// Creates a hard link newPath to the file existingPath. Returns false if the file system does not support hard links.
+static bool CreateHardLink(const QString &existingPath, const QString &newPath)
+{
+#ifdef Q_WS_WIN
+    return CreateHardLinkW((LPCWSTR)QDir::toNativeSeparators(newPath).utf16(), (LPCWSTR)QDir::toNativeSeparators(existingPath).utf16(), 0) != FALSE;
+#else
+    return link(QFile::encodeName(existingPath).constData(), QFile::encodeName(newPath).constData()) == 0;
+#endif
+}
+
 AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) : 
     assetAPI(owner),
-    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory)))
+    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory))),
+    totalSize(0),
+    maxSize(cDefaultMaxSizeMB * 1024 * 1024),
+    evictRetrySize(0)
 {
     LogInfo("* Asset cache directory: " + cacheDirectory);  
 
@@ -55,22 +110,48 @@ AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) :
         LogInfo("AssetCache: Removing all data and metadata files from cache, found 'clear-asset-cache' from start params!");
         ClearAssetCache();
     }
+    else
+        LoadIndex();
+
+    // Check --assetCacheSize start param
+    QStringList sizeParam = owner->GetFramework()->CommandLineParameters("--assetcachesize");
+    if (!sizeParam.isEmpty())
+    {
+        bool ok = false;
+        qint64 sizeMB = sizeParam.last().toLongLong(&ok);
+        if (ok && sizeMB >= 0)
+            maxSize = sizeMB * 1024 * 1024;
+        else
+            LogWarning("AssetCache: Invalid --assetCacheSize \"" + sizeParam.last() + "\", using the default of " + QString::number(cDefaultMaxSizeMB) + " MB.");
+    }
+    Evict();
+}
+
+AssetCache::~AssetCache()
+{
+    SaveIndex();
 }
 
 QString AssetCache::FindInCache(const QString &assetRef)
 {
-    QString absolutePath = GetDiskSourceByRef(assetRef);
-    if (QFile::exists(absolutePath))
-        return absolutePath;
-    else // The file is not in cache, return an empty string to denote that.
+    CacheEntry *entry = Touch(CacheFileName(assetRef));
+    if (!entry) // The file is not in cache, return an empty string to denote that.
         return "";
+    if (entry->assetRef.isEmpty())
+        entry->assetRef = assetRef;
+    return GetDiskSourceByRef(assetRef);
+}
+
+QString AssetCache::CacheFileName(const QString &assetRef)
+{
+    return AssetAPI::SanitateAssetRef(assetRef);
 }
 
 QString AssetCache::GetDiskSourceByRef(const QString &assetRef)
 {
     // Return the path where the given asset ref would be stored, if it was saved in the cache
     // (regardless of whether it now exists in the cache).
-    return assetDataDir.absolutePath() + "/" + AssetAPI::SanitateAssetRef(assetRef);
+    return assetDataDir.absolutePath() + "/" + CacheFileName(assetRef);
 }
 
 QString AssetCache::CacheDirectory() const
@@ -88,15 +169,160 @@ QString AssetCache::StoreAsset(AssetPtr asset)
 QString AssetCache::StoreAsset(const u8 *data, size_t numBytes, const QString &assetName)
 {
     QString absolutePath = GetDiskSourceByRef(assetName);
-    bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath);
-    if (success)
+    const QString fileName = CacheFileName(assetName);
+    const QByteArray hash = QCryptographicHash::hash(QByteArray::fromRawData((const char*)data, (int)numBytes), QCryptographicHash::Sha1);
+
+    // The old file may be a hard link shared with other cache files, so remove it instead of overwriting its contents.
+    RemoveEntry(fileName);
+    QFile::remove(absolutePath);
+
+    // If the same content is already cached for another asset ref, link to it instead of storing another copy.
+    QString sharedFile = FileWithContent(hash, fileName);
+    bool success = !sharedFile.isEmpty() && CreateHardLink(assetDataDir.absoluteFilePath(sharedFile), absolutePath);
+    if (!success)
+        success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath);
+    if (!success)
+        return "";
+
+    // The file was just written, so its last modified time is now, in whole seconds like the file systems store it.
+    CacheEntry &entry = AddEntry(fileName, (qint64)numBytes, (QDateTime::currentMSecsSinceEpoch() / 1000) * 1000, hash);
+    entry.assetRef = assetName;
+
+    Evict(fileName);
+    return absolutePath;
+}
+
+QDateTime AssetCache::LastModified(const QString &assetRef)
+{
+    CacheIndex::const_iterator iter = index.find(CacheFileName(assetRef));
+    if (iter == index.end())
+        return QDateTime();
+    return QDateTime::fromMSecsSinceEpoch(iter->lastModified).toUTC();
+}
+
+bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateTime)
+{
+    if (!dateTime.isValid())
+    {
+        LogError("SetLastModified() DateTime is invalid: " + assetRef);
+        return false;
+    }
+
+    CacheIndex::iterator iter = index.find(CacheFileName(assetRef));
+    if (iter == index.end())
+        return false;
+
+    // Update the file time as well, so that it is right if the index needs to be rebuilt from the cache directory.
+    if (!SetFileLastModified(GetDiskSourceByRef(assetRef), assetRef, dateTime))
+        return false;
+    iter->lastModified = (dateTime.toMSecsSinceEpoch() / 1000) * 1000;
+    return true;
+}
+
+QByteArray AssetCache::ContentHash(const QString &assetRef)
+{
+    const QString fileName = CacheFileName(assetRef);
+    CacheIndex::const_iterator iter = index.find(fileName);
+    if (iter == index.end())
+        return QByteArray();
+    return !iter->hash.isEmpty() ? iter->hash : HashEntry(fileName);
+}
+
+QByteArray AssetCache::HashEntry(const QString &fileName)
+{
+    const QString absolutePath = assetDataDir.absoluteFilePath(fileName);
+    const QByteArray hash = FileContentHash(absolutePath);
+    if (hash.isEmpty())
+        return hash;
+
+    // Replace a separate copy of already cached content with a hard link to it. Link to a temporary name first,
+    // so that the file is not lost if the link can not be created. If it can not, leave the hash of the copy unknown,
+    // so that its size is still counted separately.
+    QString sharedFile = FileWithContent(hash, fileName);
+    if (!sharedFile.isEmpty())
+    {
+        const QString linkPath = absolutePath + ".link";
+        QFile::remove(linkPath);
+        if (!CreateHardLink(assetDataDir.absoluteFilePath(sharedFile), linkPath))
+            return hash;
+        if (!QFile::remove(absolutePath))
+        {
+            QFile::remove(linkPath);
+            return hash;
+        }
+        if (!QFile::rename(linkPath, absolutePath))
+        {
+            LogWarning("AssetCache: Failed to link " + absolutePath + " to " + assetDataDir.absoluteFilePath(sharedFile) + ".");
+            QFile::remove(linkPath);
+            RemoveEntry(fileName);
+            return hash;
+        }
+    }
+
+    const CacheEntry old = index[fileName];
+    CacheEntry &entry = AddEntry(fileName, old.size, old.lastModified, hash);
+    entry.assetRef = old.assetRef;
+    entry.lastAccess = old.lastAccess;
+    return hash;
+}
+
+QString AssetCache::LinkToContent(const QString &assetRef, const QByteArray &hash)
+{
+    if (hash.isEmpty())
+        return "";
+    const QString fileName = CacheFileName(assetRef);
+    QString absolutePath = GetDiskSourceByRef(assetRef);
+
+    CacheEntry *existing = Touch(fileName);
+    if (existing && existing->hash == hash)
         return absolutePath;
+
+    QString sharedFile = FileWithContent(hash, fileName);
+    if (sharedFile.isEmpty())
+        return "";
+
+    RemoveEntry(fileName);
+    QFile::remove(absolutePath);
+    if (!CreateHardLink(assetDataDir.absoluteFilePath(sharedFile), absolutePath))
+    {
+        LogDebug("AssetCache: Failed to link " + absolutePath + " to " + assetDataDir.absoluteFilePath(sharedFile) + ".");
+        return "";
+    }
+
+    Touch(sharedFile);
+    CacheEntry &entry = AddEntry(fileName, index[sharedFile].size, (QDateTime::currentMSecsSinceEpoch() / 1000) * 1000, hash);
+    entry.assetRef = assetRef;
+    return absolutePath;
+}
+
+QString AssetCache::FileWithContent(const QByteArray &hash, const QString &exclude) const
+{
+    if (hash.isEmpty())
+        return "";
+    for(QMultiHash<QByteArray, QString>::const_iterator iter = filesByHash.find(hash); iter != filesByHash.end() && iter.key() == hash; ++iter)
+        if (iter.value() != exclude)
+            return iter.value();
     return "";
 }
 
-QDateTime AssetCache::LastModified(const QString &assetRef)
+bool AssetCache::RegisterCachedFile(const QString &assetRef)
+{
+    QString absolutePath = GetDiskSourceByRef(assetRef);
+    QFileInfo info(absolutePath);
+    if (!info.exists() || !info.isFile())
+        return false;
+
+    QDateTime lastModified = FileLastModified(absolutePath, assetRef);
+    const QString fileName = CacheFileName(assetRef);
+    CacheEntry &entry = AddEntry(fileName, info.size(), lastModified.isValid() ? lastModified.toMSecsSinceEpoch() : 0);
+    entry.assetRef = assetRef;
+
+    Evict(fileName);
+    return true;
+}
+
+QDateTime AssetCache::FileLastModified(const QString &absolutePath, const QString &assetRef)
 {
-    QString absolutePath = FindInCache(assetRef);
     if (absolutePath.isEmpty())
         return QDateTime();
 
@@ -147,18 +373,8 @@ QDateTime AssetCache::LastModified(const QString &assetRef)
 #endif
 }
 
-bool AssetCache::SetLastModified(const QString &assetRef, const QDateTime &dateTime)
+bool AssetCache::SetFileLastModified(const QString &absolutePath, const QString &assetRef, const QDateTime &dateTime)
 {
-    if (!dateTime.isValid())
-    {
-        LogError("SetLastModified() DateTime is invalid: " + assetRef);
-        return false;
-    }
-
-    QString absolutePath = FindInCache(assetRef);
-    if (absolutePath.isEmpty())
-        return false;
-
     QDate date = dateTime.date();
     QTime time = dateTime.time();
 
@@ -237,13 +453,22 @@ void *AssetCache::OpenFileHandle(const QString &absolutePath)
 
 void AssetCache::DeleteAsset(const QString &assetRef)
 {
-    QString absolutePath = GetDiskSourceByRef(assetRef);
-    if (QFile::exists(absolutePath))
-        QFile::remove(absolutePath);
+    const QString fileName = CacheFileName(assetRef);
+    if (!index.contains(fileName))
+        return;
+    RemoveEntry(fileName);
+    QFile::remove(GetDiskSourceByRef(assetRef));
 }
 
 void AssetCache::ClearAssetCache()
 {
+    index.clear();
+    filesByHash.clear();
+    lruOrder.clear();
+    totalSize = 0;
+    evictRetrySize = 0;
+    QFile::remove(IndexFilename());
+
     if (!assetDataDir.exists())
         return;
     QFileInfoList entries = assetDataDir.entryInfoList(QDir::Files|QDir::NoSymLinks|QDir::NoDotAndDotDot);
@@ -256,3 +481,214 @@ void AssetCache::ClearAssetCache()
         }
     }
 }
+
+void AssetCache::SetMaxSize(qint64 bytes)
+{
+    maxSize = std::max<qint64>(bytes, 0);
+    evictRetrySize = 0;
+    Evict();
+}
+
+AssetCache::CacheEntry *AssetCache::Touch(const QString &fileName)
+{
+    CacheIndex::iterator iter = index.find(fileName);
+    if (iter == index.end())
+        return 0;
+    iter->lastAccess = QDateTime::currentMSecsSinceEpoch();
+    lruOrder.splice(lruOrder.end(), lruOrder, iter->lruPosition);
+    return &iter.value();
+}
+
+AssetCache::CacheEntry &AssetCache::AddEntry(const QString &fileName, qint64 size, qint64 lastModified, const QByteArray &hash)
+{
+    RemoveEntry(fileName);
+
+    CacheIndex::iterator iter = index.insert(fileName, CacheEntry());
+    iter->lruPosition = lruOrder.insert(lruOrder.end(), fileName);
+    iter->size = size;
+    iter->lastModified = lastModified;
+    iter->lastAccess = QDateTime::currentMSecsSinceEpoch();
+    iter->hash = hash;
+
+    // Files with the same content are hard links to the same data, so count their size only once.
+    if (!hash.isEmpty())
+    {
+        if (!filesByHash.contains(hash))
+            totalSize += size;
+        filesByHash.insert(hash, fileName);
+    }
+    else
+        totalSize += size;
+    return iter.value();
+}
+
+void AssetCache::RemoveEntry(const QString &fileName)
+{
+    CacheIndex::iterator iter = index.find(fileName);
+    if (iter == index.end())
+        return;
+    if (!iter->hash.isEmpty())
+    {
+        filesByHash.remove(iter->hash, fileName);
+        if (!filesByHash.contains(iter->hash))
+            totalSize -= iter->size;
+    }
+    else
+        totalSize -= iter->size;
+    lruOrder.erase(iter->lruPosition);
+    index.erase(iter);
+}
+
+void AssetCache::Evict(const QString &keep)
+{
+    if (maxSize <= 0 || totalSize <= maxSize || totalSize < evictRetrySize)
+        return;
+
+    // Evict down to 90% of the limit, so that the following stores do not evict a file each.
+    const qint64 targetSize = maxSize - maxSize / 10;
+    const qint64 sizeBefore = totalSize;
+    int numEvicted = 0;
+    // Each file is visited at most once, as the skipped files are moved to the end of the LRU order.
+    size_t numToVisit = lruOrder.size();
+    std::list<QString>::iterator next = lruOrder.begin();
+    while(totalSize > targetSize && numToVisit-- > 0)
+    {
+        std::list<QString>::iterator current = next++;
+        if (*current == keep)
+            continue;
+        CacheIndex::iterator iter = index.find(*current);
+        // Keep the disk sources of loaded assets, they may be needed for reloading the asset. They are in use, so mark them
+        // recently used, so that the following evictions do not walk over them again.
+        if (!iter->assetRef.isEmpty() && assetAPI->GetAsset(iter->assetRef))
+        {
+            Touch(*current);
+            continue;
+        }
+
+        if (!assetDataDir.remove(*current) && assetDataDir.exists(*current))
+        {
+            LogWarning("AssetCache: Failed to remove cache file " + assetDataDir.absoluteFilePath(*current) + " when evicting.");
+            continue;
+        }
+        RemoveEntry(*current);
+        ++numEvicted;
+    }
+
+    // If the loaded assets keep the cache over the limit, do not rescan all the files on every store, but only after the
+    // cache has grown by the slack again. The scans are then amortized over the stores.
+    evictRetrySize = totalSize > targetSize ? totalSize + maxSize / 10 : 0;
+    if (numEvicted > 0)
+        LogDebug("AssetCache: Evicted " + QString::number(numEvicted) + " files, " + QString::number((sizeBefore - totalSize) / 1024) + " KB, from the cache.");
+}
+
+QString AssetCache::IndexFilename() const
+{
+    return cacheDirectory + "index.dat";
+}
+
+void AssetCache::LoadIndex()
+{
+    index.clear();
+    filesByHash.clear();
+    lruOrder.clear();
+    totalSize = 0;
+
+    QFile file(IndexFilename());
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        RebuildIndex();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic = 0, version = 0, numEntries = 0;
+    stream >> magic >> version >> numEntries;
+    bool ok = stream.status() == QDataStream::Ok && magic == cIndexMagic && version == cIndexVersion;
+
+    // The entries are stored least recently used first.
+    for(quint32 i = 0; ok && i < numEntries; ++i)
+    {
+        QString fileName, assetRef;
+        qint64 size, lastModified, lastAccess;
+        QByteArray hash;
+        stream >> fileName >> assetRef >> size >> lastModified >> lastAccess >> hash;
+        ok = stream.status() == QDataStream::Ok;
+        if (ok)
+        {
+            CacheEntry &entry = AddEntry(fileName, size, lastModified, hash);
+            entry.assetRef = assetRef;
+            entry.lastAccess = lastAccess;
+        }
+    }
+    file.close();
+
+    // The index is saved only on a clean exit. Remove it while the cache is in use, so that after a crash
+    // the cache is rescanned instead of trusting an index that may be out of date.
+    QFile::remove(IndexFilename());
+
+    if (!ok)
+    {
+        LogWarning("AssetCache: The cache index " + IndexFilename() + " is corrupted, rebuilding it.");
+        RebuildIndex();
+    }
+}
+
+void AssetCache::SaveIndex()
+{
+    QFile file(IndexFilename());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("AssetCache: Failed to open " + IndexFilename() + " for writing the cache index.");
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cIndexMagic << cIndexVersion << (quint32)index.size();
+    for(std::list<QString>::const_iterator iter = lruOrder.begin(); iter != lruOrder.end(); ++iter)
+    {
+        const CacheEntry &entry = index[*iter];
+        stream << *iter << entry.assetRef << entry.size << entry.lastModified << entry.lastAccess << entry.hash;
+    }
+    if (stream.status() != QDataStream::Ok)
+    {
+        LogError("AssetCache: Failed to write the cache index to " + IndexFilename() + ".");
+        file.close();
+        QFile::remove(IndexFilename());
+    }
+}
+
+void AssetCache::RebuildIndex()
+{
+    index.clear();
+    filesByHash.clear();
+    lruOrder.clear();
+    totalSize = 0;
+    if (!assetDataDir.exists())
+        return;
+
+    // The access times are not known, so use the modification times for the LRU order.
+    std::vector<TimedFile> files;
+    QDirIterator iter(assetDataDir.absolutePath(), QDir::Files|QDir::NoSymLinks|QDir::NoDotAndDotDot);
+    while(iter.hasNext())
+    {
+        iter.next();
+        QFileInfo info = iter.fileInfo();
+        files.push_back(std::make_pair((info.lastModified().toMSecsSinceEpoch() / 1000) * 1000, info));
+    }
+    std::stable_sort(files.begin(), files.end(), OlderFile);
+
+    // Hashing every file here would stall the startup after a crash. The hashes are computed when first needed instead,
+    // until then the files are counted as separate content. The cache file names are the sanitated asset refs, so the refs
+    // can be recovered, and the disk sources of the loaded assets stay pinned in Evict.
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        const QString fileName = files[i].second.fileName();
+        CacheEntry &entry = AddEntry(fileName, files[i].second.size(), files[i].first);
+        entry.assetRef = AssetAPI::DesanitateAssetRef(fileName);
+        entry.lastAccess = files[i].first;
+    }
+    if (!files.empty())
+        LogInfo("AssetCache: Rebuilt the cache index, " + QString::number(files.size()) + " files, " + QString::number(totalSize / (1024 * 1024)) + " MB.");
+}
@@ -10,14 +10,25 @@
 #include <QDir>
 #include <QObject>
 #include <QDateTime>
+#include <QHash>
+#include <QByteArray>
+
+#include <list>
 
 /// Implements a disk cache for asset files to avoid re-downloading assets between runs.
+/** The cache keeps an index of the cached files in memory, so lookups do not touch the file system. The index is saved
+    to the cache directory on exit and loaded on startup. If it is missing, for example after a crash, it is rebuilt by
+    scanning the cache directory. The rebuild does not read the files, their content hashes are computed when first needed.
+    When the cached files exceed the size limit, the least recently used ones are removed.
+    Files with identical content under different asset refs are stored once, as hard links to the same data.
+    The size limit can be set with the --assetCacheSize command line parameter. */
 class TUNDRACORE_API AssetCache : public QObject
 {
     Q_OBJECT
 
 public:
     explicit AssetCache(AssetAPI *owner, QString assetCacheDirectory);
+    ~AssetCache();
 
 public slots:
     /// Returns the absolute path on the local file system that contains a cached copy of the given asset ref.
@@ -51,6 +62,21 @@ public slots:
     /// @return bool Returns true if successful, false otherwise.
     bool SetLastModified(const QString &assetRef, const QDateTime &dateTime);
 
+    /// Returns the SHA-1 hash of the contents of the cache file for assetRef, or an empty array if the asset is not in the cache.
+    /// The hash of a file that was not written by StoreAsset, or that was found by rebuilding the index, is computed on the first call.
+    QByteArray ContentHash(const QString &assetRef);
+
+    /// Makes the cache file of assetRef share the content of another cache file with the given SHA-1 hash.
+    /// Cache files with the same content are stored once, as hard links to the same data.
+    /// @return The absolute path of the cache file of assetRef, or an empty string if no cached file has the given content.
+    QString LinkToContent(const QString &assetRef, const QByteArray &hash);
+
+    /// Adds a file that was written to the cache directory by other means than StoreAsset to the cache index.
+    /// The file is not read here, its content hash is computed when ContentHash first asks for it.
+    /// @param assetRef The asset reference whose cache file, at GetDiskSourceByRef, was written.
+    /// @return True if the file exists and was added.
+    bool RegisterCachedFile(const QString &assetRef);
+
     /// Deletes the asset with the given assetRef from the cache, if it exists.
     /// @param QString asset reference.
     void DeleteAsset(const QString &assetRef);
@@ -62,8 +88,71 @@ public slots:
     /// Get the cache directory. Returned path is guaranteed to have a trailing slash /.
     /// @return QString absolute path to the caches data directory
     QString CacheDirectory() const;
-    
+
+    /// Returns the total size of the cached files in bytes.
+    qint64 Size() const { return totalSize; }
+
+    /// Returns the maximum total size of the cached files in bytes, or 0 if unlimited.
+    qint64 MaxSize() const { return maxSize; }
+
+    /// Sets the maximum total size of the cached files in bytes, 0 for unlimited. Removes least recently used files if the cache is larger.
+    void SetMaxSize(qint64 bytes);
+
 private:
+    /// Index entry of a cached file.
+    struct CacheEntry
+    {
+        QString assetRef; ///< Original asset reference. When the index is rebuilt, recovered from the cache file name.
+        qint64 size; ///< File size in bytes.
+        qint64 lastModified; ///< Last modified time in msecs since epoch, as reported to the asset providers.
+        qint64 lastAccess; ///< Last time the file was stored or looked up, in msecs since epoch.
+        QByteArray hash; ///< SHA-1 of the file contents, empty if not computed yet.
+        std::list<QString>::iterator lruPosition; ///< Position of the file name in lruOrder.
+    };
+    typedef QHash<QString, CacheEntry> CacheIndex;
+
+    /// Returns the file name of the cache file of assetRef within the data directory.
+    static QString CacheFileName(const QString &assetRef);
+
+    /// Returns the index entry for the given cache file name and marks it as most recently used, or null if there is none.
+    CacheEntry *Touch(const QString &fileName);
+
+    /// Adds or replaces an index entry for the given cache file name. Returns the entry.
+    CacheEntry &AddEntry(const QString &fileName, qint64 size, qint64 lastModified, const QByteArray &hash = QByteArray());
+
+    /// Returns the name of a cache file other than exclude with the given content hash, or an empty string if there is none.
+    QString FileWithContent(const QByteArray &hash, const QString &exclude) const;
+
+    /// Computes the content hash of a cached file whose hash is not known, and stores it to its index entry.
+    /** If the same content is already cached under another file, the file is replaced with a hard link to it,
+        as the files with the same hash are counted once in the cache size. Returns the hash, or an empty array if the file can not be read. */
+    QByteArray HashEntry(const QString &fileName);
+
+    /// Removes the index entry for the given cache file name. Does not delete the file.
+    void RemoveEntry(const QString &fileName);
+
+    /// Deletes least recently used files until the cache fits the size limit, with some slack to avoid evicting on every store.
+    /// @param keep File name that must not be deleted, usually the file that was just stored.
+    void Evict(const QString &keep = QString());
+
+    /// Loads the index from the cache directory, or rebuilds it by scanning the data directory if it can not be loaded.
+    void LoadIndex();
+
+    /// Saves the index to the cache directory.
+    void SaveIndex();
+
+    /// Rebuilds the index from the files in the data directory. Does not read the files.
+    void RebuildIndex();
+
+    /// Returns the path of the index file.
+    QString IndexFilename() const;
+
+    /// Reads the last modified time of a file from the file system.
+    QDateTime FileLastModified(const QString &absolutePath, const QString &assetRef);
+
+    /// Writes the last modified time of a file to the file system.
+    bool SetFileLastModified(const QString &absolutePath, const QString &assetRef, const QDateTime &dateTime);
+
 #ifdef Q_WS_WIN
     /// Windows specific helper to open a file handle to absolutePath
     void *OpenFileHandle(const QString &absolutePath);
@@ -76,4 +165,22 @@ private:
 
     /// Asset data dir.
     QDir assetDataDir;
+
+    /// Cached files by file name.
+    CacheIndex index;
+
+    /// File names of the cached files by the hash of their content, for the files whose hash is known.
+    QMultiHash<QByteArray, QString> filesByHash;
+
+    /// File names of the cached files, least recently used first.
+    std::list<QString> lruOrder;
+
+    /// Total size of the cached files in bytes.
+    qint64 totalSize;
+
+    /// Maximum total size of the cached files in bytes, 0 for unlimited.
+    qint64 maxSize;
+
+    /// If nonzero, the last eviction could not get the cache under the limit, and the next one is not tried until the cache has grown to this size.
+    qint64 evictRetrySize;
 };
@@ -15,6 +15,13 @@
 
 #include "MemoryLeakCheck.h"
 
+AssetRefListener::~AssetRefListener()
+{
+    AssetTransferPtr transfer = currentTransfer.lock();
+    if (transfer)
+        transfer->RemovePriority(this);
+}
+
 AssetPtr AssetRefListener::Asset() const
 {
     return asset.lock();
@@ -40,6 +47,7 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef
         IAssetTransfer* current = currentTransfer.lock().get();
         current->disconnect(this, SLOT(OnTransferSucceeded(AssetPtr)));
         current->disconnect(this, SLOT(OnTransferFailed(IAssetTransfer*, QString)));
+        current->RemovePriority(this);
         currentTransfer.reset();
     }
     
@@ -59,12 +67,14 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef
     requestedRef = AssetReference(assetRef, assetType);
     inspectCreated = false;
 
+    // Request with the default priority, and set the priority of this listener separately, so that SetPriority can later change it.
     AssetTransferPtr transfer = assetApi->RequestAsset(assetRef, assetType);
     if (!transfer)
     {
         LogWarning("AssetRefListener::HandleAssetRefChange: Asset request for asset \"" + assetRef + "\" failed.");
         return;
     }
+    transfer->SetPriority(priority, this);
 
     connect(transfer.get(), SIGNAL(Succeeded(AssetPtr)), this, SLOT(OnTransferSucceeded(AssetPtr)), Qt::UniqueConnection);
     connect(transfer.get(), SIGNAL(Failed(IAssetTransfer*, QString)), this, SLOT(OnTransferFailed(IAssetTransfer*, QString)), Qt::UniqueConnection);
@@ -77,6 +87,14 @@ void AssetRefListener::HandleAssetRefChange(AssetAPI *assetApi, QString assetRef
     asset = AssetPtr();
 }
 
+void AssetRefListener::SetPriority(float priority_)
+{
+    priority = priority_;
+    AssetTransferPtr transfer = currentTransfer.lock();
+    if (transfer)
+        transfer->SetPriority(priority, this);
+}
+
 void AssetRefListener::OnTransferSucceeded(AssetPtr assetData)
 {
     if (!assetData)
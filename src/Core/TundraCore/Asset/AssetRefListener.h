@@ -16,7 +16,8 @@ class TUNDRACORE_API AssetRefListener : public QObject
     Q_OBJECT
 
 public:
-    AssetRefListener() : myAssetAPI(0), requestedRef(""), /** \todo This needs to be removed. */ inspectCreated(false) {};
+    AssetRefListener() : myAssetAPI(0), requestedRef(""), priority(0.f), /** \todo This needs to be removed. */ inspectCreated(false) {};
+    ~AssetRefListener();
 
     /// Issues a new asset request to the given AssetReference.
     /// @param assetRef A pointer to an attribute of type AssetReference.
@@ -31,6 +32,10 @@ public:
     /// Returns the asset currently stored in this asset reference.
     AssetPtr Asset() const;
 
+    /// Sets the download priority of the current and the following asset requests. @see IAssetTransfer::SetPriority
+    /** The transfer may be shared with other listeners, so this sets only the priority of this listener's request. */
+    void SetPriority(float priority);
+
 signals:
     /// Emitted when the raw byte download of this asset finishes.
     void Downloaded(IAssetTransfer *transfer);
@@ -52,6 +57,7 @@ private:
     AssetWeakPtr asset;
     AssetTransferWeakPtr currentTransfer;
     AssetReference requestedRef;
+    float priority;
 
     ///\todo This needs to be removed.
     bool inspectCreated;
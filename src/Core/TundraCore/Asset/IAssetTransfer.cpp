@@ -10,6 +10,7 @@
 
 IAssetTransfer::IAssetTransfer() : 
     cachingAllowed(true),
+    priority(0.f),
     diskSourceType(IAsset::Original)
 {
 }
@@ -66,6 +67,35 @@ bool IAssetTransfer::CachingAllowed() const
     return cachingAllowed;
 }
 
+void IAssetTransfer::SetPriority(float priority_, const void *requester)
+{
+    requesterPriorities[requester] = priority_;
+    UpdatePriority();
+}
+
+void IAssetTransfer::RemovePriority(const void *requester)
+{
+    if (requesterPriorities.erase(requester) > 0)
+        UpdatePriority();
+}
+
+void IAssetTransfer::UpdatePriority()
+{
+    float newPriority = 0.f;
+    for(std::map<const void *, float>::const_iterator iter = requesterPriorities.begin(); iter != requesterPriorities.end(); ++iter)
+        if (iter == requesterPriorities.begin() || iter->second > newPriority)
+            newPriority = iter->second;
+    if (newPriority == priority)
+        return;
+    priority = newPriority;
+    emit PriorityChanged(this);
+}
+
+float IAssetTransfer::Priority() const
+{
+    return priority;
+}
+
 QByteArray IAssetTransfer::RawData() const
 {
     if (rawAssetData.size() == 0) 
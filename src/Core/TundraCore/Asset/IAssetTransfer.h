@@ -10,6 +10,7 @@
 
 #include <QObject>
 #include <vector>
+#include <map>
 #include <QByteArray>
 
 /// Represents a currently ongoing asset download operation.
@@ -76,6 +77,23 @@ public slots:
 
     /// Returns the disk source type of this transfer.
     IAsset::SourceType DiskSourceType() const;
+
+    /// Sets the download priority a requester needs this transfer with. Transfers with higher priority are started first.
+    /** Providers that queue their transfers, like HttpAssetProvider, use this to order the downloads. Requesters can
+        derive the priority from for example the distance to the camera. The priority can be changed while the transfer is pending.
+        Priority has no effect on a transfer that has already started.
+        A transfer is shared by all the requesters of the same asset, so the priority of each requester is tracked separately,
+        and the transfer gets the highest of them. Lowering the priority of one requester does not demote the transfer below
+        the others.
+        @param requester Identifies the requester, for example the AssetRefListener or the transfer of a dependent asset.
+               The requests that do not identify themselves share the null requester. */
+    void SetPriority(float priority, const void *requester = 0);
+
+    /// Forgets the priority of a requester that no longer needs this transfer.
+    void RemovePriority(const void *requester);
+
+    /// Returns the download priority of this transfer: the highest priority of its requesters, or 0 if none has set one.
+    float Priority() const;
     
     /// Returns if this transfer allows caching to a disk source.
     bool CachingAllowed() const;
@@ -107,9 +125,17 @@ signals:
     /// Emitted when this transfer failed.
     void Failed(IAssetTransfer *transfer, QString reason);
 
+    /// Emitted when the priority of this transfer changes.
+    void PriorityChanged(IAssetTransfer *transfer);
+
 private:
+    /// Recomputes the priority from the priorities of the requesters, and emits PriorityChanged if it changed.
+    void UpdatePriority();
+
     QString diskSource;
     bool cachingAllowed;
+    float priority; ///< The highest of requesterPriorities.
+    std::map<const void *, float> requesterPriorities;
     
 };
 
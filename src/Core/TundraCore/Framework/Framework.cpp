@@ -180,6 +180,8 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--netRate"] = "Specifies the number of network updates per second. Default: 30."; // TundraLogicModule
     cmdLineDescs.commands["--noAssetCache"] = "Disable asset cache."; // Framework
     cmdLineDescs.commands["--assetCacheDir"] = "Specify asset cache directory to use."; // Framework
+    cmdLineDescs.commands["--assetCacheSize"] = "Specifies the maximum size of the asset cache in megabytes. Least recently used assets are removed when the cache grows larger. 0 for unlimited. Default: 2048."; // AssetCache
+    cmdLineDescs.commands["--httpConnectionsPerHost"] = "Specifies the maximum number of simultaneous HTTP asset downloads from a single host. The queued downloads are started in priority order. Default: 6."; // AssetModule
     cmdLineDescs.commands["--clear-asset-cache"] = "At the start of Tundra, remove all data and metadata files from asset cache."; // AssetCache
     cmdLineDescs.commands["--logLevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'."; // ConsoleAPI
     cmdLineDescs.commands["--logFile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt'."; // ConsoleAPI
@@ -205,6 +207,8 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--noMenuBar"] = "Disables showing of the application menu bar automatically."; // Framework
     cmdLineDescs.commands["--clientExtrapolationTime"] = "Rigidbody extrapolation time on client in milliseconds. Default 66."; // TundraProtocolModule
     cmdLineDescs.commands["--noClientPhysics"] = "Disables rigidbody handoff to client simulation after no movement packets received from server."; // TundraProtocolModule
+    cmdLineDescs.commands["--rigidBodyMaxInterval"] = "Adapts the rate at which rigid bodies are sent to each client to their distance from the client and speed, sending far and slow ones at most this many milliseconds apart. Max 2000. Default: 0, all changes sent on every network update."; // TundraProtocolModule
+    cmdLineDescs.commands["--syncBandwidth"] = "Limits the scene sync data sent to each client, in kilobytes per second. Changes that do not fit are sent later in priority order. Default: 0, unlimited."; // TundraProtocolModule
     cmdLineDescs.commands["--dumpProfiler"] = "Dump profiling blocks to console every 5 seconds."; // DebugStatsModule
     
     apiVersionInfo = new VersionInfo(Application::Version());
@@ -0,0 +1,126 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+/// Processes jobs of one kind on worker threads, and collects the finished jobs for the main thread.
+/** All the queues run their jobs on the global QThreadPool, so the background work of the modules shares one set of threads
+    instead of oversubscribing the CPU. A queue keeps at most maxConcurrentJobs of its jobs on the pool at a time and holds the
+    rest back, so that one kind of work cannot take all the threads.
+
+    The process function is called on a worker thread and may only touch the job. Do not log from it, as logging is not thread-safe.
+    While a job is queued or being processed, it is owned by the worker threads and must not be touched. The main thread takes
+    the finished jobs with TakeFinishedJob or TakeFinishedJobs, usually once per frame. */
+template<typename Job>
+class WorkerJobQueue
+{
+public:
+    typedef shared_ptr<Job> JobPtr;
+    /// Processes a job on a worker thread.
+    typedef void (*ProcessFunction)(Job &job);
+
+    WorkerJobQueue(ProcessFunction process, int maxConcurrentJobs) :
+        process_(process),
+        maxConcurrentJobs_(std::max(1, maxConcurrentJobs)),
+        numRunningJobs_(0)
+    {
+    }
+
+    /// Drops the jobs that have not been started, and waits for the running jobs to finish.
+    ~WorkerJobQueue()
+    {
+        QMutexLocker lock(&mutex_);
+        queuedJobs_.clear();
+        while(numRunningJobs_ > 0)
+            allJobsDone_.wait(&mutex_);
+    }
+
+    /// Queues the job to be processed on a worker thread.
+    void Start(const JobPtr &job)
+    {
+        QMutexLocker lock(&mutex_);
+        if (numRunningJobs_ < maxConcurrentJobs_)
+        {
+            ++numRunningJobs_;
+            QThreadPool::globalInstance()->start(new Runner(this, job));
+        }
+        else
+            queuedJobs_.push_back(job);
+    }
+
+    /// Takes the oldest finished job. Returns false if there are none.
+    /** Completing the finished jobs one at a time lets the caller stop at a frame deadline, and leave the rest for the next frame. */
+    bool TakeFinishedJob(JobPtr &job)
+    {
+        QMutexLocker lock(&mutex_);
+        if (finishedJobs_.empty())
+            return false;
+        job = finishedJobs_.front();
+        finishedJobs_.pop_front();
+        return true;
+    }
+
+    /// Appends all the finished jobs to jobs.
+    void TakeFinishedJobs(std::vector<JobPtr> &jobs)
+    {
+        QMutexLocker lock(&mutex_);
+        jobs.insert(jobs.end(), finishedJobs_.begin(), finishedJobs_.end());
+        finishedJobs_.clear();
+    }
+
+private:
+    /// Runs one job of the queue on a thread of the pool.
+    class Runner : public QRunnable
+    {
+    public:
+        Runner(WorkerJobQueue *owner, const JobPtr &job) :
+            owner_(owner), job_(job)
+        {
+            setAutoDelete(true);
+        }
+
+        void run()
+        {
+            owner_->process_(*job_);
+            owner_->JobFinished(job_);
+        }
+
+    private:
+        WorkerJobQueue *owner_;
+        JobPtr job_;
+    };
+    friend class Runner;
+
+    /// Called by the worker threads when a job has been processed. Hands the thread's slot in the queue to the next queued job.
+    void JobFinished(const JobPtr &job)
+    {
+        QMutexLocker lock(&mutex_);
+        finishedJobs_.push_back(job);
+        if (!queuedJobs_.empty())
+        {
+            QThreadPool::globalInstance()->start(new Runner(this, queuedJobs_.front()));
+            queuedJobs_.pop_front();
+        }
+        else if (--numRunningJobs_ == 0)
+            allJobsDone_.wakeAll();
+    }
+
+    ProcessFunction process_;
+    const int maxConcurrentJobs_;
+    int numRunningJobs_; ///< Jobs started on the pool and not yet finished.
+    std::deque<JobPtr> queuedJobs_; ///< Jobs waiting for a free slot in the queue.
+    std::deque<JobPtr> finishedJobs_; ///< Jobs processed by the worker threads, waiting to be taken by the main thread.
+    QMutex mutex_; ///< Guards the job lists and numRunningJobs_.
+    QWaitCondition allJobsDone_; ///< Signaled when the last running job has finished.
+};
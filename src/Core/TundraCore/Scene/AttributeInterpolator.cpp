@@ -0,0 +1,301 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AttributeInterpolator.cpp
+    @brief  Runs the attribute interpolations of a scene. */
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AttributeInterpolator.h"
+#include "IAttribute.h"
+#include "IComponent.h"
+#include "Math/MathFunc.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+template<typename T>
+void SwapRemoveAt(std::vector<T> &v, int i)
+{
+    v[i] = v.back();
+    v.pop_back();
+}
+
+inline float InterpolateValue(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+inline float3 InterpolateValue(const float3 &a, const float3 &b, float t)
+{
+    return float3(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+}
+
+inline Quat InterpolateValue(const Quat &a, const Quat &b, float t)
+{
+    return Slerp(a, b, t);
+}
+
+}
+
+void AttributeInterpolator::Lane::Push(IAttribute *attr, float length)
+{
+    attributes.push_back(attr);
+    owners.push_back(attr->Owner()->shared_from_this());
+    times.push_back(0.f);
+    lengths.push_back(length);
+}
+
+void AttributeInterpolator::Lane::SwapRemove(int i)
+{
+    SwapRemoveAt(attributes, i);
+    SwapRemoveAt(owners, i);
+    SwapRemoveAt(times, i);
+    SwapRemoveAt(lengths, i);
+}
+
+void AttributeInterpolator::Lane::AdvanceTimes(int n, float frameTime)
+{
+    factors.resize(n);
+    for(int i = 0; i < n; ++i)
+    {
+        const bool holding = times[i] > lengths[i];
+        times[i] += frameTime;
+        factors[i] = holding ? -1.f : Min(times[i] / lengths[i], 1.f);
+    }
+}
+
+template<typename T>
+void AttributeInterpolator::ValueLane<T>::SwapRemove(int i)
+{
+    Lane::SwapRemove(i);
+    SwapRemoveAt(starts, i);
+    SwapRemoveAt(ends, i);
+}
+
+template<typename T>
+void AttributeInterpolator::ValueLane<T>::ComputeValues(int n)
+{
+    values.resize(n);
+    for(int i = 0; i < n; ++i)
+        values[i] = InterpolateValue(starts[i], ends[i], factors[i]);
+}
+
+template<typename T>
+void AttributeInterpolator::ValueLane<T>::Apply(int i)
+{
+    static_cast<Attribute<T>*>(attributes[i])->Set(values[i], AttributeChange::LocalOnly);
+}
+
+void AttributeInterpolator::TransformLane::SwapRemove(int i)
+{
+    Lane::SwapRemove(i);
+    SwapRemoveAt(startPositions, i);
+    SwapRemoveAt(endPositions, i);
+    SwapRemoveAt(startOrientations, i);
+    SwapRemoveAt(endOrientations, i);
+    SwapRemoveAt(startScales, i);
+    SwapRemoveAt(endScales, i);
+}
+
+void AttributeInterpolator::TransformLane::ComputeValues(int n)
+{
+    values.resize(n);
+    for(int i = 0; i < n; ++i)
+    {
+        values[i].pos = InterpolateValue(startPositions[i], endPositions[i], factors[i]);
+        values[i].scale = InterpolateValue(startScales[i], endScales[i], factors[i]);
+    }
+    for(int i = 0; i < n; ++i)
+        if (factors[i] >= 0.f)
+            values[i].SetOrientation(Slerp(startOrientations[i], endOrientations[i], factors[i]));
+}
+
+void AttributeInterpolator::TransformLane::Apply(int i)
+{
+    static_cast<Attribute<Transform>*>(attributes[i])->Set(values[i], AttributeChange::LocalOnly);
+}
+
+void AttributeInterpolator::GenericLane::SwapRemove(int i)
+{
+    delete starts[i];
+    delete ends[i];
+    Lane::SwapRemove(i);
+    SwapRemoveAt(starts, i);
+    SwapRemoveAt(ends, i);
+}
+
+void AttributeInterpolator::GenericLane::Apply(int i)
+{
+    attributes[i]->Interpolate(starts[i], ends[i], factors[i], AttributeChange::LocalOnly);
+}
+
+AttributeInterpolator::AttributeInterpolator() :
+    updating_(false)
+{
+}
+
+AttributeInterpolator::~AttributeInterpolator()
+{
+    Clear();
+}
+
+void AttributeInterpolator::Start(IAttribute *attr, IAttribute *endValue, float length)
+{
+    assert(attr && endValue && attr->Owner() && length > 0.f && !index_.contains(attr));
+
+    switch(attr->TypeId())
+    {
+    case cAttributeReal:
+        index_.insert(attr, Slot(FloatLaneType, floats_.Size()));
+        floats_.Push(attr, length);
+        floats_.starts.push_back(static_cast<Attribute<float>*>(attr)->Get());
+        floats_.ends.push_back(static_cast<Attribute<float>*>(endValue)->Get());
+        delete endValue;
+        break;
+    case cAttributeFloat3:
+        index_.insert(attr, Slot(Float3LaneType, float3s_.Size()));
+        float3s_.Push(attr, length);
+        float3s_.starts.push_back(static_cast<Attribute<float3>*>(attr)->Get());
+        float3s_.ends.push_back(static_cast<Attribute<float3>*>(endValue)->Get());
+        delete endValue;
+        break;
+    case cAttributeQuat:
+        index_.insert(attr, Slot(QuatLaneType, quats_.Size()));
+        quats_.Push(attr, length);
+        quats_.starts.push_back(static_cast<Attribute<Quat>*>(attr)->Get());
+        quats_.ends.push_back(static_cast<Attribute<Quat>*>(endValue)->Get());
+        delete endValue;
+        break;
+    case cAttributeTransform:
+    {
+        const Transform &start = static_cast<Attribute<Transform>*>(attr)->Get();
+        const Transform &end = static_cast<Attribute<Transform>*>(endValue)->Get();
+        index_.insert(attr, Slot(TransformLaneType, transforms_.Size()));
+        transforms_.Push(attr, length);
+        transforms_.startPositions.push_back(start.pos);
+        transforms_.endPositions.push_back(end.pos);
+        transforms_.startOrientations.push_back(start.Orientation());
+        transforms_.endOrientations.push_back(end.Orientation());
+        transforms_.startScales.push_back(start.scale);
+        transforms_.endScales.push_back(end.scale);
+        delete endValue;
+        break;
+    }
+    default:
+        index_.insert(attr, Slot(GenericLaneType, generic_.Size()));
+        generic_.Push(attr, length);
+        generic_.starts.push_back(attr->Clone());
+        generic_.ends.push_back(endValue);
+        break;
+    }
+}
+
+bool AttributeInterpolator::End(IAttribute *attr)
+{
+    QHash<IAttribute*, Slot>::iterator iter = index_.find(attr);
+    if (iter == index_.end())
+        return false;
+
+    const Slot slot = *iter;
+    const bool exists = !LaneOf(slot.lane).owners[slot.index].expired();
+    if (updating_)
+    {
+        // Removing now would move the interpolations the update is walking, mark it ended for the update to remove.
+        LaneOf(slot.lane).lengths[slot.index] = 0.f;
+        index_.erase(iter);
+        return exists;
+    }
+
+    switch(slot.lane)
+    {
+    case FloatLaneType: RemoveFromLane(floats_, slot.lane, slot.index); break;
+    case Float3LaneType: RemoveFromLane(float3s_, slot.lane, slot.index); break;
+    case QuatLaneType: RemoveFromLane(quats_, slot.lane, slot.index); break;
+    case TransformLaneType: RemoveFromLane(transforms_, slot.lane, slot.index); break;
+    case GenericLaneType: RemoveFromLane(generic_, slot.lane, slot.index); break;
+    }
+    return exists;
+}
+
+void AttributeInterpolator::Clear()
+{
+    for(int i = generic_.Size() - 1; i >= 0; --i)
+        generic_.SwapRemove(i);
+    floats_ = ValueLane<float>();
+    float3s_ = ValueLane<float3>();
+    quats_ = ValueLane<Quat>();
+    transforms_ = TransformLane();
+    index_.clear();
+}
+
+void AttributeInterpolator::Update(float frameTime)
+{
+    updating_ = true;
+    UpdateLane(floats_, frameTime);
+    UpdateLane(float3s_, frameTime);
+    UpdateLane(quats_, frameTime);
+    UpdateLane(transforms_, frameTime);
+    UpdateLane(generic_, frameTime);
+    updating_ = false;
+
+    // Remove the finished interpolations, and the ones ended during the update.
+    RemoveFinished(floats_, FloatLaneType);
+    RemoveFinished(float3s_, Float3LaneType);
+    RemoveFinished(quats_, QuatLaneType);
+    RemoveFinished(transforms_, TransformLaneType);
+    RemoveFinished(generic_, GenericLaneType);
+}
+
+template<typename LaneT>
+void AttributeInterpolator::UpdateLane(LaneT &lane, float frameTime)
+{
+    // Interpolations started from the change signals during the update are appended to the lane, and run from the next update.
+    const int n = lane.Size();
+    lane.AdvanceTimes(n, frameTime);
+    lane.ComputeValues(n);
+    for(int i = 0; i < n; ++i)
+        if (lane.factors[i] >= 0.f && lane.lengths[i] > 0.f && !lane.owners[i].expired())
+            lane.Apply(i);
+}
+
+template<typename LaneT>
+void AttributeInterpolator::RemoveFinished(LaneT &lane, LaneType type)
+{
+    for(int i = lane.Size() - 1; i >= 0; --i)
+        if (lane.lengths[i] <= 0.f || lane.times[i] >= lane.lengths[i] * 2.f || lane.owners[i].expired())
+            RemoveFromLane(lane, type, i);
+}
+
+template<typename LaneT>
+void AttributeInterpolator::RemoveFromLane(LaneT &lane, LaneType type, int i)
+{
+    // An interpolation ended during an update is no longer in the index, and its attribute may have a new interpolation.
+    QHash<IAttribute*, Slot>::iterator iter = index_.find(lane.attributes[i]);
+    if (iter != index_.end() && iter->lane == type && iter->index == i)
+        index_.erase(iter);
+
+    const int last = lane.Size() - 1;
+    if (i != last)
+    {
+        iter = index_.find(lane.attributes[last]);
+        if (iter != index_.end() && iter->lane == type && iter->index == last)
+            iter->index = i;
+    }
+    lane.SwapRemove(i);
+}
+
+AttributeInterpolator::Lane &AttributeInterpolator::LaneOf(LaneType type)
+{
+    switch(type)
+    {
+    case FloatLaneType: return floats_;
+    case Float3LaneType: return float3s_;
+    case QuatLaneType: return quats_;
+    case TransformLaneType: return transforms_;
+    default: return generic_;
+    }
+}
@@ -0,0 +1,154 @@
+/**
+    For conditions of distribution and use, see copyright notice in LICENSE
+
+    @file   AttributeInterpolator.h
+    @brief  Runs the attribute interpolations of a scene. */
+
+#pragma once
+
+#include "TundraCoreApi.h"
+#include "SceneFwd.h"
+#include "Transform.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+
+#include <QHash>
+
+#include <vector>
+
+class IAttribute;
+
+/// Runs the attribute interpolations of a scene.
+/** The interpolations are stored in lanes by the attribute type, with the values of each lane in parallel arrays,
+    so that the float, float3, Quat and Transform interpolations are computed in tight loops without virtual calls
+    or cloned attributes. Attributes of other interpolable types use a generic lane, which interpolates through
+    IAttribute::Interpolate. The interpolations are found by the attribute pointer, and removed from their lane by
+    moving the last interpolation of the lane into their place.
+
+    Owned by Scene, see Scene::StartAttributeInterpolation. */
+class TUNDRACORE_API AttributeInterpolator
+{
+public:
+    AttributeInterpolator();
+    ~AttributeInterpolator();
+
+    /// Starts interpolating an attribute from its current value to the value of endValue.
+    /** Takes the ownership of endValue. An already running interpolation of the attribute must have been ended with End() first.
+        @param attr Attribute inside a component.
+        @param endValue Same kind of attribute holding the endpoint value.
+        @param length Length of the interpolation in seconds, must be positive. */
+    void Start(IAttribute *attr, IAttribute *endValue, float length);
+
+    /// Ends the interpolation of an attribute. The last set value will remain.
+    /** @return true if the attribute had an interpolation, whose component still exists. */
+    bool End(IAttribute *attr);
+
+    /// Ends all interpolations.
+    void Clear();
+
+    /// Advances all interpolations by a time step, and sets the interpolated values with LocalOnly change.
+    /** The interpolation continues for twice its length, without setting the value after the first length, so that the
+        owner can tell a continuous update from a discontinuous one. Interpolations can be started and ended from the
+        attribute change signals emitted during the update. */
+    void Update(float frameTime);
+
+    /// Returns the number of running interpolations.
+    int Size() const { return index_.size(); }
+
+private:
+    enum LaneType
+    {
+        FloatLaneType,
+        Float3LaneType,
+        QuatLaneType,
+        TransformLaneType,
+        GenericLaneType
+    };
+
+    /// The position of an interpolation in the lanes.
+    struct Slot
+    {
+        Slot() : lane(GenericLaneType), index(0) {}
+        Slot(LaneType lane_, int index_) : lane(lane_), index(index_) {}
+        LaneType lane;
+        int index;
+    };
+
+    /// The bookkeeping of the interpolations of a lane. The values are stored in the derived lanes.
+    struct Lane
+    {
+        std::vector<IAttribute*> attributes;
+        std::vector<ComponentWeakPtr> owners;
+        std::vector<float> times;
+        std::vector<float> lengths; ///< Zero for an interpolation which was ended during an update, and is removed at its end.
+        std::vector<float> factors; ///< Lerp factors of the current update, negative for the interpolations past their length.
+
+        int Size() const { return (int)attributes.size(); }
+        void Push(IAttribute *attr, float length);
+        void SwapRemove(int i);
+        /// Advances the times of the first n interpolations and computes their lerp factors.
+        void AdvanceTimes(int n, float frameTime);
+    };
+
+    /// Interpolations of an attribute type which is lerped or slerped directly.
+    template<typename T>
+    struct ValueLane : public Lane
+    {
+        std::vector<T> starts;
+        std::vector<T> ends;
+        std::vector<T> values; ///< Interpolated values of the current update.
+
+        void SwapRemove(int i);
+        void ComputeValues(int n);
+        void Apply(int i);
+    };
+
+    /// Transform interpolations, with the position, orientation and scale in separate arrays.
+    struct TransformLane : public Lane
+    {
+        std::vector<float3> startPositions;
+        std::vector<float3> endPositions;
+        std::vector<Quat> startOrientations;
+        std::vector<Quat> endOrientations;
+        std::vector<float3> startScales;
+        std::vector<float3> endScales;
+        std::vector<Transform> values; ///< Interpolated values of the current update.
+
+        void SwapRemove(int i);
+        void ComputeValues(int n);
+        void Apply(int i);
+    };
+
+    /// Interpolations of the other attribute types, which keep the start and end values as attribute clones.
+    struct GenericLane : public Lane
+    {
+        std::vector<IAttribute*> starts;
+        std::vector<IAttribute*> ends;
+
+        void SwapRemove(int i);
+        void ComputeValues(int /*n*/) {}
+        void Apply(int i);
+    };
+
+    /// Advances the interpolations of a lane and sets their values.
+    template<typename LaneT>
+    void UpdateLane(LaneT &lane, float frameTime);
+
+    /// Removes the finished and ended interpolations of a lane.
+    template<typename LaneT>
+    void RemoveFinished(LaneT &lane, LaneType type);
+
+    /// Removes an interpolation from a lane, and updates the slot of the interpolation moved into its place.
+    template<typename LaneT>
+    void RemoveFromLane(LaneT &lane, LaneType type, int i);
+
+    Lane &LaneOf(LaneType type);
+
+    ValueLane<float> floats_;
+    ValueLane<float3> float3s_;
+    ValueLane<Quat> quats_;
+    TransformLane transforms_;
+    GenericLane generic_;
+    QHash<IAttribute*, Slot> index_; ///< The slot of each interpolated attribute.
+    bool updating_; ///< Currently running Update(). Ended interpolations are then removed at the end of the update.
+};
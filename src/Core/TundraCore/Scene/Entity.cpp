@@ -18,9 +18,13 @@
 
 #include <kNet/DataSerializer.h>
 #include <kNet/DataDeserializer.h>
+#include <kNet/NetException.h>
 
 #include "MemoryLeakCheck.h"
 
+/// Largest binary serialization of a single component. Scene::SaveSceneBinary accepts entities up to 256MB.
+static const int cMaxBinaryComponentSize = 64 * 1024 * 1024;
+
 Entity::Entity(Framework* framework, Scene* scene) :
     framework_(framework),
     scene_(scene),
@@ -39,6 +43,8 @@ Entity::Entity(Framework* framework, entity_id_t id, Scene* scene) :
 
 Entity::~Entity()
 {
+    SetScene(0);
+
     // If components still alive, they become free-floating
     for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
         i->second->SetParentEntity(0);
@@ -47,6 +53,16 @@ Entity::~Entity()
     qDeleteAll(actions_);
 }
 
+void Entity::SetScene(Scene* scene)
+{
+    // The scene indexes the components until they are removed from the entity. The components added after RemoveAllComponents,
+    // for example by an EntityRemoved handler, are never removed, so drop them from the index when the entity leaves the scene.
+    if (scene_ && scene != scene_)
+        for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
+            scene_->EmitComponentRemoved(this, i->second.get(), AttributeChange::Disconnected);
+    scene_ = scene;
+}
+
 void Entity::ChangeComponentId(component_id_t old_id, component_id_t new_id)
 {
     if (old_id == new_id)
@@ -440,13 +456,25 @@ void Entity::SerializeToBinary(kNet::DataSerializer &dst) const
             dst.AddString(i->second->Name().toStdString());
             dst.Add<u8>(i->second->IsReplicated() ? 1 : 0);
             
-            // Write each component to a separate buffer, then write out its size first, so we can skip unknown components
-            QByteArray comp_bytes;
-            // Assume 64KB max per component for now
-            comp_bytes.resize(64 * 1024);
-            kNet::DataSerializer comp_dest(comp_bytes.data(), comp_bytes.size());
-            i->second->SerializeToBinary(comp_dest);
-            comp_bytes.resize(comp_dest.BytesFilled());
+            // Write each component to a separate buffer, then write out its size first, so we can skip unknown components.
+            // Start from 64KB, which fits nearly all components, and grow the buffer until the component fits.
+            QByteArray comp_bytes(64 * 1024, 0);
+            for(;;)
+            {
+                try
+                {
+                    kNet::DataSerializer comp_dest(comp_bytes.data(), comp_bytes.size());
+                    i->second->SerializeToBinary(comp_dest);
+                    comp_bytes.resize(comp_dest.BytesFilled());
+                    break;
+                }
+                catch(const kNet::NetException &)
+                {
+                    if (comp_bytes.size() >= cMaxBinaryComponentSize)
+                        throw;
+                    comp_bytes.resize(comp_bytes.size() * 2);
+                }
+            }
             
             dst.Add<u32>(comp_bytes.size());
             dst.AddArray<u8>((const u8*)comp_bytes.data(), comp_bytes.size());
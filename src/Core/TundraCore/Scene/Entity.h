@@ -430,8 +430,8 @@ private:
     /// Set new id
     void SetNewId(entity_id_t id) { id_ = id; }
 
-    /// Set new scene
-    void SetScene(Scene* scene) { scene_ = scene; }
+    /// Set new scene. Removes the components that the entity still has from the component index of the old scene.
+    void SetScene(Scene* scene);
 
     /// Emit a entity deletion signal. Called from Scene
     void EmitEntityRemoved(AttributeChange::Type change);
@@ -388,13 +388,13 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
         change = updateMode;
     assert(change != AttributeChange::Default);
 
-    if (change == AttributeChange::Disconnected)
-        return; // No signals
-    
-    // Trigger scenemanager signal
+    // Trigger scenemanager signal. The scene does not signal disconnected changes, but updates its indices on them.
     Scene* scene = ParentScene();
     if (scene)
         scene->EmitAttributeChanged(this, attribute, change);
+
+    if (change == AttributeChange::Disconnected)
+        return; // No signals
     
     // Trigger internal signal
     emit AttributeChanged(attribute, change);
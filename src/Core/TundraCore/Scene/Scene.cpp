@@ -13,6 +13,7 @@
 #include "AttributeMetadata.h"
 #include "ChangeRequest.h"
 #include "EntityReference.h"
+#include "AttributeInterpolator.h"
 
 #include "Framework.h"
 #include "Application.h"
@@ -31,17 +32,38 @@
 
 #include <kNet/DataDeserializer.h>
 #include <kNet/DataSerializer.h>
+#include <kNet/NetException.h>
 
 #include <utility>
+#include <algorithm>
 #include "MemoryLeakCheck.h"
 
 using namespace kNet;
 
+namespace
+{
+
+bool EntityIdLessThan(const Entity *a, const Entity *b)
+{
+    return a->Id() < b->Id();
+}
+
+/// Orders components the way walking the entity map and the component maps of the entities would.
+bool ComponentIdLessThan(const IComponent *a, const IComponent *b)
+{
+    const entity_id_t idA = a->ParentEntity()->Id(), idB = b->ParentEntity()->Id();
+    return idA < idB || (idA == idB && a->Id() < b->Id());
+}
+
+}
+
 Scene::Scene(const QString &name, Framework *framework, bool viewEnabled, bool authority) :
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    interpolations_(new AttributeInterpolator()),
+    nextAttributeChangeSubscriber_(0)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled;
@@ -58,6 +80,8 @@ Scene::~Scene()
     RemoveAllEntities(false);
     
     emit Removed(this);
+
+    SAFE_DELETE(interpolations_);
 }
 
 EntityPtr Scene::CreateLocalEntity(const QStringList &components, AttributeChange::Type change, bool componentsReplicated)
@@ -128,11 +152,13 @@ EntityPtr Scene::EntityByName(const QString &name) const
     if (name.isEmpty())
         return EntityPtr();
 
-    for(const_iterator it = begin(); it != end(); ++it)
-        if (it->second->Name() == name)
-            return it->second;
+    // If several entities have the same name, return the one with the lowest ID, like walking the entity map would.
+    Entity *entity = 0;
+    for(QMultiHash<QString, Entity*>::const_iterator it = entitiesByName_.find(name); it != entitiesByName_.end() && it.key() == name; ++it)
+        if (!entity || it.value()->Id() < entity->Id())
+            entity = it.value();
 
-    return EntityPtr();
+    return entity ? entity->shared_from_this() : EntityPtr();
 }
 
 bool Scene::IsUniqueName(const QString& name) const
@@ -140,11 +166,7 @@ bool Scene::IsUniqueName(const QString& name) const
     if (name.isEmpty())
         return false;
 
-    for(const_iterator it = begin(); it != end(); ++it)
-        if (it->second->Name() == name)
-            return false;
-
-    return true;
+    return !entitiesByName_.contains(name);
 }
 
 void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
@@ -219,6 +241,9 @@ void Scene::RemoveAllEntities(bool signal, AttributeChange::Type change)
     if (entities_.size())
     {
         LogWarning("Scene::RemoveAllEntities: entity map was not clear after removing all entities, clearing manually");
+        for (EntityMap::iterator it = entities_.begin(); it != entities_.end(); ++it)
+            if (it->second.get())
+                it->second->SetScene(0);
         entities_.clear();
     }
     
@@ -248,10 +273,15 @@ EntityList Scene::EntitiesWithComponent(const QString &typeName, const QString &
 
 EntityList Scene::EntitiesWithComponent(u32 typeId, const QString &name) const
 {
+    std::vector<IComponent*> components = IndexedComponents(typeId, name);
     EntityList entities;
-    for(const_iterator it = begin(); it != end(); ++it)
-        if ((name.isEmpty() && it->second->Component(typeId)) || it->second->Component(typeId, name))
-            entities.push_back(it->second);
+    for(size_t i = 0; i < components.size(); ++i)
+    {
+        // The components of an entity are adjacent, add the entity only once.
+        Entity *entity = components[i]->ParentEntity();
+        if (i == 0 || components[i-1]->ParentEntity() != entity)
+            entities.push_back(entity->shared_from_this());
+    }
     return entities;
 }
 
@@ -262,26 +292,58 @@ Entity::ComponentVector Scene::Components(const QString &typeName, const QString
 
 Entity::ComponentVector Scene::Components(u32 typeId, const QString &name) const
 {
+    std::vector<IComponent*> components = IndexedComponents(typeId, name);
     Entity::ComponentVector ret;
-    if (name.isEmpty())
+    ret.reserve(components.size());
+    for(size_t i = 0; i < components.size(); ++i)
     {
-        for(const_iterator it = begin(); it != end(); ++it)
+        // With a name given, return only the first matching component of each entity, like Entity::Component(typeId, name).
+        if (!name.isEmpty() && i > 0 && components[i-1]->ParentEntity() == components[i]->ParentEntity())
+            continue;
+        ret.push_back(components[i]->shared_from_this());
+    }
+    return ret;
+}
+
+std::vector<IComponent*> Scene::IndexedComponents(u32 typeId, const QString &name) const
+{
+    std::vector<IComponent*> ret;
+    QHash<u32, QSet<IComponent*> >::const_iterator components = componentsByType_.find(typeId);
+    if (components == componentsByType_.end())
+        return ret;
+
+    ret.reserve(components->size());
+    for(QSet<IComponent*>::const_iterator it = components->begin(); it != components->end(); ++it)
+        if (name.isEmpty() || (*it)->Name() == name)
+            ret.push_back(*it);
+    std::sort(ret.begin(), ret.end(), ComponentIdLessThan);
+    return ret;
+}
+
+void Scene::UpdateNameIndex(Entity *entity, IComponent *removedComponent)
+{
+    QString name;
+    const Entity::ComponentMap &components = entity->Components();
+    for(Entity::ComponentMap::const_iterator it = components.begin(); it != components.end(); ++it)
+        if (it->second->TypeId() == EC_Name::ComponentTypeId && it->second.get() != removedComponent)
         {
-            Entity::ComponentVector components =  it->second->ComponentsOfType(typeId);
-            if (!components.empty())
-                ret.insert(ret.end(), components.begin(), components.end());
+            name = checked_static_cast<EC_Name*>(it->second.get())->name.Get();
+            break;
         }
+
+    QHash<Entity*, QString>::iterator old = entityNames_.find(entity);
+    if (old != entityNames_.end())
+    {
+        if (*old == name)
+            return;
+        entitiesByName_.remove(*old, entity);
+        entityNames_.erase(old);
     }
-    else
+    if (!name.isEmpty())
     {
-        for(const_iterator it = begin(); it != end(); ++it)
-        {
-            ComponentPtr component = it->second->GetComponent(typeId, name);
-            if (component)
-                ret.push_back(component);
-        }
+        entitiesByName_.insert(name, entity);
+        entityNames_.insert(entity, name);
     }
-    return ret;
 }
 
 EntityList Scene::GetAllEntities() const
@@ -297,6 +359,11 @@ EntityList Scene::GetAllEntities() const
 
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    // Index the component also when the change is not signaled.
+    componentsByType_[comp->TypeId()].insert(comp);
+    if (comp->TypeId() == EC_Name::ComponentTypeId)
+        UpdateNameIndex(entity);
+
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -306,6 +373,17 @@ void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange
 
 void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    QHash<u32, QSet<IComponent*> >::iterator components = componentsByType_.find(comp->TypeId());
+    if (components != componentsByType_.end())
+    {
+        components->remove(comp);
+        if (components->isEmpty())
+            componentsByType_.erase(components);
+    }
+    // The component is still in the entity at this point, so tell the name lookup to skip it.
+    if (comp->TypeId() == EC_Name::ComponentTypeId)
+        UpdateNameIndex(entity, comp);
+
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -315,13 +393,80 @@ void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChan
 
 void Scene::EmitAttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
-    if (!comp || !attribute || change == AttributeChange::Disconnected)
+    if (!comp || !attribute)
+        return;
+    // Keep the name index up to date also when the change is not signaled.
+    if (comp->TypeId() == EC_Name::ComponentTypeId && comp->ParentEntity())
+        UpdateNameIndex(comp->ParentEntity());
+    if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
+
+    // A change that is not made by the interpolation overrides it. End the interpolation right away, so that its next
+    // update does not overwrite the new value. Only the clients run interpolations.
+    if (!interpolating_ && interpolations_->Size() > 0)
+        interpolations_->End(attribute);
+
+    if (!attributeChangeSubscribers_.empty())
+    {
+        AttributeChangeRecord record;
+        record.component = comp->shared_from_this();
+        record.attributeIndex = attribute->Index();
+        record.change = change;
+        attributeChanges_.push_back(record);
+    }
+
     emit AttributeChanged(comp, attribute, change);
 }
 
+int Scene::SubscribeAttributeChanges()
+{
+    const int subscriber = nextAttributeChangeSubscriber_++;
+    attributeChangeSubscribers_[subscriber] = attributeChanges_.size();
+    return subscriber;
+}
+
+void Scene::UnsubscribeAttributeChanges(int subscriber)
+{
+    attributeChangeSubscribers_.erase(subscriber);
+    if (attributeChangeSubscribers_.empty())
+        AttributeChangeVector().swap(attributeChanges_);
+}
+
+void Scene::TakeAttributeChanges(int subscriber, AttributeChangeVector &changes)
+{
+    changes.clear();
+    std::map<int, size_t>::iterator iter = attributeChangeSubscribers_.find(subscriber);
+    if (iter == attributeChangeSubscribers_.end())
+        return;
+
+    // With a single subscriber, hand over the whole journal without copying.
+    if (attributeChangeSubscribers_.size() == 1)
+    {
+        changes.swap(attributeChanges_);
+        if (iter->second > 0)
+            changes.erase(changes.begin(), changes.begin() + iter->second);
+        attributeChanges_.clear();
+        iter->second = 0;
+        return;
+    }
+
+    changes.assign(attributeChanges_.begin() + iter->second, attributeChanges_.end());
+    iter->second = attributeChanges_.size();
+
+    // Drop the changes that all subscribers have taken.
+    size_t taken = attributeChanges_.size();
+    for(std::map<int, size_t>::const_iterator it = attributeChangeSubscribers_.begin(); it != attributeChangeSubscribers_.end(); ++it)
+        taken = std::min(taken, it->second);
+    if (taken > 0)
+    {
+        attributeChanges_.erase(attributeChanges_.begin(), attributeChanges_.begin() + taken);
+        for(std::map<int, size_t>::iterator it = attributeChangeSubscribers_.begin(); it != attributeChangeSubscribers_.end(); ++it)
+            it->second -= taken;
+    }
+}
+
 void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, AttributeChange::Type change)
 {
     // "Stealth" addition (disconnected changetype) is not supported. Always signal.
@@ -501,29 +646,36 @@ QList<Entity *> Scene::LoadSceneBinary(const QString& filename, bool clearScene,
         return ret;
     }
 
-    ///\todo Use Latin 1?
-    QByteArray bytes = file.readAll();
-    file.close();
-
-    if (!bytes.size())
+    if (!file.size())
     {
         LogError("File " + filename + " contained 0 bytes when loading scene binary.");
         return ret;
     }
+    file.close();
 
     if (clearScene)
         RemoveAllEntities(true, change);
 
-    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+    return CreateContentFromBinary(filename, useEntityIDsFromFile, change);
 }
 
+/// Size of the chunks in which scene binaries are written and read.
+static const int cSceneBinaryChunkSize = 256 * 1024;
+/// Largest entity record accepted in a scene binary, to stop at corrupted data before running out of memory.
+static const int cMaxBinaryEntitySize = 256 * 1024 * 1024;
+
 bool Scene::SaveSceneBinary(const QString& filename, bool getTemporary, bool getLocal) const
 {
-    QByteArray bytes;
-    // Assume 4MB max for now
-    bytes.resize(4 * 1024 * 1024);
-    DataSerializer dest(bytes.data(), bytes.size());
-    
+    // Write to a temporary file that replaces the target only when the whole scene has been written,
+    // so that a failed save does not destroy the previous scene binary.
+    const QString tempFilename = filename + ".tmp";
+    QFile scenefile(tempFilename);
+    if (!scenefile.open(QFile::WriteOnly))
+    {
+        LogError("Could not open file " + tempFilename + " for writing when saving scene binary");
+        return false;
+    }
+
     // Count number of entities we accept
     uint num_entities = 0;
     for(const_iterator iter = begin(); iter != end(); ++iter)
@@ -536,33 +688,83 @@ bool Scene::SaveSceneBinary(const QString& filename, bool getTemporary, bool get
         if (serialize)
             ++num_entities;
     }
-    
-    dest.Add<u32>(num_entities);
 
-    for(const_iterator iter = begin(); iter != end(); ++iter)
+    // The entities are serialized one at a time to a buffer that is flushed to the file when it fills up,
+    // so the memory needed stays bounded by the largest entity instead of growing with the scene.
+    QByteArray chunk;
+    chunk.reserve(cSceneBinaryChunkSize);
+    QByteArray entityBytes(64 * 1024, 0);
+
+    {
+        DataSerializer dest(entityBytes.data(), entityBytes.size());
+        dest.Add<u32>(num_entities);
+        chunk.append(entityBytes.constData(), (int)dest.BytesFilled());
+    }
+
+    bool ok = true;
+    for(const_iterator iter = begin(); iter != end() && ok; ++iter)
     {
         bool serialize = true;
         if (iter->second->IsLocal() && !getLocal)
             serialize = false;
         if (iter->second->IsTemporary() && !getTemporary)
             serialize = false;
-        if (serialize)
-            iter->second->SerializeToBinary(dest);
-    }
-    
-    bytes.resize(dest.BytesFilled());
-    QFile scenefile(filename);
-    if (scenefile.open(QFile::WriteOnly))
-    {
-        scenefile.write(bytes);
-        scenefile.close();
-        return true;
+        if (!serialize)
+            continue;
+
+        // Grow the entity buffer until the entity fits. Entity::SerializeToBinary throws also when a single component
+        // exceeds its own limit, in which case the retries end at cMaxBinaryEntitySize.
+        size_t bytesFilled = 0;
+        for(;;)
+        {
+            try
+            {
+                DataSerializer dest(entityBytes.data(), entityBytes.size());
+                iter->second->SerializeToBinary(dest);
+                bytesFilled = dest.BytesFilled();
+                break;
+            }
+            catch(const kNet::NetException &)
+            {
+                if (entityBytes.size() >= cMaxBinaryEntitySize)
+                {
+                    LogError("Entity " + QString::number(iter->second->Id()) + " is too large to be saved to scene binary " + filename);
+                    ok = false;
+                    break;
+                }
+                entityBytes.resize(entityBytes.size() * 2);
+            }
+        }
+        if (!ok)
+            break;
+
+        if (chunk.size() + (int)bytesFilled > cSceneBinaryChunkSize && !chunk.isEmpty())
+        {
+            ok = scenefile.write(chunk) == chunk.size();
+            chunk.clear();
+        }
+        if ((int)bytesFilled > cSceneBinaryChunkSize)
+            ok = ok && scenefile.write(entityBytes.constData(), bytesFilled) == (qint64)bytesFilled; // Large entities bypass the chunk.
+        else
+            chunk.append(entityBytes.constData(), (int)bytesFilled);
     }
-    else
+
+    if (ok && !chunk.isEmpty())
+        ok = scenefile.write(chunk) == chunk.size();
+    scenefile.close();
+    ok = ok && scenefile.error() == QFile::NoError;
+
+    // QFile::rename does not overwrite, so remove the old file first.
+    if (ok && QFile::exists(filename) && !QFile::remove(filename))
+        ok = false;
+    if (ok && !QFile::rename(tempFilename, filename))
+        ok = false;
+    if (!ok)
     {
-        LogError("Could not open file " + filename + " for writing when saving scene binary");
-        return false;
+        QFile::remove(tempFilename);
+        LogError("Failed to write scene binary " + filename);
     }
+    return ok;
 }
 
 QList<Entity *> Scene::CreateContentFromXml(const QString &xml,  bool useEntityIDsFromFile, AttributeChange::Type change)
@@ -729,8 +931,41 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
     return ret;
 }
 
+/// Returns the size of the binary entity record at the start of the data, or 0 if the data ends before the record.
+static size_t BinaryEntityRecordSize(const char *data, size_t numBytes)
+{
+    try
+    {
+        DataDeserializer source(data, numBytes);
+        source.Read<u32>(); // Entity ID
+        source.Read<u8>(); // Replicated
+        const u32 numComponents = source.Read<u32>();
+        size_t pos = numBytes - source.BitsLeft() / 8;
+        for(u32 i = 0; i < numComponents; ++i)
+        {
+            DataDeserializer comp(data + pos, numBytes - pos);
+            comp.Read<u32>(); // Type ID
+            comp.ReadString(); // Name
+            comp.Read<u8>(); // Replicated
+            const u32 dataSize = comp.Read<u32>();
+            const size_t headerSize = (numBytes - pos) - comp.BitsLeft() / 8;
+            if (dataSize > numBytes - pos - headerSize)
+                return 0;
+            pos += headerSize + dataSize;
+        }
+        return pos;
+    }
+    catch(const kNet::NetException &)
+    {
+        return 0;
+    }
+}
+
 QList<Entity *> Scene::CreateContentFromBinary(const QString &filename, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
+    /// @todo Make server fix any broken parenting when it changes the entity IDs from unacked to replicated!
+    if (!IsAuthority() && !useEntityIDsFromFile)
+        LogWarning("Scene: The created entitity IDs need to be verified from the server. This will break EC_Placeable parenting.");
 
     QFile file(filename);
     if (!file.open(QIODevice::ReadOnly))
@@ -739,16 +974,60 @@ QList<Entity *> Scene::CreateContentFromBinary(const QString &filename, bool use
         return QList<Entity*>();
     }
 
-    QByteArray bytes = file.readAll();
-    file.close();
-    
-    if (!bytes.size())
+    if (!file.size())
     {
         LogError("File " + filename + "contained 0 bytes when loading scene binary.");
         return QList<Entity*>();
     }
 
-    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+    // Read the file in chunks to a window that holds the unparsed data. The window grows only if a single entity does not fit in it.
+    QByteArray window;
+    int windowStart = 0; // Offset of the unparsed data in the window
+    bool endOfFile = false;
+
+    std::vector<EntityWeakPtr> entities;
+    QHash<entity_id_t, entity_id_t> oldToNewIds;
+    try
+    {
+        window = file.read(cSceneBinaryChunkSize);
+        DataDeserializer header(window.constData(), window.size());
+        const uint num_entities = header.Read<u32>();
+        windowStart = sizeof(u32);
+
+        for(uint i = 0; i < num_entities; ++i)
+        {
+            size_t recordSize;
+            while((recordSize = BinaryEntityRecordSize(window.constData() + windowStart, window.size() - windowStart)) == 0)
+            {
+                if (endOfFile || window.size() - windowStart > cMaxBinaryEntitySize)
+                {
+                    LogError("Scene binary " + filename + " ended in the middle of entity data, stopping scene load!");
+                    throw kNet::NetException("Truncated scene binary");
+                }
+                // Drop the parsed data and append the next chunk of the file.
+                window.remove(0, windowStart);
+                windowStart = 0;
+                const QByteArray next = file.read(std::max(cSceneBinaryChunkSize, window.size()));
+                endOfFile = next.isEmpty();
+                window.append(next);
+            }
+
+            DataDeserializer source(window.constData() + windowStart, recordSize);
+            EntityPtr entity = CreateEntityFromBinary(source, useEntityIDsFromFile, oldToNewIds);
+            if (!entity)
+                return QList<Entity*>(); // If entity creation fails, stream desync is more than likely so stop right here
+            entities.push_back(entity);
+            windowStart += (int)recordSize;
+        }
+    }
+    catch(...)
+    {
+        // Note: if exception happens, no change signals are emitted
+        return QList<Entity *>();
+    }
+    file.close();
+
+    return SignalContentFromBinary(entities, oldToNewIds, useEntityIDsFromFile, change);
 }
 
 QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
@@ -768,71 +1047,9 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
         uint num_entities = source.Read<u32>();
         for(uint i = 0; i < num_entities; ++i)
         {
-            entity_id_t id = source.Read<u32>();
-            bool replicated = source.Read<u8>() ? true : false;
-            if (!useEntityIDsFromFile || id == 0)
-            {
-                entity_id_t originalId = id;
-                id = replicated ? NextFreeId() : NextFreeIdLocal();
-                if (originalId != 0 && !oldToNewIds.contains(originalId))
-                    oldToNewIds[originalId] = id;
-            }
-            else if (useEntityIDsFromFile && HasEntity(id))
-            {
-                entity_id_t newID = replicated ? NextFreeId() : NextFreeIdLocal();
-                ChangeEntityId(id, newID);
-            }
-
-            if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene.
-            {
-                LogDebug("Scene::CreateContentFromBinary: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
-                LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) + "might not replicate properly!");
-                RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
-            }
-
-            EntityPtr entity = CreateEntity(id);
+            EntityPtr entity = CreateEntityFromBinary(source, useEntityIDsFromFile, oldToNewIds);
             if (!entity)
-            {
-                LogError("Failed to create entity, stopping scene load!");
                 return QList<Entity*>(); // If entity creation fails, stream desync is more than likely so stop right here
-            }
-            
-            uint num_components = source.Read<u32>();
-            for(uint i = 0; i < num_components; ++i)
-            {
-                u32 typeId = source.Read<u32>(); ///\todo VLE this!
-                QString name = QString::fromStdString(source.ReadString());
-                bool compReplicated = source.Read<u8>() ? true : false;
-                uint data_size = source.Read<u32>();
-                
-                // Read the component data into a separate byte array, then deserialize from there.
-                // This way the whole stream should not desync even if something goes wrong
-                QByteArray comp_bytes;
-                comp_bytes.resize(data_size);
-                if (data_size)
-                    source.ReadArray<u8>((u8*)comp_bytes.data(), comp_bytes.size());
-                
-                try
-                {
-                    ComponentPtr new_comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated);
-                    if (new_comp)
-                    {
-                        if (data_size)
-                        {
-                            DataDeserializer comp_source(comp_bytes.data(), comp_bytes.size());
-                            // Trigger no signal yet when scene is in incoherent state
-                            new_comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
-                        }
-                    }
-                    else
-                        LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
-                }
-                catch(...)
-                {
-                    LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
-                }
-            }
-
             entities.push_back(entity);
         }
     }
@@ -842,6 +1059,82 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
         return QList<Entity *>();
     }
 
+    return SignalContentFromBinary(entities, oldToNewIds, useEntityIDsFromFile, change);
+}
+
+EntityPtr Scene::CreateEntityFromBinary(kNet::DataDeserializer &source, bool useEntityIDsFromFile, QHash<entity_id_t, entity_id_t> &oldToNewIds)
+{
+    entity_id_t id = source.Read<u32>();
+    bool replicated = source.Read<u8>() ? true : false;
+    if (!useEntityIDsFromFile || id == 0)
+    {
+        entity_id_t originalId = id;
+        id = replicated ? NextFreeId() : NextFreeIdLocal();
+        if (originalId != 0 && !oldToNewIds.contains(originalId))
+            oldToNewIds[originalId] = id;
+    }
+    else if (useEntityIDsFromFile && HasEntity(id))
+    {
+        entity_id_t newID = replicated ? NextFreeId() : NextFreeIdLocal();
+        ChangeEntityId(id, newID);
+    }
+
+    if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene.
+    {
+        LogDebug("Scene::CreateContentFromBinary: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
+        LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) + "might not replicate properly!");
+        RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
+    }
+
+    EntityPtr entity = CreateEntity(id);
+    if (!entity)
+    {
+        LogError("Failed to create entity, stopping scene load!");
+        return entity;
+    }
+
+    uint num_components = source.Read<u32>();
+    for(uint i = 0; i < num_components; ++i)
+    {
+        u32 typeId = source.Read<u32>(); ///\todo VLE this!
+        QString name = QString::fromStdString(source.ReadString());
+        bool compReplicated = source.Read<u8>() ? true : false;
+        uint data_size = source.Read<u32>();
+
+        // Read the component data into a separate byte array, then deserialize from there.
+        // This way the whole stream should not desync even if something goes wrong
+        QByteArray comp_bytes;
+        comp_bytes.resize(data_size);
+        if (data_size)
+            source.ReadArray<u8>((u8*)comp_bytes.data(), comp_bytes.size());
+
+        try
+        {
+            ComponentPtr new_comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated);
+            if (new_comp)
+            {
+                if (data_size)
+                {
+                    DataDeserializer comp_source(comp_bytes.data(), comp_bytes.size());
+                    // Trigger no signal yet when scene is in incoherent state
+                    new_comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
+                }
+            }
+            else
+                LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+        }
+        catch(...)
+        {
+            LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+        }
+    }
+
+    return entity;
+}
+
+QList<Entity *> Scene::SignalContentFromBinary(const std::vector<EntityWeakPtr> &entities, const QHash<entity_id_t, entity_id_t> &oldToNewIds,
+    bool useEntityIDsFromFile, AttributeChange::Type change)
+{
     // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
     for(unsigned i = 0; i < entities.size(); ++i)
     {
@@ -1381,42 +1674,18 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
     if (!previous)
         attr->CopyValue(endvalue, AttributeChange::LocalOnly);
     
-    AttributeInterpolation newInterp;
-    newInterp.dest = AttributeWeakPtr(comp->shared_from_this(), attr);
-    newInterp.start = AttributeWeakPtr(comp->shared_from_this(), attr->Clone());
-    newInterp.end = AttributeWeakPtr(comp->shared_from_this(), endvalue);
-    newInterp.length = length;
-    
-    interpolations_.push_back(newInterp);
+    interpolations_->Start(attr, endvalue, length);
     return true;
 }
 
 bool Scene::EndAttributeInterpolation(IAttribute* attr)
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        if (interp.dest.Get() == attr)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-            return true;
-        }
-    }
-    return false;
+    return interpolations_->End(attr);
 }
 
 void Scene::EndAllAttributeInterpolations()
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        delete interp.start.Get();
-        delete interp.end.Get();
-    }
-    
-    interpolations_.clear();
+    interpolations_->Clear();
 }
 
 void Scene::UpdateAttributeInterpolations(float frametime)
@@ -1424,44 +1693,7 @@ void Scene::UpdateAttributeInterpolations(float frametime)
     PROFILE(Scene_UpdateInterpolation);
     
     interpolating_ = true;
-    
-    for(uint i = interpolations_.size() - 1; i < interpolations_.size(); --i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        bool finished = false;
-        
-        // Check that the component still exists i.e. it's safe to access the attribute
-        if (!interp.start.owner.expired())
-        {
-            // Allow the interpolation to persist for 2x time, though we are no longer setting the value
-            // This is for the continuous/discontinuous update detection in StartAttributeInterpolation()
-            if (interp.time <= interp.length)
-            {
-                interp.time += frametime;
-                float t = interp.time / interp.length;
-                if (t > 1.0f)
-                    t = 1.0f;
-                interp.dest.Get()->Interpolate(interp.start.Get(), interp.end.Get(), t, AttributeChange::LocalOnly);
-            }
-            else
-            {
-                interp.time += frametime;
-                if (interp.time >= interp.length * 2.0f)
-                    finished = true;
-            }
-        }
-        else // Component pointer has expired, abort this interpolation
-            finished = true;
-        
-        // Remove interpolation (& delete start/endpoints) when done
-        if (finished)
-        {
-            delete interp.start.Get();
-            delete interp.end.Get();
-            interpolations_.erase(interpolations_.begin() + i);
-        }
-    }
-
+    interpolations_->Update(frametime);
     interpolating_ = false;
 }
 
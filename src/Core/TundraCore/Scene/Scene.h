@@ -14,6 +14,8 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QHash>
+#include <QSet>
 
 #include <map>
 
@@ -22,6 +24,7 @@ class Framework;
 /// Maybe have some kind of UserConnection interface class defined in Framework and use that instead.
 class UserConnection;
 class QDomDocument;
+class AttributeInterpolator;
 
 /// A collection of entities which form an observable world.
 /** Acts as a factory for all entities.
@@ -45,6 +48,15 @@ public:
     typedef EntityMap::iterator iterator; ///< entity iterator, see begin() and end()
     typedef EntityMap::const_iterator const_iterator;///< const entity iterator. see begin() and end()
 
+    /// An attribute change recorded to the attribute change journal of the scene. @sa SubscribeAttributeChanges
+    struct AttributeChangeRecord
+    {
+        ComponentWeakPtr component; ///< Owner of the changed attribute.
+        u8 attributeIndex; ///< Index of the changed attribute in the component.
+        AttributeChange::Type change; ///< Change type, never Default or Disconnected.
+    };
+    typedef std::vector<AttributeChangeRecord> AttributeChangeVector; ///< Attribute change journal.
+
     /// Returns name of the scene.
     const QString &Name() const { return name_; }
 
@@ -147,6 +159,21 @@ public:
         @param change Change signaling mode */
     void EmitAttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
 
+    /// Starts recording the signaled attribute changes of the scene to a journal, for a subscriber which reads them in batches.
+    /** Reading the journal once per frame is much cheaper than a connection to the AttributeChanged signal when a lot of
+        attributes change each frame. The changes are recorded only while the scene has subscribers.
+        @return Subscriber ID for TakeAttributeChanges and UnsubscribeAttributeChanges.
+        @sa SyncManager */
+    int SubscribeAttributeChanges();
+
+    /// Stops recording attribute changes for a subscriber.
+    void UnsubscribeAttributeChanges(int subscriber);
+
+    /// Replaces the contents of changes with the attribute changes recorded since the previous call by the subscriber, in the order they were signaled.
+    /** The subscribers must take the changes regularly, as the changes are kept until all subscribers have taken them.
+        The components of the records may have been destroyed or removed from their entities meanwhile. */
+    void TakeAttributeChanges(int subscriber, AttributeChangeVector &changes);
+
     /// Emits notification of an attribute having been created. Called by IComponent's with dynamic structure
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -192,12 +219,13 @@ public:
     void EmitComponentAcked(IComponent* component, component_id_t oldId);
 
     /// Returns all components of type T (and additionally with specific name) in the scene.
+    /** @note O(m log m), where m is the number of components of type T in the scene. */
     template <typename T>
     std::vector<shared_ptr<T> > Components(const QString &name = "") const;
 
     /// Returns list of entities with a specific component present.
     /** @param name Name of the component, optional.
-        @note O(n) */
+        @note O(m log m), where m is the number of components of type T in the scene. */
     template <typename T>
     EntityList EntitiesWithComponent(const QString &name = "") const;
 
@@ -263,12 +291,12 @@ public slots:
     /** @note The name of the entity is stored in a component EC_Name. If this component is not present in the entity, it has no name.
         @note Returns a shared pointer, but it is preferable to use a weak pointer, EntityWeakPtr,
               to avoid dangling references that prevent entities from being properly destroyed.
-        @note @note O(n)
+        @note O(k), where k is the number of entities with the name.
         @sa EntityById */
     EntityPtr EntityByName(const QString &name) const;
 
     /// Returns whether name is unique within the scene, ie. is only encountered once, or not at all.
-    /** @note O(n) */
+    /** @note O(1) */
     bool IsUniqueName(const QString& name) const;
 
     /// Returns true if entity with the specified id exists in this scene, false otherwise
@@ -298,7 +326,7 @@ public slots:
     /// Returns list of entities with a specific component present.
     /** @param typeId Type ID of the component
         @param name Name of the component, optional.
-        @note O(n) */
+        @note O(m log m), where m is the number of components of the type in the scene. */
     EntityList EntitiesWithComponent(u32 typeId, const QString &name = "") const;
     /// @overload
     /** @param typeName typeName Type name of the component.
@@ -306,8 +334,9 @@ public slots:
     EntityList EntitiesWithComponent(const QString &typeName, const QString &name = "") const;
 
     /// Returns all components of specific type (and additionally with specific name) in the scene.
-    /*  @param typeId Component type ID.
-        @param name Arbitrary name of the component (optional). */
+    /** @param typeId Component type ID.
+        @param name Arbitrary name of the component (optional).
+        @note O(m log m), where m is the number of components of the type in the scene. */
     Entity::ComponentVector Components(u32 typeId, const QString &name = "") const;
     /// overload
     /** @param typeName Component type name.
@@ -358,7 +387,8 @@ public slots:
     QList<Entity *> LoadSceneBinary(const QString& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change);
 
     /// Save the scene to binary
-    /** @param filename File name
+    /** The entities are written to the file one by one, so the memory needed does not depend on the size of the scene.
+        @param filename File name
         @param saveTemporary Are temporary entities wanted to be included.
         @param saveLocal Are local entities wanted to be included.
         @return true if successful */
@@ -375,7 +405,8 @@ public slots:
     QList<Entity *> CreateContentFromXml(const QDomDocument &xml, bool useEntityIDsFromFile, AttributeChange::Type change); /**< @overload @param xml XML document. */
 
     /// Creates scene content from binary file.
-    /** @param filename File name.
+    /** The file is read in chunks, so the memory needed for reading it does not depend on the size of the file.
+        @param filename File name.
         @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file.
                   If the scene contains any previous entities with conflicting IDs, those are removed. If false, the entity IDs from the files are ignored,
                   and new IDs are generated for the created entities.
@@ -470,14 +501,21 @@ private slots:
 private:
     friend class ::SceneAPI;
 
-    /// Container for an ongoing attribute interpolation
-    struct AttributeInterpolation
-    {
-        AttributeInterpolation() : time(0.0f), length(0.0f) {}
-        AttributeWeakPtr dest, start, end;
-        float time;
-        float length;
-    };
+    /// Creates an entity and its components from a binary entity record, without signaling the changes.
+    /** @return The created entity, or null if creating the entity failed, after which the rest of the data can not be trusted. */
+    EntityPtr CreateEntityFromBinary(kNet::DataDeserializer &source, bool useEntityIDsFromFile, QHash<entity_id_t, entity_id_t> &oldToNewIds);
+
+    /// Signals the creation of entities created from binary data, and fixes their placeable parent refs if new IDs were generated.
+    /** @return The entities that still exist after the signals. */
+    QList<Entity *> SignalContentFromBinary(const std::vector<EntityWeakPtr> &entities, const QHash<entity_id_t, entity_id_t> &oldToNewIds,
+        bool useEntityIDsFromFile, AttributeChange::Type change);
+
+    /// Returns the components of a type in the scene, optionally only the ones with a specific name, ordered by entity and component ID.
+    std::vector<IComponent*> IndexedComponents(u32 typeId, const QString &name) const;
+
+    /// Updates the entry of an entity in the name index to the current name of the entity.
+    /** @param removedComponent An EC_Name component which is being removed from the entity, and should not be read. */
+    void UpdateNameIndex(Entity *entity, IComponent *removedComponent = 0);
 
     UniqueIdGenerator idGenerator_; ///< Entity ID generator
     EntityMap entities_; ///< All entities in the scene.
@@ -486,8 +524,17 @@ private:
     bool viewEnabled_; ///< View enabled -flag.
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
-    std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    AttributeInterpolator *interpolations_; ///< Running attribute interpolations.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
+    AttributeChangeVector attributeChanges_; ///< Attribute change journal. Holds the changes not yet taken by all subscribers.
+    std::map<int, size_t> attributeChangeSubscribers_; ///< Position of each subscriber in the attribute change journal.
+    int nextAttributeChangeSubscriber_; ///< ID of the next attribute change journal subscriber.
+    /// The components of the entities of the scene by type ID, so that the component queries need not walk all the entities.
+    /** Updated on EmitComponentAdded and EmitComponentRemoved, which the entities call also for the disconnected changes,
+        and when they leave the scene with components left. */
+    QHash<u32, QSet<IComponent*> > componentsByType_;
+    QMultiHash<QString, Entity*> entitiesByName_; ///< The named entities by their EC_Name name.
+    QHash<Entity*, QString> entityNames_; ///< The name each entity in entitiesByName_ is indexed by.
 };
 
 #include "Scene.inl"
@@ -11,6 +11,8 @@
 
 A3Filter::A3Filter(InterestManager *im, int criticalrange, int maxrange, int updateinterval, bool enabled) :
     im_(im),
+    criticalrange_(criticalrange),
+    maxrange_(maxrange),
     MessageFilter(A3, enabled)
 {
     euclideandistance_ = new EuclideanDistanceFilter(im, criticalrange, true);
@@ -28,6 +30,11 @@ QString A3Filter::ToString()
     return QString("A3");
 }
 
+int A3Filter::MaxRange()
+{
+    return std::max(criticalrange_, maxrange_);
+}
+
 bool A3Filter::Filter(const IMParameters& params)
 {
     if(enabled_)
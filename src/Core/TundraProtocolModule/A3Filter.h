@@ -19,9 +19,13 @@ public:
 
     QString ToString();
 
+    int MaxRange();
+
 private:
 
     InterestManager *im_;
+    int criticalrange_;
+    int maxrange_;
     MessageFilter *euclideandistance_;
     MessageFilter *relevance_;
 };
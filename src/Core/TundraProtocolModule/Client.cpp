@@ -158,6 +158,7 @@ void Client::Login(const QString& address, unsigned short port, kNet::SocketTran
     SetLoginProperty("address", address);
     SetLoginProperty("port", QString::number(port));
     SetLoginProperty("client-version", Application::Version());
+    SetLoginProperty("protocol-version", QString::number(cProtocolVersion));
     SetLoginProperty("client-name", Application::ApplicationName());
     SetLoginProperty("client-organization", Application::OrganizationName());
 
@@ -458,6 +459,14 @@ void Client::HandleLoginReply(MessageConnection* source, const MsgLoginReply& ms
         client_id_ = msg.userID;
         ::LogInfo("Logged in successfully");
         
+        UserConnectedResponseData responseData;
+        if (msg.loginReplyData.size() > 0)
+            responseData.responseData.setContent(QByteArray((const char *)&msg.loginReplyData[0], (int)msg.loginReplyData.size()));
+
+        // Servers that do not tell the protocol version speak the original protocol.
+        const u32 protocolVersion = responseData.responseData.documentElement().attribute("protocol-version").toUInt();
+        const u32 serverProtocolVersion = std::max<u32>(protocolVersion, cProtocolOriginal);
+
         // Note: create scene & send info of login success only on first connection, not on reconnect
         if (!reconnect_)
         {
@@ -466,10 +475,7 @@ void Client::HandleLoginReply(MessageConnection* source, const MsgLoginReply& ms
 
 //            framework_->Scene()->SetDefaultScene(scene);
             owner_->GetSyncManager()->RegisterToScene(scene);
-            
-            UserConnectedResponseData responseData;
-            if (msg.loginReplyData.size() > 0)
-                responseData.responseData.setContent(QByteArray((const char *)&msg.loginReplyData[0], (int)msg.loginReplyData.size()));
+            owner_->GetSyncManager()->SetServerProtocolVersion(serverProtocolVersion);
 
             emit Connected(&responseData);
         }
@@ -482,6 +488,8 @@ void Client::HandleLoginReply(MessageConnection* source, const MsgLoginReply& ms
             ScenePtr scene = framework_->Scene()->GetScene("TundraClient");
             if (scene)
                 scene->RemoveAllEntities(true, AttributeChange::LocalOnly);
+            // The server may have been replaced with another version meanwhile.
+            owner_->GetSyncManager()->SetServerProtocolVersion(serverProtocolVersion);
         }
         reconnect_ = true;
     }
@@ -12,6 +12,8 @@
 
 EA3Filter::EA3Filter(InterestManager *im, int criticalrange, int maxrange, int raycastinterval, int updateinterval, bool enabled) :
     im_(im),
+    criticalrange_(criticalrange),
+    maxrange_(maxrange),
     MessageFilter(EA3, enabled)
 {
     euclideandistance_ = new EuclideanDistanceFilter(im, criticalrange, true);
@@ -31,6 +33,11 @@ QString EA3Filter::ToString()
     return QString("EA3");
 }
 
+int EA3Filter::MaxRange()
+{
+    return std::max(criticalrange_, maxrange_);
+}
+
 bool EA3Filter::Filter(const IMParameters& params)
 {  
     if(enabled_)
@@ -19,9 +19,16 @@ public:
 
     QString ToString();
 
+    /// Raycasting uses the renderer, so this filter must be run on the main thread.
+    bool IsThreadSafe() { return false; }
+
+    int MaxRange();
+
 private:
 
     InterestManager *im_;
+    int criticalrange_;
+    int maxrange_;
     MessageFilter *euclideandistance_;
     MessageFilter *rayvisibility_;
     MessageFilter *relevance_;
@@ -0,0 +1,90 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "EntityGrid.h"
+
+#include "Math/MathFunc.h"
+
+#include <cmath>
+
+EntityGrid::EntityGrid(float cellSize) :
+    cellSize_(cellSize > 0.f ? cellSize : 1.f),
+    invCellSize_(1.f / cellSize_),
+    numEntities_(0)
+{
+}
+
+void EntityGrid::Clear(float cellSize)
+{
+    if (cellSize <= 0.f)
+        cellSize = 1.f;
+    if (cellSize != cellSize_)
+    {
+        cells_.clear();
+        cellSize_ = cellSize;
+        invCellSize_ = 1.f / cellSize_;
+    }
+    else
+    {
+        for(CellMap::iterator iter = cells_.begin(); iter != cells_.end(); ++iter)
+            iter->clear();
+    }
+    numEntities_ = 0;
+}
+
+void EntityGrid::Insert(entity_id_t id, const float3 &pos)
+{
+    if (!pos.IsFinite())
+        return;
+    Item item;
+    item.id = id;
+    item.pos = pos;
+    cells_[CellKey(CellCoord(pos.x), CellCoord(pos.y), CellCoord(pos.z))].push_back(item);
+    ++numEntities_;
+}
+
+void EntityGrid::QuerySphere(const float3 &center, float radius, std::vector<entity_id_t> &result) const
+{
+    if (!center.IsFinite() || radius < 0.f)
+        return;
+
+    const float radiusSq = radius * radius;
+    const int minX = CellCoord(center.x - radius), maxX = CellCoord(center.x + radius);
+    const int minY = CellCoord(center.y - radius), maxY = CellCoord(center.y + radius);
+    const int minZ = CellCoord(center.z - radius), maxZ = CellCoord(center.z + radius);
+
+    // With a huge radius compared to the cell size, walking the occupied cells is cheaper than walking the range.
+    if ((quint64)(maxX - minX + 1) * (maxY - minY + 1) * (maxZ - minZ + 1) > (quint64)cells_.size())
+    {
+        for(CellMap::const_iterator iter = cells_.begin(); iter != cells_.end(); ++iter)
+            for(Cell::const_iterator item = iter->begin(); item != iter->end(); ++item)
+                if (item->pos.DistanceSq(center) <= radiusSq)
+                    result.push_back(item->id);
+        return;
+    }
+
+    for(int x = minX; x <= maxX; ++x)
+        for(int y = minY; y <= maxY; ++y)
+            for(int z = minZ; z <= maxZ; ++z)
+            {
+                CellMap::const_iterator iter = cells_.find(CellKey(x, y, z));
+                if (iter == cells_.end())
+                    continue;
+                for(Cell::const_iterator item = iter->begin(); item != iter->end(); ++item)
+                    if (item->pos.DistanceSq(center) <= radiusSq)
+                        result.push_back(item->id);
+            }
+}
+
+int EntityGrid::CellCoord(float x) const
+{
+    // Keep the coordinates inside the 21 bits CellKey packs per axis.
+    const float maxCoord = (float)((1 << 20) - 1);
+    return (int)Clamp(floorf(x * invCellSize_), -maxCoord, maxCoord);
+}
+
+quint64 EntityGrid::CellKey(int x, int y, int z)
+{
+    const quint64 mask = (1 << 21) - 1;
+    return (((quint64)(x + (1 << 20)) & mask) << 42) | (((quint64)(y + (1 << 20)) & mask) << 21) | ((quint64)(z + (1 << 20)) & mask);
+}
@@ -0,0 +1,53 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "Math/float3.h"
+
+#include <QHash>
+
+#include <vector>
+
+/// Uniform grid of entity positions, used for fast range queries.
+/** The grid is rebuilt from scratch by the user, typically once per network tick. The cell storage is kept
+    between rebuilds to avoid reallocating it every time. */
+class EntityGrid
+{
+public:
+    explicit EntityGrid(float cellSize = 50.f);
+
+    /// Removes all entities from the grid. If the cell size changes, also the cell storage is released.
+    void Clear(float cellSize);
+
+    /// Adds an entity to the grid.
+    void Insert(entity_id_t id, const float3 &pos);
+
+    /// Appends the IDs of the entities inside a sphere to result.
+    void QuerySphere(const float3 &center, float radius, std::vector<entity_id_t> &result) const;
+
+    /// Returns the number of entities in the grid.
+    size_t Size() const { return numEntities_; }
+
+    /// Returns the edge length of a grid cell.
+    float CellSize() const { return cellSize_; }
+
+private:
+    struct Item
+    {
+        entity_id_t id;
+        float3 pos;
+    };
+    typedef std::vector<Item> Cell;
+    typedef QHash<quint64, Cell> CellMap;
+
+    /// Returns the cell coordinate of a world coordinate.
+    int CellCoord(float x) const;
+    /// Returns the hash key of a cell.
+    static quint64 CellKey(int x, int y, int z);
+
+    CellMap cells_;
+    float cellSize_;
+    float invCellSize_;
+    size_t numEntities_;
+};
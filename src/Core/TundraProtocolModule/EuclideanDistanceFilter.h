@@ -19,6 +19,8 @@ public:
 
     QString ToString();
 
+    int MaxRange() { return radius_; }
+
 private:
 
     InterestManager *im_;
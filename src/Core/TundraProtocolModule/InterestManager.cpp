@@ -9,38 +9,63 @@
 #include "LoggingFunctions.h"
 #include "Profiler.h"
 
-InterestManager* InterestManager::thisPointer_ = NULL;
+#include <QRunnable>
+#include <QThreadPool>
+
+namespace
+{
+
+/// Computes the relevance set of one client on a worker thread.
+class RelevanceSetWorker : public QRunnable
+{
+public:
+    RelevanceSetWorker(InterestManager *im, UserConnectionPtr conn, ScenePtr scene, bool headless) :
+        im_(im), conn_(conn), scene_(scene), headless_(headless)
+    {
+        setAutoDelete(true);
+    }
+
+    void run()
+    {
+        im_->UpdateRelevanceSet(conn_, scene_, headless_);
+    }
+
+private:
+    InterestManager *im_;
+    UserConnectionPtr conn_;
+    ScenePtr scene_;
+    bool headless_;
+};
+
+}
 
 InterestManager::InterestManager()
 {
     activeFilter_ = 0;
     timer_ = new QTime();
     timer_->start();
+    workers_ = new QThreadPool();
 }
 
 InterestManager::~InterestManager()
 {
-    thisPointer_ = 0;
+    workers_->waitForDone();
+    delete workers_;
     delete timer_;
     delete activeFilter_;
+    workers_ = 0;
     timer_ = 0;
     activeFilter_ = 0;
 }
 
-InterestManager* InterestManager::getInstance()
-{
-    if(!thisPointer_)
-        thisPointer_ = new InterestManager;
-
-    return thisPointer_;
-}
-
 void InterestManager::AssignFilter(MessageFilter *filter)
 {
+    if(filter != activeFilter_)
+        delete activeFilter_;
     activeFilter_ = filter;
 }
 
-int InterestManager::ElapsedTime()
+int InterestManager::ElapsedTime() const
 {
     return timer_->elapsed();
 }
@@ -61,103 +86,147 @@ bool InterestManager::CheckRelevance(UserConnectionPtr conn, Entity* changed_ent
 
     bool accepted = false;  //By default, we assume that the update will be rejected
 
-    Quat client_orientation = conn->syncState->clientOrientation.Normalized();
+    const entity_id_t id = changed_entity->Id();
+    const std::vector<bool> &relevantEntities = conn->syncState->interest.relevantEntities;
 
-    params_.client_position = conn->syncState->clientLocation;      //Client location vector
-    params_.entity_position = entity_location->transform.Get().pos; //Entitys location vector
-
-    float3 d = params_.client_position - params_.entity_position;
-    float3 v = params_.entity_position - params_.client_position;   //Calculate the vector between the player and the changed entity by substracting their location vectors
-    float3 f = client_orientation.Mul(scene->ForwardVector());      //Calculate the forward vector of the client
-
-    params_.headless = headless;
-    params_.dot = v.Dot(f);                                          //Finally the dot product is calculated so we know if the entity is in front of the player or not
-    params_.distance = d.LengthSq();
-    params_.scene = scene;
-    params_.changed_entity = changed_entity;
-    params_.connection = conn;
-    params_.relAccepted = false;
-
-    if(activeFilter_ != 0)
-        accepted = activeFilter_->Filter(params_);
+    if(IsIndexed(id) && id < relevantEntities.size())    //The relevance was already computed on this network tick
+        accepted = relevantEntities[id];
+    else
+    {
+        float3 f = conn->syncState->clientOrientation.Normalized().Mul(scene->ForwardVector());  //Calculate the forward vector of the client
+        accepted = EvaluateRelevance(conn, changed_entity, entity_location->transform.Get().pos, f, scene, headless);
+    }
 
     if(accepted)
     {
-        UpdateLastUpdatedEntity(params_.connection, params_.changed_entity->Id());
+        UpdateLastUpdatedEntity(conn, id);
         return true;
     }
     else
         return false;
 }
 
-void InterestManager::UpdateRelevance(UserConnectionPtr conn, entity_id_t id, float relevance)
+bool InterestManager::EvaluateRelevance(UserConnectionPtr conn, Entity* changed_entity, const float3 &entity_position, const float3 &forward, ScenePtr scene, bool headless)
 {
-    std::map<entity_id_t, float>::iterator it;
+    IMParameters params;    //Parameters used by the filtering process. Kept on the stack so that several clients can be evaluated concurrently.
 
-    it = conn->syncState->relevanceFactors.find(id);
+    params.client_position = conn->syncState->clientLocation;       //Client location vector
+    params.entity_position = entity_position;                       //Entitys location vector
 
-    if(it == conn->syncState->relevanceFactors.end()) //Theres no entry with this entity_id
-        conn->syncState->relevanceFactors.insert(std::make_pair(id, relevance));
-    else
-        it->second = relevance;
+    float3 d = params.client_position - params.entity_position;
+    float3 v = params.entity_position - params.client_position;     //Calculate the vector between the player and the changed entity by substracting their location vectors
+
+    params.headless = headless;
+    params.dot = v.Dot(forward);                                     //Finally the dot product is calculated so we know if the entity is in front of the player or not
+    params.distance = d.LengthSq();
+    params.scene = scene;
+    params.changed_entity = changed_entity;
+    params.connection = conn;
+    params.relAccepted = false;
+
+    if(activeFilter_ != 0)
+        return activeFilter_->Filter(params);
+    return false;
 }
 
-void InterestManager::UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t id, bool visible)
+void InterestManager::UpdateRelevanceSets(ScenePtr scene, UserConnectionList &users, bool headless)
 {
-    std::map<entity_id_t, bool>::iterator it;
+    PROFILE(Interest_Management_UpdateRelevanceSets);
 
-    it = conn->syncState->visibleEntities.find(id);
+    indexedEntities_.clear();
 
-    if(it == conn->syncState->visibleEntities.end()) //Theres no entry with this entity_id
-        conn->syncState->visibleEntities.insert(std::make_pair(id, visible));
-    else
-        it->second = visible;
-}
+    if(!scene || !activeFilter_ || !activeFilter_->Enabled())   //Without an enabled filter there is nothing to precompute, CheckRelevance falls back to evaluating each change
+        return;
 
-void InterestManager::UpdateLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
-{
-    std::map<entity_id_t, float>::iterator it;
+    const float range = (float)activeFilter_->MaxRange();
+    grid_.Clear(std::max(range, 1.f));
 
-    it = conn->syncState->lastUpdatedEntitys_.find(id);
+    /*Bucket the positions of all replicated entities into the grid*/
+    for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
+    {
+        Entity *entity = iter->second.get();
+        const entity_id_t id = entity->Id();
+        if(entity->IsLocal() || id >= InterestManagementState::cMaxEntityId)
+            continue;
+        EC_Placeable *placeable = entity->GetComponent<EC_Placeable>().get();
+        if(!placeable)
+            continue;
+
+        grid_.Insert(id, placeable->transform.Get().pos);
+        if(id >= indexedEntities_.size())
+            indexedEntities_.resize(id + 1, false);
+        indexedEntities_[id] = true;
+    }
 
-    if(it == conn->syncState->lastUpdatedEntitys_.end())
-        conn->syncState->lastUpdatedEntitys_.insert(std::make_pair(id, ElapsedTime()));
-    else
-        it->second = ElapsedTime();
+    /*Evaluate the filter for each client. The scene is not modified while the workers run, as the main thread waits for them below.
+      Raycasting filters touch the renderer and must run on the main thread.*/
+    const bool parallel = users.size() > 1 && activeFilter_->IsThreadSafe();
+    for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+    {
+        if(!(*i)->syncState)
+            continue;
+        if(parallel)
+            workers_->start(new RelevanceSetWorker(this, *i, scene, headless));
+        else
+            UpdateRelevanceSet(*i, scene, headless);
+    }
+
+    if(parallel)
+    {
+        PROFILE(Interest_Management_WaitForWorkers);
+        workers_->waitForDone();
+    }
 }
 
-float InterestManager::FindLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
+void InterestManager::UpdateRelevanceSet(UserConnectionPtr conn, ScenePtr scene, bool headless)
 {
-    std::map<entity_id_t, float>::iterator it;
+    SceneSyncState *state = conn->syncState.get();
+    std::vector<bool> &relevantEntities = state->interest.relevantEntities;
 
-    it = conn->syncState->lastUpdatedEntitys_.find(id);
+    relevantEntities.clear();
+    if(!state->locationInitialized)
+        return;
+    relevantEntities.resize(indexedEntities_.size(), false);
 
-    if(it == conn->syncState->lastUpdatedEntitys_.end())
-        return 0;
-    else
-        return it->second;
+    const float3 f = state->clientOrientation.Normalized().Mul(scene->ForwardVector());   //Calculate the forward vector of the client once per tick
+
+    std::vector<entity_id_t> candidates;
+    grid_.QuerySphere(state->clientLocation, (float)activeFilter_->MaxRange(), candidates);
+    for(size_t j = 0; j < candidates.size(); ++j)
+    {
+        EntityPtr entity = scene->GetEntity(candidates[j]);
+        EC_Placeable *placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+        if(placeable && EvaluateRelevance(conn, entity.get(), placeable->transform.Get().pos, f, scene, headless))
+            relevantEntities[candidates[j]] = true;
+    }
 }
 
-void InterestManager::UpdateLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id)
+void InterestManager::UpdateRelevance(UserConnectionPtr conn, entity_id_t id, float relevance)
 {
-    std::map<entity_id_t, float>::iterator it;
+    conn->syncState->interest.SetRelevanceFactor(id, relevance);
+}
 
-    it = conn->syncState->lastRaycastedEntitys_.find(id);
+void InterestManager::UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t id, bool visible)
+{
+    conn->syncState->interest.SetEntityVisibility(id, visible);
+}
 
-    if(it == conn->syncState->lastRaycastedEntitys_.end())
-        conn->syncState->lastRaycastedEntitys_.insert(std::make_pair(id, ElapsedTime()));
-    else
-        it->second = ElapsedTime();
+void InterestManager::UpdateLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
+{
+    conn->syncState->interest.SetLastUpdated(id, ElapsedTime());
 }
 
-float InterestManager::FindLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id)
+float InterestManager::FindLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id)
 {
-    std::map<entity_id_t, float>::iterator it;
+    return conn->syncState->interest.LastUpdated(id);
+}
 
-    it = conn->syncState->lastRaycastedEntitys_.find(id);
+void InterestManager::UpdateLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id)
+{
+    conn->syncState->interest.SetLastRaycasted(id, ElapsedTime());
+}
 
-    if(it == conn->syncState->lastRaycastedEntitys_.end())
-        return 0;
-    else
-        return it->second;
+float InterestManager::FindLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id)
+{
+    return conn->syncState->interest.LastRaycasted(id);
 }
@@ -10,39 +10,54 @@
 #include "EuclideanDistanceFilter.h"
 #include "RayVisibilityFilter.h"
 #include "RelevanceFilter.h"
+#include "EntityGrid.h"
+
+#include <vector>
+
+class QThreadPool;
 
 #define IM_DEBUG
 
+/// Filters the scene changes sent to each client by their relevance to the client.
+/** The per-client bookkeeping is stored in the InterestManagementState of each client's SceneSyncState,
+    so the relevance sets of several clients can be computed concurrently. */
 class InterestManager
 {
 
 public:
 
-    /// Destructor, sets instanceFlag to false so getInstance creates new on request
-    ~InterestManager();
+    InterestManager();
 
-    /// Returns singleton pointer
-    static InterestManager* getInstance();
+    /// Destructor, waits for the worker threads and deletes the active filter
+    ~InterestManager();
 
-    /// Assign a filter to the IM
+    /// Assign a filter to the IM. The IM takes ownership of the filter and deletes the previous one.
     void AssignFilter(MessageFilter *filter);
 
     /// Main entrance method for the filtering process
+    /** If the entity was indexed by the latest UpdateRelevanceSets call, the answer is read from the client's relevance set.
+        Otherwise the active filter is evaluated for the change. */
     bool CheckRelevance(UserConnectionPtr userconnection, Entity* changed_entity, SceneWeakPtr scene, bool headless);
 
+    /// Computes the set of relevant entities for each client. Called once per network tick.
+    /** Buckets the positions of the scene entities into a uniform grid, and evaluates the active filter for each client
+        only for the entities within the filter range. Entities outside of the range are irrelevant.
+        The clients are processed in parallel on a worker pool if the active filter is thread-safe. */
+    void UpdateRelevanceSets(ScenePtr scene, UserConnectionList &users, bool headless);
+
     /// Returns the current active filtering time in milliseconds
-    int ElapsedTime();
+    int ElapsedTime() const;
 
     /// Update the relevance factor of a specific entity for future inspection
     void UpdateRelevance(UserConnectionPtr conn, entity_id_t id, float relevance);
 
-    /// Updates a specific map which contains a list of entities and their visibilities. (client specific map)
+    /// Updates the visibility of a specific entity to a client
     void UpdateEntityVisibility(UserConnectionPtr conn, entity_id_t id, bool visible);
 
-    /// Updates a map that contains the timestamps that describe when a specific entity was last updated
+    /// Updates the timestamp that describes when a specific entity was last updated to a client
     void UpdateLastUpdatedEntity(UserConnectionPtr conn, entity_id_t id);
 
-    /// Updates a map that contains the timestamps that describe when a specific entity was last raycasted
+    /// Updates the timestamp that describes when a specific entity was last raycasted for a client
     void UpdateLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id);
 
     /// Utility method for checking when a specific entity has been updated
@@ -51,13 +66,17 @@ public:
     /// Utility method for checking when a specific entity has been raycasted
     float FindLastRaycastedEntity(UserConnectionPtr conn, entity_id_t id);
 
+    /// Computes the relevance set of one client from the entity grid of the current tick.
+    /// @note Called from the worker threads. Only modifies the state of the given client.
+    void UpdateRelevanceSet(UserConnectionPtr conn, ScenePtr scene, bool headless);
+
 private:
 
-    /// Private constructor because singleton instance is gotten from getInstance()
-    InterestManager();
+    /// Runs the active filter for an entity at a position, as seen from a client looking towards forward.
+    bool EvaluateRelevance(UserConnectionPtr conn, Entity* changed_entity, const float3 &entity_position, const float3 &forward, ScenePtr scene, bool headless);
 
-    /// Pointer to this singleton class
-    static InterestManager* thisPointer_;
+    /// Returns whether the entity ID was put into the grid on the latest UpdateRelevanceSets call.
+    bool IsIndexed(entity_id_t id) const { return id < indexedEntities_.size() && indexedEntities_[id]; }
 
     /// Timer handling the update intervals
     QTime *timer_;
@@ -65,6 +84,12 @@ private:
     /// The filter that is used inside the IM
     MessageFilter* activeFilter_;
 
-    /// Parameters used by the filtering process
-    IMParameters params_;
+    /// Worker threads for computing the relevance sets of the clients
+    QThreadPool *workers_;
+
+    /// Entity positions of the latest relevance set update
+    EntityGrid grid_;
+
+    /// Bitset of the entity IDs that are in grid_
+    std::vector<bool> indexedEntities_;
 };
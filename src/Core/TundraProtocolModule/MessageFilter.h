@@ -45,6 +45,12 @@ public:
 
     virtual bool Filter(const IMParameters& params) = 0;
 
+    /// Returns the distance from the client beyond which the filter rejects all updates.
+    virtual int MaxRange() = 0;
+
+    /// Returns whether the filter can be run for several clients concurrently from worker threads.
+    virtual bool IsThreadSafe()         { return true; }
+
     virtual void SetEnabled(bool e)     { enabled_ = e; }
     virtual bool Enabled()              { return enabled_; }
     virtual IMFilter Info()             { return type_; }
@@ -2,8 +2,6 @@
 
 #include "StableHeaders.h"
 
-#include "map"
-
 #include "Geometry/Ray.h"
 #include "EC_Camera.h"
 #include "EC_Placeable.h"
@@ -40,17 +38,15 @@ bool RayVisibilityFilter::Filter(const IMParameters& params)
 
         if(params.distance < cutoffrange)  //If the entity is close enough, only then do a raycast
         {
-            std::map<entity_id_t, bool>::iterator it;
-
-            it = params.connection->syncState->visibleEntities.find(params.changed_entity->Id());
+            InterestManagementState::Visibility visibility = params.connection->syncState->interest.EntityVisibility(params.changed_entity->Id());
 
             /*Check when was the last time we raycasted and dont do it if its not the time*/
             int lastRaycasted = im_->FindLastRaycastedEntity(params.connection, params.changed_entity->Id());
             int currentTime = im_->ElapsedTime();
 
-            if(it != params.connection->syncState->visibleEntities.end() && (lastRaycasted + raycastinterval_) > currentTime)   //If the entity is located from the map
+            if(visibility != InterestManagementState::VisibilityUnknown && (lastRaycasted + raycastinterval_) > currentTime)   //If the entity has been raycasted before
             {
-                if(it->second == true) //bool which contains a value determining if the entity was visible to the user last time it was raycasted
+                if(visibility == InterestManagementState::Visible) //Determines if the entity was visible to the user last time it was raycasted
                 {
 #ifdef IM_DEBUG
                     if(params.connection->ConnectionId() == 1)
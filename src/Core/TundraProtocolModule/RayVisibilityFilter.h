@@ -19,6 +19,11 @@ public:
 
     QString ToString();
 
+    /// Raycasting uses the renderer, so this filter must be run on the main thread.
+    bool IsThreadSafe() { return false; }
+
+    int MaxRange() { return range_; }
+
 private:
 
     InterestManager *im_;
@@ -0,0 +1,449 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#include "StableHeaders.h"
+#include "RigidBodyQuantization.h"
+
+#include "kNet/DataSerializer.h"
+#include "kNet/DataDeserializer.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+
+const float cSqrt2 = 1.41421356f;
+const float cInvSqrt2 = 0.70710678f;
+const s32 cMaxPositionSteps = 1 << 30; ///< Positions further than this many steps from the bounds are clamped.
+
+s32 ClampInt(s32 value, s32 minValue, s32 maxValue)
+{
+    return value < minValue ? minValue : (value > maxValue ? maxValue : value);
+}
+
+/// Quantizes a signed value of [-range, range] to [-(2^(bits-1)-1), 2^(bits-1)-1].
+s32 QuantizeSigned(float value, float range, int bits)
+{
+    const s32 steps = (1 << (bits - 1)) - 1;
+    float normalized = value / range;
+    if (!(normalized > -1.f)) // Also catches NaN.
+        normalized = (normalized == normalized) ? -1.f : 0.f;
+    if (normalized > 1.f)
+        normalized = 1.f;
+    return (s32)floorf(normalized * steps + 0.5f);
+}
+
+float DequantizeSigned(s32 value, float range, int bits)
+{
+    const s32 steps = (1 << (bits - 1)) - 1;
+    return value * range / steps;
+}
+
+/// Writes the difference of two quantized values with a variable length code:
+/// '0' for no change, otherwise '1', a 2-bit size class and the zigzag encoded difference in 3, 6, 10 or fullBits bits.
+void WriteDelta(kNet::DataSerializer &ds, s32 value, s32 baseline, int fullBits)
+{
+    const s32 d = (s32)((u32)value - (u32)baseline);
+    const u32 zigzag = ((u32)d << 1) ^ (u32)(d >> 31);
+    if (zigzag == 0)
+    {
+        ds.Add<kNet::bit>(0);
+        return;
+    }
+    ds.Add<kNet::bit>(1);
+    if (zigzag < (1u << 3))
+    {
+        ds.AppendBits(0, 2);
+        ds.AppendBits(zigzag, 3);
+    }
+    else if (zigzag < (1u << 6))
+    {
+        ds.AppendBits(1, 2);
+        ds.AppendBits(zigzag, 6);
+    }
+    else if (zigzag < (1u << 10))
+    {
+        ds.AppendBits(2, 2);
+        ds.AppendBits(zigzag, 10);
+    }
+    else
+    {
+        ds.AppendBits(3, 2);
+        if (fullBits >= 32)
+            ds.Add<u32>(zigzag);
+        else
+            ds.AppendBits(zigzag, fullBits);
+    }
+}
+
+s32 ReadDelta(kNet::DataDeserializer &dd, s32 baseline, int fullBits)
+{
+    if (dd.Read<kNet::bit>() == 0)
+        return baseline;
+    static const int classBits[3] = { 3, 6, 10 };
+    const u32 sizeClass = dd.ReadBits(2);
+    u32 zigzag;
+    if (sizeClass < 3)
+        zigzag = dd.ReadBits(classBits[sizeClass]);
+    else
+        zigzag = fullBits >= 32 ? dd.Read<u32>() : dd.ReadBits(fullBits);
+    const s32 d = (s32)(zigzag >> 1) ^ -(s32)(zigzag & 1);
+    return (s32)((u32)baseline + (u32)d);
+}
+
+/// Size in bits of the longest code WriteDelta produces.
+int MaxDeltaBits(int fullBits)
+{
+    return 3 + std::max(fullBits, 10);
+}
+
+void WriteScale(kNet::DataSerializer &ds, const float3 &scale)
+{
+    const bool uniform = scale.x == scale.y && scale.x == scale.z;
+    ds.Add<kNet::bit>(uniform ? 1 : 0);
+    ds.Add<float>(scale.x);
+    if (!uniform)
+    {
+        ds.Add<float>(scale.y);
+        ds.Add<float>(scale.z);
+    }
+}
+
+float3 ReadScale(kNet::DataDeserializer &dd)
+{
+    float3 scale;
+    const bool uniform = dd.Read<kNet::bit>() != 0;
+    scale.x = dd.Read<float>();
+    if (uniform)
+        scale.y = scale.z = scale.x;
+    else
+    {
+        scale.y = dd.Read<float>();
+        scale.z = dd.Read<float>();
+    }
+    return scale;
+}
+
+bool IsZero(const s32 *v)
+{
+    return v[0] == 0 && v[1] == 0 && v[2] == 0;
+}
+
+bool Equals(const s32 *lhs, const s32 *rhs)
+{
+    return lhs[0] == rhs[0] && lhs[1] == rhs[1] && lhs[2] == rhs[2];
+}
+
+void WriteSignedVector(kNet::DataSerializer &ds, const s32 *v, int bits)
+{
+    const s32 steps = (1 << (bits - 1)) - 1;
+    const bool nonZero = !IsZero(v);
+    ds.Add<kNet::bit>(nonZero ? 1 : 0);
+    if (nonZero)
+        for(int i = 0; i < 3; ++i)
+            ds.AppendBits((u32)(v[i] + steps), bits); // Offset binary, [0, 2*steps].
+}
+
+void ReadSignedVector(kNet::DataDeserializer &dd, s32 *v, int bits)
+{
+    const s32 steps = (1 << (bits - 1)) - 1;
+    const bool nonZero = dd.Read<kNet::bit>() != 0;
+    for(int i = 0; i < 3; ++i)
+        v[i] = nonZero ? (s32)dd.ReadBits(bits) - steps : 0;
+}
+
+void WriteVectorDelta(kNet::DataSerializer &ds, const s32 *v, const s32 *baseline, int fullBits)
+{
+    const bool changed = !Equals(v, baseline);
+    ds.Add<kNet::bit>(changed ? 1 : 0);
+    if (changed)
+        for(int i = 0; i < 3; ++i)
+            WriteDelta(ds, v[i], baseline[i], fullBits);
+}
+
+void ReadVectorDelta(kNet::DataDeserializer &dd, s32 *v, const s32 *baseline, int fullBits)
+{
+    const bool changed = dd.Read<kNet::bit>() != 0;
+    for(int i = 0; i < 3; ++i)
+        v[i] = changed ? ReadDelta(dd, baseline[i], fullBits) : baseline[i];
+}
+
+}
+
+QuantizedRigidBodyState::QuantizedRigidBodyState() :
+    rotLargest(3),
+    scale(float3::one)
+{
+    for(int i = 0; i < 3; ++i)
+        pos[i] = rot[i] = vel[i] = angVel[i] = 0;
+}
+
+RigidBodyQuantization::RigidBodyQuantization() :
+    boundsMin(-1024.f, -1024.f, -1024.f),
+    boundsMax(1024.f, 1024.f, 1024.f),
+    positionPrecision(0.005f),
+    rotationBits(10),
+    maxVelocity(64.f),
+    velocityBits(12),
+    maxAngularVelocity(1440.f),
+    angularVelocityBits(10)
+{
+}
+
+void RigidBodyQuantization::Validate()
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        if (!(boundsMin[i] == boundsMin[i]))
+            boundsMin[i] = 0.f;
+        if (!(boundsMax[i] >= boundsMin[i]))
+            boundsMax[i] = boundsMin[i];
+    }
+    if (!(positionPrecision >= 1e-4f))
+        positionPrecision = 1e-4f;
+    rotationBits = ClampInt(rotationBits, 4, 16);
+    velocityBits = ClampInt(velocityBits, 4, 24);
+    angularVelocityBits = ClampInt(angularVelocityBits, 4, 24);
+    if (!(maxVelocity > 1e-3f))
+        maxVelocity = 1e-3f;
+    if (!(maxAngularVelocity > 1e-3f))
+        maxAngularVelocity = 1e-3f;
+}
+
+int RigidBodyQuantization::PositionBits(int axis) const
+{
+    const double steps = (double)(boundsMax[axis] - boundsMin[axis]) / positionPrecision + 1.0;
+    int bits = (int)ceil(log(steps) / log(2.0));
+    return ClampInt(bits, 1, 30);
+}
+
+int RigidBodyQuantization::MaxStateBits() const
+{
+    const int absolutePos = 1 + 3 * 32;
+    const int deltaPos = 1 + 3 * MaxDeltaBits(32);
+    const int absoluteRot = 2 + 3 * rotationBits;
+    const int deltaRot = 2 + std::max(3 * MaxDeltaBits(rotationBits + 1), absoluteRot);
+    const int scale = 1 + 1 + 3 * 32;
+    const int absoluteVel = 1 + 3 * velocityBits;
+    const int deltaVel = 1 + 3 * MaxDeltaBits(velocityBits + 1);
+    const int absoluteAngVel = 1 + 3 * angularVelocityBits;
+    const int deltaAngVel = 1 + 3 * MaxDeltaBits(angularVelocityBits + 1);
+    return std::max(absolutePos + absoluteRot + scale - 1 + absoluteVel + absoluteAngVel,
+        deltaPos + deltaRot + scale + deltaVel + deltaAngVel);
+}
+
+void RigidBodyQuantization::Quantize(const float3 &pos, const Quat &rot, const float3 &scale, const float3 &vel, const float3 &angVel, QuantizedRigidBodyState &out) const
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        double steps = floor((double)(pos[i] - boundsMin[i]) / positionPrecision + 0.5);
+        if (!(steps > -cMaxPositionSteps)) // Also catches NaN.
+            steps = (steps == steps) ? -cMaxPositionSteps : 0;
+        if (steps > cMaxPositionSteps)
+            steps = cMaxPositionSteps;
+        out.pos[i] = (s32)steps;
+    }
+
+    // Smallest three: leave out the largest component, which can be reconstructed from the others as the quaternion is normalized.
+    Quat q = rot.Normalized();
+    if (!(q.LengthSq() > 0.5f)) // Degenerate or NaN rotation.
+        q = Quat::identity;
+    float c[4] = { q.x, q.y, q.z, q.w };
+    int largest = 0;
+    for(int i = 1; i < 4; ++i)
+        if (fabsf(c[i]) > fabsf(c[largest]))
+            largest = i;
+    const float sign = c[largest] < 0.f ? -1.f : 1.f; // q and -q are the same rotation, so the largest component can always be made positive.
+    const s32 maxRotValue = (1 << rotationBits) - 1;
+    out.rotLargest = (u8)largest;
+    for(int i = 0, j = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+        float normalized = (sign * c[i] + cInvSqrt2) / cSqrt2;
+        out.rot[j++] = ClampInt((s32)floorf(normalized * maxRotValue + 0.5f), 0, maxRotValue);
+    }
+
+    out.scale = scale;
+    for(int i = 0; i < 3; ++i)
+    {
+        out.vel[i] = QuantizeSigned(vel[i], maxVelocity, velocityBits);
+        out.angVel[i] = QuantizeSigned(angVel[i], maxAngularVelocity, angularVelocityBits);
+    }
+}
+
+float3 RigidBodyQuantization::DequantizePosition(const QuantizedRigidBodyState &state) const
+{
+    return float3((float)(boundsMin.x + (double)state.pos[0] * positionPrecision),
+        (float)(boundsMin.y + (double)state.pos[1] * positionPrecision),
+        (float)(boundsMin.z + (double)state.pos[2] * positionPrecision));
+}
+
+Quat RigidBodyQuantization::DequantizeRotation(const QuantizedRigidBodyState &state) const
+{
+    const float maxRotValue = (float)((1 << rotationBits) - 1);
+    float c[4];
+    float sumSq = 0.f;
+    for(int i = 0, j = 0; i < 4; ++i)
+    {
+        if (i == state.rotLargest)
+            continue;
+        c[i] = state.rot[j++] / maxRotValue * cSqrt2 - cInvSqrt2;
+        sumSq += c[i] * c[i];
+    }
+    c[state.rotLargest & 3] = sqrtf(std::max(0.f, 1.f - sumSq));
+    return Quat(c[0], c[1], c[2], c[3]).Normalized();
+}
+
+float3 RigidBodyQuantization::DequantizeVelocity(const QuantizedRigidBodyState &state) const
+{
+    return float3(DequantizeSigned(state.vel[0], maxVelocity, velocityBits),
+        DequantizeSigned(state.vel[1], maxVelocity, velocityBits),
+        DequantizeSigned(state.vel[2], maxVelocity, velocityBits));
+}
+
+float3 RigidBodyQuantization::DequantizeAngularVelocity(const QuantizedRigidBodyState &state) const
+{
+    return float3(DequantizeSigned(state.angVel[0], maxAngularVelocity, angularVelocityBits),
+        DequantizeSigned(state.angVel[1], maxAngularVelocity, angularVelocityBits),
+        DequantizeSigned(state.angVel[2], maxAngularVelocity, angularVelocityBits));
+}
+
+void RigidBodyQuantization::Write(kNet::DataSerializer &ds, const QuantizedRigidBodyState &state, const QuantizedRigidBodyState *baseline) const
+{
+    if (!baseline)
+    {
+        bool inBounds = true;
+        for(int i = 0; i < 3; ++i)
+            if (state.pos[i] < 0 || state.pos[i] >= (1 << PositionBits(i)))
+                inBounds = false;
+        ds.Add<kNet::bit>(inBounds ? 1 : 0);
+        for(int i = 0; i < 3; ++i)
+        {
+            if (inBounds)
+                ds.AppendBits((u32)state.pos[i], PositionBits(i));
+            else
+                ds.Add<u32>((u32)state.pos[i]);
+        }
+
+        ds.AppendBits(state.rotLargest, 2);
+        for(int i = 0; i < 3; ++i)
+            ds.AppendBits((u32)state.rot[i], rotationBits);
+
+        WriteScale(ds, state.scale);
+        WriteSignedVector(ds, state.vel, velocityBits);
+        WriteSignedVector(ds, state.angVel, angularVelocityBits);
+        return;
+    }
+
+    WriteVectorDelta(ds, state.pos, baseline->pos, 32);
+
+    const bool rotChanged = state.rotLargest != baseline->rotLargest || !Equals(state.rot, baseline->rot);
+    ds.Add<kNet::bit>(rotChanged ? 1 : 0);
+    if (rotChanged)
+    {
+        // The components are only comparable if the same component was left out. Otherwise send the rotation in full.
+        const bool sameLargest = state.rotLargest == baseline->rotLargest;
+        ds.Add<kNet::bit>(sameLargest ? 1 : 0);
+        if (sameLargest)
+        {
+            for(int i = 0; i < 3; ++i)
+                WriteDelta(ds, state.rot[i], baseline->rot[i], rotationBits + 1);
+        }
+        else
+        {
+            ds.AppendBits(state.rotLargest, 2);
+            for(int i = 0; i < 3; ++i)
+                ds.AppendBits((u32)state.rot[i], rotationBits);
+        }
+    }
+
+    const bool scaleChanged = state.scale.x != baseline->scale.x || state.scale.y != baseline->scale.y || state.scale.z != baseline->scale.z;
+    ds.Add<kNet::bit>(scaleChanged ? 1 : 0);
+    if (scaleChanged)
+        WriteScale(ds, state.scale);
+
+    WriteVectorDelta(ds, state.vel, baseline->vel, velocityBits + 1);
+    WriteVectorDelta(ds, state.angVel, baseline->angVel, angularVelocityBits + 1);
+}
+
+void RigidBodyQuantization::Read(kNet::DataDeserializer &dd, bool delta, const QuantizedRigidBodyState *baseline, QuantizedRigidBodyState &out) const
+{
+    if (!delta)
+    {
+        const bool inBounds = dd.Read<kNet::bit>() != 0;
+        for(int i = 0; i < 3; ++i)
+            out.pos[i] = inBounds ? (s32)dd.ReadBits(PositionBits(i)) : (s32)dd.Read<u32>();
+
+        out.rotLargest = (u8)dd.ReadBits(2);
+        for(int i = 0; i < 3; ++i)
+            out.rot[i] = (s32)dd.ReadBits(rotationBits);
+
+        out.scale = ReadScale(dd);
+        ReadSignedVector(dd, out.vel, velocityBits);
+        ReadSignedVector(dd, out.angVel, angularVelocityBits);
+        return;
+    }
+
+    // Without a baseline the data still needs to be consumed to get to the following rigid bodies in the message.
+    const QuantizedRigidBodyState defaultState;
+    const QuantizedRigidBodyState &base = baseline ? *baseline : defaultState;
+
+    ReadVectorDelta(dd, out.pos, base.pos, 32);
+
+    if (dd.Read<kNet::bit>() != 0)
+    {
+        if (dd.Read<kNet::bit>() != 0)
+        {
+            out.rotLargest = base.rotLargest;
+            for(int i = 0; i < 3; ++i)
+                out.rot[i] = ReadDelta(dd, base.rot[i], rotationBits + 1);
+        }
+        else
+        {
+            out.rotLargest = (u8)dd.ReadBits(2);
+            for(int i = 0; i < 3; ++i)
+                out.rot[i] = (s32)dd.ReadBits(rotationBits);
+        }
+    }
+    else
+    {
+        out.rotLargest = base.rotLargest;
+        for(int i = 0; i < 3; ++i)
+            out.rot[i] = base.rot[i];
+    }
+
+    out.scale = dd.Read<kNet::bit>() != 0 ? ReadScale(dd) : base.scale;
+
+    ReadVectorDelta(dd, out.vel, base.vel, velocityBits + 1);
+    ReadVectorDelta(dd, out.angVel, base.angVel, angularVelocityBits + 1);
+}
+
+void RigidBodyQuantization::Serialize(kNet::DataSerializer &ds) const
+{
+    for(int i = 0; i < 3; ++i)
+        ds.Add<float>(boundsMin[i]);
+    for(int i = 0; i < 3; ++i)
+        ds.Add<float>(boundsMax[i]);
+    ds.Add<float>(positionPrecision);
+    ds.Add<u8>((u8)rotationBits);
+    ds.Add<float>(maxVelocity);
+    ds.Add<u8>((u8)velocityBits);
+    ds.Add<float>(maxAngularVelocity);
+    ds.Add<u8>((u8)angularVelocityBits);
+}
+
+void RigidBodyQuantization::Deserialize(kNet::DataDeserializer &dd)
+{
+    for(int i = 0; i < 3; ++i)
+        boundsMin[i] = dd.Read<float>();
+    for(int i = 0; i < 3; ++i)
+        boundsMax[i] = dd.Read<float>();
+    positionPrecision = dd.Read<float>();
+    rotationBits = dd.Read<u8>();
+    maxVelocity = dd.Read<float>();
+    velocityBits = dd.Read<u8>();
+    maxAngularVelocity = dd.Read<float>();
+    angularVelocityBits = dd.Read<u8>();
+    Validate();
+}
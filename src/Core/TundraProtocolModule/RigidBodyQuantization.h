@@ -0,0 +1,76 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "TundraProtocolModuleApi.h"
+#include "CoreTypes.h"
+#include "Math/float3.h"
+#include "Math/Quat.h"
+
+#include <kNetFwd.h>
+
+/// Rigid body state quantized for the network stream.
+/** The server and the client reconstruct the same integers from the stream, so a state received by the client can be used
+    as the baseline for delta encoding the following states of the same rigid body. */
+struct QuantizedRigidBodyState
+{
+    QuantizedRigidBodyState();
+
+    s32 pos[3]; ///< Position in quantization steps from the minimum of the bounds
+    u8 rotLargest; ///< Index of the quaternion component (x, y, z, w) left out by the smallest three compression
+    s32 rot[3]; ///< The three smallest quaternion components in quantization steps
+    float3 scale; ///< Scale, sent as floats as it rarely changes
+    s32 vel[3]; ///< Linear velocity in quantization steps, signed
+    s32 angVel[3]; ///< Angular velocity in quantization steps, signed
+};
+
+/// Quantization profile of the replicated rigid body stream of a scene.
+/** The server sends its profile to each client, and both ends encode and decode the rigid body stream with it.
+    Each rigid body update is either written in full, or delta encoded against a state the client has acknowledged.
+    @see SyncManager::SetRigidBodyQuantization */
+class TUNDRAPROTOCOL_MODULE_API RigidBodyQuantization
+{
+public:
+    /// Constructs the default profile: 5 mm precision within [-1024, 1024] on each axis, and velocities up to 64 units per second.
+    RigidBodyQuantization();
+
+    float3 boundsMin; ///< Minimum corner of the bounds within which positions are quantized. Positions outside are sent with 32 bits per axis.
+    float3 boundsMax; ///< Maximum corner of the bounds within which positions are quantized.
+    float positionPrecision; ///< Quantization step of positions in world units
+    int rotationBits; ///< Bits per component in the smallest three quaternion compression, [4, 16]
+    float maxVelocity; ///< Range of each linear velocity component in units per second. Larger values are clamped.
+    int velocityBits; ///< Bits per linear velocity component, [4, 24]
+    float maxAngularVelocity; ///< Range of each angular velocity component in degrees per second. Larger values are clamped.
+    int angularVelocityBits; ///< Bits per angular velocity component, [4, 24]
+
+    /// Clamps the parameters to their supported ranges.
+    void Validate();
+
+    /// Returns the number of bits needed for a quantized position within the bounds on the given axis.
+    int PositionBits(int axis) const;
+
+    /// Returns an upper bound for the number of bits Write produces for one rigid body.
+    int MaxStateBits() const;
+
+    /// Quantizes a rigid body state. Angular velocity is in degrees per second, as in EC_RigidBody.
+    void Quantize(const float3 &pos, const Quat &rot, const float3 &scale, const float3 &vel, const float3 &angVel, QuantizedRigidBodyState &out) const;
+
+    float3 DequantizePosition(const QuantizedRigidBodyState &state) const;
+    Quat DequantizeRotation(const QuantizedRigidBodyState &state) const;
+    float3 DequantizeVelocity(const QuantizedRigidBodyState &state) const;
+    float3 DequantizeAngularVelocity(const QuantizedRigidBodyState &state) const;
+
+    /// Writes a quantized state, delta encoded against baseline if one is given, otherwise in full.
+    void Write(kNet::DataSerializer &ds, const QuantizedRigidBodyState &state, const QuantizedRigidBodyState *baseline) const;
+
+    /// Reads a quantized state written by Write.
+    /** @param delta Whether the state was delta encoded
+        @param baseline The state the delta was encoded against. If null for a delta encoded state, the data is
+               skipped, and the returned state is meaningless. */
+    void Read(kNet::DataDeserializer &dd, bool delta, const QuantizedRigidBodyState *baseline, QuantizedRigidBodyState &out) const;
+
+    /// Serializes the profile for sending it to a client.
+    void Serialize(kNet::DataSerializer &ds) const;
+    /// Deserializes a profile received from the server.
+    void Deserialize(kNet::DataDeserializer &dd);
+};
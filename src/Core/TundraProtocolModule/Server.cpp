@@ -300,6 +300,10 @@ void Server::HandleLogin(kNet::MessageConnection* source, const MsgLogin& msg)
     
     ::LogInfo("User with connection ID " + QString::number(user->userID) + " logged in.");
     
+    // Speak the lower of the protocol versions. Clients that do not tell their version speak the original protocol.
+    const u32 clientProtocolVersion = user->Property("protocol-version").toUInt();
+    user->protocolVersion = std::min<u32>(std::max<u32>(clientProtocolVersion, cProtocolOriginal), cProtocolVersion);
+    
     // Allow entityactions & EC sync from now on
     MsgLoginReply reply;
     reply.success = 1;
@@ -330,6 +334,12 @@ void Server::HandleLogin(kNet::MessageConnection* source, const MsgLogin& msg)
     UserConnectedResponseData responseData;
     emit UserConnected(user->userID, user.get(), &responseData);
 
+    // Tell the negotiated protocol version to the client. It is an attribute of the root element, so that clients of the original protocol do not see it.
+    QDomDocument &doc = responseData.responseData;
+    if (doc.documentElement().isNull())
+        doc.appendChild(doc.createElement("login"));
+    doc.documentElement().setAttribute("protocol-version", QString::number(user->protocolVersion));
+
     QByteArray responseByteData = responseData.responseData.toByteArray(-1);
     reply.loginReplyData.insert(reply.loginReplyData.end(), responseByteData.data(), responseByteData.data() + responseByteData.size());
     user->connection->Send(reply);
@@ -28,7 +28,13 @@
 
 #include <kNet.h>
 
+#include <QRunnable>
+#include <QThreadPool>
+#include <QMutexLocker>
+
 #include <cstring>
+#include <algorithm>
+#include <cfloat>
 
 #include "MemoryLeakCheck.h"
 
@@ -38,7 +44,28 @@ kNet::MessageConnection* currentSender = 0;
 namespace TundraLogic
 {
 
-void SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds)
+class SyncManager::UserSyncWorker : public QRunnable
+{
+public:
+    UserSyncWorker(SyncManager* owner, SyncContext* context, shared_ptr<SceneSyncState> state, size_t tickBudget) :
+        owner_(owner), context_(context), state_(state), tickBudget_(tickBudget)
+    {
+        setAutoDelete(true);
+    }
+
+    void run()
+    {
+        owner_->ProcessUserSyncState(*context_, state_.get(), tickBudget_);
+    }
+
+private:
+    SyncManager* owner_;
+    SyncContext* context_;
+    shared_ptr<SceneSyncState> state_;
+    size_t tickBudget_;
+};
+
+size_t SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds)
 {
     kNet::NetworkMessage* msg = connection->StartNewMessage(id, ds.BytesFilled());
     memcpy(msg->data, ds.GetData(), ds.BytesFilled());
@@ -46,9 +73,47 @@ void SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::messag
     msg->inOrder = inOrder;
     msg->priority = 100; // Fixed priority as in those defined with xml
     connection->EndAndQueueMessage(msg);
+    return ds.BytesFilled();
+}
+
+void SyncManager::FlushSyncContext(kNet::MessageConnection* connection, SyncContext& context)
+{
+    for(size_t i = 0; i < context.messages.size(); ++i)
+    {
+        const SyncContext::OutgoingMessage &outgoing = context.messages[i];
+        kNet::NetworkMessage* msg = connection->StartNewMessage(outgoing.id, outgoing.size);
+        if (outgoing.size)
+            memcpy(msg->data, &context.messageData[outgoing.offset], outgoing.size);
+        msg->reliable = outgoing.reliable;
+        msg->inOrder = outgoing.inOrder;
+        if (!outgoing.defaultPriority)
+            msg->priority = 100; // Fixed priority as in those defined with xml
+        connection->EndAndQueueMessage(msg);
+    }
+    for(size_t i = 0; i < context.log.size(); ++i)
+    {
+        if (context.log[i].first)
+            LogError(context.log[i].second);
+        else
+            LogWarning(context.log[i].second);
+    }
+    rigidBodyBitsSent_ += context.rigidBodyBits;
+    rigidBodiesSent_ += context.rigidBodyCount;
+    context.messages.clear();
+    context.messageData.clear();
+    context.log.clear();
+    context.rigidBodyBits = 0;
+    context.rigidBodyCount = 0;
 }
 
-void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+SyncContext& SyncManager::GetSyncContext(size_t index)
+{
+    while(syncContexts_.size() <= index)
+        syncContexts_.push_back(new SyncContext());
+    return *syncContexts_[index];
+}
+
+void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncContext& context)
 {
     // Component identification
     ds.AddVLE<kNet::VLE8_16_32>(comp->Id() & UniqueIdGenerator::LAST_REPLICATED_ID);
@@ -56,7 +121,7 @@ void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
     ds.AddString(comp->Name().toStdString());
     
     // Create a nested dataserializer for the attributes, so we can survive unknown or incompatible components
-    kNet::DataSerializer attrDs(attrDataBuffer_, 16 * 1024);
+    kNet::DataSerializer attrDs(context.attrDataBuffer, 16 * 1024);
     
     // Static-structured attributes
     unsigned numStaticAttrs = comp->NumStaticAttributes();
@@ -78,17 +143,113 @@ void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
     
     // Add the attribute array to the main serializer
     ds.AddVLE<kNet::VLE8_16_32>(attrDs.BytesFilled());
-    ds.AddArray<u8>((unsigned char*)attrDataBuffer_, attrDs.BytesFilled());
+    ds.AddArray<u8>((unsigned char*)context.attrDataBuffer, attrDs.BytesFilled());
+}
+
+void SyncManager::WriteCachedComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncContext& context)
+{
+    if (!serializationCacheEnabled_)
+    {
+        WriteComponentFullUpdate(ds, comp, context);
+        return;
+    }
+    
+    QByteArray data;
+    {
+        QMutexLocker lock(&serializationCacheMutex_);
+        data = fullUpdateCache_.value(comp->Id());
+    }
+    if (data.isEmpty())
+    {
+        // Serialize outside the lock. If another connection does the same concurrently, the results are identical.
+        kNet::DataSerializer compDs(context.cachedDataBuffer, 64 * 1024);
+        WriteComponentFullUpdate(compDs, comp, context);
+        data = QByteArray(context.cachedDataBuffer, compDs.BytesFilled());
+        QMutexLocker lock(&serializationCacheMutex_);
+        fullUpdateCache_.insert(comp->Id(), data);
+    }
+    // The full update is byte-aligned, so it can be spliced into the message as is
+    ds.AddArray<u8>((const unsigned char*)data.constData(), data.size());
+}
+
+QByteArray SyncManager::EditAttributesData(IComponent* comp, const u8* dirtyAttributes, const std::vector<u8>& changedAttributes, SyncContext& context)
+{
+    const AttributeVector& attrs = comp->Attributes();
+    unsigned numBytes = (attrs.size() + 7) >> 3;
+    
+    QPair<component_id_t, QByteArray> key;
+    if (serializationCacheEnabled_)
+    {
+        key = qMakePair(comp->Id(), QByteArray((const char*)dirtyAttributes, numBytes));
+        QMutexLocker lock(&serializationCacheMutex_);
+        QHash<QPair<component_id_t, QByteArray>, QByteArray>::const_iterator i = editAttrsCache_.find(key);
+        if (i != editAttrsCache_.end())
+            return i.value();
+    }
+    
+    kNet::DataSerializer attrDataDs(context.attrDataBuffer, 16 * 1024);
+    
+    // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+    unsigned bitsMethod1 = changedAttributes.size() * 8 + 8;
+    unsigned bitsMethod2 = attrs.size();
+    // Method 1: indices
+    if (bitsMethod1 <= bitsMethod2)
+    {
+        attrDataDs.Add<kNet::bit>(0);
+        attrDataDs.Add<u8>(changedAttributes.size());
+        for (unsigned i = 0; i < changedAttributes.size(); ++i)
+        {
+            attrDataDs.Add<u8>(changedAttributes[i]);
+            attrs[changedAttributes[i]]->ToBinary(attrDataDs);
+        }
+    }
+    // Method 2: bitmask
+    else
+    {
+        attrDataDs.Add<kNet::bit>(1);
+        for (unsigned i = 0; i < attrs.size(); ++i)
+        {
+            if (dirtyAttributes[i >> 3] & (1 << (i & 7)))
+            {
+                attrDataDs.Add<kNet::bit>(1);
+                attrs[i]->ToBinary(attrDataDs);
+            }
+            else
+                attrDataDs.Add<kNet::bit>(0);
+        }
+    }
+    
+    if (!serializationCacheEnabled_)
+        return QByteArray::fromRawData(context.attrDataBuffer, attrDataDs.BytesFilled());
+    QByteArray data(context.attrDataBuffer, attrDataDs.BytesFilled());
+    QMutexLocker lock(&serializationCacheMutex_);
+    editAttrsCache_.insert(key, data);
+    return data;
+}
+
+void SyncManager::ResetSerializationCache(bool enabled)
+{
+    fullUpdateCache_.clear();
+    editAttrsCache_.clear();
+    serializationCacheEnabled_ = enabled;
 }
 
 SyncManager::SyncManager(TundraLogicModule* owner) :
     owner_(owner),
     framework_(owner->GetFramework()),
+    attributeChangeSubscriber_(-1),
     updatePeriod_(1.0f / 20.0f),
     interestmanager_(0),
     updateAcc_(0.0),
     maxLinExtrapTime_(3.0f),
-    noClientPhysicsHandoff_(false)
+    noClientPhysicsHandoff_(false),
+    maxBytesPerSecond_(0),
+    workers_(new QThreadPool()),
+    serializationCacheEnabled_(false),
+    rigidBodyProfileId_(0),
+    rigidBodyBitsSent_(0),
+    rigidBodiesSent_(0),
+    rigidBodyMaxInterval_(0.f)
 {
     KristalliProtocolModule *kristalli = framework_->GetModule<KristalliProtocolModule>();
     connect(kristalli, SIGNAL(NetworkMessageReceived(kNet::MessageConnection *, kNet::packet_id_t, kNet::message_id_t, const char *, size_t)), 
@@ -97,6 +258,28 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
     if (framework_->HasCommandLineParameter("--noclientphysics"))
         noClientPhysicsHandoff_ = true;
 
+    QStringList bandwidthParam = framework_->CommandLineParameters("--syncbandwidth");
+    if (bandwidthParam.size() > 0)
+    {
+        bool ok;
+        int kiloBytesPerSecond = bandwidthParam.first().toInt(&ok);
+        if (ok && kiloBytesPerSecond >= 0)
+            SetMaxBytesPerSecond(kiloBytesPerSecond * 1024);
+        else
+            LogError("SyncManager: --syncBandwidth parameter is not a valid non-negative integer.");
+    }
+
+    QStringList rigidBodyIntervalParam = framework_->CommandLineParameters("--rigidbodymaxinterval");
+    if (rigidBodyIntervalParam.size() > 0)
+    {
+        bool ok;
+        int milliseconds = rigidBodyIntervalParam.first().toInt(&ok);
+        if (ok && milliseconds >= 0)
+            SetRigidBodyMaxInterval(milliseconds / 1000.f);
+        else
+            LogError("SyncManager: --rigidBodyMaxInterval parameter is not a valid non-negative integer.");
+    }
+
     /*Parse through possible Interest Management parameterṣ*/
     if (framework_->CommandLineParameters("--im").size() == 1)
     {
@@ -146,6 +329,14 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
 
 SyncManager::~SyncManager()
 {
+    ScenePtr scene = scene_.lock();
+    if (scene && attributeChangeSubscriber_ >= 0)
+        scene->UnsubscribeAttributeChanges(attributeChangeSubscriber_);
+    SetInterestManager(0);
+    workers_->waitForDone();
+    delete workers_;
+    for(size_t i = 0; i < syncContexts_.size(); ++i)
+        delete syncContexts_[i];
 }
 
 void SyncManager::SendCameraUpdateRequest(UserConnectionPtr conn, bool enabled)
@@ -163,6 +354,10 @@ void SyncManager::SendCameraUpdateRequest(UserConnectionPtr conn, bool enabled)
     ds.Add<u8>(enabled);
 
     QueueMessage(conn->connection, cCameraOrientationRequest, true, true, ds);
+
+    // The last reported location goes stale once the client stops sending camera updates.
+    if (!enabled && conn->syncState)
+        conn->syncState->locationInitialized = false;
 }
 
 void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ray, bool rel, int critrange, int relrange, int updateint, int raycastint)
@@ -180,11 +375,11 @@ void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ra
             for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
                 if ((*i)->syncState)
                 {
-                    SendCameraUpdateRequest((*i), enabled);
-                    (*i)->syncState->visibleEntities.clear();
-                    (*i)->syncState->relevanceFactors.clear();
-                    (*i)->syncState->lastUpdatedEntitys_.clear();
-                    (*i)->syncState->lastRaycastedEntitys_.clear();
+                    // The rigid body send rate adaptation needs the camera updates even without the IM.
+                    SendCameraUpdateRequest((*i), enabled || rigidBodyMaxInterval_ > 0.f);
+                    // The withheld changes were filtered with the old settings, send them out now.
+                    (*i)->syncState->FlushDeferredEntities();
+                    (*i)->syncState->interest.Clear();
                 }
         }
 
@@ -226,24 +421,18 @@ void SyncManager::UpdateInterestManagerSettings(bool enabled, bool eucl, bool ra
 InterestManager* SyncManager::GetInterestManager()
 {
     if(!interestmanager_)
-        interestmanager_ = InterestManager::getInstance();
+        interestmanager_ = new InterestManager();
 
     return interestmanager_;
 }
 
 void SyncManager::SetInterestManager(InterestManager *im)
 {
-    if(!im && !interestmanager_)
+    if(im == interestmanager_)
         return;
 
-    else if(!im && interestmanager_)
-    {
-        delete interestmanager_;
-        interestmanager_ = 0;
-    }
-
-    else
-        interestmanager_ = im;
+    delete interestmanager_;    //SyncManager owns the IM
+    interestmanager_ = im;
 }
 
 void SyncManager::SetUpdatePeriod(float period)
@@ -256,6 +445,66 @@ void SyncManager::SetUpdatePeriod(float period)
     GetClientExtrapolationTime();
 }
 
+void SyncManager::SetMaxBytesPerSecond(int bytesPerSecond)
+{
+    maxBytesPerSecond_ = std::max(bytesPerSecond, 0);
+}
+
+void SyncManager::SetRigidBodyQuantization(const RigidBodyQuantization &profile)
+{
+    if (!owner_->IsServer())
+    {
+        LogWarning("SyncManager::SetRigidBodyQuantization: The profile can only be set on the server.");
+        return;
+    }
+
+    rigidBodyQuantization_ = profile;
+    rigidBodyQuantization_.Validate();
+    ++rigidBodyProfileId_;
+
+    // The states the clients have acknowledged were quantized with the old profile, so they can not be used as baselines anymore.
+    UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+    for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+        if ((*i)->syncState && (*i)->protocolVersion >= cProtocolRigidBodyQuantization)
+        {
+            (*i)->syncState->ResetRigidBodyStream();
+            SendRigidBodyQuantization((*i)->connection);
+        }
+}
+
+void SyncManager::SetServerProtocolVersion(u32 version)
+{
+    server_syncstate_.protocolVersion = version;
+    server_syncstate_.ResetRigidBodyStream();
+}
+
+void SyncManager::SetRigidBodyMaxInterval(float seconds)
+{
+    const bool wasEnabled = rigidBodyMaxInterval_ > 0.f;
+    rigidBodyMaxInterval_ = Clamp(seconds, 0.f, 2.f);
+
+    // The send rate follows the distance to the client's camera, so ask the clients to report it, unless the IM does already.
+    const bool enabled = rigidBodyMaxInterval_ > 0.f;
+    if (wasEnabled != enabled && !interestmanager_ && owner_->IsServer())
+    {
+        UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+            if ((*i)->syncState)
+                SendCameraUpdateRequest(*i, enabled);
+    }
+}
+
+float SyncManager::RigidBodyBitsPerBody() const
+{
+    return rigidBodiesSent_ > 0 ? (float)((double)rigidBodyBitsSent_ / rigidBodiesSent_) : 0.f;
+}
+
+void SyncManager::ResetRigidBodyStats()
+{
+    rigidBodyBitsSent_ = 0;
+    rigidBodiesSent_ = 0;
+}
+
 void SyncManager::GetClientExtrapolationTime()
 {
     QStringList extrapTimeParam = framework_->CommandLineParameters("--clientextrapolationtime");
@@ -294,10 +543,18 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     if (previous)
     {
         disconnect(previous.get(), 0, this, 0);
+        if (attributeChangeSubscriber_ >= 0)
+            previous->UnsubscribeAttributeChanges(attributeChangeSubscriber_);
         server_syncstate_.Clear();
     }
     
     scene_.reset();
+    attributeChangeSubscriber_ = -1;
+    if (owner_->IsServer())
+    {
+        rigidBodyQuantization_ = RigidBodyQuantization();
+        ++rigidBodyProfileId_;
+    }
     
     if (!scene)
     {
@@ -308,8 +565,8 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     scene_ = scene;
     Scene* sceneptr = scene.get();
     
-    connect(sceneptr, SIGNAL( AttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ),
-        SLOT( OnAttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ));
+    // Attribute changes are by far the most frequent, read them from the journal of the scene once per frame instead of a signal per change.
+    attributeChangeSubscriber_ = sceneptr->SubscribeAttributeChanges();
     connect(sceneptr, SIGNAL( AttributeAdded(IComponent*, IAttribute*, AttributeChange::Type) ),
         SLOT( OnAttributeAdded(IComponent*, IAttribute*, AttributeChange::Type) ));
     connect(sceneptr, SIGNAL( AttributeRemoved(IComponent*, IAttribute*, AttributeChange::Type) ),
@@ -328,6 +585,9 @@ void SyncManager::RegisterToScene(ScenePtr scene)
 
 void SyncManager::HandleKristalliMessage(kNet::MessageConnection* source, kNet::packet_id_t packetId, kNet::message_id_t messageId, const char* data, size_t numBytes)
 {
+    // Handle the local changes made so far before the changes of the message.
+    ProcessAttributeChanges();
+
     try
     {
         switch(messageId)
@@ -365,6 +625,12 @@ void SyncManager::HandleKristalliMessage(kNet::MessageConnection* source, kNet::
         case cRigidBodyUpdateMessage:
             HandleRigidBodyChanges(source, packetId, data, numBytes);
             break;
+        case cRigidBodyQuantizationMessage:
+            HandleRigidBodyQuantization(source, data, numBytes);
+            break;
+        case cRigidBodyAckMessage:
+            HandleRigidBodyAck(source, data, numBytes);
+            break;
         case cEntityActionMessage:
             {
                 MsgEntityAction msg(data, numBytes);
@@ -399,10 +665,14 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
     // Mark all entities in the sync state as new so we will send them
     user->syncState = MAKE_SHARED(SceneSyncState, user->ConnectionId(), owner_->IsServer());
     user->syncState->SetParentScene(scene_);
+    user->syncState->protocolVersion = user->protocolVersion;
 
-    if(interestmanager_) //If the server is running InterestManager, inform the connected user that the server wants camera updates
+    if(interestmanager_ || rigidBodyMaxInterval_ > 0.f) //If the server is running InterestManager or adapts the rigid body send rate, inform the connected user that the server wants camera updates
         SendCameraUpdateRequest(user, true);
 
+    if (owner_->IsServer() && user->protocolVersion >= cProtocolRigidBodyQuantization)
+        SendRigidBodyQuantization(user->connection);
+
     if (owner_->IsServer())
         emit SceneStateCreated(user.get(), user->syncState.get());
 
@@ -416,6 +686,30 @@ void SyncManager::NewUserConnected(const UserConnectionPtr &user)
     }
 }
 
+void SyncManager::ProcessAttributeChanges()
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene || attributeChangeSubscriber_ < 0)
+        return;
+
+    Scene::AttributeChangeVector changes;
+    scene->TakeAttributeChanges(attributeChangeSubscriber_, changes);
+    if (changes.empty())
+        return;
+
+    PROFILE(SyncManager_ProcessAttributeChanges);
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        // Skip the changes of components which have been destroyed or removed from their entity since.
+        ComponentPtr comp = changes[i].component.lock();
+        if (!comp || !comp->ParentEntity())
+            continue;
+        const AttributeVector &attributes = comp->Attributes();
+        if (changes[i].attributeIndex < attributes.size() && attributes[changes[i].attributeIndex])
+            OnAttributeChanged(comp.get(), attributes[changes[i].attributeIndex], changes[i].change);
+    }
+}
+
 void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change)
 {
     assert(comp && attr);
@@ -424,18 +718,6 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
 
     bool isServer = owner_->IsServer();
     
-    // Client: Check for stopping interpolation, if we change a currently interpolating variable ourselves
-    if (!isServer) // Since the server never interpolates attributes, we don't need to do this check on the server at all.
-    {
-        ScenePtr scene = scene_.lock();
-        if (scene && !scene->IsInterpolating() && !currentSender)
-        {
-            if (attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate)
-                // Note: it does not matter if the attribute was not actually interpolating
-                scene->EndAttributeInterpolation(attr);
-        }
-    }
-    
     // Is this change even supposed to go to the network?
     if (change != AttributeChange::Replicate || comp->IsLocal())
         return;
@@ -454,14 +736,16 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
             if ((*i)->syncState)
             {
                 /// Check here if the attribute should be updated to which client?
+                /// If the entity is not relevant, remember the change so that it can be sent once the entity becomes relevant again.
                 /// @remarks InterestManager functionality
-                /// \bug The attribute should be marked dirty, but sending should be deferred until entity is relevant
-                /// With this logic, the dirty attributes from the non-relevant period will simply be forgotten
                 if(interestmanager_ && !interestmanager_->CheckRelevance((*i), entity, scene_, framework_->IsHeadless()))
-                    continue;
+                    (*i)->syncState->MarkAttributeDeferred(entity->Id(), comp->Id(), attr->Index());
 
                 else    //If IM is not available, accept the update
+                {
+                    (*i)->syncState->FlushDeferredEntity(entity->Id());
                     (*i)->syncState->MarkAttributeDirty(entity->Id(), comp->Id(), attr->Index());
+                }
             }
         }
     }
@@ -742,7 +1026,9 @@ void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
             continue;
         }
 
-        const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+        const float interpPeriod = r.interpPeriod; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+        // The extrapolation time is given in update periods, so scale it to the interpolation period of this entity.
+        const float maxExtrapTime = 1.0f + (maxLinExtrapTime_ - 1.0f) * updatePeriod_ / interpPeriod;
 
         // Test: Uncomment to only interpolate.
 //        r.interpTime = std::min(1.0f, r.interpTime + (float)frametime / interpPeriod);
@@ -761,7 +1047,7 @@ void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
         }
         else // Linear extrapolation if server has not sent an update.
         {
-            if (isNewtonian && maxLinExtrapTime_ > 1.0f)
+            if (isNewtonian && maxExtrapTime > 1.0f)
                 pos = r.interpEnd.pos + r.interpEnd.vel * (r.interpTime-1.f) * interpPeriod;
             else
                 pos = r.interpEnd.pos;
@@ -780,7 +1066,7 @@ void SyncManager::InterpolateRigidBodies(f64 frametime, SceneSyncState* state)
         // One fixed update interval: interpolate
         // Two subsequent update intervals: linear extrapolation
         // All subsequente update intervals: local physics extrapolation.
-        if (r.interpTime >= maxLinExtrapTime_) // Hand-off to client-side physics?
+        if (r.interpTime >= maxExtrapTime) // Hand-off to client-side physics?
         {
             if (rigidBody)
             {
@@ -831,6 +1117,8 @@ void SyncManager::Update(f64 frametime)
 {
     PROFILE(SyncManager_Update);
 
+    ProcessAttributeChanges();
+
     // For the client, smoothly update all rigid bodies by interpolating.
     if (!owner_->IsServer())
         InterpolateRigidBodies(frametime, &server_syncstate_);
@@ -851,281 +1139,598 @@ void SyncManager::Update(f64 frametime)
     {
         // If we are server, process all authenticated users
 
+        // Per-client byte budget for this tick. Zero means unlimited.
+        const size_t tickBudget = maxBytesPerSecond_ > 0 ? std::max((size_t)(maxBytesPerSecond_ * updatePeriod_), (size_t)1) : 0;
+
         // Then send out changes to other attributes via the generic sync mechanism.
         UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+
+        // Compute the relevant entities of each client once for the whole tick, so that the attribute changes
+        // until the next tick can be filtered with a simple lookup.
+        if (interestmanager_)
+            interestmanager_->UpdateRelevanceSets(scene, users, framework_->IsHeadless());
+
+        // Do the per-client work that may signal scripts or touch the renderer on the main thread first.
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
             if ((*i)->syncState)
             {
-                // First send out all changes to rigid bodies.
-                // After processing this function, the bits related to rigid body states have been cleared,
-                // so the generic sync will not double-replicate the rigid body positions and velocities.
-                ReplicateRigidBodyChanges((*i)->connection, (*i)->syncState.get());
-
-                ProcessSyncState((*i)->connection, (*i)->syncState.get());
+                // Entities that have become relevant since their last change get their withheld changes sent now.
+                if (interestmanager_)
+                    FlushRelevantDeferredEntities(*i);
+                // When the bandwidth is limited, send the most important entities first.
+                if (tickBudget > 0)
+                    PrioritizeSyncState((*i)->syncState.get());
             }
+
+        // Then craft the messages of each client on the worker threads. The scene is not modified while the workers run,
+        // as the main thread waits for them below, so the component data serialized for one client can be reused for the others.
+        const bool parallel = users.size() > 1;
+        ResetSerializationCache(parallel);
+        {
+            PROFILE(SyncManager_ProcessUserSyncStates);
+            size_t numContexts = 0;
+            for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+                if ((*i)->syncState)
+                {
+                    SyncContext &context = GetSyncContext(numContexts++);
+                    context.roundTripTime = (*i)->connection ? (*i)->connection->RoundTripTime() * 0.001f : 0.f;
+                    if (parallel)
+                        workers_->start(new UserSyncWorker(this, &context, (*i)->syncState, tickBudget));
+                    else
+                        ProcessUserSyncState(context, (*i)->syncState.get(), tickBudget);
+                }
+            if (parallel)
+                workers_->waitForDone();
+        }
+        ResetSerializationCache(false);
+
+        // Finally hand the messages over to kNet on the main thread.
+        size_t numContexts = 0;
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+            if ((*i)->syncState)
+                FlushSyncContext((*i)->connection, *syncContexts_[numContexts++]);
     }
     else
     {
         // If we are client, process just the server sync state
         kNet::MessageConnection* connection = owner_->GetKristalliModule()->GetMessageConnection();
         if (connection)
-            ProcessSyncState(connection, &server_syncstate_);
+        {
+            SyncContext &context = GetSyncContext(0);
+            ProcessSyncState(context, &server_syncstate_);
+            FlushSyncContext(connection, context);
+            if (server_syncstate_.protocolVersion >= cProtocolRigidBodyQuantization)
+                SendRigidBodyAck(connection, &server_syncstate_);
+        }
     }
 }
 
-void SyncManager::ReplicateRigidBodyChanges(kNet::MessageConnection* destination, SceneSyncState* state)
+void SyncManager::ProcessUserSyncState(SyncContext& context, SceneSyncState* state, size_t tickBudget)
 {
-    PROFILE(SyncManager_ReplicateRigidBodyChanges);
-    
-    ScenePtr scene = scene_.lock();
-    if (!scene)
-        return;
+    // First send out all changes to rigid bodies.
+    // After processing this function, the bits related to rigid body states have been cleared,
+    // so the generic sync will not double-replicate the rigid body positions and velocities.
+    size_t rigidBodyBytes = ReplicateRigidBodyChanges(context, state);
+
+    // The rigid body stream counts against the budget. Always allow at least one entity through the generic sync,
+    // so that a saturated rigid body stream can not starve it completely.
+    size_t budget = tickBudget;
+    if (budget > 0)
+        budget = rigidBodyBytes < budget ? budget - rigidBodyBytes : 1;
+    ProcessSyncState(context, state, budget);
+}
 
-    const int maxMessageSizeBytes = 1400;
-    kNet::NetworkMessage *msg = destination->StartNewMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes);
-    msg->contentID = 0;
-    msg->inOrder = true;
-    msg->reliable = false;
-    kNet::DataSerializer ds(msg->data, maxMessageSizeBytes);
+/// An update for a single rigid body in the encoding of the original protocol takes at most this many bits. (conservative bound)
+static const int cMaxLegacyRigidBodyBits = 350;
+
+/// Writes the changed fields of a rigid body in the encoding of the original protocol, and records them as sent to ess.
+/** Returns false and writes nothing if none of the fields changed. The angular velocity is given in degrees per second. */
+static bool WriteLegacyRigidBodyChange(kNet::DataSerializer &ds, EntitySyncState &ess, const Transform &t, const float3 &linearVel, const float3 &angVel,
+    bool posChanged, bool rotChanged, bool scaleChanged, bool velChanged, bool angVelChanged)
+{
+    // Detect whether to send compact or full states for each variable.
+    // 0 - don't send, 1 - send compact, 2 - send full.
+    int posSendType = posChanged ? (t.pos.Abs().MaxElement() >= 1023.f ? 2 : 1) : 0;
+    int rotSendType;
+    int scaleSendType;
+    int velSendType;
+    int angVelSendType;
+
+    float3x3 rot;
+    if (rotChanged)
+    {
+        rot = t.Orientation3x3();
+        float3 fwd = rot.Col(2);
+        float3 up = rot.Col(1);
+        float3 planeNormal = float3::unitY.Cross(rot.Col(2));
+        float d = planeNormal.Dot(rot.Col(1));
+
+        if (up.Dot(float3::unitY) >= 0.999f)
+            rotSendType = 1; // Looking upright, 1 DOF.
+        else if (Abs(d) <= 0.001f && Abs(fwd.Dot(float3::unitY)) < 0.95f && up.Dot(float3::unitY) > 0.f)
+            rotSendType = 2; // No roll, i.e. 2 DOF. Use this only if not looking too close towards the +Y axis, due to precision issues, and only when object +Y is towards world up.
+        else
+            rotSendType = 3; // Full 3 DOF
+    }
+    else
+        rotSendType = 0;
+
+    if (scaleChanged)
+    {
+        float3 s = t.scale.Abs();
+        scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
+    }
+    else
+        scaleSendType = 0;
+
+    velSendType = velChanged ? (linearVel.LengthSq() >= 64.f ? 2 : 1) : 0;
+    angVelSendType = angVelChanged ? 1 : 0;
+
+    if (posSendType == 0 && rotSendType == 0 && scaleSendType == 0 && velSendType == 0 && angVelSendType == 0)
+        return false;
+
+    ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
+
+    ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2); // Sends fixed 8 bits.
+    if (posSendType == 1) // Sends fixed 57 bits.
+    {
+        ds.AddSignedFixedPoint(11, 8, t.pos.x);
+        ds.AddSignedFixedPoint(11, 8, t.pos.y);
+        ds.AddSignedFixedPoint(11, 8, t.pos.z);
+    }
+    else if (posSendType == 2) // Sends fixed 96 bits.
+    {
+        ds.Add<float>(t.pos.x);
+        ds.Add<float>(t.pos.y);
+        ds.Add<float>(t.pos.z);
+    }
+
+    if (rotSendType == 1) // Orientation with 1 DOF, only yaw.
+    {
+        // The transform is looking straight forward, i.e. the +y vector of the transform local space points straight towards +y in world space.
+        // Therefore the forward vector has y == 0, so send (x,z) as a 2D vector.
+        ds.AddNormalizedVector2D(rot.Col(2).x, rot.Col(2).z, 8);  // Sends fixed 8 bits.
+    }
+    else if (rotSendType == 2) // Orientation with 2 DOF, yaw and pitch.
+    {
+        float3 forward = rot.Col(2);
+        forward.Normalize();
+        ds.AddNormalizedVector3D(forward.x, forward.y, forward.z, 9, 8); // Sends fixed 17 bits.
+    }
+    else if (rotSendType == 3) // Orientation with 3 DOF, full yaw, pitch and roll.
+    {
+        Quat o = t.Orientation();
+
+        float3 axis;
+        float angle;
+        o.ToAxisAngle(axis, angle);
+        if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
+        {
+            axis = -axis;
+            angle = 2.f * 3.141592654f - angle;
+        }
 
-    for(std::list<EntitySyncState*>::iterator iter = state->dirtyQueue.begin(); iter != state->dirtyQueue.end(); ++iter)
+        // Sends 10-31 bits.
+        u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
+        if (quantizedAngle != 0)
+            ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
+    }
+
+    if (scaleSendType == 1) // Sends fixed 32 bits.
+    {
+        ds.Add<float>(t.scale.x);
+    }
+    else if (scaleSendType == 2) // Sends fixed 96 bits.
     {
-        const int maxRigidBodyMessageSizeBits = 350; // An update for a single rigid body can take at most this many bits. (conservative bound)
-        // If we filled up this message, send it out and start crafting anothero one.
-        if (maxMessageSizeBytes * 8 - (int)ds.BitsFilled() <= maxRigidBodyMessageSizeBits)
+        ds.Add<float>(t.scale.x);
+        ds.Add<float>(t.scale.y);
+        ds.Add<float>(t.scale.z);
+    }
+
+    if (velSendType == 1) // Sends fixed 32 bits.
+        ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 3, 8);
+    else if (velSendType == 2) // Sends fixed 39 bits.
+        ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 10, 8);
+    if (velSendType != 0)
+        ess.linearVelocity = linearVel;
+
+    if (angVelSendType == 1)
+    {
+        // The original protocol sends the angular velocity in radians.
+        const float3 angVelRad = DegToRad(angVel);
+        Quat o = Quat::FromEulerZYX(angVelRad.z, angVelRad.y, angVelRad.x);
+
+        float3 axis;
+        float angle;
+        o.ToAxisAngle(axis, angle);
+        if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
         {
-            destination->EndAndQueueMessage(msg, ds.BytesFilled());
-            msg = destination->StartNewMessage(cRigidBodyUpdateMessage, maxMessageSizeBytes);
-            ds = kNet::DataSerializer(msg->data, maxMessageSizeBytes);
+            axis = -axis;
+            angle = 2.f * 3.141592654f - angle;
         }
+        // Sends at most 31 bits.
+        u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
+        if (quantizedAngle != 0)
+            ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
+
+        ess.angularVelocity = angVel;
+    }
+
+    if (posSendType != 0)
+        ess.transform.pos = t.pos;
+    if (rotSendType != 0)
+        ess.transform.rot = t.rot;
+    if (scaleSendType != 0)
+        ess.transform.scale = t.scale;
+    return true;
+}
+
+size_t SyncManager::ReplicateRigidBodyChanges(SyncContext& context, SceneSyncState* state)
+{
+    // Note: runs on the worker threads, so no profiling here.
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return 0;
+
+    // First collect the rigid body changes of the dirty entities. They are sent below when the entity is due for an update,
+    // and stay pending until then.
+    for(SyncQueue<EntitySyncState>::iterator iter = state->dirtyQueue.begin(); iter != state->dirtyQueue.end(); ++iter)
+    {
         EntitySyncState &ess = **iter;
 
         if (ess.isNew || ess.removed)
             continue; // Newly created and removed entities are handled through the traditional sync mechanism.
 
         EntityPtr e = scene->GetEntity(ess.id);
+        if (!e)
+            continue;
         shared_ptr<EC_Placeable> placeable = e->GetComponent<EC_Placeable>();
         if (!placeable.get())
             continue;
 
-        std::map<component_id_t, ComponentSyncState>::iterator placeableComp = ess.components.find(placeable->Id());
+        ComponentSyncState *placeableComp = ess.components.find(placeable->Id());
 
-        bool transformDirty = false;
-        if (placeableComp != ess.components.end())
+        u8 changes = 0;
+        if (placeableComp)
         {
-            ComponentSyncState &pss = placeableComp->second;
+            ComponentSyncState &pss = *placeableComp;
             if (!pss.isNew && !pss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
             {
-                transformDirty = (pss.dirtyAttributes[0] & 1) != 0; // The Transform of an EC_Placeable is the first attibute in the component.
+                if (pss.dirtyAttributes[0] & 1) // The Transform of an EC_Placeable is the first attibute in the component.
+                    changes |= EntitySyncState::TransformChanged;
                 pss.dirtyAttributes[0] &= ~1;
             }
         }
-        bool velocityDirty = false;
-        bool angularVelocityDirty = false;
         
         shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
         if (rigidBody)
         {
-            std::map<component_id_t, ComponentSyncState>::iterator rigidBodyComp = ess.components.find(rigidBody->Id());
-            if (rigidBodyComp != ess.components.end())
+            ComponentSyncState *rigidBodyComp = ess.components.find(rigidBody->Id());
+            if (rigidBodyComp)
             {
-                ComponentSyncState &rss = rigidBodyComp->second;
+                ComponentSyncState &rss = *rigidBodyComp;
                 if (!rss.isNew && !rss.removed) // Newly created and deleted components are handled through the traditional sync mechanism.
                 {
-                    velocityDirty = (rss.dirtyAttributes[1] & (1 << 5)) != 0;
-                    angularVelocityDirty = (rss.dirtyAttributes[1] & (1 << 6)) != 0;
+                    bool velocityDirty = (rss.dirtyAttributes[1] & (1 << 5)) != 0;
+                    bool angularVelocityDirty = (rss.dirtyAttributes[1] & (1 << 6)) != 0;
 
                     rss.dirtyAttributes[1] &= ~(1 << 5);
                     rss.dirtyAttributes[1] &= ~(1 << 6);
 
-                    velocityDirty = velocityDirty && (rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f);
-                    angularVelocityDirty = angularVelocityDirty && (rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f);
+                    if (velocityDirty && rigidBody->linearVelocity.Get().DistanceSq(ess.linearVelocity) >= 1e-2f)
+                        changes |= EntitySyncState::VelocityChanged;
+                    if (angularVelocityDirty && rigidBody->angularVelocity.Get().DistanceSq(ess.angularVelocity) >= 1e-1f)
+                        changes |= EntitySyncState::AngularVelocityChanged;
 
                     // If the object enters rest, force an update, and force the update to be sent as reliable, so that the client
                     // is guaranteed to receive the message, and will put the object to rest, instead of extrapolating it away indefinitely.
                     if (rigidBody->linearVelocity.Get().IsZero(1e-4f) && !ess.linearVelocity.IsZero(1e-4f))
-                    {
-                        velocityDirty = true;
-                        msg->reliable = true;
-                    }
+                        changes |= EntitySyncState::VelocityChanged | EntitySyncState::EnteredRest;
                     if (rigidBody->angularVelocity.Get().IsZero(1e-4f) && !ess.angularVelocity.IsZero(1e-4f))
-                    {
-                        angularVelocityDirty = true;
-                        msg->reliable = true;
-                    }
+                        changes |= EntitySyncState::AngularVelocityChanged | EntitySyncState::EnteredRest;
                 }
             }
         }
 
-        if (!transformDirty && !velocityDirty && !angularVelocityDirty)
+        if (!changes)
+            continue;
+        if (!ess.pendingRigidBodyChanges)
+            state->pendingRigidBodies.push_back(ess.id);
+        ess.pendingRigidBodyChanges |= changes;
+    }
+
+    size_t bytesQueued = 0;
+
+    const RigidBodyQuantization &profile = rigidBodyQuantization_;
+    RigidBodyStreamState &stream = state->rigidBodyStream;
+    const bool legacy = state->protocolVersion < cProtocolRigidBodyQuantization;
+    const int maxMessageSizeBytes = sizeof(context.rigidBodyBuffer);
+    // An update for a single rigid body takes at most this many bits: the entity ID, the baseline age and the state.
+    const int maxRigidBodyMessageSizeBits = legacy ? cMaxLegacyRigidBodyBits : 32 + 1 + 5 + profile.MaxStateBits();
+    bool reliable = false;
+    kNet::DataSerializer ds(context.rigidBodyBuffer, maxMessageSizeBytes);
+    RigidBodyStreamState::SentMessage *sentMessage = 0; // The message being crafted, started when the first rigid body is written to it.
+
+    // An entity ID can be listed twice if its sync state was recreated, so remove the duplicates.
+    std::vector<entity_id_t> &pending = context.pendingRigidBodies;
+    pending.swap(state->pendingRigidBodies);
+    state->pendingRigidBodies.clear();
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+    for(size_t i = 0; i < pending.size(); ++i)
+    {
+        EntitySyncState *essPtr = state->entities.find(pending[i]);
+        if (!essPtr)
+            continue;
+        EntitySyncState &ess = *essPtr;
+        const u8 changes = ess.pendingRigidBodyChanges;
+        ess.pendingRigidBodyChanges = 0;
+        if (!changes || ess.isNew || ess.removed)
             continue;
 
-        const Transform &t = placeable->transform.Get();
+        EntityPtr e = scene->GetEntity(ess.id);
+        shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
+        if (!placeable.get())
+            continue;
+        shared_ptr<EC_RigidBody> rigidBody = e->GetComponent<EC_RigidBody>();
 
-        float timeSinceLastSend = kNet::Clock::SecondsSinceF(ess.lastNetworkSendTime);
-        const float3 predictedClientSidePosition = ess.transform.pos + timeSinceLastSend * ess.linearVelocity;
-        float error = t.pos.DistanceSq(predictedClientSidePosition);
-        UNREFERENCED_PARAM(error)
-        // TEST: To have the server estimate how far the client has simulated, use this.
-//        bool posChanged = transformDirty && (timeSinceLastSend > 0.2f || t.pos.DistanceSq(/*ess.transform.pos*/ predictedClientSidePosition) > 5e-5f);
+        const Transform &t = placeable->transform.Get();
+        const bool transformDirty = (changes & EntitySyncState::TransformChanged) != 0;
         bool posChanged = transformDirty && t.pos.DistanceSq(ess.transform.pos) > 1e-3f;
         bool rotChanged = transformDirty && (t.rot.DistanceSq(ess.transform.rot) > 1e-1f);
         bool scaleChanged = transformDirty && (t.scale.DistanceSq(ess.transform.scale) > 1e-3f);
+        const bool velocityDirty = (changes & (EntitySyncState::VelocityChanged | EntitySyncState::AngularVelocityChanged)) != 0;
 
-        // Detect whether to send compact or full states for each variable.
-        // 0 - don't send, 1 - send compact, 2 - send full.
-        int posSendType = posChanged ? (t.pos.Abs().MaxElement() >= 1023.f ? 2 : 1) : 0;
-        int rotSendType;
-        int scaleSendType;
-        int velSendType;
-        int angVelSendType;
-
-        float3x3 rot;
-        if (rotChanged)
-        {
-            rot = t.Orientation3x3();
-            float3 fwd = rot.Col(2);
-            float3 up = rot.Col(1);
-            float3 planeNormal = float3::unitY.Cross(rot.Col(2));
-            float d = planeNormal.Dot(rot.Col(1));
+        if (!posChanged && !rotChanged && !scaleChanged && !velocityDirty)
+            continue;
 
-            if (up.Dot(float3::unitY) >= 0.999f)
-                rotSendType = 1; // Looking upright, 1 DOF.
-            else if (Abs(d) <= 0.001f && Abs(fwd.Dot(float3::unitY)) < 0.95f && up.Dot(float3::unitY) > 0.f)
-                rotSendType = 2; // No roll, i.e. 2 DOF. Use this only if not looking too close towards the +Y axis, due to precision issues, and only when object +Y is towards world up.
-            else
-                rotSendType = 3; // Full 3 DOF
-        }
-        else
-            rotSendType = 0;
+        const float3 &linearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
+        const float3 &angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero; // In degrees per second.
 
-        if (scaleChanged)
+        // Hold back the bodies that are not due for an update yet. A body entering rest is always sent right away.
+        const bool bodyReliable = (changes & EntitySyncState::EnteredRest) != 0;
+        if (!bodyReliable && rigidBodyMaxInterval_ > 0.f)
         {
-            float3 s = t.scale.Abs();
-            scaleSendType = (s.MaxElement() - s.MinElement() <= 1e-3f) ? 1 : 2; // Uniform scale only?
+            const float interval = RigidBodySendInterval(state, t.pos, linearVel, angVel, context.roundTripTime);
+            if (kNet::Clock::SecondsSinceF(ess.lastNetworkSendTime) + 0.5f * updatePeriod_ < interval)
+            {
+                ess.pendingRigidBodyChanges = changes;
+                state->pendingRigidBodies.push_back(ess.id);
+                continue;
+            }
         }
-        else
-            scaleSendType = 0;
 
-        const float3 &linearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-        const float3 angVel = rigidBody ? DegToRad(rigidBody->angularVelocity.Get()) : float3::zero;
+        if (legacy)
+        {
+            // The original protocol has no message header, so a message is started by the first rigid body written to it.
+            if (ds.BitsFilled() > 0 && maxMessageSizeBytes * 8 - (int)ds.BitsFilled() < maxRigidBodyMessageSizeBits)
+            {
+                bytesQueued += context.Queue(cRigidBodyUpdateMessage, reliable, true, context.rigidBodyBuffer, ds.BytesFilled(), true);
+                reliable = false;
+                ds = kNet::DataSerializer(context.rigidBodyBuffer, maxMessageSizeBytes);
+            }
 
-        velSendType = velocityDirty ? (linearVel.LengthSq() >= 64.f ? 2 : 1) : 0;
-        angVelSendType = angularVelocityDirty ? 1 : 0;
+            const size_t bitsStart = ds.BitsFilled();
+            if (!WriteLegacyRigidBodyChange(ds, ess, t, linearVel, angVel, posChanged, rotChanged, scaleChanged,
+                (changes & EntitySyncState::VelocityChanged) != 0, (changes & EntitySyncState::AngularVelocityChanged) != 0))
+                continue;
+            context.rigidBodyBits += ds.BitsFilled() - bitsStart;
+            ++context.rigidBodyCount;
 
-        if (posSendType == 0 && rotSendType == 0 && scaleSendType == 0 && velSendType == 0 && angVelSendType == 0)
+            reliable = reliable || bodyReliable;
+            ess.lastNetworkSendTime = kNet::Clock::Tick();
             continue;
-
-        int bitIdx = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitIdx)
-        ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
-
-        ds.AddArithmeticEncoded(8, posSendType, 3, rotSendType, 4, scaleSendType, 3, velSendType, 3, angVelSendType, 2); // Sends fixed 8 bits.
-        if (posSendType == 1) // Sends fixed 57 bits.
-        {
-            ds.AddSignedFixedPoint(11, 8, t.pos.x);
-            ds.AddSignedFixedPoint(11, 8, t.pos.y);
-            ds.AddSignedFixedPoint(11, 8, t.pos.z);
         }
-        else if (posSendType == 2) // Sends fixed 96 bits.
-        {
-            ds.Add<float>(t.pos.x);
-            ds.Add<float>(t.pos.y);
-            ds.Add<float>(t.pos.z);
-        }        
 
-        if (rotSendType == 1) // Orientation with 1 DOF, only yaw.
+        // The whole state of the body is sent. The fields that have not changed since the baseline cost a bit each.
+        QuantizedRigidBodyState quantized;
+        profile.Quantize(t.pos, t.Orientation(), t.scale, linearVel, angVel, quantized);
+
+        // If we filled up this message, send it out and start crafting another one.
+        if (sentMessage && maxMessageSizeBytes * 8 - (int)ds.BitsFilled() < maxRigidBodyMessageSizeBits)
         {
-            // The transform is looking straight forward, i.e. the +y vector of the transform local space points straight towards +y in world space.
-            // Therefore the forward vector has y == 0, so send (x,z) as a 2D vector.
-            ds.AddNormalizedVector2D(rot.Col(2).x, rot.Col(2).z, 8);  // Sends fixed 8 bits.
+            bytesQueued += context.Queue(cRigidBodyUpdateMessage, reliable, true, context.rigidBodyBuffer, ds.BytesFilled(), true);
+            reliable = false;
+            sentMessage = 0;
         }
-        else if (rotSendType == 2) // Orientation with 2 DOF, yaw and pitch.
+        if (!sentMessage)
         {
-            float3 forward = rot.Col(2);
-            forward.Normalize();
-            ds.AddNormalizedVector3D(forward.x, forward.y, forward.z, 9, 8); // Sends fixed 17 bits.
+            sentMessage = &stream.BeginMessage(stream.nextSeq++);
+            ds = kNet::DataSerializer(context.rigidBodyBuffer, maxMessageSizeBytes);
+            ds.Add<u16>(sentMessage->seq);
+            ds.Add<u8>(rigidBodyProfileId_);
         }
-        else if (rotSendType == 3) // Orientation with 3 DOF, full yaw, pitch and roll.
-        {
-            Quat o = t.Orientation();
 
-            float3 axis;
-            float angle;
-            o.ToAxisAngle(axis, angle);
-            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
-            {
-                axis = -axis;
-                angle = 2.f * 3.141592654f - angle;
-            }
+        // Delta encode against the latest state the client has acknowledged, if the client still remembers it.
+        const u16 baselineAge = (u16)(sentMessage->seq - ess.ackedRigidBodySeq);
+        const bool delta = ess.hasAckedRigidBody && baselineAge >= 1 && baselineAge <= RigidBodyStreamState::cHistorySize;
 
-            // Sends 10-31 bits.
-            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-            if (quantizedAngle != 0)
-                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
-        }
+        const size_t bitsStart = ds.BitsFilled();
+        ds.AddVLE<kNet::VLE8_16_32>(ess.id); // Sends max. 32 bits.
+        ds.Add<kNet::bit>(delta ? 1 : 0);
+        if (delta)
+            ds.AppendBits(baselineAge - 1, 5);
+        profile.Write(ds, quantized, delta ? &ess.ackedRigidBody : 0);
+        context.rigidBodyBits += ds.BitsFilled() - bitsStart;
+        ++context.rigidBodyCount;
+
+        sentMessage->bodies.push_back(std::make_pair(ess.id, quantized));
+        reliable = reliable || bodyReliable;
+
+        ess.transform = t;
+        ess.linearVelocity = linearVel;
+        ess.angularVelocity = angVel;
+        ess.lastNetworkSendTime = kNet::Clock::Tick();
+    }
+    pending.clear();
 
-        if (scaleSendType == 1) // Sends fixed 32 bytes.
-        {
-            ds.Add<float>(t.scale.x);
-        }
-        else if (scaleSendType == 2) // Sends fixed 96 bits.
-        {
-            ds.Add<float>(t.scale.x);
-            ds.Add<float>(t.scale.y);
-            ds.Add<float>(t.scale.z);
-        }
+    if (sentMessage || (legacy && ds.BytesFilled() > 0))
+        bytesQueued += context.Queue(cRigidBodyUpdateMessage, reliable, true, context.rigidBodyBuffer, ds.BytesFilled(), true);
+    return bytesQueued;
+}
 
-        if (velSendType == 1) // Sends fixed 32 bits.
-        {
-            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 3, 8);
-            ess.linearVelocity = linearVel;
-        }
-        else if (velSendType == 2) // Sends fixed 39 bits.
-        {
-            ds.AddVector3D(linearVel.x, linearVel.y, linearVel.z, 11, 10, 10, 8);
-            ess.linearVelocity = linearVel;
-        }
+/// Largest angle in radians that a rigid body may move between its updates as seen from the client, when the rigid body send rate is adaptive.
+static const float cMaxRigidBodyAngularError = 0.01f;
 
-        if (angVelSendType == 1)
-        {
-            Quat o = Quat::FromEulerZYX(angVel.z, angVel.y, angVel.x);
+float SyncManager::RigidBodySendInterval(const SceneSyncState* state, const float3 &pos, const float3 &linearVel, const float3 &angularVel, float roundTripTime) const
+{
+    // Without the client's camera position the distance is unknown, so send at the full rate.
+    if (rigidBodyMaxInterval_ <= updatePeriod_ || !state->locationInitialized)
+        return updatePeriod_;
+
+    // The client sees the body about half a round trip late already, so on a slow connection leave less room for the send interval.
+    const float maxInterval = std::max(updatePeriod_, rigidBodyMaxInterval_ - 0.5f * roundTripTime);
+
+    // Send often enough that the body moves at most a small angle as seen from the client between the updates.
+    // Rotation is weighted as if the body was one unit in size.
+    const float distance = pos.Distance(state->clientLocation);
+    const float speed = linearVel.Length() + DegToRad(angularVel.Length());
+    if (speed <= 1e-4f)
+        return maxInterval;
+    return std::min(std::max(cMaxRigidBodyAngularError * distance / speed, updatePeriod_), maxInterval);
+}
+
+void SyncManager::SendRigidBodyQuantization(kNet::MessageConnection* connection)
+{
+    if (!connection)
+        return;
+
+    const int maxMessageSizeBytes = 64;
+    char buffer[maxMessageSizeBytes];
+    kNet::DataSerializer ds(buffer, maxMessageSizeBytes);
+    ds.Add<u8>(rigidBodyProfileId_);
+    rigidBodyQuantization_.Serialize(ds);
+    QueueMessage(connection, cRigidBodyQuantizationMessage, true, true, ds);
+}
+
+void SyncManager::SendRigidBodyAck(kNet::MessageConnection* connection, SceneSyncState* state)
+{
+    RigidBodyStreamState &stream = state->rigidBodyStream;
+    if (!stream.ackPending)
+        return;
+
+    char buffer[8];
+    kNet::DataSerializer ds(buffer, sizeof(buffer));
+    ds.Add<u16>(stream.latestReceived);
+    ds.Add<u32>(stream.receivedMask);
+    // Unreliable, as the acknowledgement is repeated with the following ones, which tell the latest 33 received messages.
+    QueueMessage(connection, cRigidBodyAckMessage, false, false, ds);
+
+    stream.ackPending = false;
+    stream.PruneReceived();
+}
+
+void SyncManager::HandleRigidBodyQuantization(kNet::MessageConnection* source, const char* data, size_t numBytes)
+{
+    if (owner_->IsServer())
+    {
+        LogWarning("SyncManager: Received a rigid body quantization profile from a client, ignoring.");
+        return;
+    }
+
+    kNet::DataDeserializer dd(data, numBytes);
+    rigidBodyProfileId_ = dd.Read<u8>();
+    rigidBodyQuantization_.Deserialize(dd);
+    // The server forgets the acknowledged states when it changes the profile, so do the same.
+    server_syncstate_.ResetRigidBodyStream();
+}
+
+void SyncManager::HandleRigidBodyAck(kNet::MessageConnection* source, const char* data, size_t numBytes)
+{
+    SceneSyncState* state = GetSceneSyncState(source);
+    if (!state || !owner_->IsServer() || state->protocolVersion < cProtocolRigidBodyQuantization)
+        return;
 
-            float3 axis;
-            float angle;
-            o.ToAxisAngle(axis, angle);
-            if (angle >= 3.141592654f) // Remove the quaternion double cover representation by constraining angle to [0, pi].
+    kNet::DataDeserializer dd(data, numBytes);
+    const u16 latest = dd.Read<u16>();
+    const u32 mask = dd.Read<u32>();
+
+    RigidBodyStreamState &stream = state->rigidBodyStream;
+    for(int i = -1; i < 32; ++i)
+    {
+        if (i >= 0 && !(mask & (1u << i)))
+            continue;
+        const u16 seq = (u16)(latest - 1 - i);
+        RigidBodyStreamState::SentMessage &sent = stream.sent[seq % RigidBodyStreamState::cHistorySize];
+        if (!sent.pending || sent.seq != seq)
+            continue; // Already acknowledged, or too old to be remembered.
+
+        // The states in the message are now known to the client. Use them as baselines, unless newer ones are already acknowledged.
+        for(size_t j = 0; j < sent.bodies.size(); ++j)
+        {
+            EntitySyncState *ess = state->entities.find(sent.bodies[j].first);
+            if (ess && (!ess->hasAckedRigidBody || (s16)(seq - ess->ackedRigidBodySeq) > 0))
             {
-                axis = -axis;
-                angle = 2.f * 3.141592654f - angle;
+                ess->ackedRigidBody = sent.bodies[j].second;
+                ess->ackedRigidBodySeq = seq;
+                ess->hasAckedRigidBody = true;
             }
-             // Sends at most 31 bits.
-            u32 quantizedAngle = ds.AddQuantizedFloat(0, 3.141592654f, 10, angle);
-            if (quantizedAngle != 0)
-                ds.AddNormalizedVector3D(axis.x, axis.y, axis.z, 11, 10);
+        }
+        sent.pending = false;
+        sent.bodies.clear();
+    }
+}
+
+void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+{
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+
+    if (server_syncstate_.protocolVersion < cProtocolRigidBodyQuantization)
+    {
+        HandleLegacyRigidBodyChanges(packetId, data, numBytes);
+        return;
+    }
+
+    kNet::DataDeserializer dd(data, numBytes);
+    const u16 seq = dd.Read<u16>();
+    const u8 profileId = dd.Read<u8>();
+    if (profileId != rigidBodyProfileId_)
+        return; // Crafted with another profile than ours, so it can not be decoded. Do not acknowledge it, so that the server will not use it as a baseline.
+
+    RigidBodyStreamState &stream = server_syncstate_.rigidBodyStream;
+    const RigidBodyQuantization &profile = rigidBodyQuantization_;
+    bool allBaselinesFound = true;
 
-            ess.angularVelocity = angVel;
+    while(dd.BitsLeft() >= 9)
+    {
+        u32 entityID = dd.ReadVLE<kNet::VLE8_16_32>();
+        const bool delta = dd.Read<kNet::bit>() != 0;
+        const u16 baselineAge = delta ? (u16)(dd.ReadBits(5) + 1) : 0;
+
+        RigidBodyStreamState::ReceivedStates &received = stream.received[entityID];
+        const QuantizedRigidBodyState *baseline = delta ? received.Find((u16)(seq - baselineAge)) : 0;
+        QuantizedRigidBodyState quantized;
+        profile.Read(dd, delta, baseline, quantized);
+        if (delta && !baseline)
+        {
+            // The baseline has been forgotten, so the state can not be decoded. The server will send the body in full once the baseline is old enough.
+            allBaselinesFound = false;
+            continue;
         }
-        if (posSendType != 0)
-            ess.transform.pos = t.pos;
-        if (rotSendType != 0)
-            ess.transform.rot = t.rot;
-        if (scaleSendType != 0)
-            ess.transform.scale = t.scale;
+        received.Store(seq, quantized);
 
-//        std::cout << "pos: " << posSendType << ", rot: " << rotSendType << ", scale: " << scaleSendType << ", vel: " << velSendType << ", angvel: " << angVelSendType << std::endl;
+        EntityPtr e = scene->GetEntity(entityID);
+        if (!e) // Discard this message - we don't have the entity in our scene to which the message applies to.
+            continue;
+        shared_ptr<EC_Placeable> placeable = e->GetComponent<EC_Placeable>();
+        if (!placeable)
+            continue;
 
-        int bitsEnd = ds.BitsFilled();
-        UNREFERENCED_PARAM(bitsEnd)
-        ess.lastNetworkSendTime = kNet::Clock::Tick();
+        Transform t = placeable->transform.Get();
+        t.pos = profile.DequantizePosition(quantized);
+        t.SetOrientation(profile.DequantizeRotation(quantized));
+        t.scale = quantized.scale;
+        ApplyRigidBodyChange(e.get(), packetId, t, profile.DequantizeVelocity(quantized), profile.DequantizeAngularVelocity(quantized));
     }
-    if (ds.BytesFilled() > 0)
-        destination->EndAndQueueMessage(msg, ds.BytesFilled());
-    else
-        destination->FreeMessage(msg);
+
+    if (allBaselinesFound)
+        stream.MarkReceived(seq);
 }
 
-void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes)
+void SyncManager::HandleLegacyRigidBodyChanges(kNet::packet_id_t packetId, const char* data, size_t numBytes)
 {
     ScenePtr scene = scene_.lock();
     if (!scene)
@@ -1138,14 +1743,21 @@ void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::
         EntityPtr e = scene->GetEntity(entityID);
         shared_ptr<EC_Placeable> placeable = e ? e->GetComponent<EC_Placeable>() : shared_ptr<EC_Placeable>();
         shared_ptr<EC_RigidBody> rigidBody = e ? e->GetComponent<EC_RigidBody>() : shared_ptr<EC_RigidBody>();
-        Transform t = e ? placeable->transform.Get() : Transform();
 
+        // Only the changed fields are sent, the others keep the latest received values.
+        Transform t = placeable ? placeable->transform.Get() : Transform();
         float3 newLinearVel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-
-        // If the server omitted linear velocity, interpolate towards the last received linear velocity.
-        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = e ? server_syncstate_.entityInterpolations.find(entityID) : server_syncstate_.entityInterpolations.end();
-        if (iter != server_syncstate_.entityInterpolations.end())
-            newLinearVel = iter->second.interpEnd.vel;
+        float3 newAngVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
+        std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = server_syncstate_.entityInterpolations.find(entityID);
+        if (placeable && iter != server_syncstate_.entityInterpolations.end())
+        {
+            const RigidBodyInterpolationState::RigidBodyState &latest = iter->second.interpEnd;
+            t.pos = latest.pos;
+            t.SetOrientation(latest.rot);
+            t.scale = latest.scale;
+            newLinearVel = latest.vel;
+            newAngVel = latest.angVel;
+        }
 
         int posSendType;
         int rotSendType;
@@ -1179,15 +1791,13 @@ void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::
         {
             float3 forward;
             dd.ReadNormalizedVector3D(9, 8, forward.x, forward.y, forward.z);
-
             float3x3 orientation = float3x3::LookAt(float3::unitZ, forward, float3::unitY, float3::unitY);
             t.SetOrientation(orientation);
-
         }
         else if (rotSendType == 3)
         {
             // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
-	        u32 quantizedAngle = dd.ReadBits(10);
+            u32 quantizedAngle = dd.ReadBits(10);
             if (quantizedAngle != 0)
             {
                 float angle = quantizedAngle * 3.141592654f / (float)((1 << 10) - 1);
@@ -1213,8 +1823,6 @@ void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::
         else if (velSendType == 2)
             dd.ReadVector3D(11, 10, 10, 8, newLinearVel.x, newLinearVel.y, newLinearVel.z);
 
-        float3 newAngVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
-
         if (angVelSendType == 1)
         {
             // Read the quantized float manually, without a call to ReadQuantizedFloat, to be able to compare the quantized bit pattern.
@@ -1229,94 +1837,192 @@ void SyncManager::HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::
                 Swap(newAngVel.z, newAngVel.x);
                 newAngVel = RadToDeg(newAngVel);
             }
+            else
+                newAngVel = float3::zero;
         }
 
-        if (!e) // Discard this message - we don't have the entity in our scene to which the message applies to.
+        if (!placeable) // Discard this message - we don't have the entity in our scene to which the message applies to.
             continue;
 
         // Did anything change?
         if (posSendType != 0 || rotSendType != 0 || scaleSendType != 0 || velSendType != 0 || angVelSendType != 0)
+            ApplyRigidBodyChange(e.get(), packetId, t, newLinearVel, newAngVel);
+    }
+}
+
+void SyncManager::ApplyRigidBodyChange(Entity* entity, kNet::packet_id_t packetId, const Transform &t, const float3 &linearVel, const float3 &angularVel)
+{
+    const entity_id_t entityID = entity->Id();
+    shared_ptr<EC_Placeable> placeable = entity->GetComponent<EC_Placeable>();
+    shared_ptr<EC_RigidBody> rigidBody = entity->GetComponent<EC_RigidBody>();
+
+    // The server may send the entity less often than on every network update, so interpolate over the measured update interval.
+    float updateInterval = updatePeriod_;
+    EntitySyncState *entityState = server_syncstate_.entities.find(entityID);
+    if (entityState)
+    {
+        entityState->UpdateReceived(2.0f);
+        updateInterval = std::max(updateInterval, entityState->avgUpdateInterval);
+    }
+
+    // Create or update the interpolation state.
+    Transform orig = placeable->transform.Get();
+
+    std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = server_syncstate_.entityInterpolations.find(entityID);
+    if (iter != server_syncstate_.entityInterpolations.end())
+    {
+        RigidBodyInterpolationState &interp = iter->second;
+
+        if (kNet::PacketIDIsNewerThan(interp.lastReceivedPacketCounter, packetId))
+            return; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
+        interp.lastReceivedPacketCounter = packetId;
+
+        const float interpPeriod = interp.interpPeriod; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
+        float3 curVel;
+
+        if (interp.interpTime < 1.0f)
+            curVel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel*interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel*interpPeriod, interp.interpTime);
+        else
+            curVel = interp.interpEnd.vel;
+        float3 curAngVel = float3::zero; ///\todo
+        interp.interpStart.pos = orig.pos;
+        interp.interpEnd.pos = t.pos;
+        interp.interpStart.rot = orig.Orientation();
+        interp.interpEnd.rot = t.Orientation();
+        interp.interpStart.scale = orig.scale;
+        interp.interpEnd.scale = t.scale;
+        interp.interpStart.vel = curVel;
+        interp.interpEnd.vel = linearVel;
+        interp.interpStart.angVel = curAngVel;
+        interp.interpEnd.angVel = angularVel;
+        interp.interpTime = 0.f;
+        interp.interpPeriod = updateInterval;
+        interp.interpolatorActive = true;
+
+        // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
+        const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
+        if (!isNewtonian)
+            interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
+    }
+    else
+    {
+        RigidBodyInterpolationState interp;
+        interp.interpStart.pos = orig.pos;
+        interp.interpEnd.pos = t.pos;
+        interp.interpStart.rot = orig.Orientation();
+        interp.interpEnd.rot = t.Orientation();
+        interp.interpStart.scale = orig.scale;
+        interp.interpEnd.scale = t.scale;
+        interp.interpStart.vel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
+        interp.interpEnd.vel = linearVel;
+        interp.interpStart.angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
+        interp.interpEnd.angVel = angularVel;
+        interp.interpTime = 0.f;
+        interp.interpPeriod = updateInterval;
+        interp.lastReceivedPacketCounter = packetId;
+        interp.interpolatorActive = true;
+        server_syncstate_.entityInterpolations[entityID] = interp;
+    }
+}
+
+void SyncManager::FlushRelevantDeferredEntities(const UserConnectionPtr &user)
+{
+    SceneSyncState *state = user->syncState.get();
+    if (state->deferredEntities.empty())
+        return;
+
+    PROFILE(SyncManager_FlushRelevantDeferredEntities);
+
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
+
+    const bool headless = framework_->IsHeadless();
+    std::vector<entity_id_t> relevantIds;
+    for(std::map<entity_id_t, DeferredComponentMap>::iterator iter = state->deferredEntities.begin(); iter != state->deferredEntities.end();)
+    {
+        EntityPtr entity = scene->GetEntity(iter->first);
+        if (!entity) // The entity is gone, there is nothing to send anymore.
         {
-            // Create or update the interpolation state.
-            Transform orig = placeable->transform.Get();
+            state->deferredEntities.erase(iter++);
+            continue;
+        }
+        if (interestmanager_->CheckRelevance(user, entity.get(), scene_, headless))
+            relevantIds.push_back(iter->first);
+        ++iter;
+    }
 
-            std::map<entity_id_t, RigidBodyInterpolationState>::iterator iter = server_syncstate_.entityInterpolations.find(entityID);
-            if (iter != server_syncstate_.entityInterpolations.end())
-            {
-                RigidBodyInterpolationState &interp = iter->second;
+    for(size_t i = 0; i < relevantIds.size(); ++i)
+        state->FlushDeferredEntity(relevantIds[i]);
+}
+
+/// Sorts entity sync states to descending send priority.
+static bool EntitySyncStatePriorityGreater(const EntitySyncState *lhs, const EntitySyncState *rhs)
+{
+    return lhs->priority > rhs->priority;
+}
 
-                if (kNet::PacketIDIsNewerThan(interp.lastReceivedPacketCounter, packetId))
-                    continue; // This is an out-of-order received packet. Ignore it. (latest-data-guarantee)
-                interp.lastReceivedPacketCounter = packetId;
+void SyncManager::PrioritizeSyncState(SceneSyncState* state)
+{
+    PROFILE(SyncManager_PrioritizeSyncState);
 
-                const float interpPeriod = updatePeriod_; // Time in seconds how long interpolating the Hermite spline from [0,1] should take.
-                float3 curVel;
+    ScenePtr scene = scene_.lock();
+    if (!scene)
+        return;
 
-                if (interp.interpTime < 1.0f)
-                    curVel = HermiteDerivative(interp.interpStart.pos, interp.interpStart.vel*interpPeriod, interp.interpEnd.pos, interp.interpEnd.vel*interpPeriod, interp.interpTime);
-                else
-                    curVel = interp.interpEnd.vel;
-                float3 curAngVel = float3::zero; ///\todo
-                interp.interpStart.pos = orig.pos;
-                if (posSendType != 0)
-                    interp.interpEnd.pos = t.pos;
-                interp.interpStart.rot = orig.Orientation();
-                if (rotSendType != 0)
-                    interp.interpEnd.rot = t.Orientation();
-                interp.interpStart.scale = orig.scale;
-                if (scaleSendType != 0)
-                    interp.interpEnd.scale = t.scale;
-                interp.interpStart.vel = curVel;
-                if (velSendType != 0)
-                    interp.interpEnd.vel = newLinearVel;
-                interp.interpStart.angVel = curAngVel;
-                if (angVelSendType != 0)
-                    interp.interpEnd.angVel = newAngVel;
-                interp.interpTime = 0.f;
-                interp.interpolatorActive = true;
-
-                // Objects without a rigidbody, or with mass 0 never extrapolate (objects with mass 0 are stationary for Bullet).
-                const bool isNewtonian = rigidBody && rigidBody->mass.Get() > 0;
-                if (!isNewtonian)
-                    interp.interpStart.vel = interp.interpEnd.vel = float3::zero;
-            }
-            else
-            {
-                RigidBodyInterpolationState interp;
-                interp.interpStart.pos = orig.pos;
-                interp.interpEnd.pos = t.pos;
-                interp.interpStart.rot = orig.Orientation();
-                interp.interpEnd.rot = t.Orientation();
-                interp.interpStart.scale = orig.scale;
-                interp.interpEnd.scale = t.scale;
-                interp.interpStart.vel = rigidBody ? rigidBody->linearVelocity.Get() : float3::zero;
-                interp.interpEnd.vel = newLinearVel;
-                interp.interpStart.angVel = rigidBody ? rigidBody->angularVelocity.Get() : float3::zero;
-                interp.interpEnd.angVel = newAngVel;
-                interp.interpTime = 0.f;
-                interp.lastReceivedPacketCounter = packetId;
-                interp.interpolatorActive = true;
-                server_syncstate_.entityInterpolations[entityID] = interp;
-            }
+    // Distance in world units at which the priority of an entity has dropped to half.
+    const float halfPriorityDistance = 20.f;
+    const bool hasClientLocation = state->locationInitialized && state->clientLocation.IsFinite();
+
+    for(SyncQueue<EntitySyncState>::iterator iter = state->dirtyQueue.begin(); iter != state->dirtyQueue.end(); ++iter)
+    {
+        EntitySyncState &ess = **iter;
+        // Removals are small and must not linger behind a re-creation of the same ID, so always send them first.
+        if (ess.removed)
+        {
+            ess.priority = FLT_MAX;
+            continue;
         }
+
+        // Waiting time is the base of the priority, so that everything gets eventually sent even on a saturated connection.
+        float priority = updatePeriod_ + kNet::Clock::SecondsSinceF(ess.lastSyncTime);
+
+        if (hasClientLocation)
+        {
+            EntityPtr entity = scene->GetEntity(ess.id);
+            EC_Placeable *placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+            if (placeable)
+                priority *= halfPriorityDistance / (halfPriorityDistance + placeable->WorldPosition().Distance(state->clientLocation));
+        }
+
+        // Entities the interest manager considers less relevant get at most half less priority.
+        priority *= 0.5f + 0.5f * Clamp01(state->interest.RelevanceFactor(ess.id));
+
+        ess.priority = priority;
     }
+
+    state->dirtyQueue.sort(EntitySyncStatePriorityGreater);
 }
 
-void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state)
+void SyncManager::ProcessSyncState(SyncContext& context, SceneSyncState* state, size_t maxBytes)
 {
-    PROFILE(SyncManager_ProcessSyncState);
+    // Note: runs on the worker threads, so no profiling here, and log messages go through the context.
     
     unsigned sceneId = 0; ///\todo Replace with proper scene ID once multiscene support is in place.
     
     ScenePtr scene = scene_.lock();
     int numMessagesSent = 0;
+    size_t bytesSent = 0;
     bool isServer = owner_->IsServer();
     UNREFERENCED_PARAM(isServer)
     
-    // Process the state's dirty entity queue.
-    /// \todo Limit and prioritize the data sent. For now the whole queue is processed, regardless of whether the connection is being saturated.
+    // Process the state's dirty entity queue. If the byte budget runs out, the remaining entities stay dirty
+    // in the queue and are processed on the next tick.
     while (!state->dirtyQueue.empty())
     {
+        if (maxBytes > 0 && bytesSent >= maxBytes)
+            break;
+
         EntitySyncState& entityState = *state->dirtyQueue.front();
         state->dirtyQueue.pop_front();
         entityState.isInQueue = false;
@@ -1326,7 +2032,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
         if (!entity)
         {
             if (!entityState.removed)
-                LogWarning("Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state");
+                context.LogWarning("Entity " + QString::number(entityState.id) + " has gone missing from the scene without the remove properly signalled. Removing from replication state");
             entityState.isNew = false;
             removeState = true;
         }
@@ -1343,7 +2049,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             // If we have both new & removed flags on the entity, it will probably result in buggy behaviour
             if (entityState.isNew)
             {
-                LogWarning("Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!");
+                context.LogWarning("Entity " + QString::number(entityState.id) + " queued for both deletion and creation. Buggy behaviour will possibly result!");
                 // The delete has been processed. Do not remember it anymore, but requeue the state for creation
                 entityState.removed = false;
                 removeState = false;
@@ -1353,16 +2059,16 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             else
                 removeState = true;
             
-            kNet::DataSerializer ds(removeEntityBuffer_, 1024);
+            kNet::DataSerializer ds(context.removeEntityBuffer, 1024);
             ds.AddVLE<kNet::VLE8_16_32>(sceneId);
             ds.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
-            QueueMessage(destination, cRemoveEntityMessage, true, true, ds);
+            bytesSent += context.Queue(cRemoveEntityMessage, true, true, ds.GetData(), ds.BytesFilled());
             ++numMessagesSent;
         }
         // New entity
         else if (entityState.isNew)
         {
-            kNet::DataSerializer ds(createEntityBuffer_, 64 * 1024);
+            kNet::DataSerializer ds(context.createEntityBuffer, 64 * 1024);
             
             // Entity identification and temporary flag
             ds.AddVLE<kNet::VLE8_16_32>(sceneId);
@@ -1386,12 +2092,12 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 ComponentPtr comp = i->second;
                 if (!comp->IsReplicated())
                     continue;
-                WriteComponentFullUpdate(ds, comp);
+                WriteCachedComponentFullUpdate(ds, comp, context);
                 // Mark the component undirty in the receiver's syncstate
                 state->MarkComponentProcessed(entity->Id(), comp->Id());
             }
             
-            QueueMessage(destination, cCreateEntityMessage, true, true, ds);
+            bytesSent += context.Queue(cCreateEntityMessage, true, true, ds.GetData(), ds.BytesFilled());
             ++numMessagesSent;
             
             // The create has been processed fully. Clear dirty flags.
@@ -1400,11 +2106,11 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
         else if (entity)
         {
             // Components or attributes have been added, changed, or removed. Prepare the dataserializers
-            kNet::DataSerializer removeCompsDs(removeCompsBuffer_, 1024);
-            kNet::DataSerializer removeAttrsDs(removeAttrsBuffer_, 1024);
-            kNet::DataSerializer createCompsDs(createCompsBuffer_, 64 * 1024);
-            kNet::DataSerializer createAttrsDs(createAttrsBuffer_, 16 * 1024);
-            kNet::DataSerializer editAttrsDs(editAttrsBuffer_, 64 * 1024);
+            kNet::DataSerializer removeCompsDs(context.removeCompsBuffer, 1024);
+            kNet::DataSerializer removeAttrsDs(context.removeAttrsBuffer, 1024);
+            kNet::DataSerializer createCompsDs(context.createCompsBuffer, 64 * 1024);
+            kNet::DataSerializer createAttrsDs(context.createAttrsBuffer, 16 * 1024);
+            kNet::DataSerializer editAttrsDs(context.editAttrsBuffer, 64 * 1024);
             
             while (!entityState.dirtyQueue.empty())
             {
@@ -1417,7 +2123,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 if (!comp)
                 {
                     if (!compState.removed)
-                        LogWarning("Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->");
+                        context.LogWarning("Component " + QString::number(compState.id) + " of " + entity->ToString() + " has gone missing from the scene without the remove properly signalled. Removing from client replication state->");
                     compState.isNew = false;
                     removeCompState = true;
                 }
@@ -1452,7 +2158,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                         createCompsDs.AddVLE<kNet::VLE8_16_32>(entityState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                     }
                     // Then add the component data
-                    WriteComponentFullUpdate(createCompsDs, comp);
+                    WriteCachedComponentFullUpdate(createCompsDs, comp, context);
                     // Mark the component undirty in the receiver's syncstate
                     state->MarkComponentProcessed(entity->Id(), comp->Id());
                 }
@@ -1471,9 +2177,9 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                         {
                             // Create attribute. Make sure it exists and is dynamic.
                             if (attrIndex >= attrs.size() || !attrs[attrIndex])
-                                LogError("CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                context.LogError("CreateAttribute for nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                             else if (!attrs[attrIndex]->IsDynamic())
-                                LogError("CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                context.LogError("CreateAttribute for a static attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                             else
                             {
                                 // If first attribute, write the entity ID first
@@ -1507,7 +2213,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                     compState.newAndRemovedAttributes.clear();
                     
                     // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
-                    changedAttributes_.clear();
+                    context.changedAttributes.clear();
                     unsigned numBytes = (attrs.size() + 7) >> 3;
                     for (unsigned i = 0; i < numBytes; ++i)
                     {
@@ -1520,14 +2226,14 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                                 {
                                     u8 attrIndex = i * 8 + j;
                                     if (attrIndex < attrs.size() && attrs[attrIndex])
-                                        changedAttributes_.push_back(attrIndex);
+                                        context.changedAttributes.push_back(attrIndex);
                                     else
-                                        LogError("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
+                                        context.LogError("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 }
                             }
                         }
                     }
-                    if (changedAttributes_.size())
+                    if (context.changedAttributes.size())
                     {
                         // If first component for which attribute changes are sent, write the entity ID first
                         if (!editAttrsDs.BytesFilled())
@@ -1537,42 +2243,13 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                         }
                         editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                         
-                        // Create a nested dataserializer for the actual attribute data, so we can skip components
-                        kNet::DataSerializer attrDataDs(attrDataBuffer_, 16 * 1024);
-                        
-                        // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                        unsigned bitsMethod1 = changedAttributes_.size() * 8 + 8;
-                        unsigned bitsMethod2 = attrs.size();
-                        // Method 1: indices
-                        if (bitsMethod1 <= bitsMethod2)
-                        {
-                            attrDataDs.Add<kNet::bit>(0);
-                            attrDataDs.Add<u8>(changedAttributes_.size());
-                            for (unsigned i = 0; i < changedAttributes_.size(); ++i)
-                            {
-                                attrDataDs.Add<u8>(changedAttributes_[i]);
-                                attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
-                            }
-                        }
-                        // Method 2: bitmask
-                        else
-                        {
-                            attrDataDs.Add<kNet::bit>(1);
-                            for (unsigned i = 0; i < attrs.size(); ++i)
-                            {
-                                if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
-                                {
-                                    attrDataDs.Add<kNet::bit>(1);
-                                    attrs[i]->ToBinary(attrDataDs);
-                                }
-                                else
-                                    attrDataDs.Add<kNet::bit>(0);
-                            }
-                        }
+                        // The actual attribute data is a nested array, so we can skip components.
+                        // Clients with the same dirty attributes share the data serialized for the first of them this tick.
+                        QByteArray attrData = EditAttributesData(comp.get(), compState.dirtyAttributes, context.changedAttributes, context);
                         
                         // Add the attribute data array to the main serializer
-                        editAttrsDs.AddVLE<kNet::VLE8_16_32>(attrDataDs.BytesFilled());
-                        editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, attrDataDs.BytesFilled());
+                        editAttrsDs.AddVLE<kNet::VLE8_16_32>(attrData.size());
+                        editAttrsDs.AddArray<u8>((const unsigned char*)attrData.constData(), attrData.size());
                         
                         // Now zero out all remaining dirty bits
                         for (unsigned i = 0; i < numBytes; ++i)
@@ -1587,27 +2264,27 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             // Send the messages which have data
             if (removeCompsDs.BytesFilled())
             {
-                QueueMessage(destination, cRemoveComponentsMessage, true, true, removeCompsDs);
+                bytesSent += context.Queue(cRemoveComponentsMessage, true, true, removeCompsDs.GetData(), removeCompsDs.BytesFilled());
                 ++numMessagesSent;
             }
             if (removeAttrsDs.BytesFilled())
             {
-                QueueMessage(destination, cRemoveAttributesMessage, true, true, removeAttrsDs);
+                bytesSent += context.Queue(cRemoveAttributesMessage, true, true, removeAttrsDs.GetData(), removeAttrsDs.BytesFilled());
                 ++numMessagesSent;
             }
             if (createCompsDs.BytesFilled())
             {
-                QueueMessage(destination, cCreateComponentsMessage, true, true, createCompsDs);
+                bytesSent += context.Queue(cCreateComponentsMessage, true, true, createCompsDs.GetData(), createCompsDs.BytesFilled());
                 ++numMessagesSent;
             }
             if (createAttrsDs.BytesFilled())
             {
-                QueueMessage(destination, cCreateAttributesMessage, true, true, createAttrsDs);
+                bytesSent += context.Queue(cCreateAttributesMessage, true, true, createAttrsDs.GetData(), createAttrsDs.BytesFilled());
                 ++numMessagesSent;
             }
             if (editAttrsDs.BytesFilled())
             {
-                QueueMessage(destination, cEditAttributesMessage, true, true, editAttrsDs);
+                bytesSent += context.Queue(cEditAttributesMessage, true, true, editAttrsDs.GetData(), editAttrsDs.BytesFilled());
                 ++numMessagesSent;
             }
             
@@ -1827,6 +2504,8 @@ void SyncManager::HandleCreateEntity(kNet::MessageConnection* source, const char
     const Entity::ComponentMap &components = entity->Components();
     for (Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
         i->second->ComponentChanged(change);
+    // Mark the changes dirty now, so that marking the entity processed below clears them.
+    ProcessAttributeChanges();
     
     // Send CreateEntityReply (server only)
     if (isServer)
@@ -2082,10 +2761,11 @@ void SyncManager::HandleRemoveComponents(kNet::MessageConnection* source, const
         }
         entity->RemoveComponent(comp, change);
         // Delete from the sender's syncstate, so that we don't echo the delete back needlessly
-        if (state->entities.find(entityID) != state->entities.end())
+        EntitySyncState *entityState = state->entities.find(entityID);
+        if (entityState)
         {
-            state->entities[entityID].RemoveFromQueue(compID); // Be sure to erase from dirty queue so that we don't invoke UDB
-            state->entities[entityID].components.erase(compID);
+            entityState->RemoveFromQueue(compID); // Be sure to erase from dirty queue so that we don't invoke UDB
+            entityState->components.erase(compID);
         }
     }
 }
@@ -2174,11 +2854,13 @@ void SyncManager::HandleCreateAttributes(kNet::MessageConnection* source, const
     }
     
     // Signal attribute changes after creating and reading all
+    for (unsigned i = 0; i < addedAttrs.size(); ++i)
+        addedAttrs[i]->Owner()->EmitAttributeChanged(addedAttrs[i], change);
+    ProcessAttributeChanges();
     for (unsigned i = 0; i < addedAttrs.size(); ++i)
     {
         IComponent* owner = addedAttrs[i]->Owner();
         u8 attrIndex = addedAttrs[i]->Index();
-        owner->EmitAttributeChanged(addedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
         state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
@@ -2276,12 +2958,12 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
     
     // Record the update time for calculating the update interval
     float updateInterval = updatePeriod_; // Default update interval if state not found or interval not measured yet
-    std::map<entity_id_t, EntitySyncState>::iterator it = state->entities.find(entityID);
-    if (it != state->entities.end())
+    EntitySyncState *entityState = state->entities.find(entityID);
+    if (entityState)
     {
-        it->second.UpdateReceived();
-        if (it->second.avgUpdateInterval > 0.0f)
-            updateInterval = it->second.avgUpdateInterval;
+        entityState->UpdateReceived();
+        if (entityState->avgUpdateInterval > 0.0f)
+            updateInterval = entityState->avgUpdateInterval;
     }
     // Add a fudge factor in case there is jitter in packet receipt or the server is too taxed
     updateInterval *= 1.25f;
@@ -2372,11 +3054,13 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
     }
     
     // Signal attribute changes after reading all
+    for (unsigned i = 0; i < changedAttrs.size(); ++i)
+        changedAttrs[i]->Owner()->EmitAttributeChanged(changedAttrs[i], change);
+    ProcessAttributeChanges();
     for (unsigned i = 0; i < changedAttrs.size(); ++i)
     {
         IComponent* owner = changedAttrs[i]->Owner();
         u8 attrIndex = changedAttrs[i]->Index();
-        owner->EmitAttributeChanged(changedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
         state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
     }
@@ -2406,15 +3090,14 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
     entity_id_t senderEntityID = ds.ReadVLE<kNet::VLE8_16_32>() | UniqueIdGenerator::FIRST_UNACKED_ID;
     entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
     scene->ChangeEntityId(senderEntityID, entityID);
-    state->RemoveFromQueue(senderEntityID); // Make sure we don't have stale pointers in the dirty queue
-    state->entities[entityID] = state->entities[senderEntityID]; // Copy the sync state to the new ID
-    state->entities[entityID].id = entityID; // Must remember to change ID manually
-    state->entities.erase(senderEntityID);
+    // Make sure we don't have stale pointers in the dirty queue. A state already at the new ID is replaced by the rekey.
+    state->RemoveFromQueue(senderEntityID);
+    state->RemoveFromQueue(entityID);
+    EntitySyncState& entityState = state->entities.rekey(senderEntityID, entityID); // Move the sync state to the new ID
+    entityState.id = entityID; // Must remember to change ID manually
     
     //std::cout << "CreateEntityReply, entity " << senderEntityID << " -> " << entityID << std::endl;
     
-    EntitySyncState& entityState = state->entities[entityID];
-    
     EntityPtr entity = scene->GetEntity(entityID);
     if (!entity)
     {
@@ -2431,9 +3114,10 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
         //std::cout << "CreateEntityReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        // Unlink both states from the entity's dirty queue, as the rekey moves one and destroys the other
+        entityState.RemoveFromQueue(senderCompID);
+        entityState.RemoveFromQueue(compID);
+        entityState.components.rekey(senderCompID, compID).id = compID; // Move the sync state to the new ID, and remember to change ID manually
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
@@ -2443,10 +3127,10 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
     // Send notification
     scene->EmitEntityAcked(entity.get(), senderEntityID);
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (SyncStateMap<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, i.key());
     }
 }
 
@@ -2491,19 +3175,20 @@ void SyncManager::HandleCreateComponentsReply(kNet::MessageConnection* source, c
         //std::cout << "CreateComponentReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        // Unlink both states from the entity's dirty queue, as the rekey moves one and destroys the other
+        entityState.RemoveFromQueue(senderCompID);
+        entityState.RemoveFromQueue(compID);
+        entityState.components.rekey(senderCompID, compID).id = compID; // Move the sync state to the new ID, and remember to change ID manually
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
         scene->EmitComponentAcked(comp, senderCompID);
     }
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (SyncStateMap<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, i.key());
     }
 }
 
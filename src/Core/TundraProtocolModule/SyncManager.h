@@ -16,11 +16,72 @@
 #include <kNet/Types.h>
 
 #include <QObject>
+#include <QHash>
+#include <QPair>
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+
+class QThreadPool;
 
 class Framework;
 
 namespace TundraLogic
 {
+/// Scratch buffers and crafted messages of one connection's network update tick.
+/** On the server the per-client work of the tick runs concurrently on worker threads, so each connection processed
+    in parallel needs its own buffers. The messages and log output are handed to kNet and the console on the main thread. */
+struct SyncContext
+{
+    SyncContext() : roundTripTime(0.f), rigidBodyBits(0), rigidBodyCount(0) {}
+
+    /// A message crafted during the tick, waiting to be queued to the connection.
+    struct OutgoingMessage
+    {
+        kNet::message_id_t id;
+        bool reliable;
+        bool inOrder;
+        bool defaultPriority; ///< Keep the priority kNet gives to new messages, instead of the fixed scene sync priority
+        size_t offset; ///< Offset of the message data in messageData
+        size_t size;
+    };
+
+    /// Append a message to be queued at the end of the tick. Returns the number of bytes queued.
+    size_t Queue(kNet::message_id_t id, bool reliable, bool inOrder, const char* data, size_t size, bool defaultPriority = false)
+    {
+        OutgoingMessage msg = { id, reliable, inOrder, defaultPriority, messageData.size(), size };
+        messageData.insert(messageData.end(), data, data + size);
+        messages.push_back(msg);
+        return size;
+    }
+
+    /// Remember a log message to be printed at the end of the tick.
+    void LogWarning(const QString &msg) { log.push_back(std::make_pair(false, msg)); }
+    void LogError(const QString &msg) { log.push_back(std::make_pair(true, msg)); }
+
+    char createEntityBuffer[64 * 1024];
+    char createCompsBuffer[64 * 1024];
+    char editAttrsBuffer[64 * 1024];
+    char createAttrsBuffer[16 * 1024];
+    char attrDataBuffer[16 * 1024];
+    char cachedDataBuffer[64 * 1024];
+    char rigidBodyBuffer[1400];
+    char removeCompsBuffer[1024];
+    char removeEntityBuffer[1024];
+    char removeAttrsBuffer[1024];
+    std::vector<u8> changedAttributes;
+    std::vector<entity_id_t> pendingRigidBodies;
+
+    float roundTripTime; ///< Round trip time of the connection in seconds, measured before the tick
+
+    size_t rigidBodyBits; ///< Bits spent on the rigid bodies sent during the tick, excluding the message headers
+    size_t rigidBodyCount; ///< Number of rigid bodies sent during the tick
+
+    std::vector<OutgoingMessage> messages;
+    std::vector<char> messageData;
+    std::vector<std::pair<bool, QString> > log; ///< Log messages, true for errors
+};
+
 /// Performs synchronization of the changes in a scene between the server and the client.
 /** SyncManager and SceneSyncState combined can be used to implement prioritization logic on how and when
     a sync state is filled per client connection. SyncManager object is only exposed to scripting on the server. */
@@ -41,11 +102,24 @@ public:
     /// Create new replication state for user and dirty it (server operation only)
     void NewUserConnected(const UserConnectionPtr &user);
 
-    /// Get and Set the IM
+    /// Returns the IM, creating it if it does not exist yet.
     InterestManager* GetInterestManager();
 
+    /// Sets the IM. SyncManager takes ownership of the IM and deletes the previous one. Pass null to disable interest management.
     void SetInterestManager(InterestManager* im);
 
+    /// Sets the quantization profile of the rigid body stream of the scene (server only).
+    /** The profile is sent to all connected clients, and the following rigid body updates are sent in full until the clients
+        acknowledge them. The profile is reset to the default when a new scene is registered. */
+    void SetRigidBodyQuantization(const RigidBodyQuantization &profile);
+
+    /// Returns the quantization profile of the rigid body stream. On the client, this is the profile received from the server.
+    const RigidBodyQuantization &GetRigidBodyQuantization() const { return rigidBodyQuantization_; }
+
+    /// Sets the protocol version negotiated with the server at login (client only).
+    /** Servers of the original protocol send the rigid body changes in the original encoding, and take no acknowledgements. */
+    void SetServerProtocolVersion(u32 version);
+
 public slots:
     /// Set update period (seconds)
     void SetUpdatePeriod(float period);
@@ -53,6 +127,34 @@ public slots:
     /// Get update period
     float GetUpdatePeriod() const { return updatePeriod_; }
 
+    /// Set the maximum amount of scene sync data sent to each client per second (server only).
+    /** Entities that do not fit into the per-tick budget stay dirty and are sent on a later tick, highest priority first.
+        @param bytesPerSecond Bandwidth budget per client connection in bytes, or 0 for unlimited (default). */
+    void SetMaxBytesPerSecond(int bytesPerSecond);
+
+    /// Returns the maximum amount of scene sync data sent to each client per second, 0 if unlimited.
+    int MaxBytesPerSecond() const { return maxBytesPerSecond_; }
+
+    /// Sets the longest interval at which a rigid body changing on the server is sent to a client (server only).
+    /** When set, the rigid bodies are sent at a per-client rate adapted to their distance from the client's camera
+        and their speed, so that the far and slow ones are sent less often. The rigid bodies near the client and the ones
+        entering rest are still sent on every network update. The round trip time of the client counts against the interval.
+        @param seconds Longest send interval in seconds, at most 2, or 0 to send all rigid body changes on every network update (default). */
+    void SetRigidBodyMaxInterval(float seconds);
+
+    /// Returns the longest rigid body send interval in seconds, or 0 if the rigid body send rate is not adaptive.
+    float RigidBodyMaxInterval() const { return rigidBodyMaxInterval_; }
+
+    /// Returns the average number of bits spent per rigid body update sent since the last ResetRigidBodyStats, or 0 if none were sent (server only).
+    /** Includes the per-body entity ID and delta header, but not the message headers. */
+    float RigidBodyBitsPerBody() const;
+
+    /// Returns the number of rigid body updates sent since the last ResetRigidBodyStats (server only).
+    double RigidBodyUpdatesSent() const { return (double)rigidBodiesSent_; }
+
+    /// Resets the rigid body stream statistics.
+    void ResetRigidBodyStats();
+
     /// Returns SceneSyncState for a client connection.
     /** @note This slot is only exposed on Server, other wise will return null ptr.
         @param int connection ID of the client. */
@@ -79,9 +181,6 @@ signals:
     void SceneStateCreated(UserConnection *user, SceneSyncState *state);
     
 private slots:
-    /// Trigger EC sync because of component attributes changing
-    void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
-
     /// Trigger EC sync because of component attribute added
     void OnAttributeAdded(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
 
@@ -110,10 +209,34 @@ private slots:
     void HandleKristalliMessage(kNet::MessageConnection* source, kNet::packet_id_t, kNet::message_id_t id, const char* data, size_t numBytes);
 
 private:
-    /// Queue a message to the receiver from a given DataSerializer.
-    void QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds);
+    /// Processes the sync state of one client connection on a worker thread.
+    class UserSyncWorker;
+
+    /// Takes the attribute changes recorded by the scene since the previous call, and marks them dirty for sync.
+    /** Called each frame, and before handling the messages which clear dirty attributes so that the received changes are not echoed back. */
+    void ProcessAttributeChanges();
+
+    /// Trigger EC sync because of component attributes changing
+    void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
+
+    /// Queue a message to the receiver from a given DataSerializer. Returns the number of bytes queued.
+    size_t QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds);
+    /// Queue the messages crafted into a sync context to the receiver, print its log messages, and clear it. Main thread only.
+    void FlushSyncContext(kNet::MessageConnection* connection, SyncContext& context);
     /// Craft a component full update, with all static and dynamic attributes.
-    void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncContext& context);
+    /// Write a component full update, serializing it only once per network tick for all client connections.
+    void WriteCachedComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp, SyncContext& context);
+    /// Serialize the dirty attributes of a component for the edit attributes message.
+    /** The data is serialized only once per network tick for each distinct set of dirty attributes, and shared by all client connections.
+        @param comp Component
+        @param dirtyAttributes Dirty attributes bitfield of the component
+        @param changedAttributes Indices of the dirty attributes that exist in the component
+        @param context Sync context whose scratch buffers to use
+        @return The serialized data, valid until the next call with the same context. */
+    QByteArray EditAttributesData(IComponent* comp, const u8* dirtyAttributes, const std::vector<u8>& changedAttributes, SyncContext& context);
+    /// Discard the serialized data of the previous network tick. Sharing is enabled only if the data will be sent to several connections.
+    void ResetSerializationCache(bool enabled);
     /// Handle entity action message.
     void HandleEntityAction(kNet::MessageConnection* source, MsgEntityAction& msg);
     /// Handle create entity message.
@@ -138,8 +261,28 @@ private:
     void HandleCreateComponentsReply(kNet::MessageConnection* source, const char* data, size_t numBytes);
     
     void HandleRigidBodyChanges(kNet::MessageConnection* source, kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Handle rigid body changes message of a server speaking the original protocol.
+    void HandleLegacyRigidBodyChanges(kNet::packet_id_t packetId, const char* data, size_t numBytes);
+    /// Starts interpolating the entity towards a rigid body state received from the server.
+    void ApplyRigidBodyChange(Entity* entity, kNet::packet_id_t packetId, const Transform &t, const float3 &linearVel, const float3 &angularVel);
+    /// Handle rigid body quantization profile message.
+    void HandleRigidBodyQuantization(kNet::MessageConnection* source, const char* data, size_t numBytes);
+    /// Handle rigid body acknowledgement message.
+    void HandleRigidBodyAck(kNet::MessageConnection* source, const char* data, size_t numBytes);
 
-    void ReplicateRigidBodyChanges(kNet::MessageConnection* destination, SceneSyncState* state);
+    /// Returns how long a rigid body may go without updates to the client, in seconds. The rigid body is sent on every network update if this is at most the update period.
+    float RigidBodySendInterval(const SceneSyncState* state, const float3 &pos, const float3 &linearVel, const float3 &angularVel, float roundTripTime) const;
+
+    /// Sends the rigid body quantization profile to a client.
+    void SendRigidBodyQuantization(kNet::MessageConnection* connection);
+    /// Acknowledges the rigid body messages received since the last acknowledgement to the server.
+    void SendRigidBodyAck(kNet::MessageConnection* connection, SceneSyncState* state);
+
+    /// Sends out the changed rigid body transforms and velocities. Returns the number of bytes queued.
+    /** The states are quantized with the rigid body quantization profile, and delta encoded against the latest states
+        the client has acknowledged. Clients of the original protocol get only the changed fields in the original encoding.
+        Can run on a worker thread. */
+    size_t ReplicateRigidBodyChanges(SyncContext& context, SceneSyncState* state);
 
     void InterpolateRigidBodies(f64 frametime, SceneSyncState* state);
 
@@ -147,10 +290,29 @@ private:
     void GetClientExtrapolationTime();
 
     /// Process one sync state for changes in the scene
-    /** \todo For now, sends all changed entities/components. In the future, this shall be subject to interest management
-        @param destination MessageConnection where to send the messages
-        @param state Syncstate to process */
-    void ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state);
+    /** If a byte budget is given, the dirty entities are sent in queue order until the budget runs out, so the queue should be
+        sorted with PrioritizeSyncState first. The rest stay dirty and are carried over to the next tick.
+        Can run on a worker thread, as it only reads the scene and touches no other sync state than the given one.
+        @param context Sync context where to craft the messages
+        @param state Syncstate to process
+        @param maxBytes Maximum number of bytes to queue, or 0 to process the whole dirty queue */
+    void ProcessSyncState(SyncContext& context, SceneSyncState* state, size_t maxBytes = 0);
+
+    /// Process the rigid body stream and the generic sync of one client connection within the per-client byte budget.
+    /** Can run on a worker thread. */
+    void ProcessUserSyncState(SyncContext& context, SceneSyncState* state, size_t tickBudget);
+
+    /// Returns the sync context for the index'th connection processed on this tick, creating it if necessary.
+    SyncContext& GetSyncContext(size_t index);
+
+    /// Re-evaluates the relevance of the entities that have withheld changes for a client, and flushes the changes of the now relevant ones.
+    /// @remarks InterestManager functionality
+    void FlushRelevantDeferredEntities(const UserConnectionPtr &user);
+
+    /// Computes the send priority of each entity in the dirty queue of a sync state and sorts the queue, highest priority first.
+    /** The priority grows with the time the entity has been waiting, and shrinks with the distance to the client
+        and with a low interest management relevance. */
+    void PrioritizeSyncState(SceneSyncState* state);
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -172,6 +334,8 @@ private:
     
     /// Scene pointer
     SceneWeakPtr scene_;
+    /// Subscriber ID to the attribute change journal of the scene, or -1 if not subscribed.
+    int attributeChangeSubscriber_;
     
     /// Time period for update, default 1/30th of a second
     float updatePeriod_;
@@ -182,20 +346,40 @@ private:
     float maxLinExtrapTime_;
     /// Disable client physics handoff -flag
     bool noClientPhysicsHandoff_;
+    /// Per-client scene sync bandwidth budget in bytes per second, 0 if unlimited
+    int maxBytesPerSecond_;
     
     /// Server sync state (client only)
     SceneSyncState server_syncstate_;
     
-    /// Fixed buffers for crafting messages
+    /// Fixed buffers for crafting the reply messages on the main thread
     char createEntityBuffer_[64 * 1024];
-    char createCompsBuffer_[64 * 1024];
-    char editAttrsBuffer_[64 * 1024];
-    char createAttrsBuffer_[16 * 1024];
     char attrDataBuffer_[16 * 1024];
-    char removeCompsBuffer_[1024];
-    char removeEntityBuffer_[1024];
-    char removeAttrsBuffer_[1024];
-    std::vector<u8> changedAttributes_;
+
+    /// Sync contexts for processing the connections on the network tick, one per concurrently processed connection
+    std::vector<SyncContext*> syncContexts_;
+    /// Worker threads for processing the client connections concurrently (server only)
+    QThreadPool* workers_;
+
+    /// Whether the serialized component data is shared between client connections during this network tick
+    bool serializationCacheEnabled_;
+    /// Guards the serialization caches while the client connections are processed concurrently
+    QMutex serializationCacheMutex_;
+    /// Component full updates serialized during this network tick, by component ID
+    QHash<component_id_t, QByteArray> fullUpdateCache_;
+    /// Edit attributes data serialized during this network tick, by component ID and dirty attributes bitfield
+    QHash<QPair<component_id_t, QByteArray>, QByteArray> editAttrsCache_;
+
+    /// Quantization profile of the rigid body stream
+    RigidBodyQuantization rigidBodyQuantization_;
+    /// Identifies the current profile, so that the rigid body messages crafted with a previous profile can be told apart
+    u8 rigidBodyProfileId_;
+    /// Bits spent on the rigid bodies sent since the stats were reset
+    u64 rigidBodyBitsSent_;
+    /// Number of rigid bodies sent since the stats were reset
+    u64 rigidBodiesSent_;
+    /// Longest rigid body send interval in seconds, 0 if the rigid body send rate is not adaptive
+    float rigidBodyMaxInterval_;
 
     InterestManager *interestmanager_;
 };
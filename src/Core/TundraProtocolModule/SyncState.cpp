@@ -19,6 +19,7 @@ SceneSyncState::SceneSyncState(u32 userConnectionID, bool isServer) :
     userConnectionID_(userConnectionID),
     changeRequest_(userConnectionID),
     isServer_(isServer),
+    protocolVersion(cProtocolOriginal),
     locationInitialized(false),
     clientLocation(float3::nan),
     initialLocation(float3::nan)
@@ -81,8 +82,7 @@ void SceneSyncState::MarkEntityPending(entity_id_t id)
 
     // If user does not have the entity in the first place, do nothing.
     // Its going to be asked to be added to the state via the permission signals later.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.find(id))
         return;
 
     MarkEntityRemoved(id);  // Remove from current sync state (removes entity from client)
@@ -135,31 +135,31 @@ void SceneSyncState::Clear()
 {
     dirtyQueue.clear();
     entities.clear();
+    deferredEntities.clear();
     pendingEntities_.clear();
+    rigidBodyStream.Reset();
+    pendingRigidBodies.clear();
     changeRequest_.Reset();
     scene_.reset();
 }
 
+void SceneSyncState::ResetRigidBodyStream()
+{
+    rigidBodyStream.Reset();
+    for(SyncStateMap<entity_id_t, EntitySyncState>::iterator i = entities.begin(); i != entities.end(); ++i)
+        i->hasAckedRigidBody = false;
+}
+
 void SceneSyncState::RemoveFromQueue(entity_id_t id)
 {
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i != entities.end())
+    EntitySyncState *entityState = entities.find(id);
+    if (entityState && entityState->isInQueue)
     {
-        if (i->second.isInQueue)
-        {
-            for (std::list<EntitySyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-            {
-                if ((*j) == &i->second)
-                {
-                    dirtyQueue.erase(j);
-                    break;
-                }
-            }
-            i->second.isInQueue = false;
-            for (std::map<component_id_t, ComponentSyncState>::iterator j = i->second.components.begin(); j != i->second.components.end(); ++j)
-                j->second.isInQueue = false;
-            i->second.dirtyQueue.clear();
-        }
+        dirtyQueue.remove(entityState);
+        entityState->isInQueue = false;
+        entityState->dirtyQueue.clear();
+        for (SyncStateMap<component_id_t, ComponentSyncState>::iterator j = entityState->components.begin(); j != entityState->components.end(); ++j)
+            j->isInQueue = false;
     }
 }
 
@@ -206,24 +206,25 @@ void SceneSyncState::MarkEntityRemoved(entity_id_t id)
     /// @remark Enables a 'pending' logic in SyncManager, with which a script can throttle the sending of entities to clients.
     if (isServer_)
         RemovePendingEntity(id);
+    deferredEntities.erase(id);
 
     // If user did not have the entity in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    EntitySyncState *entityState = entities.find(id);
+    if (!entityState)
         return;
     // If entity is marked new, it was not sent yet and can be simply removed from the sync state
-    if (i->second.isNew)
+    if (entityState->isNew)
     {
         RemoveFromQueue(id);
         entities.erase(id);
         return;
     }
     // Else mark as removed and queue the update
-    i->second.removed = true;
-    if (!i->second.isInQueue)
+    entityState->removed = true;
+    if (!entityState->isInQueue)
     {
-        dirtyQueue.push_back(&i->second);
-        i->second.isInQueue = true;
+        dirtyQueue.push_back(entityState);
+        entityState->isInQueue = true;
     }
 }
 
@@ -241,12 +242,20 @@ void SceneSyncState::MarkComponentDirty(entity_id_t id, component_id_t compId)
 
 void SceneSyncState::MarkComponentRemoved(entity_id_t id, component_id_t compId)
 {
+    std::map<entity_id_t, DeferredComponentMap>::iterator deferred = deferredEntities.find(id);
+    if (deferred != deferredEntities.end())
+    {
+        deferred->second.erase(compId);
+        if (deferred->second.empty())
+            deferredEntities.erase(deferred);
+    }
+
     // If user did not have the entity or component in the first place, do nothing
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    EntitySyncState *entityState = entities.find(id);
+    if (!entityState)
         return;
     MarkEntityDirty(id);
-    i->second.MarkComponentRemoved(compId);
+    entityState->MarkComponentRemoved(compId);
 }
 
 void SceneSyncState::MarkAttributeDirty(entity_id_t id, component_id_t compId, u8 attrIndex)
@@ -276,6 +285,49 @@ void SceneSyncState::MarkAttributeRemoved(entity_id_t id, component_id_t compId,
     compState.MarkAttributeRemoved(attrIndex);
 }
 
+void SceneSyncState::MarkAttributeDeferred(entity_id_t id, component_id_t compId, u8 attrIndex)
+{
+    ComponentSyncState& compState = deferredEntities[id][compId];
+    if (!compState.id)
+        compState.id = compId;
+    compState.MarkAttributeDirty(attrIndex);
+}
+
+bool SceneSyncState::FlushDeferredEntity(entity_id_t id)
+{
+    std::map<entity_id_t, DeferredComponentMap>::iterator deferred = deferredEntities.find(id);
+    if (deferred == deferredEntities.end())
+        return false;
+
+    PROFILE(SyncState_FlushDeferredEntity);
+
+    // Take the changes out first, MarkAttributeDirty may end up modifying deferredEntities via the pending logic.
+    DeferredComponentMap components;
+    components.swap(deferred->second);
+    deferredEntities.erase(deferred);
+
+    for(DeferredComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        const ComponentSyncState &compState = i->second;
+        for(unsigned j = 0; j < 32; ++j)
+        {
+            u8 byte = compState.dirtyAttributes[j];
+            if (!byte)
+                continue;
+            for(unsigned k = 0; k < 8; ++k)
+                if (byte & (1 << k))
+                    MarkAttributeDirty(id, i->first, (u8)(j * 8 + k));
+        }
+    }
+    return true;
+}
+
+void SceneSyncState::FlushDeferredEntities()
+{
+    while(!deferredEntities.empty())
+        FlushDeferredEntity(deferredEntities.begin()->first);
+}
+
 // Private
 
 bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
@@ -290,8 +342,7 @@ bool SceneSyncState::ShouldMarkAsDirty(entity_id_t id)
     // Only request if this entity does not have a sync state yet.
     // Otherwise this id will spam the signal handler on every change if
     // the addition to sync state was accepted.
-    std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-    if (i == entities.end())
+    if (!entities.find(id))
     {
         PROFILE(SyncState_Emit_AboutToDirtyEntity);
         
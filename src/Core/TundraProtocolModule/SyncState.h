@@ -8,9 +8,13 @@
 #include "SceneFwd.h"
 
 #include "kNet/PolledTimer.h"
+#include "kNet/Clock.h"
 #include "kNet/Types.h"
 #include "Transform.h"
 #include "Math/float3.h"
+#include "SyncStateStorage.h"
+#include "RigidBodyQuantization.h"
+#include "TundraMessages.h"
 
 #include <QObject>
 #include <QVariant>
@@ -18,6 +22,7 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 /// Component's per-user network sync state
 struct ComponentSyncState
@@ -26,7 +31,9 @@ struct ComponentSyncState
         removed(false),
         isNew(true),
         isInQueue(false),
-        id(0)
+        id(0),
+        queuePrev(0),
+        queueNext(0)
     {
         for (unsigned i = 0; i < 32; ++i)
             dirtyAttributes[i] = 0;
@@ -61,6 +68,8 @@ struct ComponentSyncState
     bool removed; ///< The component has been removed since last update
     bool isNew; ///< The client does not have the component and it must be serialized in full
     bool isInQueue; ///< The component is already in the entity's dirty queue
+    ComponentSyncState *queuePrev; ///< Previous component in the entity's dirty queue
+    ComponentSyncState *queueNext; ///< Next component in the entity's dirty queue
 };
 
 /// Entity's per-user network sync state
@@ -71,27 +80,25 @@ struct EntitySyncState
         isNew(true),
         isInQueue(false),
         id(0),
-        avgUpdateInterval(0.0f)
+        avgUpdateInterval(0.0f),
+        priority(0.0f),
+        lastSyncTime(kNet::Clock::Tick()),
+        lastNetworkSendTime(0),
+        ackedRigidBodySeq(0),
+        hasAckedRigidBody(false),
+        pendingRigidBodyChanges(0),
+        queuePrev(0),
+        queueNext(0)
     {
     }
     
     void RemoveFromQueue(component_id_t id)
     {
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
-        if (i != components.end())
+        ComponentSyncState *compState = components.find(id);
+        if (compState && compState->isInQueue)
         {
-            if (i->second.isInQueue)
-            {
-                for (std::list<ComponentSyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.erase(j);
-                        break;
-                    }
-                }
-                i->second.isInQueue = false;
-            }
+            dirtyQueue.remove(compState);
+            compState->isInQueue = false;
         }
     }
     
@@ -110,42 +117,43 @@ struct EntitySyncState
     void MarkComponentRemoved(component_id_t id)
     {
         // If user did not have the component in the first place, do nothing
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
-        if (i == components.end())
+        ComponentSyncState *compState = components.find(id);
+        if (!compState)
             return;
         // If component is marked new, it was not sent yet and can be simply removed from the sync state
-        if (i->second.isNew)
+        if (compState->isNew)
         {
             RemoveFromQueue(id);
             components.erase(id);
             return;
         }
         // Else mark as removed and queue the update
-        i->second.removed = true;
-        if (!i->second.isInQueue)
+        compState->removed = true;
+        if (!compState->isInQueue)
         {
-            dirtyQueue.push_back(&i->second);
-            i->second.isInQueue = true;
+            dirtyQueue.push_back(compState);
+            compState->isInQueue = true;
         }
     }
     
     void DirtyProcessed()
     {
-        for (std::map<component_id_t, ComponentSyncState>::iterator i = components.begin(); i != components.end(); ++i)
+        dirtyQueue.clear();
+        for (SyncStateMap<component_id_t, ComponentSyncState>::iterator i = components.begin(); i != components.end(); ++i)
         {
-            i->second.DirtyProcessed();
-            i->second.isInQueue = false;
+            i->DirtyProcessed();
+            i->isInQueue = false;
         }
-        dirtyQueue.clear();
         isNew = false;
+        lastSyncTime = kNet::Clock::Tick();
     }
     
-    void UpdateReceived()
+    void UpdateReceived(float maxInterval = 0.5f)
     {
         float time = updateTimer.MSecsElapsed() * 0.001f;
         updateTimer.Start();
         // Maximum update rate should be 100fps. Discard either very frequent or very infrequent updates.
-        if (time < 0.005f || time >= 0.5f)
+        if (time < 0.005f || time >= maxInterval)
             return;
         // If it's the first measurement, set time directly. Else smooth
         if (avgUpdateInterval == 0.0f)
@@ -154,8 +162,8 @@ struct EntitySyncState
             avgUpdateInterval = 0.5 * time + 0.5 * avgUpdateInterval;
     }
     
-    std::list<ComponentSyncState*> dirtyQueue; ///< Dirty components
-    std::map<component_id_t, ComponentSyncState> components; ///< Component syncstates
+    SyncQueue<ComponentSyncState> dirtyQueue; ///< Dirty components
+    SyncStateMap<component_id_t, ComponentSyncState> components; ///< Component syncstates
     entity_id_t id; ///< Entity ID. Duplicated here intentionally to allow recognizing the entity without the parent map.
     bool removed; ///< The entity has been removed since last update
     bool isNew; ///< The client does not have the entity and it must be serialized in full
@@ -164,12 +172,34 @@ struct EntitySyncState
     kNet::PolledTimer updateTimer; ///< Last update received timer
     float avgUpdateInterval; ///< Average network update interval in seconds
 
+    float priority; ///< Send priority, computed each tick by SyncManager when the sync bandwidth is limited. Higher is sent first.
+    kNet::tick_t lastSyncTime; ///< Time when the dirty state of the entity was last processed
+
     // Special cases for rigid body streaming:
     // On the server side, remember the last sent rigid body parameters, so that we can perform effective pruning of redundant data.
     Transform transform;
     float3 linearVelocity;
     float3 angularVelocity;
     kNet::tick_t lastNetworkSendTime;
+
+    /// On the server side, the latest rigid body state the client has acknowledged. The rigid body updates are delta encoded against it.
+    QuantizedRigidBodyState ackedRigidBody;
+    u16 ackedRigidBodySeq; ///< Sequence number of the rigid body message that carried ackedRigidBody
+    bool hasAckedRigidBody; ///< Whether ackedRigidBody is valid
+
+    /// Rigid body changes of the entity that are waiting to be sent to the client.
+    enum RigidBodyChange
+    {
+        TransformChanged = 1,
+        VelocityChanged = 2,
+        AngularVelocityChanged = 4,
+        EnteredRest = 8 ///< The body stopped moving. Sent immediately and reliably.
+    };
+    /// On the server side, the RigidBodyChange flags of the changes not sent yet, as the entity is not due for a rigid body update.
+    u8 pendingRigidBodyChanges;
+
+    EntitySyncState *queuePrev; ///< Previous entity in the scene's dirty queue
+    EntitySyncState *queueNext; ///< Next entity in the scene's dirty queue
 };
 
 struct RigidBodyInterpolationState
@@ -195,6 +225,200 @@ struct RigidBodyInterpolationState
     /// Remembers the packet id of the most recently received network sync packet. Used to enforce
     /// proper ordering (generate latest-data-guarantee messaging) for the received movement packets.
     kNet::packet_id_t lastReceivedPacketCounter;
+
+    /// Time in seconds how long interpolating from interpStart to interpEnd should take. Follows the measured update interval of the entity,
+    /// as the server may send the rigid bodies far from the client less often.
+    float interpPeriod;
+};
+
+/// Per-connection bookkeeping of the delta encoded rigid body stream.
+/** The server remembers the rigid body states it sent in each of its latest rigid body messages. The client acknowledges the messages
+    it has received, after which the server uses the states carried by them as the baselines of the following updates.
+    The client remembers the states it received, so that it can resolve the baselines. */
+struct RigidBodyStreamState
+{
+    /// Number of latest messages remembered on both sides. A baseline older than this is not used.
+    static const int cHistorySize = 32;
+
+    /// Rigid body states sent in one message (server).
+    struct SentMessage
+    {
+        SentMessage() : seq(0), pending(false) {}
+
+        u16 seq;
+        bool pending; ///< The message has not been acknowledged yet
+        std::vector<std::pair<entity_id_t, QuantizedRigidBodyState> > bodies;
+    };
+
+    /// Rigid body states of one entity received in the latest messages, indexed by the sequence number modulo cHistorySize (client).
+    struct ReceivedStates
+    {
+        ReceivedStates() : latestSeq(0), empty(true)
+        {
+            for(int i = 0; i < cHistorySize; ++i)
+                valid[i] = false;
+        }
+
+        /// Returns the state received in the message with the given sequence number, or null if it is not remembered anymore.
+        const QuantizedRigidBodyState *Find(u16 sequence) const
+        {
+            const int slot = sequence % cHistorySize;
+            return valid[slot] && seq[slot] == sequence ? &states[slot] : 0;
+        }
+
+        void Store(u16 sequence, const QuantizedRigidBodyState &state)
+        {
+            const int slot = sequence % cHistorySize;
+            if (empty || (s16)(sequence - latestSeq) > 0)
+                latestSeq = sequence;
+            empty = false;
+            seq[slot] = sequence;
+            valid[slot] = true;
+            states[slot] = state;
+        }
+
+        u16 latestSeq; ///< Sequence number of the newest message that carried a state of the entity
+        bool empty; ///< No states have been stored yet
+        u16 seq[cHistorySize];
+        bool valid[cHistorySize];
+        QuantizedRigidBodyState states[cHistorySize];
+    };
+
+    RigidBodyStreamState() { Reset(); }
+
+    void Reset()
+    {
+        nextSeq = 0;
+        for(int i = 0; i < cHistorySize; ++i)
+        {
+            sent[i].pending = false;
+            sent[i].bodies.clear();
+        }
+        latestReceived = 0;
+        receivedMask = 0;
+        hasReceived = false;
+        ackPending = false;
+        received.clear();
+    }
+
+    /// Starts recording the states sent in a new message (server). Returns the record.
+    SentMessage &BeginMessage(u16 seq)
+    {
+        SentMessage &msg = sent[seq % cHistorySize];
+        msg.seq = seq;
+        msg.pending = true;
+        msg.bodies.clear();
+        return msg;
+    }
+
+    /// Forgets the received states of the entities that have not been updated for so long that their states can not be baselines anymore (client).
+    void PruneReceived()
+    {
+        for(std::map<entity_id_t, ReceivedStates>::iterator i = received.begin(); i != received.end();)
+        {
+            if ((s16)(latestReceived - i->second.latestSeq) > cHistorySize)
+                received.erase(i++);
+            else
+                ++i;
+        }
+    }
+
+    /// Remembers that the message with the given sequence number was received (client).
+    void MarkReceived(u16 seq)
+    {
+        if (!hasReceived || (s16)(seq - latestReceived) > 0)
+        {
+            // Shift the older messages in the mask, and add the previous latest one to it.
+            const int shift = (u16)(seq - latestReceived);
+            if (!hasReceived || shift > 32)
+                receivedMask = 0;
+            else if (shift == 32)
+                receivedMask = 1u << 31;
+            else
+                receivedMask = (receivedMask << shift) | (1u << (shift - 1));
+            latestReceived = seq;
+            hasReceived = true;
+        }
+        else
+        {
+            const int age = (u16)(latestReceived - seq);
+            if (age >= 1 && age <= 32)
+                receivedMask |= 1u << (age - 1);
+        }
+        ackPending = true;
+    }
+
+    // Server side
+    u16 nextSeq; ///< Sequence number of the next rigid body message
+    SentMessage sent[cHistorySize]; ///< The latest sent messages, indexed by the sequence number modulo cHistorySize
+
+    // Client side
+    u16 latestReceived; ///< Sequence number of the newest received message
+    u32 receivedMask; ///< Bit i is set if message latestReceived - 1 - i was received
+    bool hasReceived; ///< Whether any message has been received
+    bool ackPending; ///< Whether new messages have been received since the last acknowledgement
+    std::map<entity_id_t, ReceivedStates> received; ///< States received for each entity
+};
+
+/// Per-client interest management bookkeeping, kept in flat arrays indexed by entity ID.
+/** Entity IDs at or above cMaxEntityId are not stored, and read back as the default values. 
+    @remarks InterestManager functionality */
+struct InterestManagementState
+{
+    /// Entity IDs at or above this are not stored, to keep the arrays bounded.
+    static const entity_id_t cMaxEntityId = 1 << 24;
+
+    /// Visibility of an entity as determined by the latest raycast.
+    enum Visibility
+    {
+        VisibilityUnknown = 0,
+        Hidden,
+        Visible
+    };
+
+    void Clear()
+    {
+        relevanceFactors.clear();
+        visibility.clear();
+        lastUpdated.clear();
+        lastRaycasted.clear();
+        relevantEntities.clear();
+    }
+
+    float RelevanceFactor(entity_id_t id) const { return Get(relevanceFactors, id, 1.f); }
+    void SetRelevanceFactor(entity_id_t id, float relevance) { Set(relevanceFactors, id, relevance, 1.f); }
+
+    Visibility EntityVisibility(entity_id_t id) const { return (Visibility)Get(visibility, id, (u8)VisibilityUnknown); }
+    void SetEntityVisibility(entity_id_t id, bool visible) { Set(visibility, id, (u8)(visible ? Visible : Hidden), (u8)VisibilityUnknown); }
+
+    int LastUpdated(entity_id_t id) const { return Get(lastUpdated, id, 0); }
+    void SetLastUpdated(entity_id_t id, int time) { Set(lastUpdated, id, time, 0); }
+
+    int LastRaycasted(entity_id_t id) const { return Get(lastRaycasted, id, 0); }
+    void SetLastRaycasted(entity_id_t id, int time) { Set(lastRaycasted, id, time, 0); }
+
+    std::vector<float> relevanceFactors; ///< Relevance factor [0,1] of each entity
+    std::vector<u8> visibility; ///< Visibility of each entity, see Visibility
+    std::vector<int> lastUpdated; ///< Time in msecs when each entity was last accepted for update
+    std::vector<int> lastRaycasted; ///< Time in msecs when each entity was last raycasted
+    std::vector<bool> relevantEntities; ///< Bitset of the entities relevant to the client. Computed once per network tick.
+
+private:
+    template<typename T>
+    static T Get(const std::vector<T> &values, entity_id_t id, T defaultValue)
+    {
+        return id < values.size() ? values[id] : defaultValue;
+    }
+
+    template<typename T>
+    static void Set(std::vector<T> &values, entity_id_t id, T value, T defaultValue)
+    {
+        if (id >= cMaxEntityId)
+            return;
+        if (id >= values.size())
+            values.resize(id + 1, defaultValue);
+        values[id] = value;
+    }
 };
 
 /// State change request to permit/deny changes.
@@ -261,6 +485,9 @@ private:
 
 typedef std::list<component_id_t> ComponentIdList;
 
+/// Attribute dirty bits of the components of one entity, that were withheld from a client by the interest manager.
+typedef std::map<component_id_t, ComponentSyncState> DeferredComponentMap;
+
 /// Scene's per-user network sync state
 class TUNDRAPROTOCOL_MODULE_API SceneSyncState : public QObject
 {
@@ -271,23 +498,31 @@ public:
     virtual ~SceneSyncState();
 
     /// Dirty entities pending processing
-    std::list<EntitySyncState*> dirtyQueue; 
+    SyncQueue<EntitySyncState> dirtyQueue; 
 
     /// Entity sync states
-    std::map<entity_id_t, EntitySyncState> entities; 
+    SyncStateMap<entity_id_t, EntitySyncState> entities; 
 
     /// Entity interpolations
     std::map<entity_id_t, RigidBodyInterpolationState> entityInterpolations;
 
-    /// Maps containing the relevance factors and visibility data
-    /// @remarks InterestManager functionality
-    std::map<entity_id_t, bool> visibleEntities;
-    std::map<entity_id_t, float> relevanceFactors;
+    /// Protocol version of the connection, which decides the encoding of the rigid body stream
+    u32 protocolVersion;
 
-    /// Couple of maps containing the timestamps of last updates and raycasts
+    /// Delta encoding state of the rigid body stream
+    RigidBodyStreamState rigidBodyStream;
+
+    /// Entities with rigid body changes that are waiting to be sent (server). See EntitySyncState::pendingRigidBodyChanges.
+    std::vector<entity_id_t> pendingRigidBodies;
+
+    /// Relevance factors, visibility data and the timestamps of last updates and raycasts
     /// @remarks InterestManager functionality
-    std::map<entity_id_t, float> lastUpdatedEntitys_;
-    std::map<entity_id_t, float> lastRaycastedEntitys_;
+    InterestManagementState interest;
+
+    /// Attribute changes of entities that are currently not relevant to the client.
+    /** The changes are kept here instead of the dirty queue, and flushed to the dirty state as one update when the entity becomes relevant again.
+        @remarks InterestManager functionality */
+    std::map<entity_id_t, DeferredComponentMap> deferredEntities;
 
     /// @remarks InterestManager functionality
     Quat clientOrientation;
@@ -337,6 +572,9 @@ public slots:
 public:
     void SetParentScene(SceneWeakPtr scene);
     void Clear();
+
+    /// Forgets the rigid body states sent and acknowledged so far, so that the following rigid body updates are sent in full.
+    void ResetRigidBodyStream();
     
     void RemoveFromQueue(entity_id_t id);
 
@@ -353,6 +591,18 @@ public:
     void MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex);
     void MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex);
 
+    /// Remembers an attribute change that the interest manager withheld from the client.
+    /// @remarks InterestManager functionality
+    void MarkAttributeDeferred(entity_id_t id, component_id_t compId, u8 attrIndex);
+
+    /// Moves the withheld attribute changes of an entity to the dirty state. Returns true if there were any.
+    /// @remarks InterestManager functionality
+    bool FlushDeferredEntity(entity_id_t id);
+
+    /// Moves the withheld attribute changes of all entities to the dirty state.
+    /// @remarks InterestManager functionality
+    void FlushDeferredEntities();
+
     // Silently does the same as MarkEntityDirty without emitting change request signal.
     EntitySyncState& MarkEntityDirtySilent(entity_id_t id);
 
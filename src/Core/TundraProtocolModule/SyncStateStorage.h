@@ -0,0 +1,337 @@
+// For conditions of distribution and use, see copyright notice in LICENSE
+
+#pragma once
+
+#include "CoreTypes.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cassert>
+
+/// Intrusive doubly linked queue of sync states.
+/** The queued objects link to each other through their queuePrev and queueNext members, so queueing, dequeueing and
+    removing from the middle of the queue are O(1) and never allocate. An object can be in at most one queue at a time,
+    and must be removed from the queue before it is destroyed. */
+template<typename T>
+class SyncQueue
+{
+public:
+    /// Forward iterator over the queued objects. Dereferences to a pointer to the object, like std::list<T*>::iterator.
+    class iterator
+    {
+    public:
+        iterator() : node_(0) {}
+        explicit iterator(T *node) : node_(node) {}
+
+        T *operator *() const { return node_; }
+        iterator &operator ++() { node_ = node_->queueNext; return *this; }
+        iterator operator ++(int) { iterator prev = *this; node_ = node_->queueNext; return prev; }
+        bool operator ==(const iterator &rhs) const { return node_ == rhs.node_; }
+        bool operator !=(const iterator &rhs) const { return node_ != rhs.node_; }
+
+    private:
+        T *node_;
+    };
+
+    SyncQueue() : head_(0), tail_(0), size_(0) {}
+
+    bool empty() const { return head_ == 0; }
+    size_t size() const { return size_; }
+    T *front() const { return head_; }
+
+    iterator begin() const { return iterator(head_); }
+    iterator end() const { return iterator(); }
+
+    /// Appends an object to the end of the queue. The object must not be in any queue.
+    void push_back(T *node)
+    {
+        assert(node && !node->queuePrev && !node->queueNext && head_ != node);
+        node->queuePrev = tail_;
+        node->queueNext = 0;
+        if (tail_)
+            tail_->queueNext = node;
+        else
+            head_ = node;
+        tail_ = node;
+        ++size_;
+    }
+
+    /// Removes the first object of the queue.
+    void pop_front()
+    {
+        if (head_)
+            remove(head_);
+    }
+
+    /// Removes an object from the queue. The object must be in this queue.
+    void remove(T *node)
+    {
+        assert(node && size_ > 0);
+        if (node->queuePrev)
+            node->queuePrev->queueNext = node->queueNext;
+        else
+            head_ = node->queueNext;
+        if (node->queueNext)
+            node->queueNext->queuePrev = node->queuePrev;
+        else
+            tail_ = node->queuePrev;
+        node->queuePrev = node->queueNext = 0;
+        --size_;
+    }
+
+    /// Removes all objects from the queue.
+    void clear()
+    {
+        while(head_)
+        {
+            T *next = head_->queueNext;
+            head_->queuePrev = head_->queueNext = 0;
+            head_ = next;
+        }
+        tail_ = 0;
+        size_ = 0;
+    }
+
+    /// Sorts the queue with a strict weak ordering of object pointers. The sort is stable.
+    template<typename Compare>
+    void sort(Compare comp)
+    {
+        if (size_ < 2)
+            return;
+        sortScratch_.clear();
+        for(T *node = head_; node; node = node->queueNext)
+            sortScratch_.push_back(node);
+        std::stable_sort(sortScratch_.begin(), sortScratch_.end(), comp);
+        for(size_t i = 0; i < sortScratch_.size(); ++i)
+        {
+            sortScratch_[i]->queuePrev = i > 0 ? sortScratch_[i - 1] : 0;
+            sortScratch_[i]->queueNext = i + 1 < sortScratch_.size() ? sortScratch_[i + 1] : 0;
+        }
+        head_ = sortScratch_.front();
+        tail_ = sortScratch_.back();
+    }
+
+private:
+    SyncQueue(const SyncQueue &);
+    void operator =(const SyncQueue &);
+
+    T *head_;
+    T *tail_;
+    size_t size_;
+    std::vector<T*> sortScratch_;
+};
+
+/// Map from an integer ID to a sync state object.
+/** The objects are allocated from chunks owned by the map, and are looked up through a flat open addressing table
+    with linear probing. Unlike the table slots, the objects never move in memory while they are in the map, so they
+    can be linked to SyncQueues. The map can not be copied. */
+template<typename Key, typename T>
+class SyncStateMap
+{
+    struct Slot
+    {
+        Key key;
+        T *value; ///< Null if the slot is empty
+    };
+
+public:
+    /// Forward iterator over the objects of the map, in no particular order. Dereferences to the object.
+    class iterator
+    {
+    public:
+        iterator() : slot_(0), end_(0) {}
+        iterator(Slot *slot, Slot *end) : slot_(slot), end_(end) { SkipEmpty(); }
+
+        T &operator *() const { return *slot_->value; }
+        T *operator ->() const { return slot_->value; }
+        Key key() const { return slot_->key; }
+        iterator &operator ++() { ++slot_; SkipEmpty(); return *this; }
+        bool operator ==(const iterator &rhs) const { return slot_ == rhs.slot_; }
+        bool operator !=(const iterator &rhs) const { return slot_ != rhs.slot_; }
+
+    private:
+        void SkipEmpty() { while(slot_ != end_ && !slot_->value) ++slot_; }
+
+        Slot *slot_;
+        Slot *end_;
+    };
+
+    SyncStateMap() : size_(0), shift_(32) {}
+    ~SyncStateMap()
+    {
+        clear();
+        for(size_t i = 0; i < chunks_.size(); ++i)
+            allocator_.deallocate(chunks_[i].first, chunks_[i].second);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    iterator begin() { return slots_.empty() ? iterator() : iterator(&slots_[0], &slots_[0] + slots_.size()); }
+    iterator end() { return slots_.empty() ? iterator() : iterator(&slots_[0] + slots_.size(), &slots_[0] + slots_.size()); }
+
+    /// Returns the object with the given key, or null if there is none.
+    T *find(Key key) const
+    {
+        if (slots_.empty())
+            return 0;
+        const size_t mask = slots_.size() - 1;
+        for(size_t i = Home(key); slots_[i].value; i = (i + 1) & mask)
+            if (slots_[i].key == key)
+                return slots_[i].value;
+        return 0;
+    }
+
+    /// Returns the object with the given key, creating a default-constructed one if there is none.
+    T &operator [](Key key)
+    {
+        T *existing = find(key);
+        if (existing)
+            return *existing;
+
+        if ((size_ + 1) * 4 > slots_.size() * 3)
+            Rehash(std::max<size_t>(slots_.size() * 2, 8));
+
+        T *value = Allocate();
+        Insert(key, value);
+        ++size_;
+        return *value;
+    }
+
+    /// Destroys the object with the given key. Returns whether there was one.
+    bool erase(Key key)
+    {
+        T *value = Unlink(key);
+        if (!value)
+            return false;
+        Release(value);
+        return true;
+    }
+
+    /// Moves the object with key oldKey to newKey without copying it, replacing any object with newKey. 
+    /// If there is no object with oldKey, a default-constructed object is created with newKey. Returns the object.
+    /// The replaced object is destroyed, so it must not be in a SyncQueue; the caller removes it from its queue first.
+    T &rekey(Key oldKey, Key newKey)
+    {
+        if (oldKey == newKey)
+            return (*this)[newKey];
+        T *value = find(oldKey);
+        if (!value)
+        {
+            erase(newKey);
+            return (*this)[newKey];
+        }
+        // Take the object out of the table without destroying it, then insert it back with the new key.
+        Unlink(oldKey);
+        erase(newKey);
+        if ((size_ + 1) * 4 > slots_.size() * 3)
+            Rehash(std::max<size_t>(slots_.size() * 2, 8));
+        Insert(newKey, value);
+        ++size_;
+        return *value;
+    }
+
+    /// Destroys all objects. The allocated memory is kept for reuse.
+    void clear()
+    {
+        for(size_t i = 0; i < slots_.size(); ++i)
+            if (slots_[i].value)
+            {
+                Release(slots_[i].value);
+                slots_[i].value = 0;
+            }
+        size_ = 0;
+    }
+
+private:
+    SyncStateMap(const SyncStateMap &);
+    void operator =(const SyncStateMap &);
+
+    /// Fibonacci hashing, which spreads the mostly sequential IDs well over the table.
+    size_t Home(Key key) const { return shift_ >= 32 ? 0 : (size_t)(((u32)key * 0x9E3779B1u) >> shift_); }
+
+    void Insert(Key key, T *value)
+    {
+        const size_t mask = slots_.size() - 1;
+        size_t i = Home(key);
+        while(slots_[i].value)
+            i = (i + 1) & mask;
+        slots_[i].key = key;
+        slots_[i].value = value;
+    }
+
+    /// Removes the key from the table without destroying the object. Returns the object, or null if there was none.
+    T *Unlink(Key key)
+    {
+        if (slots_.empty())
+            return 0;
+        const size_t mask = slots_.size() - 1;
+        size_t i = Home(key);
+        while(slots_[i].value && slots_[i].key != key)
+            i = (i + 1) & mask;
+        T *value = slots_[i].value;
+        if (!value)
+            return 0;
+        --size_;
+
+        // Backward shift deletion: move the following entries of the probe sequence back, so that no tombstones are needed.
+        for(size_t j = (i + 1) & mask; slots_[j].value; j = (j + 1) & mask)
+        {
+            size_t home = Home(slots_[j].key);
+            bool canMove = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if (canMove)
+            {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].value = 0;
+        return value;
+    }
+
+    void Rehash(size_t newSize)
+    {
+        std::vector<Slot> old;
+        old.swap(slots_);
+        Slot empty = { Key(), 0 };
+        slots_.resize(newSize, empty);
+        shift_ = 32;
+        for(size_t n = newSize; n > 1; n >>= 1)
+            --shift_;
+        for(size_t i = 0; i < old.size(); ++i)
+            if (old[i].value)
+                Insert(old[i].key, old[i].value);
+    }
+
+    T *Allocate()
+    {
+        if (free_.empty())
+        {
+            // Grow the storage geometrically, but start small as most component maps hold only a few states.
+            size_t chunkSize = std::max<size_t>(size_, 4);
+            T *chunk = allocator_.allocate(chunkSize);
+            chunks_.push_back(std::make_pair(chunk, chunkSize));
+            for(size_t i = chunkSize; i > 0; --i)
+                free_.push_back(chunk + i - 1);
+        }
+        T *value = free_.back();
+        free_.pop_back();
+        new (value) T();
+        return value;
+    }
+
+    void Release(T *value)
+    {
+        value->~T();
+        free_.push_back(value);
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<std::pair<T*, size_t> > chunks_;
+    std::vector<T*> free_;
+    std::allocator<T> allocator_;
+    size_t size_;
+    unsigned shift_;
+};
@@ -2,6 +2,12 @@
 
 #pragma once
 
+// Protocol versions. The client sends its version as the "protocol-version" login property, and the server
+// replies with the version the connection uses, which is the lower of the two. Peers that do not tell a version speak cProtocolOriginal.
+const unsigned long cProtocolOriginal = 1;
+const unsigned long cProtocolRigidBodyQuantization = 2; // Rigid body updates are quantized with a profile and delta encoded against acknowledged states.
+const unsigned long cProtocolVersion = cProtocolRigidBodyQuantization; // The version this build speaks.
+
 // Login
 const unsigned long cLoginMessage = 100;
 const unsigned long cLoginReplyMessage = 101;
@@ -19,6 +25,8 @@ const unsigned long cRemoveEntityMessage = 116;
 const unsigned long cCreateEntityReplyMessage = 117; // Server->client only
 const unsigned long cCreateComponentsReplyMessage = 118; // Server->client only
 const unsigned long cRigidBodyUpdateMessage = 119;
+const unsigned long cRigidBodyQuantizationMessage = 123; // Server->client only, cProtocolRigidBodyQuantization onwards
+const unsigned long cRigidBodyAckMessage = 124; // Client->server only, cProtocolRigidBodyQuantization onwards
 
 // Entity action
 const unsigned long cEntityActionMessage = 120;
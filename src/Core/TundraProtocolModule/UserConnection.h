@@ -5,6 +5,7 @@
 #include "CoreTypes.h"
 #include "TundraProtocolModuleApi.h"
 #include "TundraProtocolModuleFwd.h"
+#include "TundraMessages.h"
 
 #include <kNet/SharedPtr.h>
 #include <kNet/MessageConnection.h>
@@ -21,7 +22,7 @@ class TUNDRAPROTOCOL_MODULE_API UserConnection : public QObject, public enable_s
     Q_PROPERTY(int id READ ConnectionId)
 
 public:
-    UserConnection() : userID(0) {}
+    UserConnection() : userID(0), protocolVersion(cProtocolOriginal) {}
 
     /// Returns the connection ID.
     int ConnectionId() const { return userID; }
@@ -34,6 +35,8 @@ public:
     QString loginData;
     /// Property map
     LoginPropertyMap properties;
+    /// Protocol version negotiated at login
+    u32 protocolVersion;
     /// Scene sync state, created and used by the SyncManager
     shared_ptr<SceneSyncState> syncState;
 
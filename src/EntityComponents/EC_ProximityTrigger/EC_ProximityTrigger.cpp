@@ -11,8 +11,11 @@
 #include "Entity.h"
 
 #include "EC_Placeable.h"
+#include "OgreWorld.h"
+#include "PlaceableGrid.h"
 #include "LoggingFunctions.h"
 #include "FrameAPI.h"
+#include "Profiler.h"
 
 EC_ProximityTrigger::EC_ProximityTrigger(Scene *scene) :
     IComponent(scene),
@@ -49,24 +52,83 @@ void EC_ProximityTrigger::Update(float /*timeStep*/)
     if (!placeable)
         return;
     
-    EntityList otherTriggers = scene->GetEntitiesWithComponent(EC_ProximityTrigger::TypeNameStatic());
-    for(EntityList::iterator i = otherTriggers.begin(); i != otherTriggers.end(); ++i)
+    PROFILE(EC_ProximityTrigger_Update);
+
+    // Collect the entities in range before emitting any signals, as the signal handlers may modify the scene.
+    std::vector<std::pair<EntityPtr, float> > inRange;
+    const float3 pos = placeable->WorldPosition();
+    OgreWorldPtr world = scene->GetWorld<OgreWorld>();
+    if (threshold > 0.0f && world)
+    {
+        // Only the placeables within the threshold distance need to be checked for triggers.
+        std::vector<EC_Placeable*> nearby;
+        world->Placeables()->QuerySphere(pos, threshold, nearby);
+        for(size_t i = 0; i < nearby.size(); ++i)
+        {
+            Entity* otherEntity = nearby[i]->ParentEntity();
+            if (otherEntity && otherEntity != entity && otherEntity->GetComponent<EC_ProximityTrigger>())
+                inRange.push_back(std::make_pair(otherEntity->shared_from_this(), pos.Distance(nearby[i]->WorldPosition())));
+        }
+    }
+    else
     {
-        Entity* otherEntity = (*i).get();
-        if (otherEntity != entity)
+        EntityList otherTriggers = scene->GetEntitiesWithComponent(EC_ProximityTrigger::TypeNameStatic());
+        for(EntityList::iterator i = otherTriggers.begin(); i != otherTriggers.end(); ++i)
         {
-            EC_Placeable* otherPlaceable = otherEntity->GetComponent<EC_Placeable>().get();
-            if (!otherPlaceable)
-                continue;
-            float3 offset = placeable->transform.Get().pos - otherPlaceable->transform.Get().pos;
-            float distance = offset.Length();
-            
-            if ((threshold <= 0.0f) || (distance <= threshold))
+            Entity* otherEntity = (*i).get();
+            if (otherEntity != entity)
             {
-                emit triggered(otherEntity, distance);
+                EC_Placeable* otherPlaceable = otherEntity->GetComponent<EC_Placeable>().get();
+                if (!otherPlaceable)
+                    continue;
+                float distance = pos.Distance(otherPlaceable->WorldPosition());
+                
+                if ((threshold <= 0.0f) || (distance <= threshold))
+                    inRange.push_back(std::make_pair(*i, distance));
             }
         }
     }
+
+    // The entities that were in range in the last update, but are not anymore, have left.
+    EntitiesInRangeSet lastInRange;
+    lastInRange.swap(entities_);
+    std::vector<bool> entered(inRange.size(), false);
+    for(size_t i = 0; i < inRange.size(); ++i)
+    {
+        entities_.insert(inRange[i].first);
+        entered[i] = (lastInRange.erase(inRange[i].first) == 0);
+        if (entered[i])
+            connect(inRange[i].first.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)), Qt::UniqueConnection);
+    }
+
+    for(EntitiesInRangeSet::iterator i = lastInRange.begin(); i != lastInRange.end(); ++i)
+    {
+        EntityPtr otherEntity = i->lock();
+        if (otherEntity)
+        {
+            disconnect(otherEntity.get(), SIGNAL(EntityRemoved(Entity*, AttributeChange::Type)), this, SLOT(OnEntityRemoved(Entity*)));
+            emit entityLeave(otherEntity.get());
+        }
+    }
+    for(size_t i = 0; i < inRange.size(); ++i)
+    {
+        if (entities_.find(inRange[i].first) == entities_.end())
+            continue; // Removed from the scene by a signal handler.
+        Entity* otherEntity = inRange[i].first.get();
+        if (entered[i])
+            emit entityEnter(otherEntity);
+        emit triggered(otherEntity, inRange[i].second);
+    }
+}
+
+void EC_ProximityTrigger::OnEntityRemoved(Entity* entity)
+{
+    EntitiesInRangeSet::iterator i = entities_.find(entity->shared_from_this());
+    if (i != entities_.end())
+    {
+        entities_.erase(i);
+        emit entityLeave(entity);
+    }
 }
 
 void EC_ProximityTrigger::SetUpdateMode()
@@ -8,6 +8,8 @@
 
 #include "IComponent.h"
 
+#include <set>
+
 /// Reports distance, each frame, of other entities that also have this same component.
 /** <table class="header">
     <tr>
@@ -15,6 +17,8 @@
     <h2>ProximityTrigger</h2>
     Reports distance, each frame, of other entities that also have this same component.
     The entities also need to have EC_Placeable component so that distance can be calculated.
+    With a threshold distance, the nearby entities are found from the placeable grid of the scene, so the cost does not grow
+    with the number of triggers farther away. Also signals when other entities come within or go beyond the threshold distance.
 
     <b>Attributes</b>:
     <ul>
@@ -74,9 +78,28 @@ signals:
         @todo Make signature uppercase, QML support is deprecated. */
     void triggered(Entity* otherEntity, float distance);
 
+    /// Another entity with EC_ProximityTrigger has come within the threshold distance.
+    /** @note needs to be lowercase for QML to accept connections to it.
+        @todo Make signature uppercase, QML support is deprecated. */
+    void entityEnter(Entity* otherEntity);
+
+    /// Another entity with EC_ProximityTrigger has gone beyond the threshold distance, or has been removed from the scene.
+    /** @note needs to be lowercase for QML to accept connections to it.
+        @todo Make signature uppercase, QML support is deprecated. */
+    void entityLeave(Entity* otherEntity);
+
 private:
     /// Attribute has been updated
     void AttributesChanged();
+
+    /// As C++ standard weak_ptr doesn't provide less than operator (or any comparison operators for that matter), we need to provide it ourselves.
+    struct EntityWeakPtrLessThan
+    {
+        bool operator() (const EntityWeakPtr &a, const EntityWeakPtr &b) const { return WEAK_PTR_LESS_THAN(a, b); }
+    };
+    typedef std::set<EntityWeakPtr, EntityWeakPtrLessThan> EntitiesInRangeSet;
+    /// Entities within the threshold distance in the last update.
+    EntitiesInRangeSet entities_;
     
 private slots:
     /// Check for other triggers and emit signals
@@ -87,4 +110,7 @@ private slots:
 
     /// Change update mode (periodic, or every frame)
     void SetUpdateMode();
+
+    /// Called when an entity within the threshold distance is removed from the scene
+    void OnEntityRemoved(Entity* entity);
 };